@@ -0,0 +1,43 @@
+;;;; fasl-read.scm
+;;;;
+;;;; Measures the FASL reader. The global closures of the scheme package
+;;;; are written to a temporary file, which is then read back a number of
+;;;; times through a file port. The fastest pass is reported:
+;;;;
+;;;;   vcsh --no-repl --silent benchmarks/fasl-read.scm
+
+(define *fasl-read-passes* 20)
+
+(define (fasl-read-benchmark-data)
+  "Returns a list of the global closures of the scheme package."
+  (let ((data ()))
+    (dolist (sym (local-package-symbols (find-package "scheme")))
+      (when (and (symbol-bound? sym) (closure? (symbol-value sym)))
+        (set! data (cons (symbol-value sym) data))))
+    data))
+
+(define (time-fasl-read filename)
+  "Reads every object in <filename>, returning the number read and the
+   time taken, in milliseconds."
+  (with-port p (open-file filename :encoding :binary)
+    (let ((reader (make-fasl-reader p))
+          (start (runtime))
+          (count 0))
+      (while (not (eof-object? (fast-read reader)))
+        (incr! count))
+      (values count (* 1000.0 (- (runtime) start))))))
+
+(let ((filename (temporary-file-name "fasl-read"))
+      (best #f)
+      (count 0))
+  (with-port p (open-file filename :mode :write :encoding :binary)
+    (with-fasl-stream s p
+      (dolist (closure (fasl-read-benchmark-data))
+        (fasl-write s closure))))
+  (dotimes (ii *fasl-read-passes*)
+    (mvbind (pass-count ms) (time-fasl-read filename)
+      (set! count pass-count)
+      (set! best (if best (min best ms) ms))))
+  (format #t "; fasl-read: ~a objects, ~a bytes, best of ~a passes: ~a ms\n"
+          count (hash-ref (file-details filename) :size) *fasl-read-passes* best)
+  (delete-file filename))
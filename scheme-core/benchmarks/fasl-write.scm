@@ -0,0 +1,36 @@
+;;;; fasl-write.scm
+;;;;
+;;;; Measures the time the compiler spends in the FASL writer. This is
+;;;; loaded into the compiler ahead of the image compile setup, and
+;;;; wraps each of the FASL stream entry points to total the time spent
+;;;; in them, which is reported once the compile is done. Writes made
+;;;; while another is in progress are counted with the outer one:
+;;;;
+;;;;   vcsh -c --load-file:benchmarks/fasl-write.scm --load-file:setup-image-compile.scm --output:fasl-write-bench.scf scheme.scm
+
+(define *fasl-write-calls* 0)
+(define *fasl-write-ms* 0.0)
+(define *fasl-write-depth* 0)
+
+(define (time-fasl-writes fn)
+  "Returns a function that applies <fn> to its arguments, adding the
+   time taken to the totals unless a timed write is in progress."
+  (lambda args
+    (if (> *fasl-write-depth* 0)
+        (apply fn args)
+        (let ((start (runtime)))
+          (set! *fasl-write-depth* 1)
+          (unwind-protect
+           (lambda () (apply fn args))
+           (lambda ()
+             (set! *fasl-write-depth* 0)
+             (incr! *fasl-write-calls*)
+             (incr! *fasl-write-ms* (* 1000.0 (- (runtime) start)))))))))
+
+(dolist (sym '(scheme::fasl-write scheme::fasl-write-op scheme::commit-fasl-writes))
+  (set-symbol-value! sym (time-fasl-writes (symbol-value sym))))
+
+(add-hook-function! 'scheme::*shutdown-hook*
+                    (lambda (rc)
+                      (format #t "; fasl-write: ~a calls, ~a ms\n"
+                              *fasl-write-calls* *fasl-write-ms*)))
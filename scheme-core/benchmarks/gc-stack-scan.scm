@@ -0,0 +1,42 @@
+;;;; gc-stack-scan.scm
+;;;;
+;;;; Measures the cost of conservative stack scanning as the number of
+;;;; heap segments grows. Each full collection is timed twice, once
+;;;; with a shallow stack and once with a deep one, and the difference
+;;;; is the time spent classifying the extra stack words. The heap is
+;;;; doubled up to the segment limit, so smaller heap segments reach
+;;;; larger segment counts:
+;;;;
+;;;;   vcsh -Xheap-segment-size=4194304 -Xmax-heap-segments=256 benchmarks/gc-stack-scan.scm
+
+(define (time-gc :optional (repeat 20))
+  "Returns the average time taken by a full collection, in milliseconds."
+  (let ((start (runtime)))
+    (dotimes (ii repeat)
+      (gc))
+    (/ (* 1000.0 (- (runtime) start)) repeat)))
+
+(define (time-gc-at-depth depth)
+  "Returns the average time taken by a full collection with <depth>
+   nested calls on the stack."
+  (let recur ((n depth))
+    (if (= n 0)
+        (time-gc)
+        (let ((ms (recur (- n 1))))
+          ms))))
+
+(define (heap-segments)
+  (vector-ref (gc-info) 0))
+
+(define (stack-scan-benchmark :optional (depth 800) (max-segments (vector-ref (gc-info) 2)))
+  (format #t "; depth ~a\n" depth)
+  (format #t "; segments  shallow-ms  deep-ms  scan-ms\n")
+  (let loop ()
+    (let* ((shallow (time-gc))
+           (deep (time-gc-at-depth depth)))
+      (format #t "; ~a ~a ~a ~a\n" (heap-segments) shallow deep (- deep shallow)))
+    (when (<= (* 2 (heap-segments)) max-segments)
+      (scheme::%request-heap-size (* 2 (heap-segments)))
+      (loop))))
+
+(stack-scan-benchmark)
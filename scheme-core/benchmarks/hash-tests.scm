@@ -7,7 +7,7 @@
    from the list <keys>. The value for each key is the key itself."
   (fold (lambda (key table)
           (hash-set! table key key))
-        (make-hash hash-type)
+        (if (eq? hash-type :eq) (make-identity-hash) (make-hash))
         keys))
 
 (define (file->hash filename :optional (hash-type :equal))
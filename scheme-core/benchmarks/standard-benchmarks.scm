@@ -234,6 +234,23 @@
      (for-each (lambda (sym) (hash-ref htable sym))
                *hash-test-syms*))))
 
+(define *hash-test-strings*
+  (map #L(string-append "hash-test-" (number->string _)) (iseq 0 10000)))
+
+(defbench hash-set!-strings
+  (let ((htable (make-hash)))
+    (account
+     (for-each (lambda (str) (hash-set! htable str 'foo))
+               *hash-test-strings*))))
+
+(defbench hash-ref-strings
+  (let ((htable (make-hash)))
+    (for-each (lambda (str) (hash-set! htable str 'foo))
+              *hash-test-strings*)
+    (account
+     (for-each (lambda (str) (hash-ref htable str))
+               *hash-test-strings*))))
+
 (defbench funcall-inline
   (account
    ((lambda()
@@ -37,6 +37,8 @@ type. If there is no valid typecode of that name, returns #f."
     ((#.system::TC_GC_TRIP_WIRE)   'trip-wire) 
     ((#.system::TC_FAST_OP)        'fast-op)
     ((#.system::TC_FASL_READER)    'fasl-reader)
+    ((#.system::TC_ENVIRONMENT)    'environment)
+    ((#.system::TC_ENVIRONMENT_SLOTS) 'environment-slots)
     (#t #f)))
 
 (define (%representation-of obj)
@@ -0,0 +1,305 @@
+;;;; compiler-bytecode.scm --
+;;;;
+;;;; The bytecode backend. This flattens the fast-op assembly of selected
+;;;; closure bodies into linear bytecode for the VM's bytecode
+;;;; interpreter.
+;;;;
+;;;; (C) Copyright 2001-2014 East Coast Toolworks Inc.
+;;;; (C) Portions Copyright 1988-1994 Paradigm Associates Inc.
+;;;;
+;;;; See the file "license.terms" for information on usage and
+;;;; redistribution of this file, and for a DISCLAIMER OF ALL
+;;;; WARRANTIES.
+
+(define *compile-bytecode* #t)
+
+;;;; Bytecode instructions
+;;;
+;;; A bytecode body is a vector of fixnum opcodes, each followed by
+;;; its operands. The interpreter keeps intermediate values in an
+;;; accumulator, and function arguments on an operand stack. Labels
+;;; exist only in the symbolic form of the instruction stream, and
+;;; are resolved to absolute vector offsets at assembly time.
+
+(define-structure bytecode-defn
+  opcode
+  name
+  formals)
+
+(define *bytecode-name->bytecode-defn* (make-identity-hash))
+(define *bytecode-opcode->bytecode-defn* (make-identity-hash))
+
+(define (extend-bytecode-names! op-name op-code formals)
+  (when (hash-has? *bytecode-name->bytecode-defn* op-name)
+    (error "Bytecode already defined: ~s" op-name))
+  (when (hash-has? *bytecode-opcode->bytecode-defn* op-code)
+    (error "Bytecode opcode for ~s already defined: ~s" op-name op-code))
+  (unless (every? #L(memq _ '(:literal :symbol :index :label :fast-op)) formals)
+    (error "Invalid formal argument list for bytecode: ~s" formals))
+  (let ((defn (make-bytecode-defn :name op-name
+                                  :opcode op-code
+                                  :formals formals)))
+    (hash-set! *bytecode-name->bytecode-defn* op-name defn)
+    (hash-set! *bytecode-opcode->bytecode-defn* op-code defn)))
+
+(defmacro (define-bytecode op-name op-code . formals)
+  `(eval-when (:load-toplevel :compile-toplevel :execute)
+     (extend-bytecode-names! ,op-name ,op-code ',formals)))
+
+(define-bytecode :literal               #.system::BC_LITERAL                :literal           )
+(define-bytecode :global-ref            #.system::BC_GLOBAL_REF             :symbol            )
+(define-bytecode :global-set!           #.system::BC_GLOBAL_SET             :symbol            )
+(define-bytecode :global-def            #.system::BC_GLOBAL_DEF             :symbol :literal   )
+(define-bytecode :local-ref             #.system::BC_LOCAL_REF              :index :index      )
+(define-bytecode :local-ref-restarg     #.system::BC_LOCAL_REF_RESTARG      :index :index      )
+(define-bytecode :local-set!            #.system::BC_LOCAL_SET              :index :index      )
+(define-bytecode :stack-local-ref       #.system::BC_STACK_LOCAL_REF        :index             )
+(define-bytecode :stack-local-set!      #.system::BC_STACK_LOCAL_SET        :index             )
+(define-bytecode :push                  #.system::BC_PUSH                                      )
+(define-bytecode :call-global           #.system::BC_CALL_GLOBAL            :symbol :index     )
+(define-bytecode :call                  #.system::BC_CALL                   :index             )
+(define-bytecode :tail-call-global      #.system::BC_TAIL_CALL_GLOBAL       :symbol :index     )
+(define-bytecode :tail-call             #.system::BC_TAIL_CALL              :index             )
+(define-bytecode :jump                  #.system::BC_JUMP                   :label             )
+(define-bytecode :jump-if-false         #.system::BC_JUMP_IF_FALSE          :label             )
+(define-bytecode :closure               #.system::BC_CLOSURE                :literal :fast-op  )
+(define-bytecode :eqp                   #.system::BC_EQP                                       )
+(define-bytecode :car                   #.system::BC_CAR                                       )
+(define-bytecode :cdr                   #.system::BC_CDR                                       )
+(define-bytecode :not                   #.system::BC_NOT                                       )
+(define-bytecode :nullp                 #.system::BC_NULLP                                     )
+(define-bytecode :get-env               #.system::BC_GET_ENV                                   )
+(define-bytecode :fast-op               #.system::BC_FAST_OP                :fast-op           )
+(define-bytecode :return                #.system::BC_RETURN                                    )
+
+(define (lookup-bytecode op)
+  (let ((defn (hash-ref *bytecode-name->bytecode-defn* op #f)))
+    (unless defn
+      (error "Invalid bytecode: ~s." op))
+    (values (bytecode-defn-opcode defn)
+            (bytecode-defn-formals defn))))
+
+;;;; The bytecode assembler
+
+(define (bytecode-label? insn)
+  (eq? (car insn) :label))
+
+(define (bytecode-label-offsets insns)
+  (let ((offsets (make-identity-hash))
+        (pc 0))
+    (dolist (insn insns)
+      (if (bytecode-label? insn)
+          (hash-set! offsets (second insn) pc)
+          (incr! pc (length insn))))
+    offsets))
+
+(define (assemble-bytecode insns)
+  "Assemble the symbolic instruction list <insns> into a bytecode vector."
+  (runtime-check list? insns "Malformed bytecode assembly syntax.")
+  (let ((offsets (bytecode-label-offsets insns))
+        (code ()))
+    (define (prepare-bytecode-arg formal actual)
+      (case formal
+        ((:literal) actual)
+        ((:symbol)  (runtime-check symbol? actual))
+        ((:index)   (runtime-check exact? actual))
+        ((:label)   (hash-ref offsets actual))
+        ((:fast-op) (fasm actual ()))))
+    (dolist (insn insns)
+      (unless (bytecode-label? insn)
+        (dbind (op . actuals) insn
+          (mvbind (opcode formals) (lookup-bytecode op)
+            (unless (same-length? actuals formals)
+              (error "Improper number of arguments while assembling bytecode ~s" insn))
+            (push! opcode code)
+            (for-each (lambda (formal actual)
+                        (push! (prepare-bytecode-arg formal actual) code))
+                      formals actuals)))))
+    (list->vector (reverse! code))))
+
+(define (bytecode-instructions code)
+  "Decode the bytecode vector <code> into a list of instructions, each
+   of the form (<offset> <op-name> . <operands>)."
+  (let recur ((pc 0))
+    (if (>= pc (length code))
+        ()
+        (let* ((defn (hash-ref *bytecode-opcode->bytecode-defn* (vector-ref code pc) #f))
+               (arity (if defn (length (bytecode-defn-formals defn)) 0)))
+          `((,pc ,(if defn (bytecode-defn-name defn) (vector-ref code pc))
+                 ,@(map #L(vector-ref code (+ pc _ 1)) (iseq 0 arity)))
+            ,@(recur (+ pc arity 1)))))))
+
+;;;; The bytecode compiler
+;;;
+;;; Fast-op assembly is flattened by walking each chain in evaluation
+;;; order. Argument subtrees that the fast-op evaluator would evaluate
+;;; with a recursive call instead leave their value in the accumulator
+;;; and are then pushed on the operand stack. Operations with no
+;;; bytecode equivalent (catch, throw, unwind, and the other frame
+;;; manipulation operations) are kept as fast-op trees and evaluated
+;;; by the fast-op evaluator from within the bytecode.
+
+(forward cpass/bytecode)
+
+(define (fasm->bytecode fasm)
+  "Compile the fast-op assembly <fasm> into a :bytecode fast-op."
+  (let ((insns ())
+        (depth 0)
+        (max-depth 0)
+        (label-count 0))
+
+    (define (emit! . insn)
+      (push! insn insns))
+
+    (define (new-label)
+      (incr! label-count)
+      label-count)
+
+    (define (emit-push!)
+      (emit! :push)
+      (incr! depth)
+      (set! max-depth (max depth max-depth)))
+
+    (define (pop-operands! n)
+      (set! depth (- depth n)))
+
+    (define (emit-return! tail?)
+      (when tail?
+        (emit! :return)))
+
+    (define (compile-arguments actuals)
+      (dolist (actual actuals)
+        (compile actual #f)
+        (emit-push!)))
+
+    ;; Ops that transfer control (application, sequence, and
+    ;; conditionals) end a fast-op chain, so anything after them in a
+    ;; :block is unreachable.
+    (define (compile-block fasms tail?)
+      (cond ((null? fasms)
+             (emit-return! tail?))
+            ((or (null? (cdr fasms))
+                 (memq (car (car fasms)) '(:apply :apply-global :sequence :if-true)))
+             (compile (car fasms) tail?))
+            (#t
+             (compile (car fasms) #f)
+             (compile-block (cdr fasms) tail?))))
+
+    (define (compile fasm tail?)
+      (dbind (op . args) fasm
+        (case op
+          ((:block)
+           (compile-block args tail?))
+
+          ((:literal :global-ref :global-set! :global-def :car :cdr :not :nullp :get-env)
+           (apply emit! op args)
+           (emit-return! tail?))
+
+          ((:local-ref-by-index)
+           (apply emit! :local-ref args)
+           (emit-return! tail?))
+
+          ((:local-ref-restarg)
+           (apply emit! :local-ref-restarg args)
+           (emit-return! tail?))
+
+          ((:local-set-by-index)
+           (apply emit! :local-set! args)
+           (emit-return! tail?))
+
+          ((:stack-local-ref)
+           (apply emit! :stack-local-ref args)
+           (emit-return! tail?))
+
+          ((:stack-local-set)
+           (apply emit! :stack-local-set! args)
+           (emit-return! tail?))
+
+          ((:retval)
+           (emit-return! tail?))
+
+          ((:sequence)
+           (compile (first args) #f)
+           (compile (second args) tail?))
+
+          ((:if-true)
+           (let ((else-label (new-label))
+                 (end-label (new-label)))
+             (emit! :jump-if-false else-label)
+             (compile (first args) tail?)
+             (unless tail?
+               (emit! :jump end-label))
+             (emit! :label else-label)
+             (compile (second args) tail?)
+             (emit! :label end-label)))
+
+          ((:apply-global)
+           (dbind (fn-sym actuals) args
+             (compile-arguments actuals)
+             (emit! (if tail? :tail-call-global :call-global) fn-sym (length actuals))
+             (pop-operands! (length actuals))))
+
+          ((:apply)
+           (dbind (fn actuals) args
+             (compile fn #f)
+             (emit-push!)
+             (compile-arguments actuals)
+             (emit! (if tail? :tail-call :call) (length actuals))
+             (pop-operands! (+ 1 (length actuals)))))
+
+          ((:eqp)
+           (compile (first args) #f)
+           (emit-push!)
+           (compile (second args) #f)
+           (emit! :eqp)
+           (pop-operands! 1)
+           (emit-return! tail?))
+
+          ((:while-true)
+           (let ((loop-label (new-label))
+                 (end-label (new-label)))
+             (emit! :label loop-label)
+             (compile (first args) #f)
+             (emit! :jump-if-false end-label)
+             (compile (second args) #f)
+             (emit! :jump loop-label)
+             (emit! :label end-label)
+             (emit-return! tail?)))
+
+          ((:closure)
+           (apply emit! :closure (cdr (cpass/bytecode fasm)))
+           (emit-return! tail?))
+
+          (#t
+           (emit! :fast-op (cpass/bytecode fasm))
+           (emit-return! tail?)))))
+
+    (compile fasm #t)
+    `(:bytecode ,(reverse! insns) ,max-depth)))
+
+;;;; Closure selection
+;;;
+;;; Closures are compiled to bytecode when *compile-bytecode* is true,
+;;; unless overridden for a specific closure by a :bytecode property
+;;; in its %lambda property list.
+
+(define (bytecode-closure? lambda-info)
+  (dbind (l-list . p-list) lambda-info
+    (aif (assoc :bytecode p-list)
+         (cdr it)
+         *compile-bytecode*)))
+
+(define (bytecode-closure-body body)
+  (bind-if-match (:stack-frame ?frame-body) body
+    `(:stack-frame ,(fasm->bytecode ?frame-body))
+    (fasm->bytecode body)))
+
+(define (xform-bytecode-closure fop)
+  (bind-if-match (:closure ?lambda-info ?body) fop
+    (if (bytecode-closure? ?lambda-info)
+        `(:closure ,?lambda-info ,(bytecode-closure-body ?body))
+        fop)
+    fop))
+
+(define (cpass/bytecode fasm)
+  (map-fop-assembly xform-bytecode-closure fasm))
@@ -23,7 +23,7 @@
 
 (define (valid-fop-formals? formals)
   (define (valid-formal-type? type)
-    (memq type '(:literal :symbol :fast-op :fast-ops :index)))
+    (memq type '(:literal :symbol :fast-op :fast-ops :index :bytecode)))
   (if (and (list? formals)
            (<= (length formals) 3)
            (every? valid-formal-type? formals))
@@ -78,6 +78,10 @@
 (define-fast-op :local-ref-by-index     #.system::FOP_LOCAL_REF_BY_INDEX    :index :index      )
 (define-fast-op :local-ref-restarg      #.system::FOP_LOCAL_REF_RESTARG     :index :index      )
 (define-fast-op :local-set-by-index     #.system::FOP_LOCAL_SET_BY_INDEX    :index :index      )
+(define-fast-op :stack-frame            #.system::FOP_STACK_FRAME           :fast-op           )
+(define-fast-op :stack-local-ref        #.system::FOP_STACK_LOCAL_REF       :index             )
+(define-fast-op :stack-local-set        #.system::FOP_STACK_LOCAL_SET       :index             )
+(define-fast-op :bytecode               #.system::FOP_BYTECODE              :bytecode :index   )
 
 (define (parse-fast-op fast-op)
   (let ((opcode (scheme::%fast-op-opcode fast-op))
@@ -112,6 +116,7 @@
               (fop-defn-formals defn))))
 
 (forward fasm)
+(forward assemble-bytecode)
 
 (define (fasm-block asms next-op)
   (fold-right fasm next-op asms))
@@ -125,6 +130,7 @@
         ((:fast-ops) (map #L(fasm _ ()) actual))
         ((:symbol)   (runtime-check symbol? actual))
         ((:index)    (runtime-check exact? actual))
+        ((:bytecode) (assemble-bytecode actual))
         (#t
          (error "Invalid fast-op formal argument type: ~s" formal)))))
 
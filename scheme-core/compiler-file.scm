@@ -327,7 +327,7 @@
                         (throw 'end-compile-now return-code))))
         (handler-bind ((runtime-error compiler-runtime-error-handler))
           (setup-initial-package!)
-          (dynamic-let ((*location-mapping* (make-identity-hash)))
+          (dynamic-let ((*location-mapping* (make-weak-key-hash)))
             (do-compile-files input-filenames
                               output-filename))
           (trace-message #t "; Compile completed successfully.\n"))
@@ -14,6 +14,8 @@
 
 (define *optimize/integrate-subrs* #t)
 
+(define *optimize/stack-frames* #t)
+
 (define (fop-id x) x)
 
 (forward map-fop-assembly)
@@ -104,6 +106,49 @@
 (define (optimize-pass/integrate-subrs fasm)
   (map-fop-assembly xform-integrate fasm))
 
+;;;; Stack allocated frames
+;;;
+;;; A closure whose body contains no nested :closure or :get-env can
+;;; never have its own frame captured, so its bindings can live on the
+;;; frame stack rather than in a heap environment. The body of such a
+;;; closure is wrapped in a :stack-frame, references to its own frame
+;;; become :stack-local-ref/:stack-local-set, and references to outer
+;;; frames are shifted down by one, since the stack frame isn't part of
+;;; the environment chain.
+
+(define (fasm-captures-env? fasm)
+  (let ((captures? #f))
+    (map-fop-assembly (lambda (fop)
+                        (when (memq (car fop) '(:closure :get-env))
+                          (set! captures? #t))
+                        fop)
+                      fasm)
+    captures?))
+
+(define (xform-stack-local-ref fop)
+  (case (car fop)
+    ((:local-ref-by-index :local-ref-restarg :local-set-by-index)
+     (dbind (op frame-index var-index) fop
+       (cond ((> frame-index 0)
+              `(,op ,(- frame-index 1) ,var-index))
+             ((eq? op :local-set-by-index)
+              `(:stack-local-set ,var-index))
+             (#t
+              `(:stack-local-ref ,var-index)))))
+    (#t
+     fop)))
+
+(define (xform-stack-frame fop)
+  (bind-if-match (:closure ?lambda-info ?body) fop
+    (if (fasm-captures-env? ?body)
+        fop
+        `(:closure ,?lambda-info
+                   (:stack-frame ,(map-fop-assembly xform-stack-local-ref ?body))))
+    fop))
+
+(define (optimize-pass/stack-frames fasm)
+  (map-fop-assembly xform-stack-frame fasm))
+
 ;;;; The toplevel optimizer
 
 (define (opt-pass enabled? pass-fn)
@@ -111,7 +156,8 @@
 
 (define (optimize-pass/full fop)
   ((rcompose optimize-pass/global-applications
-             (opt-pass *optimize/integrate-subrs* optimize-pass/integrate-subrs))
+             (opt-pass *optimize/integrate-subrs* optimize-pass/integrate-subrs)
+             (opt-pass *optimize/stack-frames* optimize-pass/stack-frames))
    fop))
 
 (define (optimize-fop-assembly fasm)
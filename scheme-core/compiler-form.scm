@@ -11,9 +11,10 @@
 ;;;; WARRANTIES.
 
 (define (compile-to-fasm form)
- (cpass/fasm-optimize
-  (cpass/meaning
-   (cpass/expand form))))
+ (cpass/bytecode
+  (cpass/fasm-optimize
+   (cpass/meaning
+    (cpass/expand form)))))
 
 (define (compile form)
   "Accept a <form> and compile it into a closure that can be invoked to produce the
@@ -24,6 +24,7 @@
              "compiler-expand.scm"
              "compiler-meaning.scm"
              "compiler-foptimize.scm"
+             "compiler-bytecode.scm"
              "compiler-form.scm"
              "compiler-file.scm")
   (:exports "compile-file"
@@ -36,4 +37,5 @@
             "*files-to-compile*"
             "*initial-package*"
             "*disable-load-unit-boundaries*"
+            "*compile-bytecode*"
             "compile"))
@@ -12,6 +12,7 @@
 
 (eval-when (:compile-toplevel :load-toplevel :execute)
   (export! '(*
+             *after-gc-hook*
              *allow-rich-writes*
              *arg-values*
              *current-load-file*
@@ -407,16 +408,19 @@
              hash->list
              hash-clear!
              hash-copy
+             hash-fold
              hash-for-each
              hash-has?
              hash-keys
              hash-keys/t
+             hash-merge!
              hash-push!
              hash-ref
              hash-ref*
              hash-remove!
              hash-set!
              hash-set-multiple!
+             hash-update!
              hash?
              home-directory
              identity
@@ -537,6 +541,8 @@
              make-structure-by-name
              make-tree
              make-vector
+             make-weak-key-hash
+             make-weak-value-hash
              map
              map-pair
              match-pattern-variables
@@ -624,6 +630,7 @@
              port-mode
              port-name
              port-open?
+             port-position
              port-translate-mode
              positive?
              primitive?
@@ -726,6 +733,7 @@
              set-environment-variable!
              set-isect
              set-isect/eq
+             set-port-position!
              set-port-translate-mode!
              set-property!
              set-random-seed!
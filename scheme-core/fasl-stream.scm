@@ -12,53 +12,69 @@
 
 (define-structure fasl-stream
   target-port
-  (objects-to-write :default ()))
-
-(define-structure fasl-op
-  fasl-opcode
-  param-objects)
+  (sharing-map :default #f)
+  (aborted? :default #f))
 
 (define (open-fasl-output-stream port)
-  "Open a new FASL output stream targeting <port>."
+  "Open a new FASL output stream targeting <port>. <port> must be a
+   binary port that can seek."
   (make-fasl-stream :target-port port))
 
+(define (fasl-stream-writing-sharing-map stream)
+  (aif (fasl-stream-sharing-map stream)
+       it
+       (let ((smap (begin-sharing-map (fasl-stream-target-port stream))))
+         (set-fasl-stream-sharing-map! stream smap)
+         smap)))
+
 (define (fasl-write stream object)
-  "Write <object> to FASL stream <stream>.  Note that the object is not actually writen
-   to the stream's target port until the stream itself is closed."
-  (set-fasl-stream-objects-to-write! stream (cons object (fasl-stream-objects-to-write stream)))
+  "Write <object> to FASL stream <stream>. The object is written to the
+   stream's target port as it is now, but objects referred to more than
+   once aren't fully written until the stream is committed."
+  (fast-write-using-sharing-map object
+                                (fasl-stream-target-port stream)
+                                (fasl-stream-writing-sharing-map stream))
   stream)
 
 (define (fasl-write-op stream fasl-opcode . params)
   "Writes an arbitrary FASL opcode, <fasl-opcode>, to FASL stream <stream>. The paramater
    objects in the list <param-objects>, are written to the FASL stream immediately after
    the opcode."
-  (fasl-write stream (make-fasl-op :fasl-opcode fasl-opcode
-                                   :param-objects params)))
+  (let ((smap (fasl-stream-writing-sharing-map stream))
+        (port (fasl-stream-target-port stream)))
+    (fast-write-opcode fasl-opcode port)
+    (dolist (obj params)
+      (fast-write-using-sharing-map obj port smap)))
+  stream)
 
 (define (abort-fasl-writes stream)
-  "Aborts all pending writes to <stream> since the stream was opened
-   or last committed."
-  (set-fasl-stream-objects-to-write! stream ())
+  "Aborts all writes to <stream> since the stream was opened or last
+   committed. The writes are cut off with FASL_OP_EOF, and writing
+   resumes in their place."
+  (awhen (fasl-stream-sharing-map stream)
+    (let ((port (fasl-stream-target-port stream)))
+      (set-port-position! port (sharing-map-base it))
+      (fast-write-opcode system::FASL_OP_EOF port)
+      (set-port-position! port (sharing-map-base it))
+      (set-fasl-stream-sharing-map! stream #f)
+      (set-fasl-stream-aborted?! stream #t)))
   ())
 
 (define (commit-fasl-writes stream)
-  "Commits FASL stream <stream>. This is the FASL stream operation that actually
-   writes the stream's content's to the target port."
-  (let ((shared-structure-table (find-shared-structures (fasl-stream-objects-to-write stream))))
-
-    (fast-write-opcode system::FASL_OP_RESET_READER_DEFS (fasl-stream-target-port stream))
-
-    (dolist (obj (reverse (fasl-stream-objects-to-write stream)))
-      (cond ((fasl-op? obj)
-             (fast-write-opcode (fasl-op-fasl-opcode obj) (fasl-stream-target-port stream))
-             (dolist (obj (fasl-op-param-objects obj))
-               (fast-write-using-shared-structure-table obj
-                                                        (fasl-stream-target-port stream)
-                                                        shared-structure-table)))
-            (#t
-             (fast-write-using-shared-structure-table obj (fasl-stream-target-port stream)
-                                                      shared-structure-table))))
-    stream))
+  "Commits FASL stream <stream>, finishing the objects written to the
+   stream's target port since the stream was opened or last committed."
+  (awhen (fasl-stream-sharing-map stream)
+    (finish-sharing-map it (fasl-stream-target-port stream))
+    (set-fasl-stream-sharing-map! stream #f))
+  ;; Aborted writes may have left bytes past the end of those that
+  ;; replaced them, so they're cut off again, in a way that later
+  ;; writes overwrite.
+  (when (fasl-stream-aborted? stream)
+    (let* ((port (fasl-stream-target-port stream))
+           (end (port-position port)))
+      (fast-write-opcode system::FASL_OP_EOF port)
+      (set-port-position! port end)))
+  stream)
 
 (defmacro (with-fasl-stream s port . code)
   `(let ((,s (open-fasl-output-stream ,port)))
@@ -18,123 +18,212 @@
   "Writes a type code <code> to <port>."
   `(write-binary-fixnum-u8 ,code ,port))
 
+(define (fast-write-varint n port)
+  "Writes the non-negative fixnum <n> to <port> as an unsigned LEB128
+   varint: seven bits to a byte, low bits first, with the high bit set
+   on every byte but the last."
+  (let loop ((n n))
+    (cond ((< n 128)
+           (write-binary-fixnum-u8 n port))
+          (#t
+           (write-binary-fixnum-u8 (+ 128 (remainder n 128)) port)
+           (loop (quotient n 128))))))
+
+(define (fast-write-format port)
+  "Writes the FASL format version to <port>, which applies to everything
+   written after it."
+  (fast-write-opcode system::FASL_OP_FORMAT port)
+  (write-binary-fixnum-u8 system::FASL_FORMAT_VERSION port))
+
+;; Objects are written in a single pass, as they come. The sharing map
+;; keeps the offset and opcode of each object written since the last
+;; FASL_OP_RESET_READER_DEFS, encoded as a fixnum, and an object written
+;; again is written as a reference to that offset. The first reference
+;; to an object queues a fixup, which is how the reader learns to record
+;; the object: once the writer is done, each fixup adds FASL_OP_RECORD
+;; to the opcode at its offset.
+;;
+;; Closure bodies, whether made by FOP_CLOSURE or by the BC_CLOSURE
+;; instructions of bytecode, are written as deferred objects, which a
+;; reader may skip over and read on their own, later on. That only works
+;; if nothing inside a body refers to anything outside it, nor the other
+;; way around, other than interned symbols and packages, which a reader
+;; can read again where they were first written and get the same object.
+;; The writer can't tell in advance, so it watches the references it
+;; writes, and a body that turns out to share anything else has its
+;; length set to zero, which has it read in place. Bodies are never
+;; nested, so the sharing map keeps those it's written in the order of
+;; their starts, for looking up the body holding a given position.
+
+(define-structure deferred-object
+  start
+  (end :default #f)
+  (shared? :default #f))
+
 (define-structure sharing-map
-  (indicies :default (make-identity-hash))
-  (next-index :default 0)
-  (structure-layouts :default (make-identity-hash)))
-
-(define (find-shared-structures object) ; REVISIT: Switch to tail recursive algorithm (and the writer itself)
-  "Returns an identity hash of all objects referenced by <object>
-   more than once. This includes both circular and shared structure. The
-   value associated with each hash is #f."
-  (let ((visited-objects (make-identity-hash))
-        (visited-layouts (make-identity-hash)))
-    (let visit ((o object))
-      (unless (%immediate? o) ; Ignore immediates, they're shared by definition
-        (cond ((hash-has? visited-objects o)
-               (hash-set! visited-objects o #t))
-              (#t
-               (hash-set! visited-objects o #f)
-               (case (%representation-of o)
-                 ((closure)
-                  (visit (%closure-code o))
-                  (visit (%closure-env o))
-                  (visit (%property-list o)))
-                 ((macro)
-                  (visit (%macro-transformer o)))
-                 ((cons)
-                  (visit (car o))
-                  (visit (cdr o)))
-                 ((symbol)
-                  (visit (symbol-package o))
-                  (visit (symbol-name o)))
-                 ((vector)
-                  (dolist (x o)
-                    (visit x)))
-                 ((structure)
-                  (hash-set! visited-layouts (%structure-layout o) #f)
-                  (dotimes (ii (%structure-length o))
-                    (visit (%structure-ref o ii))))
-                 ((hash)
-                  (dolist (k/v (hash->a-list o))
-                    (visit (car k/v))
-                    (visit (cdr k/v))))
-                 ((fast-op)
-                  (dolist (op-piece (scheme::%fast-op-args o))
-                    (visit op-piece)))
-                 (#t
-                  ()))))))
-
-    (let ((smap (make-sharing-map :structure-layouts visited-layouts)))
-      (dohash (object shared? visited-objects)
-        (when shared?
-          (hash-set! (sharing-map-indicies smap) object #f)))
-      smap)))
-
-(define (fast-write-using-shared-structure-table object port smap)
-  "Writes <object> on <port> in FASL format. <smap> is a hash table
-  `mapping shared objects to object IDs.  It is used to avoid writing shared
-   objects (including circular references) more than once. <smap> can
-   also be #f, which disables shared structure detection. In this case, this
+  base
+  (offsets :default (make-identity-hash))
+  (structure-layouts :default (make-identity-hash))
+  (fixups :default ())
+  (deferred-objects :default (make-vector 16 #f))
+  (deferred-object-count :default 0)
+  (open-deferred-object :default #f))
+
+(define (begin-sharing-map port)
+  "Begins a block of FASL objects on <port>, headed by the format they're
+   written in, returning a sharing map for writing them. <port> must be
+   able to seek, for the fixups of objects written more than once."
+  (fast-write-format port)
+  (let ((smap (make-sharing-map :base (port-position port))))
+    (fast-write-opcode system::FASL_OP_RESET_READER_DEFS port)
+    smap))
+
+(define (finish-sharing-map smap port)
+  "Applies the fixups queued in <smap>, leaving <port> positioned after
+   the last object written."
+  (unless (null? (sharing-map-fixups smap))
+    (let ((end (port-position port)))
+      (dolist (location (sharing-map-fixups smap))
+        (set-port-position! port (+ (sharing-map-base smap) (quotient location 256)))
+        (fast-write-opcode (+ system::FASL_OP_RECORD (remainder location 256)) port))
+      (set-port-position! port end)
+      (set-sharing-map-fixups! smap ()))))
+
+(define (fast-write-using-sharing-map object port smap)
+  "Writes <object> on <port> in FASL format. <smap> is a sharing map
+   from begin-sharing-map, used to write objects already written as
+   references to them, which preserves shared and circular structure.
+   <smap> can also be #f, which disables sharing. In this case, this
    function will not terminate when passed a circular structure."
 
-  (define (is-shared? object)
-    (and smap
-         (hash-has? (sharing-map-indicies smap) object)))
-
-  (define (get-next-index!)
-    (let ((next-index (sharing-map-next-index smap)))
-      (set-sharing-map-next-index! smap (+ next-index 1))
-      next-index))
-
-  (define (length-excluding-shared xs)
-    "Returns the length of the object <xs> and a boolean indicating if the
-   measured list has a non-null final CDR. If <xs> is a list, it stops
-   counting if it encounters structures in the hash <smap>,
-   other than the first instance of <xs> itself."
-    (if (pair? xs)
-        (let loop ((len 1) (xs (cdr xs)))
-          (if (or (atom? xs)
-                  (is-shared? xs))
-              (values len (not (null? xs)))
-              (loop (+ len 1) (cdr xs))))
-        (values (length xs) #f)))
-
-  (define (check-sharing-and-write object :optional (do-write fast-write-object))
-    (if (is-shared? object)
-        (aif (hash-ref (sharing-map-indicies smap) object)
-             (begin
-               (fast-write-opcode system::FASL_OP_READER_REFERENCE port)
-               (fast-write-object it))
-             (begin
-               (let ((next-index (get-next-index!)))
-                 (hash-set! (sharing-map-indicies smap) object next-index)
-                 (fast-write-opcode system::FASL_OP_READER_DEFINITION port)
-                 (fast-write-object next-index)
-                 (do-write object))))
-        (do-write object)))
-
+  (define offsets (and smap (sharing-map-offsets smap)))
+  (define layouts (and smap (sharing-map-structure-layouts smap)))
+
+  (define (written-location table object)
+    (and table (hash-ref table object #f)))
+
+  (define (note-location! table object opcode)
+    (when table
+      (hash-set! table object
+                 (+ (* 256 (- (port-position port) (sharing-map-base smap))) opcode))))
+
+  (define (name? object)
+    (or (package? object)
+        (and (symbol? object) (symbol-package object) #t)))
+
+  (define (write-deferred-length! deferred length)
+    (let ((end (port-position port)))
+      (set-port-position! port (+ (deferred-object-start deferred) 1))
+      (write-binary-fixnum-u32 length port)
+      (set-port-position! port end)))
+
+  (define (add-deferred-object! deferred)
+    (let ((count (sharing-map-deferred-object-count smap)))
+      (when (= count (length (sharing-map-deferred-objects smap)))
+        (set-sharing-map-deferred-objects! smap (vector-resize (sharing-map-deferred-objects smap)
+                                                               (* 2 count)
+                                                               #f)))
+      (vector-set! (sharing-map-deferred-objects smap) count deferred)
+      (set-sharing-map-deferred-object-count! smap (+ count 1))))
+
+  ;; The deferred object written around <position>, if any.
+  (define (deferred-object-at position)
+    (let ((deferred (sharing-map-deferred-objects smap)))
+      (let loop ((lo 0)
+                 (hi (sharing-map-deferred-object-count smap)))
+        (if (< lo hi)
+            (let ((mid (quotient (+ lo hi) 2)))
+              (if (<= (deferred-object-start (vector-ref deferred mid)) position)
+                  (loop (+ mid 1) hi)
+                  (loop lo mid)))
+            (and (> lo 0)
+                 (let ((candidate (vector-ref deferred (- lo 1))))
+                   (and (< position (deferred-object-end candidate))
+                        candidate)))))))
+
+  (define (note-shared-reference! position)
+    (awhen (sharing-map-open-deferred-object smap)
+      (when (< position (deferred-object-start it))
+        (set-deferred-object-shared?! it #t)))
+    (awhen (deferred-object-at position)
+      (unless (deferred-object-shared? it)
+        (set-deferred-object-shared?! it #t)
+        (write-deferred-length! it 0))))
+
+  (define (write-reference table object location)
+    (unless (name? object)
+      (note-shared-reference! (+ (sharing-map-base smap) (quotient (abs location) 256))))
+    (when (> location 0)
+      (set-sharing-map-fixups! smap (cons location (sharing-map-fixups smap)))
+      (hash-set! table object (- location)))
+    (fast-write-opcode system::FASL_OP_RECORD_REFERENCE port)
+    (fast-write-varint (quotient (abs location) 256) port))
+
+  (define (write-opcode object opcode)
+    (note-location! offsets object opcode)
+    (fast-write-opcode opcode port))
+
+  (define (fast-write-deferred object)
+    (let ((deferred (make-deferred-object :start (port-position port))))
+      (fast-write-opcode system::FASL_OP_DEFERRED port)
+      (write-binary-fixnum-u32 0 port)
+      (set-sharing-map-open-deferred-object! smap deferred)
+      (fast-write-object object)
+      (set-sharing-map-open-deferred-object! smap #f)
+      (set-deferred-object-end! deferred (port-position port))
+      (unless (deferred-object-shared? deferred)
+        (write-deferred-length! deferred (- (deferred-object-end deferred)
+                                            (deferred-object-start deferred)
+                                            5)))
+      (add-deferred-object! deferred)))
+
+  ;; Bytecode is only ever written from a fast-op, which has already
+  ;; checked that it decodes into whole instructions.
+  (define (fast-write-bytecode code)
+    (aif (written-location offsets code)
+         (write-reference offsets code it)
+         (begin
+           (write-opcode code system::FASL_OP_VECTOR)
+           (fast-write-varint (length code) port)
+           (let loop ((pc 0))
+             (when (< pc (length code))
+               (let* ((opcode (vector-ref code pc))
+                      (operand-count (%bytecode-operand-count opcode)))
+                 (fast-write-object opcode)
+                 (dotimes (ii operand-count)
+                   (if (and (= opcode system::BC_CLOSURE) (= ii 1))
+                       (fast-write-deferred (vector-ref code (+ pc ii 1)))
+                       (fast-write-object (vector-ref code (+ pc ii 1)))))
+                 (loop (+ pc operand-count 1))))))))
 
   (define (fast-write-structure-layout layout)
-    (define (do-write)
-      (fast-write-opcode system::FASL_OP_STRUCTURE_LAYOUT port)
-      (check-sharing-and-write layout))
-    (if smap
-        (let ((layout-table (sharing-map-structure-layouts smap)))
-          (aif (hash-ref layout-table layout)
-               (begin
-                 (fast-write-opcode system::FASL_OP_READER_REFERENCE port)
-                 (fast-write-object it))
-               (begin
-                 (let ((next-index (get-next-index!)))
-                   (hash-set! layout-table layout next-index)
-                   (fast-write-opcode system::FASL_OP_READER_DEFINITION port)
-                   (fast-write-object next-index)
-                   (do-write)))))
-        (do-write)))
+    (aif (written-location layouts layout)
+         (write-reference layouts layout it)
+         (begin
+           (note-location! layouts layout system::FASL_OP_STRUCTURE_LAYOUT)
+           (fast-write-opcode system::FASL_OP_STRUCTURE_LAYOUT port)
+           (fast-write-object layout))))
+
+  (define (fast-write-cons object)
+    (write-opcode object system::FASL_OP_CONS)
+    (let loop ((xs object))
+      (fast-write-object (car xs))
+      (let ((next (cdr xs)))
+        (cond ((and (pair? next)
+                    (not (written-location offsets next)))
+               (write-opcode next system::FASL_OP_CONS)
+               (loop next))
+              (#t
+               (fast-write-object next))))))
 
   (define (fast-write-object object)
+    (if (%immediate? object)
+        (fast-write-immediate object)
+        (aif (written-location offsets object)
+             (write-reference offsets object it)
+             (fast-write-composite object))))
 
+  (define (fast-write-immediate object)
     (case (%representation-of object)
       ((nil)
        (fast-write-opcode system::FASL_OP_NIL port))
@@ -146,19 +235,11 @@
        (fast-write-opcode system::FASL_OP_CHARACTER port)
        (write-binary-fixnum-u8 (char->integer object) port))
 
-      ((cons)
-       (mvbind (len dotted?) (length-excluding-shared object smap)
-         (fast-write-opcode (if dotted? system::FASL_OP_LISTD system::FASL_OP_LIST) port)
-         (check-sharing-and-write len)
-         (let loop ((i 0) (xs object))
-           (cond ((< i len)
-                  (check-sharing-and-write (car xs))
-                  (loop (+ i 1) (cdr xs)))
-                 (dotted?
-                  (check-sharing-and-write xs))))))
-
       ((fixnum)
        (cond
+        ((and (>= object 0)
+              (< object (- system::FASL_OP_RECORD system::FASL_OP_SMALL_FIXNUM)))
+         (fast-write-opcode (+ system::FASL_OP_SMALL_FIXNUM object) port))
         ((and (>= object -128) (<= object 127))
          (fast-write-opcode system::FASL_OP_FIX8 port)
          (write-binary-fixnum-s8 object port))
@@ -172,88 +253,110 @@
          (fast-write-opcode system::FASL_OP_FIX64 port)
          (write-binary-fixnum-s64 object port))))
 
+      (#t
+       (fast-write-composite object))))
+
+  (define (fast-write-composite object)
+    (case (%representation-of object)
+      ((cons)
+       (fast-write-cons object))
+
       ((flonum)
-       (fast-write-opcode system::FASL_OP_FLOAT port)
+       (write-opcode object system::FASL_OP_FLOAT)
        (write-binary-flonum object port))
 
       ((complex)
-       (fast-write-opcode system::FASL_OP_COMPLEX port)
+       (write-opcode object system::FASL_OP_COMPLEX)
        (write-binary-flonum (real-part object) port)
        (write-binary-flonum (imag-part object) port))
 
       ((string)
-       (fast-write-opcode system::FASL_OP_STRING port)
-       (check-sharing-and-write (length object))
+       (write-opcode object system::FASL_OP_STRING)
+       (fast-write-varint (length object) port)
        (write-binary-string object port))
 
       ((package)
-       (fast-write-opcode system::FASL_OP_PACKAGE port)
-       (check-sharing-and-write (package-name object)))
+       (write-opcode object system::FASL_OP_PACKAGE)
+       (fast-write-object (package-name object)))
 
       ((symbol)
-       (fast-write-opcode system::FASL_OP_SYMBOL port)
-       (check-sharing-and-write (symbol-name object))
-       (check-sharing-and-write (symbol-package object)))
+       (write-opcode object system::FASL_OP_SYMBOL)
+       (let ((name (symbol-name object)))
+         (fast-write-varint (length name) port)
+         (write-binary-string name port))
+       (fast-write-object (symbol-package object)))
 
       ((vector)
-       (fast-write-opcode system::FASL_OP_VECTOR port)
-       (check-sharing-and-write (length object))
+       (write-opcode object system::FASL_OP_VECTOR)
+       (fast-write-varint (length object) port)
        (dovec (x object)
-         (check-sharing-and-write x)))
+         (fast-write-object x)))
 
       ((hash)
-       (fast-write-opcode system::FASL_OP_HASH port)
-       (check-sharing-and-write (identity-hash? object))
-       (check-sharing-and-write (hash->a-list object)))
+       (write-opcode object system::FASL_OP_HASH)
+       (fast-write-object (identity-hash? object))
+       (fast-write-object (hash->a-list object)))
 
       ((subr)
-       (fast-write-opcode system::FASL_OP_SUBR port)
-       (check-sharing-and-write (procedure-name object)))
+       (write-opcode object system::FASL_OP_SUBR)
+       (fast-write-object (procedure-name object)))
 
       ((closure)
-       (fast-write-opcode system::FASL_OP_CLOSURE port)
-       (check-sharing-and-write (%closure-env object))
-       (check-sharing-and-write (%closure-code object))
-       (check-sharing-and-write (%property-list object)))
+       (write-opcode object system::FASL_OP_CLOSURE)
+       (fast-write-object (%closure-env object))
+       (fast-write-object (%closure-code object))
+       (fast-write-object (%property-list object)))
 
       ((macro)
-       (fast-write-opcode system::FASL_OP_MACRO port)
-       (check-sharing-and-write (%macro-transformer object)))
+       (write-opcode object system::FASL_OP_MACRO)
+       (fast-write-object (%macro-transformer object)))
 
       ((structure)
-       (fast-write-opcode system::FASL_OP_STRUCTURE port)
+       (write-opcode object system::FASL_OP_STRUCTURE)
        (fast-write-structure-layout (%structure-layout object))
        (let ((len (%structure-length object)))
-         (check-sharing-and-write len)
+         (fast-write-varint len port)
          (dotimes (ii len)
-           (check-sharing-and-write (%structure-ref object ii)))))
+           (fast-write-object (%structure-ref object ii)))))
 
       ((fast-op)
        (mvbind (fop-opcode fop-name args next-op) (compiler::parse-fast-op object #f)
-         (fast-write-opcode (case (length args)
-                              ((0) (if (null? next-op) system::FASL_OP_FAST_OP_0 system::FASL_OP_FAST_OP_0N))
-                              ((1) (if (null? next-op) system::FASL_OP_FAST_OP_1 system::FASL_OP_FAST_OP_1N))
-                              ((2) (if (null? next-op) system::FASL_OP_FAST_OP_2 system::FASL_OP_FAST_OP_2N))
-                              (#t (error "Unsupported fast-op arity: ~s" object)))
-                            port)
-         (check-sharing-and-write fop-opcode)
-         (dolist (arg args)
-           (check-sharing-and-write arg))
+         (write-opcode object
+                       (case (length args)
+                         ((0) (if (null? next-op) system::FASL_OP_FAST_OP_0 system::FASL_OP_FAST_OP_0N))
+                         ((1) (if (null? next-op) system::FASL_OP_FAST_OP_1 system::FASL_OP_FAST_OP_1N))
+                         ((2) (if (null? next-op) system::FASL_OP_FAST_OP_2 system::FASL_OP_FAST_OP_2N))
+                         (#t (error "Unsupported fast-op arity: ~s" object))))
+         (fast-write-varint fop-opcode port)
+         (cond ((or (not smap) (sharing-map-open-deferred-object smap))
+                (dolist (arg args)
+                  (fast-write-object arg)))
+               ((= fop-opcode system::FOP_CLOSURE)
+                (fast-write-object (car args))
+                (fast-write-deferred (cadr args)))
+               ((= fop-opcode system::FOP_BYTECODE)
+                (fast-write-bytecode (car args))
+                (fast-write-object (cadr args)))
+               (#t
+                (dolist (arg args)
+                  (fast-write-object arg))))
          (unless (null? next-op)
-           (check-sharing-and-write next-op))))
+           (fast-write-object next-op))))
 
       (#t
        (error "fast-write of unsupported type ~a : ~s" (%representation-of object) object))))
 
-  (check-sharing-and-write object))
+  (fast-write-object object))
 
 (define (fast-write/ignore-sharing object port)
   "Writes <object> to <port> in FASL format. No attempt is made to preserve
    structure sharing; if <object> is circular, this function will never
    terminate."
-  (fast-write-using-shared-structure-table object port #f))
+  (fast-write-format port)
+  (fast-write-using-sharing-map object port #f))
 
 (define (fast-write object port)
   "Writes <object> to <port> in FASL format."
-  (fast-write-using-shared-structure-table object port (find-shared-structures object)))
-
+  (let ((smap (begin-sharing-map port)))
+    (fast-write-using-sharing-map object port smap)
+    (finish-sharing-map smap port)))
@@ -11,21 +11,15 @@
 ;;;; WARRANTIES.
 
 (define (hash-keys hash)
-  (map car (hash->a-list hash)))
+  (hash-fold (lambda (k v keys) (cons k keys)) () hash))
 
 (define (hash-keys/t hash)
-  (map car (filter cdr (hash->a-list hash))))
+  (hash-fold (lambda (k v keys) (if v (cons k keys) keys)) () hash))
 
 (define (hash-push! hash key value)
   "Push <value> onto the list in hash table <hash>, referred to by <key>."
   (hash-set! hash key (cons value (hash-ref hash key ()))))
 
-(define (hash-for-each fn hash)
-  (dovec (k/v (%hash-binding-vector hash))
-    (unless (null? k/v)
-      (dbind (k . v) k/v
-        (fn k v)))))
-
 (defmacro (dohash head . body)
   (unless (list? head)
     (error "dolist requires a list for <head>" head))
@@ -10,16 +10,15 @@
 ;;;; redistribution of this file, and for a DISCLAIMER OF ALL
 ;;;; WARRANTIES.
 
-
-;;;; REVISIT: *memoize-result-caches*  should forget caches for functions
-;;;;           that get finalized. (Which requires weak references.)
-
-(define *memoize-result-caches* '())
+;;; The result caches of memoized functions, keyed by function. This is
+;;; weak, so a cache is dropped along with its function.
+(define *memoize-result-caches* (make-weak-key-hash))
 
 (define *memoize-results?* #t)
 
 (define (forget-all-memoized-results)
-  (map hash-clear! *memoize-result-caches*))
+  (dohash (f result-cache *memoize-result-caches*)
+    (hash-clear! result-cache)))
 
 (define (memoize f)
   "Returns a memoized version of the procedure <f>.  The memoized version
@@ -27,15 +26,16 @@
    a given set of arguments. If the function is ever called with that set of
    arguments again, the memoized function will return the remembered value
    rather than recompute the value a second time."
-  (let ((no-cached-result (gensym))
-        (result-cache (make-hash)))
-    (push! result-cache *memoize-result-caches*)
-    (lambda arguments
-      (if *memoize-results?*
-          (let ((cached-result (hash-ref result-cache arguments no-cached-result)))
-            (if (eq? cached-result no-cached-result)
-                (let ((result (apply f arguments)))
-                  (hash-set! result-cache arguments result)
-                  result)
-                cached-result))
-          (apply f arguments)))))
+  (let* ((no-cached-result (gensym))
+         (result-cache (make-hash))
+         (memoized-f (lambda arguments
+                       (if *memoize-results?*
+                           (let ((cached-result (hash-ref result-cache arguments no-cached-result)))
+                             (if (eq? cached-result no-cached-result)
+                                 (let ((result (apply f arguments)))
+                                   (hash-set! result-cache arguments result)
+                                   result)
+                                 cached-result))
+                           (apply f arguments)))))
+    (hash-set! *memoize-result-caches* memoized-f result-cache)
+    memoized-f))
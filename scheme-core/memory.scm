@@ -10,19 +10,14 @@
 ;;;; redistribution of this file, and for a DISCLAIMER OF ALL
 ;;;; WARRANTIES.
 
-(define *gc-target-free-cell-factor* 0.9)
+(define *after-gc-hook* ())
 
-(define (maybe-enlarge-heap cells-freed)
-  (dbind [heap-segments heap-segment-cells max-heap-segments] (gc-info)
-    (let ((target-free-cells (* heap-segments heap-segment-cells *gc-target-free-cell-factor*)))
-      (unless (>= cells-freed target-free-cells)
-        (let ((heap-segments-needed (ceiling (/ (- target-free-cells cells-freed)
-                                                 heap-segment-cells))))
-          (%request-heap-size (min max-heap-segments
-                                   (+ heap-segments-needed heap-segments))))))))
-
-(define (trap-after-gc trapno frp cells-freed)
-  (maybe-enlarge-heap cells-freed))
+(define (trap-after-gc trapno frp cells-free pause-time)
+  "Handle the end of a garbage collection pause. <pause-time> is the
+   length of the pause in seconds. <cells-free> is the number of cells
+   available after the collection, or #f if the pause was a slice of an
+   incremental collection that is still in progress."
+  (invoke-hook '*after-gc-hook* cells-free pause-time))
 
 (eval-when (:compile-toplevel :load-toplevel :execute)
   (%set-trap-handler! system::TRAP_AFTER_GC trap-after-gc))
@@ -148,7 +148,7 @@ character or #f if not found."
   "Signals a read error."
   (abort 'read-error error-type port location args))
 
-(define *location-mapping* (make-identity-hash))
+(define *location-mapping* (make-weak-key-hash))
 
 (define (open-output-buffer)
   (let ((buf (open-output-string)))
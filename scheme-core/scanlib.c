@@ -26,6 +26,10 @@ void init1()
      register_internal_file(&ifile_compiler_run_scf);
      register_internal_file(&ifile_scheme_scf);
 
+     /* A boot image already holds everything scheme.scf defines. */
+     if (boot_image_loaded())
+          return;
+
      lref_t port = open_c_data_input(&ifile_scheme_scf);
 
      liifasl_load(lmake_fasl_reader(port));
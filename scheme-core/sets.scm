@@ -92,7 +92,8 @@
   "Given a list <xs>, return a bag. The resultant bag is an a-list
    binding values in <xs> to the number of times they occur in
    the original list."
- (let ((hash (make-set-hash)))
+ (let ((hash (make-set-hash))
+       (count-one #L(+ _ 1)))
    (dolist (x xs)
-     (hash-set! hash x (+ 1 (hash-ref hash x 0))))
+     (hash-update! hash x count-one 0))
    (hash->a-list hash)))
@@ -9,6 +9,7 @@
 ;;;; redistribution of this file, and for a DISCLAIMER OF ALL
 ;;;; WARRANTIES.
 
+(%define %bytecode-operand-count #.(host-scheme::%subr-by-name "%bytecode-operand-count"))
 (%define %closure #.(host-scheme::%subr-by-name "%closure"))
 (%define %closure-code #.(host-scheme::%subr-by-name "%closure-code"))
 (%define %closure-env #.(host-scheme::%subr-by-name "%closure-env"))
@@ -20,9 +21,11 @@
 (%define %directory #.(host-scheme::%subr-by-name "%directory"))
 (%define %dump-heap-state #.(host-scheme::%subr-by-name "%dump-heap-state"))
 (%define %%fasl-load #.(host-scheme::%subr-by-name "%%fasl-load"))
+(%define %environment-frames #.(host-scheme::%subr-by-name "%environment-frames"))
 (%define %fast-op #.(host-scheme::%subr-by-name "%fast-op"))
 (%define %fast-op-args #.(host-scheme::%subr-by-name "%fast-op-args"))
 (%define %fast-op-opcode #.(host-scheme::%subr-by-name "%fast-op-opcode"))
+(%define %fast-op-deferred? #.(host-scheme::%subr-by-name "%fast-op-deferred?"))
 (%define %fast-op-next #.(host-scheme::%subr-by-name "%fast-op-next"))
 (%define %file-details #.(host-scheme::%subr-by-name "%file-details"))
 
@@ -35,6 +38,7 @@
 (%define %make-eof #.(host-scheme::%subr-by-name "%make-eof"))
 (%define %memref #.(host-scheme::%subr-by-name "%memref"))
 (%define %obaddr #.(host-scheme::%subr-by-name "%obaddr"))
+(%define %open-c-data-input-string #.(host-scheme::%subr-by-name "%open-c-data-input-string"))
 (%define %package-bindings #.(host-scheme::%subr-by-name "%package-bindings"))
 (%define %package-use-list #.(host-scheme::%subr-by-name "%package-use-list"))
 (%define %packagecons #.(host-scheme::%subr-by-name "%packagecons"))
@@ -45,6 +49,7 @@
 (%define %set-closure-env #.(host-scheme::%subr-by-name "%set-closure-env"))
 (%define %set-control-field #.(host-scheme::%subr-by-name "%set-control-field"))
 (%define %set-debug-flags #.(host-scheme::%subr-by-name "%set-debug-flags"))
+(%define %set-fasl-lazy-load! #.(host-scheme::%subr-by-name "%set-fasl-lazy-load!"))
 (%define %set-fasl-package-list! #.(host-scheme::%subr-by-name "%set-fasl-package-list!"))
 (%define %set-interrupt-mask! #.(host-scheme::%subr-by-name "%set-interrupt-mask!"))
 (%define %set-package-name #.(host-scheme::%subr-by-name "%set-package-name"))
@@ -137,12 +142,16 @@
 (%define hash->list #.(host-scheme::%subr-by-name "hash->list"))
 (%define hash-clear! #.(host-scheme::%subr-by-name "hash-clear!"))
 (%define hash-copy #.(host-scheme::%subr-by-name "hash-copy"))
+(%define hash-fold #.(host-scheme::%subr-by-name "hash-fold"))
+(%define hash-for-each #.(host-scheme::%subr-by-name "hash-for-each"))
 (%define hash-has? #.(host-scheme::%subr-by-name "hash-has?"))
+(%define hash-merge! #.(host-scheme::%subr-by-name "hash-merge!"))
 (%define hash-ref #.(host-scheme::%subr-by-name "hash-ref"))
 (%define hash-ref* #.(host-scheme::%subr-by-name "hash-ref*"))
 (%define hash-remove! #.(host-scheme::%subr-by-name "hash-remove!"))
 (%define hash-set! #.(host-scheme::%subr-by-name "hash-set!"))
 (%define hash-set-multiple! #.(host-scheme::%subr-by-name "hash-set-multiple!"))
+(%define hash-update! #.(host-scheme::%subr-by-name "hash-update!"))
 (%define hash? #.(host-scheme::%subr-by-name "hash?"))
 (%define identity-hash? #.(host-scheme::%subr-by-name "identity-hash?"))
 (%define imag-part #.(host-scheme::%subr-by-name "imag-part"))
@@ -165,6 +174,8 @@
 (%define make-polar #.(host-scheme::%subr-by-name "make-polar"))
 (%define make-rectangular #.(host-scheme::%subr-by-name "make-rectangular"))
 (%define make-vector #.(host-scheme::%subr-by-name "make-vector"))
+(%define make-weak-key-hash #.(host-scheme::%subr-by-name "make-weak-key-hash"))
+(%define make-weak-value-hash #.(host-scheme::%subr-by-name "make-weak-value-hash"))
 (%define modulo #.(host-scheme::%subr-by-name "modulo"))
 (%define nan? #.(host-scheme::%subr-by-name "nan?"))
 (%define newline #.(host-scheme::%subr-by-name "newline"))
@@ -190,6 +201,7 @@
 (%define port-column #.(host-scheme::%subr-by-name "port-column"))
 (%define port-row #.(host-scheme::%subr-by-name "port-row"))
 (%define port-name #.(host-scheme::%subr-by-name "port-name"))
+(%define port-position #.(host-scheme::%subr-by-name "port-position"))
 (%define port-translate-mode #.(host-scheme::%subr-by-name "port-translate-mode"))
 (%define primitive? #.(host-scheme::%subr-by-name "primitive?"))
 (%define procedure? #.(host-scheme::%subr-by-name "procedure?"))
@@ -219,6 +231,7 @@
 (%define set-car! #.(host-scheme::%subr-by-name "set-car!"))
 (%define set-cdr! #.(host-scheme::%subr-by-name "set-cdr!"))
 (%define set-environment-variable! #.(host-scheme::%subr-by-name "set-environment-variable!"))
+(%define set-port-position! #.(host-scheme::%subr-by-name "set-port-position!"))
 (%define set-port-translate-mode! #.(host-scheme::%subr-by-name "set-port-translate-mode!"))
 (%define set-random-seed! #.(host-scheme::%subr-by-name "set-random-seed!"))
 (%define set-symbol-package! #.(host-scheme::%subr-by-name "set-symbol-package!"))
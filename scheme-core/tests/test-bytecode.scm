@@ -0,0 +1,149 @@
+(define-package "test-bytecode"
+  (:uses "scheme"
+         "unit-test"
+         "unit-test-utils"))
+
+(define (closure-engine f)
+  (mvbind (opcode opname args) (compiler::parse-fast-op (cdr (scheme::%closure-code f)))
+    (if (eq? opname :stack-frame)
+        (mvbind (opcode opname) (compiler::parse-fast-op (car args))
+          opname)
+        opname)))
+
+(define *bytecode-test-global* 0)
+
+(defmacro (both-engines lambda-list . body)
+  `(list (scheme::%lambda ((:bytecode . #t)) ,lambda-list ,@body)
+         (scheme::%lambda ((:bytecode . #f)) ,lambda-list ,@body)))
+
+(define-test bytecode-selection
+  (dbind (bc tree) (both-engines (x) (+ x 1))
+    (check (eq? :bytecode (closure-engine bc)))
+    (check (not (eq? :bytecode (closure-engine tree))))
+    (check (= (bc 1) (tree 1))))
+
+  (dbind (bc tree) (both-engines (x) (lambda () x))
+    (check (eq? :bytecode (closure-engine bc)))
+    (check (= ((bc 2)) ((tree 2)) 2))))
+
+(define-test bytecode-execution
+  (dolist (f (both-engines (x) (if (< x 0) (- x) x)))
+    (check (= (f -3) 3))
+    (check (= (f 4) 4)))
+
+  (dolist (f (both-engines (x y) (and x (or y 'no))))
+    (check (eq? (f #f 1) #f))
+    (check (eq? (f #t #f) 'no))
+    (check (eq? (f #t 'yes) 'yes)))
+
+  (dolist (f (both-engines (xs) (list (car xs) (cdr xs) (null? xs) (not xs) (eq? xs xs))))
+    (check (equal? (f '(1 2)) '(1 (2) #f #f #t))))
+
+  (dolist (f (both-engines (n)
+               (let ((acc ()))
+                 (while (> n 0)
+                   (push! n acc)
+                   (set! n (- n 1)))
+                 acc)))
+    (check (equal? (f 3) '(1 2 3))))
+
+  (dolist (f (both-engines (a . rest) (set! a (list a)) (cons a rest)))
+    (check (equal? (f 1 2 3) '((1) 2 3)))
+    (check (equal? (f 1) '((1)))))
+
+  (dolist (f (both-engines (a b) b))
+    (check (runtime-error? (f 1))))
+
+  (dolist (f (both-engines (fn x) (fn (fn x))))
+    (check (= (f #L(* _ 2) 3) 12)))
+
+  (dolist (f (both-engines (x) (set! *bytecode-test-global* (+ *bytecode-test-global* x))))
+    (set! *bytecode-test-global* 0)
+    (f 2)
+    (f 3)
+    (check (= *bytecode-test-global* 5)))
+
+  (dolist (f (both-engines (x) (catch 'tag (list 1 (throw 'tag x) 2))))
+    (check (eq? (f 'thrown) 'thrown)))
+
+  (dolist (f (both-engines (n) (let loop ((n n) (acc 0))
+                                 (if (= n 0)
+                                     acc
+                                     (loop (- n 1) (+ acc 1))))))
+    (check (= (f 100000) 100000))))
+
+(define-test bytecode-fast-io
+  (let ((f (fast-io-round-trip (scheme::%lambda ((:bytecode . #t)) (x y)
+                                 (if (< x y) (list x y) (+ x y))))))
+    (check (eq? :bytecode (closure-engine f)))
+    (check (equal? (f 1 2) '(1 2)))
+    (check (= (f 2 1) 3))))
+
+(define (bytecode-test-callee x) (list :first x))
+
+(define (redefine-bytecode-test-callee! fn)
+  (scheme::%define-global 'bytecode-test-callee fn))
+
+;; Global call sites cache the function they last applied, so these
+;; check that each way of changing it is seen by the next call, from
+;; both tail and non-tail positions.
+(define-test global-call-redefinition
+  (let ((original bytecode-test-callee)
+        (sites (append (both-engines (x) (bytecode-test-callee x))
+                       (both-engines (x) (car (list (bytecode-test-callee x)))))))
+    (unwind-protect
+     (lambda ()
+       (define (results x)
+         (map #L(_ x) sites))
+       (check (every? #L(equal? _ '(:first 1)) (results 1)))
+       (redefine-bytecode-test-callee! (lambda (x . rest) (cons :rest x)))
+       (check (every? #L(equal? _ '(:rest . 2)) (results 2)))
+       (redefine-bytecode-test-callee! list)
+       (check (every? #L(equal? _ '(3)) (results 3)))
+       (set! bytecode-test-callee (lambda (x) (list :set x)))
+       (check (every? #L(equal? _ '(:set 4)) (results 4)))
+       (gc)
+       (check (every? #L(equal? _ '(:set 5)) (results 5)))
+       (scheme::%set-closure-code bytecode-test-callee
+                                  (scheme::%closure-code (lambda (x) (list :code x))))
+       (check (every? #L(equal? _ '(:code 6)) (results 6)))
+       (redefine-bytecode-test-callee! 7)
+       (check (every? #L(runtime-error? (_ 7)) sites)))
+     (lambda ()
+       (redefine-bytecode-test-callee! original)))))
+
+(define (bytecode-fast-op code depth)
+  (scheme::%fast-op system::FOP_BYTECODE code depth ()))
+
+(define-test bytecode-validation
+  (let* ((code (vector system::BC_LITERAL 42 system::BC_RETURN))
+         (fop (bytecode-fast-op code 0)))
+    (vector-set! code 1 'changed)
+    (check (equal? (car (scheme::%fast-op-args fop)) #(#.system::BC_LITERAL 42 #.system::BC_RETURN)))
+    (vector-set! (car (scheme::%fast-op-args fop)) 1 'changed)
+    (check (equal? (car (scheme::%fast-op-args fop)) #(#.system::BC_LITERAL 42 #.system::BC_RETURN))))
+
+  (check (not (runtime-error? (bytecode-fast-op #(#.system::BC_LITERAL #f
+                                                  #.system::BC_JUMP_IF_FALSE 6
+                                                  #.system::BC_LITERAL 1
+                                                  #.system::BC_RETURN)
+                                                0))))
+
+  (check (runtime-error? (bytecode-fast-op '(#.system::BC_RETURN) 0)))
+  (check (runtime-error? (bytecode-fast-op #(#.system::BC_RETURN) -1)))
+  (check (runtime-error? (bytecode-fast-op #() 0)))
+  (check (runtime-error? (bytecode-fast-op #(99) 0)))
+  (check (runtime-error? (bytecode-fast-op #(#.system::BC_LITERAL) 0)))
+  (check (runtime-error? (bytecode-fast-op #(#.system::BC_LITERAL 1) 0)))
+  (check (runtime-error? (bytecode-fast-op #(#.system::BC_GLOBAL_REF 1 #.system::BC_RETURN) 0)))
+  (check (runtime-error? (bytecode-fast-op #(#.system::BC_JUMP 10) 0)))
+  (check (runtime-error? (bytecode-fast-op #(#.system::BC_LITERAL 1 #.system::BC_JUMP 1) 0)))
+  (check (runtime-error? (bytecode-fast-op #(#.system::BC_FAST_OP 1 #.system::BC_RETURN) 0)))
+  (check (runtime-error? (bytecode-fast-op #(#.system::BC_EQP #.system::BC_RETURN) 1)))
+  (check (runtime-error? (bytecode-fast-op #(#.system::BC_PUSH #.system::BC_RETURN) 0)))
+  (check (runtime-error? (bytecode-fast-op #(#.system::BC_CALL 0 #.system::BC_RETURN) 1)))
+  (check (runtime-error? (bytecode-fast-op #(#.system::BC_LITERAL #f
+                                             #.system::BC_JUMP_IF_FALSE 5
+                                             #.system::BC_PUSH
+                                             #.system::BC_RETURN)
+                                           1))))
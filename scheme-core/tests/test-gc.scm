@@ -0,0 +1,189 @@
+(define-package "test-gc"
+  (:uses "scheme"
+         "unit-test"
+         "unit-test-utils"))
+
+(define (minor-collection-count)
+  (vector-ref (gc-info) 8))
+
+(define (allocate-through-nursery)
+  "Allocate enough short-lived cells to force at least one minor
+   collection, or do a full collection if the nursery is disabled."
+  (if (= (vector-ref (gc-info) 7) 0)
+      (gc)
+      (let ((minors (minor-collection-count)))
+        (let loop ((junk ()) (n 0))
+          (unless (> (minor-collection-count) minors)
+            (if (> n 1000)
+                (loop () 0)
+                (loop (cons (list 1.5 2.5) junk) (+ n 1))))))))
+
+(define (young-value i)
+  (list i (* i 1.0)))
+
+(define (young-values? xs)
+  (let loop ((i 0) (xs xs))
+    (cond ((null? xs) #t)
+          ((equal? (car xs) (young-value i)) (loop (+ i 1) (cdr xs)))
+          (#t #f))))
+
+(define *gc-test-global* #f)
+
+;; Each of these tests makes some objects old with a full collection,
+;; stores many freshly allocated values into them, and then forces a
+;; minor collection. Values reachable only through the old objects
+;; survive only if the write barrier remembered them.
+
+(define-test minor-collection/vector-set!
+  (let ((vec (make-vector 1000 #f)))
+    (gc)
+    (dotimes (ii 1000)
+      (vector-set! vec ii (young-value ii)))
+    (allocate-through-nursery)
+    (check (young-values? (vector->list vec)))))
+
+(define-test minor-collection/set-car!
+  (let ((xs (make-list 1000 #f)))
+    (gc)
+    (let loop ((ii 0) (pos xs))
+      (unless (null? pos)
+        (set-car! pos (young-value ii))
+        (loop (+ ii 1) (cdr pos))))
+    (allocate-through-nursery)
+    (check (young-values? xs))))
+
+(define-test minor-collection/set-cdr!
+  (let ((head (cons #f ())))
+    (gc)
+    (let loop ((ii 999) (tail ()))
+      (if (< ii 0)
+          (set-cdr! head tail)
+          (loop (- ii 1) (cons (young-value ii) tail))))
+    (allocate-through-nursery)
+    (check (young-values? (cdr head)))))
+
+(define-test minor-collection/hash-set!
+  (let ((hash (make-hash))
+        (ihash (make-identity-hash)))
+    (gc)
+    (dotimes (ii 1000)
+      (hash-set! hash (number->string ii) (young-value ii))
+      (hash-set! ihash ii (young-value ii)))
+    (allocate-through-nursery)
+    (check (young-values? (map #L(hash-ref hash (number->string _)) (iseq 0 1000))))
+    (check (young-values? (map #L(hash-ref ihash _) (iseq 0 1000))))))
+
+(define-test minor-collection/global-and-closure-variables
+  (let ((f (let ((x #f))
+             (lambda (op)
+               (if (eq? op :set)
+                   (set! x (map young-value (iseq 0 1000)))
+                   x)))))
+    (gc)
+    (f :set)
+    (set! *gc-test-global* (map young-value (iseq 0 1000)))
+    (allocate-through-nursery)
+    (check (young-values? (f :get)))
+    (check (young-values? *gc-test-global*))))
+
+(define-test minor-collection/survivors
+  (let ((survivors (map young-value (iseq 0 1000))))
+    (allocate-through-nursery)
+    (allocate-through-nursery)
+    (check (young-values? survivors))))
+
+(define-test after-gc-hook
+  (let ((pauses ()))
+    (define (record-pause cells-free pause-time)
+      (push! (cons cells-free pause-time) pauses))
+    (add-hook-function! '*after-gc-hook* record-pause)
+    (unwind-protect
+     (lambda () (gc))
+     (lambda () (remove-hook-function! '*after-gc-hook* record-pause)))
+    (check (any? #L(and (exact? (car _)) (> (car _) 0)) pauses))
+    (check (every? #L(or (not (car _)) (exact? (car _))) pauses))
+    (check (every? #L(and (inexact? (cdr _)) (>= (cdr _) 0)) pauses))
+    (check (not (memq record-pause *after-gc-hook*)))))
+
+(define-test gc-phase-times
+  (gc)
+  (let ((info (gc-info)))
+    (check (>= (vector-ref info 12) 1))
+    (dolist (ii '(13 14 15))
+      (check (inexact? (vector-ref info ii)))
+      (check (>= (vector-ref info ii) 0)))
+    (check (> (vector-ref info 14) 0))))
+
+(define (heap-segments)
+  (vector-ref (gc-info) 0))
+
+(define-test heap-sizing
+  (gc)
+  (let ((segments (heap-segments))
+        (segment-cells (vector-ref (gc-info) 1))
+        (grown-segments #f))
+    (let ((xs (make-list (* 2 segment-cells) #f)))
+      (gc)
+      (set! grown-segments (heap-segments))
+      (check (> grown-segments segments))
+      (check (= (length xs) (* 2 segment-cells))))
+    (gc)
+    (gc)
+    (check (<= (heap-segments) grown-segments))))
+
+(define (add-garbage-keys! hash n)
+  (dotimes (ii n)
+    (hash-set! hash (list ii) ii)))
+
+(define (add-garbage-values! hash n)
+  (dotimes (ii n)
+    (hash-set! hash (number->string ii) (list ii))))
+
+;; The stack is scanned conservatively, so a few dead entries may be
+;; kept by stale references, and minor collections can remove others
+;; while they're being added. The checks only require that most of them
+;; are gone after a collection.
+
+(define-test weak-key-hash
+  (let ((hash (make-weak-key-hash))
+        (live (map list (iseq 0 100))))
+    (check (identity-hash? hash))
+    (dolist (key live)
+      (hash-set! hash key :live))
+    (add-garbage-keys! hash 1000)
+    (gc)
+    (check (every? #L(eq? (hash-ref hash _) :live) live))
+    (check (< (length hash) 200))
+    (add-garbage-keys! hash 1000)
+    (check (every? #L(eq? (hash-ref hash _) :live) live))))
+
+(define-test weak-value-hash
+  (let ((hash (make-weak-value-hash))
+        (live (map list (iseq 0 100))))
+    (check (not (identity-hash? hash)))
+    (dolist (val live)
+      (hash-set! hash (format #f "live-~a" (car val)) val))
+    (add-garbage-values! hash 1000)
+    (gc)
+    (check (every? #L(eq? (hash-ref hash (format #f "live-~a" (car _))) _) live))
+    (check (< (length hash) 200))))
+
+(define-test minor-collection/weak-hash
+  (let ((hash (make-weak-key-hash))
+        (live (map list (iseq 0 100))))
+    (gc)
+    (dolist (key live)
+      (hash-set! hash key :live))
+    (add-garbage-keys! hash 1000)
+    (allocate-through-nursery)
+    (check (every? #L(eq? (hash-ref hash _) :live) live))
+    (check (< (length hash) 200))))
+
+(define-test weak-hash-copy
+  (let* ((key (list 1))
+         (hash (hash-copy (make-weak-key-hash))))
+    (hash-set! hash key :live)
+    (add-garbage-keys! hash 1000)
+    (gc)
+    (check (eq? (hash-ref hash key) :live))
+    (check (< (length hash) 100))))
@@ -297,6 +297,21 @@
 
     (check (runtime-error? (sxhash 'foo :not-a-hash)))
     (check (not (= (sxhash "foo" h/eq) (sxhash "foo" h/equal))))))
+
+(define-test hash-sxhash-string
+  (let ((s (string-copy "foo"))
+        (h (make-hash)))
+    (check (= (sxhash s) (sxhash "foo")))
+    (check (= (sxhash 'foo) (sxhash "foo")))
+    (check (>= (sxhash s) 0))
+    (hash-set! h s :foo)
+    (string-set! s 0 #\b)
+    (check (= (sxhash s) (sxhash "boo")))
+    (check (not (hash-ref h "foo")))
+    (string-upcase! s)
+    (check (= (sxhash s) (sxhash "BOO")))
+    (string-downcase! s)
+    (check (= (sxhash s) (sxhash "boo")))))
     
 (define-test hash-subr-keys
   (let ((h (make-hash)))
@@ -376,3 +391,187 @@
     (check (eq? (hash-ref h1 a) #f))
     (check (eq? (hash-ref h1 b) #f))
     (check (eq? (hash-ref h1 c) #f))))
+
+(define-test hash-remove-and-reinsert
+  (let ((h (make-hash))
+        (keys (map #L(format #f "key-~a" _) (iseq 0 2000))))
+    (dolist (key keys)
+      (hash-set! h key key))
+    (let loop ((keys keys) (ii 0))
+      (unless (null? keys)
+        (when (even? ii)
+          (hash-remove! h (car keys)))
+        (loop (cdr keys) (+ ii 1))))
+    (check (= (length h) 1000))
+    (check (every? #L(eq? (not (hash-has? h (format #f "key-~a" _))) (even? _)) (iseq 0 2000)))
+    (dotimes (ii 2000)
+      (hash-set! h (format #f "key-~a" ii) ii))
+    (check (= (length h) 2000))
+    (check (every? #L(= (hash-ref h (format #f "key-~a" _)) _) (iseq 0 2000)))))
+
+(define (hash-binding-count hash)
+  (length (scheme::%hash-binding-vector hash)))
+
+(define (hash-deleted-entry-count hash)
+  (length (filter not (vector->list (scheme::%hash-binding-vector hash)))))
+
+(define-test hash-remove-compaction
+  (let ((h (make-hash)))
+    (dotimes (ii 10000)
+      (hash-set! h ii ii))
+    (let ((full-size (hash-binding-count h)))
+      (dotimes (ii 9990)
+        (hash-remove! h ii))
+      (check (= (length h) 10))
+      (check (< (hash-binding-count h) full-size))
+      (check (every? #L(= (hash-ref h _) _) (iseq 9990 10000)))))
+
+  (let ((h (make-hash)))
+    (dotimes (ii 100)
+      (hash-set! h ii ii))
+    (dotimes (ii 20000)
+      (hash-remove! h ii)
+      (hash-set! h (+ ii 100) (+ ii 100)))
+    (check (= (length h) 100))
+    (check (<= (hash-deleted-entry-count h)
+               (* 0.2 (hash-binding-count h))))
+    (check (every? #L(= (hash-ref h _) _) (iseq 20000 20100)))))
+
+(define-test identity-hash-remove-and-reinsert
+  (let ((h (make-identity-hash))
+        (keys (map #L(cons _ _) (iseq 0 5000))))
+    (dolist (key keys)
+      (hash-set! h key (car key)))
+    (dolist (key keys)
+      (when (even? (car key))
+        (hash-remove! h key)))
+    (check (= (length h) 2500))
+    (check (every? #L(eq? (not (hash-has? h _)) (even? (car _))) keys))
+    (dolist (key keys)
+      (hash-remove! h key)
+      (hash-set! h (list (car key)) (car key)))
+    (check (= (length h) 5000))
+    (check (every? #L(not (hash-has? h _)) keys))
+    (check (equal? (qsort (hash-keys h) < car) (map list (iseq 0 5000))))))
+
+(define-test concurrent-hash
+  (check (runtime-error? (make-hash :not-a-hash-kind)))
+  (check (hash? (make-hash #f)))
+  (let ((h (make-hash :concurrent))
+        (ih (make-identity-hash :concurrent))
+        (keys (map #L(cons _ _) (iseq 0 5000))))
+    (check (not (identity-hash? h)))
+    (check (identity-hash? ih))
+    (dotimes (ii 5000)
+      (hash-set! h (format #f "key-~a" ii) ii))
+    (dolist (key keys)
+      (hash-set! ih key (car key)))
+    (check (= (length h) 5000))
+    (check (= (length ih) 5000))
+    (check (every? #L(= (hash-ref h (format #f "key-~a" _)) _) (iseq 0 5000)))
+    (check (every? #L(= (hash-ref ih _) (car _)) keys))
+    (check (not (hash-has? ih (cons 1 1))))
+    (check (equal? (hash-ref* h "key-10") '("key-10" . 10)))
+
+    (dolist (key keys)
+      (when (even? (car key))
+        (hash-remove! ih key)))
+    (check (= (length ih) 2500))
+    (check (every? #L(eq? (not (hash-has? ih _)) (even? (car _))) keys))
+    (check (= (length (hash-keys ih)) 2500))
+    (dolist (key keys)
+      (hash-set! ih key (- (car key))))
+    (check (= (length ih) 5000))
+    (check (every? #L(= (hash-ref ih _) (- (car _))) keys))
+
+    (let ((copy (hash-copy ih)))
+      (check (equal? ih copy))
+      (hash-clear! ih)
+      (check (= (length ih) 0))
+      (check (not (hash-has? ih (car keys))))
+      (check (= (length copy) 5000))
+      (hash-set! ih (car keys) :again)
+      (check (eq? (hash-ref ih (car keys)) :again)))))
+
+(define-test hash-incremental-resize
+  ;; Tables this large are enlarged a few entries at a time, so these
+  ;; operations all run while entries are being moved to the new table.
+  (let ((h (make-hash))
+        (ih (make-identity-hash))
+        (keys (map #L(cons _ _) (iseq 0 11500))))
+    (dolist (key keys)
+      (hash-set! h (car key) key)
+      (hash-set! ih key (car key)))
+    (gc)
+    (check (= (length h) 11500))
+    (check (= (length ih) 11500))
+    (check (every? #L(eq? (hash-ref h (car _)) _) keys))
+    (dolist (key keys)
+      (when (even? (car key))
+        (hash-remove! h (car key))
+        (hash-remove! ih key)))
+    (check (= (length h) 5750))
+    (check (= (length ih) 5750))
+    (check (every? #L(eq? (not (hash-has? ih _)) (even? (car _))) keys))
+    (check (equal? (qsort (hash-keys h) <) (filter odd? (iseq 0 11500))))
+    (check (every? #L(eq? (hash-ref h (car _)) _) (filter #L(odd? (car _)) keys)))))
+
+(define-test hash-for-each
+  (let ((h (hash :a 1 :b 2 :c 3))
+        (seen ()))
+    (hash-for-each (lambda (k v) (push! (cons k v) seen)) h)
+    (check (equal? (qsort seen < cdr) '((:a . 1) (:b . 2) (:c . 3))))
+    (check (runtime-error? (hash-for-each :not-a-procedure h)))
+    (check (runtime-error? (hash-for-each (lambda (k v) k) :not-a-hash)))))
+
+(define-test hash-fold
+  (let ((h (hash :a 1 :b 2 :c 3)))
+    (check (= (hash-fold (lambda (k v sum) (+ v sum)) 0 h) 6))
+    (check (eq? (hash-fold (lambda (k v sum) (+ v sum)) :none (make-hash)) :none))
+    (check (equal? (qsort (hash-fold (lambda (k v kvs) (cons (cons k v) kvs)) () h) < cdr)
+                   '((:a . 1) (:b . 2) (:c . 3))))))
+
+(define-test hash-update!
+  (let ((h (make-hash))
+        (ih (make-identity-hash)))
+    (dolist (word '("a" "b" "a" "c" "a" "b"))
+      (hash-update! h word #L(+ _ 1) 0))
+    (check (= (hash-ref h "a") 3))
+    (check (= (hash-ref h "b") 2))
+    (check (= (hash-ref h "c") 1))
+    (check (= (length h) 3))
+    (check (eq? (hash-update! ih :x not) #t))
+    (check (eq? (hash-ref ih :x) #t))
+    (check (runtime-error? (hash-update! h "a" :not-a-procedure)))
+
+    ;; The update procedure may change the table itself, enough to make
+    ;; it grow.
+    (hash-update! ih :y (lambda (v)
+                          (dotimes (ii 100)
+                            (hash-set! ih ii ii))
+                          :updated))
+    (check (eq? (hash-ref ih :y) :updated))
+    (check (= (length ih) 102))
+    (hash-update! ih :x (lambda (v)
+                          (hash-remove! ih :y)
+                          (hash-clear! ih)
+                          v))
+    (check (eq? (hash-ref ih :x) #t))
+    (check (= (length ih) 1))))
+
+(define-test hash-merge!
+  (let ((h (hash :a 1 :b 2))
+        (ih (identity-hash :b 3 :c 4))
+        (big (make-hash)))
+    (check (eq? (hash-merge! h ih) h))
+    (check (= (length h) 3))
+    (check (equal? (map #L(hash-ref h _) '(:a :b :c)) '(1 3 4)))
+    (check (= (length ih) 2))
+    (dotimes (ii 5000)
+      (hash-set! big (number->string ii) ii))
+    (hash-merge! h big)
+    (check (= (length h) 5003))
+    (check (= (hash-ref h "4999") 4999))
+    (hash-merge! h h)
+    (check (= (length h) 5003))
+    (check (runtime-error? (hash-merge! h :not-a-hash)))))
@@ -154,6 +154,34 @@
       (check (runtime-error? (read-binary-fixnum-s32 '()))))
     (check (not (runtime-error? (delete-file test-filename))))))
 
+(define-test binary-port-positions
+  (let ((test-filename (temporary-file-name "sct")))
+    (with-port p (open-file test-filename :mode :write :encoding :binary)
+      (check (= (port-position p) 0))
+      (write-binary-fixnum-u8 1 p)
+      (write-binary-fixnum-u32 2 p)
+      (check (= (port-position p) 5))
+      (check (eq? p (set-port-position! p 0)))
+      (check (= (port-position p) 0))
+      (write-binary-fixnum-u8 3 p)
+      (check (= (port-position p) 1))
+      (set-port-position! p 5)
+      (write-binary-fixnum-u8 4 p)
+      (check (runtime-error? (set-port-position! p -1))))
+    (with-port p (open-file test-filename :encoding :binary)
+      (check (= (port-position p) 0))
+      (check (= (read-binary-fixnum-u8 p) 3))
+      (check (= (port-position p) 1))
+      (set-port-position! p 5)
+      (check (= (read-binary-fixnum-u8 p) 4))
+      (set-port-position! p 1)
+      (check (= (read-binary-fixnum-u32 p) 2))
+      (check (= (port-position p) 5)))
+    (delete-file test-filename))
+
+  (check (runtime-error? (port-position (open-input-string "text"))))
+  (check (runtime-error? (set-port-position! (open-output-string) 0))))
+
 (define-test flush-whitespace-string-input 
   (let ((ip (open-input-string "  123 4 ")))
     (check (char=? #\space (peek-char ip)))
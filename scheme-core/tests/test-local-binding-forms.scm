@@ -207,3 +207,63 @@
     (set! *dynamic-let-var-2* 24))
   (check (equal? *dynamic-let-var-1* :dlet1))
   (check (equal? *dynamic-let-var-2* :dlet2)))
+
+(define-test closure-environment
+  (let ((x 1) (y 2))
+    (let ((get-x (lambda () x))
+          (set-x! (lambda (v) (set! x v))))
+      (set-x! 10)
+      (check (= (get-x) 10))
+      (check (equal? (car (scheme::%closure-env get-x)) '((x y) 10 2)))
+
+      (let ((copy (scheme::%closure (scheme::%closure-env get-x)
+                                    (scheme::%closure-code get-x)
+                                    ())))
+        (check (= (copy) 10))
+        (set-x! 20)
+        (check (= (get-x) 20))
+        (check (= (copy) 10)))))
+
+  (let ((f (lambda (a b . c) (lambda () (list a b c)))))
+    (check (equal? ((f 1 2 3 4)) '(1 2 (3 4))))
+    (check (equal? ((f 1 2)) '(1 2 ())))
+    (check (equal? (car (scheme::%closure-env (f 1 2 3))) '((a b . c) 1 2 3)))
+    (check (runtime-error? ((f 1)))))
+
+  (let ((f (lambda (a b c d e f g . h)
+             (lambda (op)
+               (case op
+                 ((:get) (list a b c d e f g h))
+                 ((:set) (set! d 'dd) (set! g 'gg)))))))
+    (let ((g (f 1 2 3 4 5 6 7 8 9)))
+      (check (equal? (g :get) '(1 2 3 4 5 6 7 (8 9))))
+      (g :set)
+      (check (equal? (g :get) '(1 2 3 dd 5 6 gg (8 9))))
+      (check (equal? (car (scheme::%closure-env g)) '((a b c d e f g . h) 1 2 3 dd 5 6 gg 8 9)))
+      (let ((copy (scheme::%closure (scheme::%closure-env g) (scheme::%closure-code g) ())))
+        (check (equal? (copy :get) '(1 2 3 dd 5 6 gg (8 9))))))
+    (check (equal? ((f 1 2 3 4 5 6 7) :get) '(1 2 3 4 5 6 7 ())))
+    (check (runtime-error? ((f 1 2 3 4 5) :get))))
+
+  (let ((f (lambda args (lambda () args))))
+    (check (equal? ((f)) ()))
+    (check (equal? ((f 1 2)) '(1 2)))
+    (check (equal? (car (scheme::%closure-env (f 1 2))) '(args 1 2)))))
+
+(define-test stack-frame-locals
+  (let ((x 1))
+    (let ((f (lambda (y) (set! x (+ x y)) (list x y))))
+      (check (equal? (f 2) '(3 2)))
+      (check (= x 3))))
+
+  (check (equal? (map (lambda (a) (* a 2)) '(1 2 3)) '(2 4 6)))
+  (check (equal? ((lambda (a . r) (set! a (list a)) (cons a r)) 1 2 3) '((1) 2 3)))
+  (check (runtime-error? ((lambda (a b) b) 1)))
+  (check (runtime-error? ((lambda (a b) (set! b 2) b) 1)))
+  (check (equal? ((lambda (a b) a) 1) 1))
+
+  (letrec ((count-down (lambda (n acc)
+                         (if (= n 0)
+                             acc
+                             (count-down (- n 1) (+ acc 1))))))
+    (check (= (count-down 10000 0) 10000))))
@@ -35,3 +35,38 @@
   (dynamic-let ((scheme::*environment-vars* '(("var" . "non-numeric"))))
     (check (not (environment-variable/number "VAR")))))
 
+
+(define (run-vcsh . args)
+  "Run another copy of this program with the command line arguments
+   <args>, returning its exit status."
+  (system (format #f "~a~a < /dev/null > /dev/null 2>&1"
+                  *program-launch-name*
+                  (apply string-append (map #L(string-append " " _) args)))))
+
+(define-test boot-image
+  (let ((image (temporary-file-name "img"))
+        (script (temporary-file-name "scm"))
+        (output (temporary-file-name "out")))
+    (with-port p (open-file script :mode :write)
+      (format p "(define h (make-hash))~%")
+      (format p "(dolist (k '(a b c)) (hash-set! h k (symbol-name k)))~%")
+      (format p "(gc)~%")
+      (format p "(with-port p (open-file ~s :mode :write)~%" output)
+      (format p "  (write (list (map #L(* _ _) (iseq 0 4))~%")
+      (format p "               (hash-ref h 'b)~%")
+      (format p "               (eq? (intern! \"car\" \"scheme\") 'car)~%")
+      (format p "               (apply + '(1 2 3))) p))~%"))
+
+    (check (= 0 (run-vcsh (format #f "-Xdump-boot-image=~a" image))))
+    (check (= 0 (run-vcsh (format #f "-Xboot-image=~a" image)
+                          "--no-repl"
+                          (format #f "--load-file=~a" script))))
+    (check (equal? '((0 1 4 9) "b" #t 6)
+                   (with-port p (open-file output) (read p))))
+
+    (check (not (= 0 (run-vcsh (format #f "-Xboot-image=~a" script)
+                               "--no-repl"))))
+
+    (delete-file image)
+    (delete-file script)
+    (delete-file output)))
@@ -187,14 +187,14 @@
   "Display the specified environment <env> to standard output."
   (dformat "; Environment:\n")
   (doiterate ((count frame-no 0)
-              (list frame env))
+              (list frame (%environment-frames env)))
     (dump-frame frame frame-no)))
 
 (defmacro (watch-locals)
   "Establish a watch on the topmost environment frame. The frame
    will be displayed to standard output at each execution of the
    watch."
-  `(dump-frame (car (the-environment)) :locals))
+  `(dump-frame (car (%environment-frames (the-environment))) :locals))
 
 (defmacro (watch-environment)
   "Establish a watch on the entire environment. The environment
@@ -385,6 +385,17 @@
                (in-trace-level
                 (recur (cadr actuals))
                 (close)))
+              ((eq? :bytecode opname)
+               (emit "(~s" opname)
+               (in-trace-level
+                (dolist (insn (compiler::bytecode-instructions (car actuals)))
+                  (dbind (pc op . operands) insn
+                    (emit "~a: ~s" pc op)
+                    (dolist (operand operands)
+                      (if (compiler::fast-op? operand)
+                          (in-trace-level (recur operand))
+                          (dformat " ~s" operand)))))
+                (close)))
               ((memq opname '(:literal :local-ref :local-set! :global-ref :global-set!
                               :local-ref-by-index :local-set-by-index :local-ref-restarg))
                (emit "~s" (cons opname actuals)))
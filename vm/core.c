@@ -201,10 +201,110 @@ lref_t lisubr_table()
      return interp.subr_table;
 }
 
+/***** environments *****/
+
+/* Closure environments are presented to Scheme code (and written to
+ * FASL files) as lists of (formals . actuals) frames, innermost frame
+ * first. These two functions convert between that representation and
+ * the environment objects used by the evaluator. */
+
+static lref_t environment_frame_list(lref_t env)
+{
+     if (NULLP(env))
+          return NIL;
+
+     lref_t actuals = NIL;
+     lref_t tail = NIL;
+     lref_t formals = ENVIRONMENT_FORMALS(env);
+     size_t ii = 0;
+
+     for (; CONSP(formals); formals = CDR(formals), ii++)
+     {
+          lref_t val = ENVIRONMENT_SLOT(env, ii);
+
+          if (UNBOUND_MARKER_P(val))
+               break;
+
+          lref_t cell = lcons(val, NIL);
+
+          if (NULLP(actuals))
+               actuals = cell;
+          else
+               SET_CDR(tail, cell);
+
+          tail = cell;
+     }
+
+     if (!NULLP(formals) && !CONSP(formals))
+     {
+          if (NULLP(actuals))
+               actuals = ENVIRONMENT_SLOT(env, ii);
+          else
+               SET_CDR(tail, ENVIRONMENT_SLOT(env, ii));
+     }
+
+     return lcons(lcons(ENVIRONMENT_FORMALS(env), actuals),
+                  environment_frame_list(ENVIRONMENT_PARENT(env)));
+}
+
+static lref_t environment_from_frame_list(lref_t frames)
+{
+     if (NULLP(frames))
+          return NIL;
+
+     if (!CONSP(frames) || !CONSP(CAR(frames)))
+          vmerror_wrong_type(frames);
+
+     lref_t parent = environment_from_frame_list(CDR(frames));
+
+     lref_t formals = CAR(CAR(frames));
+     lref_t actuals = CDR(CAR(frames));
+
+     if (SYMBOLP(formals))
+     {
+          formals = lcons(formals, NIL);
+          actuals = lcons(actuals, NIL);
+     }
+
+     size_t dim = 0;
+     lref_t rest = formals;
+
+     for (; CONSP(rest); rest = CDR(rest))
+          dim++;
+
+     lref_t env = new_environment(parent, formals, NULLP(rest) ? dim : dim + 1, 0, NULL);
+
+     size_t ii = 0;
+     for (; CONSP(formals) && CONSP(actuals); formals = CDR(formals), ii++)
+     {
+          SET_ENVIRONMENT_SLOT(env, ii, CAR(actuals));
+          actuals = CDR(actuals);
+     }
+
+     if (!NULLP(rest))
+          SET_ENVIRONMENT_SLOT(env, dim, actuals);
+
+     return env;
+}
+
+lref_t lenvironment_frames(lref_t env)
+{
+     if (!(NULLP(env) || ENVIRONMENTP(env)))
+          vmerror_wrong_type_n(1, env);
+
+     return environment_frame_list(env);
+}
+
+
 /***** closures *****/
 
 lref_t lclosurecons(lref_t env, lref_t code, lref_t property_list)
 {
+     if (CONSP(env))
+          env = environment_from_frame_list(env);
+     else if (!(NULLP(env) || ENVIRONMENTP(env)))
+          vmerror_wrong_type_n(1, env);
+
      lref_t z = new_cell(TC_CLOSURE);
 
      if (!(CONSP(code) || NULLP(code)))
@@ -224,6 +324,8 @@ lref_t lset_closure_code(lref_t exp, lref_t code)
 
      SET_CLOSURE_CODE(exp, code);
 
+     flush_call_site_caches();
+
      return exp;
 }
 
@@ -240,6 +342,11 @@ lref_t lset_closure_env(lref_t exp, lref_t env)
      if (!CLOSUREP(exp))
           vmerror_wrong_type(exp);
 
+     if (CONSP(env))
+          env = environment_from_frame_list(env);
+     else if (!(NULLP(env) || ENVIRONMENTP(env)))
+          vmerror_wrong_type_n(2, env);
+
      SET_CLOSURE_ENV(exp, env);
 
      return exp;
@@ -250,7 +357,7 @@ lref_t lclosure_env(lref_t exp)
      if (!CLOSUREP(exp))
           return boolcons(false);
      else
-          return (CLOSURE_ENV(exp));
+          return environment_frame_list(CLOSURE_ENV(exp));
 }
 
 lref_t lset_property_list(lref_t exp, lref_t property_list)
@@ -355,6 +462,9 @@ lref_t lvalues2list(lref_t obj)
 
 lref_t fast_op(int opcode, lref_t arg1, lref_t arg2, lref_t next)
 {
+     if (opcode == FOP_BYTECODE)
+          validate_bytecode(arg1, arg2);
+
      lref_t fop = new_cell(TC_FAST_OP);
 
      fop->header.opcode = opcode;
@@ -372,14 +482,33 @@ lref_t lfast_op(lref_t opcode, lref_t arg1, lref_t arg2, lref_t next)
      if (!FAST_OP_P(next) && !NULLP(next))
           vmerror_wrong_type_n(2, next);
 
+     /* Bytecode is validated as it's built, so the fast-op gets a code
+      * vector of its own that the caller can't change afterwards. */
+     if ((FIXNM(opcode) == FOP_BYTECODE) && VECTORP(arg1))
+          arg1 = lvector_copy(arg1);
+
      return fast_op(FIXNM(opcode), arg1, arg2, next);
 }
 
+/* True if <fastop> is a body the FASL reader has yet to read. */
+lref_t lfast_op_deferredp(lref_t fastop)
+{
+     if (!FAST_OP_P(fastop))
+          vmerror_wrong_type_n(1, fastop);
+
+     return boolcons(fastop->header.opcode == FOP_DEFERRED);
+}
+
+/* A fast op deferred by the FASL reader is read before it's looked into,
+ * so that it never shows. */
 lref_t lfast_op_opcode(lref_t fastop)
 {
      if (!FAST_OP_P(fastop))
           vmerror_wrong_type_n(1, fastop);
 
+     if (fastop->header.opcode == FOP_DEFERRED)
+          fasl_load_deferred(fastop);
+
      return fixcons(fastop->header.opcode);
 }
 
@@ -388,6 +517,16 @@ lref_t lfast_op_args(lref_t fast_op)
      if (!FAST_OP_P(fast_op))
           vmerror_wrong_type_n(1, fast_op);
 
+     if (fast_op->header.opcode == FOP_DEFERRED)
+          fasl_load_deferred(fast_op);
+
+     /* Bytecode code vectors are handed out as copies, to keep them as
+      * they were validated. */
+     if (fast_op->header.opcode == FOP_BYTECODE)
+          return lcons(lvector_copy(fast_op->as.fast_op.arg1),
+                       lcons(fast_op->as.fast_op.arg2,
+                             NIL));
+
      return lcons(fast_op->as.fast_op.arg1,
                   lcons(fast_op->as.fast_op.arg2,
                         NIL));
@@ -398,6 +537,9 @@ lref_t lfast_op_next(lref_t fast_op)
      if (!FAST_OP_P(fast_op))
           vmerror_wrong_type_n(1, fast_op);
 
+     if (fast_op->header.opcode == FOP_DEFERRED)
+          fasl_load_deferred(fast_op);
+
      return fast_op->as.fast_op.next;
 }
 
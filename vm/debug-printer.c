@@ -361,6 +361,14 @@ lref_t debug_print_object(lref_t obj, lref_t port, bool machine_readable)
                scwritef("~u", port, (lref_t) obj);
           break;
 
+     case TC_ENVIRONMENT:
+          scwritef("~u ~s", port, (lref_t) obj, ENVIRONMENT_FORMALS(obj));
+          break;
+
+     case TC_ENVIRONMENT_SLOTS:
+          scwritef("~u", port, (lref_t) obj);
+          break;
+
      case TC_VALUES_TUPLE:
           scwritef("~u ~s", port, (lref_t) obj, obj->as.values_tuple.values);
           break;
@@ -739,6 +747,8 @@ struct port_class_t debug_port_class = {
      NULL,                   // close
      NULL,                   // gc_free
      NULL,                   // length
+     NULL,                   // seek
+     NULL,                   // read_in_place
 };
 
 
@@ -751,20 +761,22 @@ lref_t ldebug_write(lref_t form)
 
 lref_t lopen_debug_port()
 {
-     return &interp.debugger_output;
+     return interp.debugger_output;
 }
 
 void init_debugger_output()
 {
-     interp.debugger_output.header.type = TC_PORT;
+     interp.debugger_output = gc_allocate_static_cell();
+
+     interp.debugger_output->header.type = TC_PORT;
 
-     initialize_port(&interp.debugger_output,
+     initialize_port(interp.debugger_output,
                      &debug_port_class,
                      NIL,
                      PORT_OUTPUT | PORT_TEXT,
                      NIL,
                      NULL);
 
-     SET_PORT_TEXT_INFO(&interp.debugger_output, allocate_text_info());
+     SET_PORT_TEXT_INFO(interp.debugger_output, allocate_text_info());
 }
 
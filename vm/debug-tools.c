@@ -34,6 +34,9 @@ lref_t ldump_heap_state(lref_t port)
 
           for (obj = org, ii = 0; obj < end; obj++, ii++)
           {
+               if (GC_BITMAP_CELL_P(obj))
+                    continue;
+
                if (ii % 256 == 0)
                {
                     lnewline(port);
@@ -110,6 +113,9 @@ lref_t lheap_cell_count_by_typecode()
 
           for (obj = org; obj < end; ++obj)
           {
+               if (GC_BITMAP_CELL_P(obj))
+                    continue;
+
                type = TYPE(obj);
 
                internal_type_counts[type]++;
@@ -125,10 +125,9 @@ void vmerror_io_error(const _TCHAR *desc, lref_t info)
 
 void vmerror_fast_read(const _TCHAR * message, lref_t reader, lref_t details /* = NIL */)
 {
-     /*  REVISIT: vmerror_fast_read don't always show valid port locations */
      assert(FASL_READER_P(reader));
 
-     size_t location = PORT_BYTES_READ(reader);
+     size_t location = fasl_reader_position(reader);
 
      vmtrap(TRAP_FAST_READ_ERROR,
             (enum vmt_options_t)(VMT_MANDATORY_TRAP | VMT_HANDLER_MUST_ESCAPE),
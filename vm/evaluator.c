@@ -11,6 +11,7 @@
  * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
  */
 
+#include <memory.h>
 #include <stdio.h>
 
 #include "scan-private.h"
@@ -169,7 +170,7 @@ lref_t vmtrap(enum trap_type_t trap, enum vmt_options_t options, size_t argc, ..
 
 /***** The evaluator *****/
 
-static lref_t execute_fast_op(lref_t form, lref_t env);
+static lref_t execute_fast_op(lref_t form, lref_t env, lref_t *locals);
 
 static lref_t arg_list_from_buffer(size_t argc, lref_t argv[])
 {
@@ -181,57 +182,159 @@ static lref_t arg_list_from_buffer(size_t argc, lref_t argv[])
      return result;
 }
 
-static lref_t extend_env(lref_t actuals, lref_t formals, lref_t env)
+/* bind_actuals
+ *
+ * Bind the actual arguments in <argv> to the <dim> slots in
+ * <slots>. If <rest> is true, the last slot is a rest argument, and
+ * receives the list <rest_actuals>. Missing fixed arguments are bound
+ * to UNBOUND_MARKER, and signal an error only if they're
+ * referenced. Extra arguments with no rest argument to hold them are
+ * ignored.
+ */
+EVAL_INLINE void bind_actuals(lref_t *slots, size_t dim,
+                              bool rest, lref_t rest_actuals,
+                              size_t argc, lref_t argv[])
+{
+     size_t ii;
+     for (ii = 0; (ii < dim) && (ii < argc); ii++)
+          slots[ii] = argv[ii];
+
+     for (; ii < dim; ii++)
+          slots[ii] = UNBOUND_MARKER;
+
+     if (rest)
+          slots[dim - 1] = rest_actuals;
+}
+
+EVAL_INLINE size_t formals_dim(lref_t formals, bool *rest)
+{
+     size_t dim = 0;
+
+     for (; CONSP(formals); formals = CDR(formals))
+          dim++;
+
+     *rest = !NULLP(formals);
+
+     return *rest ? dim + 1 : dim;
+}
+
+EVAL_INLINE lref_t rest_arg_list(size_t dim, size_t argc, lref_t argv[])
+{
+     size_t fixed = dim - 1;
+
+     return (argc > fixed) ? arg_list_from_buffer(argc - fixed, argv + fixed) : NIL;
+}
+
+/* new_environment
+ *
+ * Allocate an environment frame of <dim> slots. The first <argc> slots
+ * take their values from <argv>, and any others hold UNBOUND_MARKER.
+ * The slot cells are allocated ahead of the frame, last first, so
+ * each is complete before anything links to it.
+ */
+lref_t new_environment(lref_t parent, lref_t formals, size_t dim,
+                       size_t argc, lref_t argv[])
 {
-     if (SYMBOLP(formals))
-          return lcons(lcons(lcons(formals, NIL), lcons(actuals, NIL)), env);
+     if (dim > ENVIRONMENT_MAX_DIM)
+          vmerror_arg_out_of_range(formals, _T("too many formals"));
+
+     lref_t slots = NIL;
+
+     for (size_t cell_index = ENVIRONMENT_SLOT_CELLS(dim); cell_index > 0; cell_index--)
+     {
+          lref_t cell = new_cell(TC_ENVIRONMENT_SLOTS);
+
+          for (size_t ii = 0; ii < 3; ii++)
+          {
+               size_t slot_index = 2 * (cell_index - 1) + ii;
+               lref_t val = NIL;
+
+               if ((ii == 2) && !NULLP(slots))
+                    val = slots;
+               else if (slot_index < dim)
+                    val = (slot_index < argc) ? argv[slot_index] : UNBOUND_MARKER;
+
+               cell->as.environment_slots.slot[ii] = val;
+          }
+
+          slots = cell;
+     }
+
+     lref_t frame = new_cell(TC_ENVIRONMENT);
+
+     frame->header.env_dim = (unsigned int)dim;
+     frame->as.environment.parent = parent;
+     frame->as.environment.formals = formals;
+
+     if (dim == 1)
+          frame->as.environment.slot = (argc > 0) ? argv[0] : UNBOUND_MARKER;
      else
-          return lcons(lcons(formals, actuals), env);
+          frame->as.environment.slots = slots;
+
+     return frame;
 }
 
-lref_t binding_cell_by_index(fixnum_t frame_index, fixnum_t var_index, lref_t env)
+/* extend_env
+ *
+ * Build a new heap environment frame binding <formals> to the actual
+ * arguments in <argv>. The _shaped variant takes the <dim> and <rest>
+ * computed by formals_dim, for callers that have them cached.
+ */
+static lref_t extend_env_shaped(size_t argc, lref_t argv[],
+                               lref_t formals, size_t dim, bool rest,
+                               lref_t env)
 {
-     lref_t frame = env;
+     lref_t rest_list = rest ? rest_arg_list(dim, argc, argv) : NIL;
 
-     for (; frame_index; frame_index--)
-          frame = CDR(frame);
+     lref_t frame = new_environment(env, formals, dim, argc, argv);
+
+     if (rest)
+          SET_ENVIRONMENT_SLOT(frame, dim - 1, rest_list);
+
+     return frame;
+}
+
+static lref_t extend_env(size_t argc, lref_t argv[], lref_t formals, lref_t env)
+{
+     bool rest;
+     size_t dim = formals_dim(formals, &rest);
+
+     return extend_env_shaped(argc, argv, formals, dim, rest, env);
+}
 
-     lref_t actuals = CDR(CAR(frame));
-     for(; !NULLP(actuals) && var_index; var_index--)
-          actuals = CDR(actuals);
+EVAL_INLINE lref_t env_frame_by_index(fixnum_t frame_index, lref_t env)
+{
+     for (; frame_index; frame_index--)
+          env = ENVIRONMENT_PARENT(env);
 
-     return actuals;
+     return env;
 }
 
 lref_t lenvlookup_by_index(fixnum_t frame_index, fixnum_t var_index, lref_t env)
 {
-     lref_t binding_cell = binding_cell_by_index(frame_index, var_index, env);
+     lref_t val = ENVIRONMENT_SLOT(env_frame_by_index(frame_index, env), var_index);
 
-     if (NULLP(binding_cell)) {
+     if (UNBOUND_MARKER_P(val)) {
           vmerror_arg_out_of_range(NIL, _T("too few arguments"));
      }
 
-     return CAR(binding_cell);
+     return val;
 }
 
 void lenvlookup_set_by_index(fixnum_t frame_index, fixnum_t var_index, lref_t env, lref_t val)
 {
-     lref_t binding_cell = binding_cell_by_index(frame_index, var_index, env);
+     lref_t frame = env_frame_by_index(frame_index, env);
 
-     if (NULLP(binding_cell)) {
+     if (UNBOUND_MARKER_P(ENVIRONMENT_SLOT(frame, var_index))) {
           vmerror_arg_out_of_range(NIL, _T("too few arguments (no binding cell)"));
      }
 
-     SET_CAR(binding_cell, val);
+     SET_ENVIRONMENT_SLOT(frame, var_index, val);
 }
 
 lref_t lenvlookup_restarg_by_index(fixnum_t frame_index, fixnum_t var_index, lref_t env)
 {
-     if (var_index == 0) {
-          return lenvlookup_by_index(frame_index, 0, env);
-     }
-
-     return binding_cell_by_index(frame_index, var_index, env);
+     return ENVIRONMENT_SLOT(env_frame_by_index(frame_index, env), var_index);
 }
 
 /* Frame stack
@@ -250,6 +353,38 @@ EVAL_INLINE void *fstack_alloca(size_t size)
      return (void *)(CURRENT_TIB()->fsp);
 }
 
+/* fstack_bind_locals
+ *
+ * Bind <formals> to the actual arguments in <argv>, with the bindings
+ * themselves allocated on the frame stack. This is used for closures
+ * the compiler has proven never capture their own frame, and avoids
+ * any heap allocation for those calls other than a rest list. As with
+ * extend_env, the _shaped variant takes the shape of the formals.
+ */
+EVAL_INLINE lref_t *fstack_bind_shaped_locals(size_t argc, lref_t argv[], size_t dim, bool rest)
+{
+     lref_t rest_list = rest ? rest_arg_list(dim, argc, argv) : NIL;
+
+     if (CURRENT_TIB()->fsp - dim < CURRENT_TIB()->frame_stack)
+          vmerror_stack_overflow((uint8_t *)CURRENT_TIB()->fsp);
+
+     CURRENT_TIB()->fsp = CURRENT_TIB()->fsp - dim;
+
+     lref_t *locals = CURRENT_TIB()->fsp;
+
+     bind_actuals(locals, dim, rest, rest_list, argc, argv);
+
+     return locals;
+}
+
+EVAL_INLINE lref_t *fstack_bind_locals(size_t argc, lref_t argv[], lref_t formals)
+{
+     bool rest;
+     size_t dim = formals_dim(formals, &rest);
+
+     return fstack_bind_shaped_locals(argc, argv, dim, rest);
+}
+
 EVAL_INLINE lref_t *fstack_enter_frame(enum frame_type_t ft, size_t slots)
 {
      lref_t *prev_frame = CURRENT_TIB()->frame;
@@ -318,17 +453,16 @@ EVAL_INLINE enum frame_type_t fstack_frame_type(lref_t *frame)
 
 #define _ARGV(index) ((index >= argc) ? NIL : argv[index])
 
-EVAL_INLINE lref_t subr_apply(lref_t function, size_t argc, lref_t argv[], lref_t * env, lref_t * retval)
+EVAL_INLINE void subr_apply_type(lref_t function, enum subr_arity_t type,
+                                 size_t argc, lref_t argv[], lref_t * retval)
 {
      lref_t arg1;
      lref_t args;
      size_t ii;
 
-     UNREFERENCED(env);
-
      fstack_enter_subr_frame(function);
 
-     switch (SUBR_TYPE(function))
+     switch (type)
      {
      case SUBR_0:
           *retval = (SUBR_F0(function) ());
@@ -371,13 +505,20 @@ EVAL_INLINE lref_t subr_apply(lref_t function, size_t argc, lref_t argv[], lref_
      }
 
      fstack_leave_frame();
+}
+
+EVAL_INLINE lref_t subr_apply(lref_t function, size_t argc, lref_t argv[], lref_t * env, lref_t * retval)
+{
+     UNREFERENCED(env);
+
+     subr_apply_type(function, SUBR_TYPE(function), argc, argv, retval);
 
      return NIL;
 }
 
 EVAL_INLINE lref_t apply(lref_t function,
                          size_t argc, lref_t argv[],
-                         lref_t * env, lref_t * retval)
+                         lref_t * env, lref_t ** locals, lref_t * retval)
 {
      if (SUBRP(function))
           return subr_apply(function, argc, argv, env, retval);
@@ -385,12 +526,25 @@ EVAL_INLINE lref_t apply(lref_t function,
      if (CLOSUREP(function))
      {
           lref_t c_code = CLOSURE_CODE(function);
+          lref_t body = CDR(c_code);
+
+          if (FAST_OP_P(body) && (body->header.opcode == FOP_DEFERRED))
+               fasl_load_deferred(body);
+
+          if (FAST_OP_P(body) && (body->header.opcode == FOP_STACK_FRAME))
+          {
+               *env = CLOSURE_ENV(function);
+               *locals = fstack_bind_locals(argc, argv, CAR(c_code));
+
+               return body->as.fast_op.arg1;  /*  tail call */
+          }
 
-          *env = extend_env(arg_list_from_buffer(argc, argv),
+          *env = extend_env(argc, argv,
                             CAR(c_code),
                             CLOSURE_ENV(function));
+          *locals = NULL;
 
-          return CDR(c_code);   /*  tail call */
+          return body;   /*  tail call */
      }
 
      vmerror_wrong_type(function);
@@ -398,6 +552,125 @@ EVAL_INLINE lref_t apply(lref_t function,
      return NIL;
 }
 
+/* Call site caches
+ *
+ * Each call site that applies the value of a global (FOP_APPLY_GLOBAL,
+ * or BC_CALL_GLOBAL and BC_TAIL_CALL_GLOBAL in bytecode) has an entry
+ * in a direct mapped table, indexed by the address of the site. It
+ * holds the function the site last applied, and what apply would
+ * otherwise work out from that function on every call: the arity of a
+ * subr, or the body and the shape of the formals of a closure. Since
+ * none of that depends on the call site, an entry is valid for as long
+ * as its callee is the function being applied, which is checked
+ * against the value just read from the global. Redefining the global
+ * takes effect at once, and sites that share an entry only cost each
+ * other misses.
+ *
+ * The collector doesn't trace the table, so it's flushed before each
+ * sweep, which could free a cached callee and reuse its cell for a
+ * new function. It's also flushed when closure code is changed.
+ */
+void flush_call_site_caches()
+{
+     memset(interp.call_site_caches, 0, sizeof(interp.call_site_caches));
+}
+
+static void call_site_cache_fill(struct call_site_cache_t *cache, lref_t fn)
+{
+     /*  Reading a deferred body can collect, which flushes the cache,
+      *  so it's read before the entry is filled. */
+     if (CLOSUREP(fn)
+         && FAST_OP_P(CDR(CLOSURE_CODE(fn)))
+         && (CDR(CLOSURE_CODE(fn))->header.opcode == FOP_DEFERRED))
+          fasl_load_deferred(CDR(CLOSURE_CODE(fn)));
+
+     cache->callee = fn;
+     cache->kind = CALL_SITE_UNCACHED;
+
+     if (SUBRP(fn))
+     {
+          cache->kind = CALL_SITE_SUBR;
+          cache->subr_type = SUBR_TYPE(fn);
+     }
+     else if (CLOSUREP(fn))
+     {
+          lref_t c_code = CLOSURE_CODE(fn);
+          lref_t body = CDR(c_code);
+
+          cache->formals = CAR(c_code);
+          cache->dim = formals_dim(cache->formals, &cache->rest);
+
+          if (FAST_OP_P(body) && (body->header.opcode == FOP_STACK_FRAME))
+          {
+               cache->kind = CALL_SITE_STACK_CLOSURE;
+               cache->body = body->as.fast_op.arg1;
+          }
+          else
+          {
+               cache->kind = CALL_SITE_CLOSURE;
+               cache->body = body;
+          }
+     }
+}
+
+/* Find the cache entry for the call site at <site>, which is about to
+ * apply <fn>, the value of the global <sym>, filling it if needed. */
+EVAL_INLINE struct call_site_cache_t *call_site_cache(const void *site, lref_t sym, lref_t fn)
+{
+     /* Sites are at least pointer aligned, and fast op sites cell aligned. */
+     uintptr_t addr = (uintptr_t) site / sizeof(lref_t);
+
+     struct call_site_cache_t *cache =
+          &interp.call_site_caches[(addr ^ (addr >> 2)) & (CALL_SITE_CACHE_SIZE - 1)];
+
+     if (cache->callee != fn)
+     {
+          if (UNBOUND_MARKER_P(fn))
+               vmerror_unbound(sym);
+
+          call_site_cache_fill(cache, fn);
+     }
+
+     return cache;
+}
+
+/* Apply <fn> in the same way as apply, using the <cache> entry found
+ * for it. Evaluating the arguments since then may have flushed the
+ * entry or handed it to another call site. Binding the arguments can
+ * allocate, and flush it again, so the body is read beforehand. */
+EVAL_INLINE lref_t apply_cached(struct call_site_cache_t *cache, lref_t fn,
+                                size_t argc, lref_t argv[],
+                                lref_t * env, lref_t ** locals, lref_t * retval)
+{
+     if (cache->callee != fn)
+          call_site_cache_fill(cache, fn);
+
+     lref_t body = cache->body;
+
+     switch (cache->kind)
+     {
+     case CALL_SITE_SUBR:
+          subr_apply_type(fn, cache->subr_type, argc, argv, retval);
+          return NIL;
+
+     case CALL_SITE_STACK_CLOSURE:
+          *env = CLOSURE_ENV(fn);
+          *locals = fstack_bind_shaped_locals(argc, argv, cache->dim, cache->rest);
+          return body;  /*  tail call */
+
+     case CALL_SITE_CLOSURE:
+          *env = extend_env_shaped(argc, argv, cache->formals, cache->dim, cache->rest,
+                                   CLOSURE_ENV(fn));
+          *locals = NULL;
+          return body;  /*  tail call */
+
+     case CALL_SITE_UNCACHED:
+          break;
+     }
+
+     return apply(fn, argc, argv, env, locals, retval);
+}
+
 static lref_t *find_matching_escape(lref_t *start_frame, lref_t tag)
 {
      if (CURRENT_TIB()->escape_frame != NULL)
@@ -456,12 +729,576 @@ void unwind_stack_for_throw()
      }
 }
 
-static lref_t execute_fast_op(lref_t fop, lref_t env)
+/***** The bytecode interpreter *****/
+
+#if defined(__GNUC__)
+#  define BC_THREADED_DISPATCH
+#endif
+
+#ifdef BC_THREADED_DISPATCH
+#  define BC_OP(op) L_##op:
+#  define BC_NEXT() goto *bc_dispatch[FIXNM(*pc++)]
+#else
+#  define BC_OP(op) case op:
+#  define BC_NEXT() continue
+#endif
+
+/* Non-tail calls from bytecode. Primitives are applied directly,
+ * since they never have a fast-op body to continue into. */
+EVAL_INLINE lref_t bytecode_apply(lref_t fn, size_t argc, lref_t argv[])
+{
+     lref_t retval = NIL;
+
+     if (!SUBRP(fn))
+          return apply1(fn, argc, argv);
+
+     subr_apply(fn, argc, argv, NULL, &retval);
+
+     return retval;
+}
+
+/* Non-tail calls of globals from bytecode, using the call site cache
+ * entry just found for <fn>. */
+EVAL_INLINE lref_t bytecode_apply_cached(struct call_site_cache_t *cache, lref_t fn,
+                                         size_t argc, lref_t argv[])
+{
+     lref_t retval = NIL;
+     lref_t env = NIL;
+     lref_t *locals = NULL;
+     lref_t *fsp = CURRENT_TIB()->fsp;
+
+     lref_t next_form = apply_cached(cache, fn, argc, argv, &env, &locals, &retval);
+
+     if (!NULLP(next_form))
+          retval = execute_fast_op(next_form, env, locals);
+
+     CURRENT_TIB()->fsp = fsp;
+
+     return retval;
+}
+
+/* The number of inline operands following each bytecode opcode. */
+static const uint8_t bytecode_operand_count[BC_LAST + 1] = {
+     [BC_LITERAL]           = 1,
+     [BC_GLOBAL_REF]        = 1,
+     [BC_GLOBAL_SET]        = 1,
+     [BC_GLOBAL_DEF]        = 2,
+     [BC_LOCAL_REF]         = 2,
+     [BC_LOCAL_REF_RESTARG] = 2,
+     [BC_LOCAL_SET]         = 2,
+     [BC_STACK_LOCAL_REF]   = 1,
+     [BC_STACK_LOCAL_SET]   = 1,
+     [BC_PUSH]              = 0,
+     [BC_CALL_GLOBAL]       = 2,
+     [BC_CALL]              = 1,
+     [BC_TAIL_CALL_GLOBAL]  = 2,
+     [BC_TAIL_CALL]         = 1,
+     [BC_JUMP]              = 1,
+     [BC_JUMP_IF_FALSE]     = 1,
+     [BC_CLOSURE]           = 2,
+     [BC_EQP]               = 0,
+     [BC_CAR]               = 0,
+     [BC_CDR]               = 0,
+     [BC_NOT]               = 0,
+     [BC_NULLP]             = 0,
+     [BC_GET_ENV]           = 0,
+     [BC_FAST_OP]           = 1,
+     [BC_RETURN]            = 0,
+};
+
+enum
+{
+     /* Operand stack heights of offsets not yet reached, and of
+      * offsets that hold operands rather than opcodes. */
+     BC_HEIGHT_UNREACHED = -1,
+     BC_HEIGHT_OPERAND = -2
+};
+
+static bool bytecode_count_p(lref_t x)
+{
+     return FIXNUMP(x) && (FIXNM(x) >= 0);
+}
+
+/* Check the opcode at <pc> and the types of its operands, returning
+ * NULL if they're valid and the reason they aren't otherwise. */
+static const _TCHAR *check_bytecode_insn(lref_t *code, size_t len, size_t pc)
+{
+     if (!FIXNUMP(code[pc]) || (FIXNM(code[pc]) < 0) || (FIXNM(code[pc]) > BC_LAST))
+          return _T("bad bytecode opcode");
+
+     fixnum_t op = FIXNM(code[pc]);
+     lref_t *args = code + pc + 1;
+
+     if (pc + bytecode_operand_count[op] >= len)
+          return _T("missing bytecode operands");
+
+     switch (op)
+     {
+     case BC_GLOBAL_REF:
+     case BC_GLOBAL_SET:
+     case BC_GLOBAL_DEF:
+          if (!SYMBOLP(args[0]))
+               return _T("bad bytecode symbol");
+          break;
+
+     case BC_CALL_GLOBAL:
+     case BC_TAIL_CALL_GLOBAL:
+          if (!SYMBOLP(args[0]))
+               return _T("bad bytecode symbol");
+          if (!bytecode_count_p(args[1]))
+               return _T("bad bytecode argument count");
+          break;
+
+     case BC_LOCAL_REF:
+     case BC_LOCAL_REF_RESTARG:
+     case BC_LOCAL_SET:
+          if (!bytecode_count_p(args[0]) || !bytecode_count_p(args[1]))
+               return _T("bad bytecode local index");
+          break;
+
+     case BC_STACK_LOCAL_REF:
+     case BC_STACK_LOCAL_SET:
+          if (!bytecode_count_p(args[0]))
+               return _T("bad bytecode local index");
+          break;
+
+     case BC_CALL:
+     case BC_TAIL_CALL:
+          if (!bytecode_count_p(args[0]))
+               return _T("bad bytecode argument count");
+          break;
+
+     case BC_JUMP:
+     case BC_JUMP_IF_FALSE:
+          if (!bytecode_count_p(args[0]) || ((size_t)FIXNM(args[0]) >= len))
+               return _T("bad bytecode jump target");
+          break;
+
+     case BC_CLOSURE:
+          if (!FAST_OP_P(args[1]))
+               return _T("bad bytecode closure body");
+          break;
+
+     case BC_FAST_OP:
+          if (!FAST_OP_P(args[0]))
+               return _T("bad bytecode fast-op");
+          break;
+     }
+
+     return NULL;
+}
+
+/* Flow the operand stack height <height> from an instruction to the one
+ * at <next>, queueing it on <work> the first time it's reached. */
+static const _TCHAR *flow_bytecode_height(fixnum_t *heights, size_t len,
+                                          size_t *work, size_t *work_count,
+                                          size_t next, fixnum_t height)
+{
+     if (next >= len)
+          return _T("bytecode runs off the end of its code");
+
+     if (heights[next] == BC_HEIGHT_OPERAND)
+          return _T("bad bytecode jump target");
+
+     if (heights[next] == BC_HEIGHT_UNREACHED)
+     {
+          heights[next] = height;
+          work[(*work_count)++] = next;
+     }
+     else if (heights[next] != height)
+          return _T("inconsistent bytecode stack depth");
+
+     return NULL;
+}
+
+static const _TCHAR *check_bytecode(lref_t *code, size_t len, fixnum_t depth,
+                                    fixnum_t *heights, size_t *work)
+{
+     const _TCHAR *reason = NULL;
+     size_t work_count = 0;
+
+     for (size_t pc = 0; pc < len; )
+     {
+          if ((reason = check_bytecode_insn(code, len, pc)) != NULL)
+               return reason;
+
+          size_t operands = bytecode_operand_count[FIXNM(code[pc])];
+
+          heights[pc++] = BC_HEIGHT_UNREACHED;
+
+          for (; operands; operands--)
+               heights[pc++] = BC_HEIGHT_OPERAND;
+     }
+
+     if ((reason = flow_bytecode_height(heights, len, work, &work_count, 0, 0)) != NULL)
+          return reason;
+
+     while (work_count)
+     {
+          size_t pc = work[--work_count];
+          fixnum_t op = FIXNM(code[pc]);
+          fixnum_t height = heights[pc];
+          fixnum_t popped = 0;
+          size_t next = pc + 1 + bytecode_operand_count[op];
+
+          switch (op)
+          {
+          case BC_PUSH:
+               if (height + 1 > depth)
+                    return _T("bytecode operand stack overflow");
+               height++;
+               break;
+
+          case BC_EQP:
+               popped = 1;
+               break;
+
+          case BC_CALL_GLOBAL:
+          case BC_TAIL_CALL_GLOBAL:
+               popped = FIXNM(code[pc + 2]);
+               break;
+
+          case BC_CALL:
+          case BC_TAIL_CALL:
+               popped = FIXNM(code[pc + 1]) + 1;
+               break;
+          }
+
+          if (popped > height)
+               return _T("bytecode operand stack underflow");
+
+          height -= popped;
+
+          switch (op)
+          {
+          case BC_TAIL_CALL_GLOBAL:
+          case BC_TAIL_CALL:
+          case BC_RETURN:
+               continue;
+
+          case BC_JUMP:
+               next = (size_t)FIXNM(code[pc + 1]);
+               break;
+
+          case BC_JUMP_IF_FALSE:
+               reason = flow_bytecode_height(heights, len, work, &work_count,
+                                             (size_t)FIXNM(code[pc + 1]), height);
+               if (reason != NULL)
+                    return reason;
+               break;
+          }
+
+          if ((reason = flow_bytecode_height(heights, len, work, &work_count, next, height)) != NULL)
+               return reason;
+     }
+
+     return NULL;
+}
+
+/* validate_bytecode
+ *
+ * Check that the code vector <code> can be run by execute_bytecode with
+ * an operand stack of <depth> entries. Every opcode must be known and
+ * have its operands, jumps must land on instructions, control can't run
+ * off the end of the vector, and the operand stack height must stay
+ * within [0, <depth>] and agree wherever control flow joins.
+ * execute_bytecode relies on this, and checks none of it itself, so
+ * this is applied to every FOP_BYTECODE fast-op as it's built.
+ */
+void validate_bytecode(lref_t code, lref_t depth)
+{
+     if (!VECTORP(code))
+          vmerror_wrong_type(code);
+
+     if (!bytecode_count_p(depth))
+          vmerror_wrong_type(depth);
+
+     size_t len = code->as.vector.dim;
+     fixnum_t *heights = (fixnum_t *)gc_malloc((len + 1) * sizeof(fixnum_t));
+     size_t *work = (size_t *)gc_malloc((len + 1) * sizeof(size_t));
+
+     const _TCHAR *reason = check_bytecode(code->as.vector.data, len, FIXNM(depth), heights, work);
+
+     gc_free(heights);
+     gc_free(work);
+
+     if (reason != NULL)
+          vmerror_arg_out_of_range(code, reason);
+}
+
+lref_t lbytecode_operand_count(lref_t opcode)
+{
+     if (!FIXNUMP(opcode))
+          vmerror_wrong_type_n(1, opcode);
+
+     if ((FIXNM(opcode) < 0) || (FIXNM(opcode) > BC_LAST))
+          vmerror_arg_out_of_range(opcode, _T("[0,BC_LAST]"));
+
+     return fixcons(bytecode_operand_count[FIXNM(opcode)]);
+}
+
+/* execute_bytecode
+ *
+ * Run the linear bytecode attached to the FOP_BYTECODE fast-op
+ * <bc>. The code vector holds fixnum opcodes, each followed by its
+ * inline operands, with jump targets given as absolute offsets into
+ * the vector. Intermediate results are held in an accumulator and
+ * outgoing arguments are pushed onto an operand stack allocated on
+ * the frame stack, so argument evaluation doesn't need to recurse
+ * through execute_fast_op.
+ *
+ * Calls in tail position are not made here. Instead, the function
+ * and its arguments are returned in <fn>, <argc>, and <argv>, and the
+ * return value is true, which lets the caller apply the function in
+ * its own loop without growing the C stack. Tail calls of globals
+ * also return their call site cache entry in <cache>, which is NULL
+ * for other tail calls.
+ */
+static bool execute_bytecode(lref_t bc, lref_t env, lref_t *locals,
+                             lref_t *retval, lref_t *fn, struct call_site_cache_t **cache,
+                             size_t *argc, lref_t argv[])
+{
+     lref_t *code = bc->as.fast_op.arg1->as.vector.data;
+     size_t depth = (size_t)FIXNM(bc->as.fast_op.arg2);
+     lref_t *fsp = CURRENT_TIB()->fsp;
+
+     if (fsp - depth < CURRENT_TIB()->frame_stack)
+          vmerror_stack_overflow((uint8_t *)fsp);
+
+     lref_t *stack = fsp - depth;
+     lref_t *sp = stack;
+     lref_t *pc = code;
+     lref_t *target;
+     lref_t acc = *retval;
+     lref_t sym;
+     lref_t val;
+     size_t n;
+
+     CURRENT_TIB()->fsp = stack;
+     *cache = NULL;
+
+#ifdef BC_THREADED_DISPATCH
+     static const void *bc_dispatch[BC_LAST + 1] = {
+          [BC_LITERAL]           = &&L_BC_LITERAL,
+          [BC_GLOBAL_REF]        = &&L_BC_GLOBAL_REF,
+          [BC_GLOBAL_SET]        = &&L_BC_GLOBAL_SET,
+          [BC_GLOBAL_DEF]        = &&L_BC_GLOBAL_DEF,
+          [BC_LOCAL_REF]         = &&L_BC_LOCAL_REF,
+          [BC_LOCAL_REF_RESTARG] = &&L_BC_LOCAL_REF_RESTARG,
+          [BC_LOCAL_SET]         = &&L_BC_LOCAL_SET,
+          [BC_STACK_LOCAL_REF]   = &&L_BC_STACK_LOCAL_REF,
+          [BC_STACK_LOCAL_SET]   = &&L_BC_STACK_LOCAL_SET,
+          [BC_PUSH]              = &&L_BC_PUSH,
+          [BC_CALL_GLOBAL]       = &&L_BC_CALL_GLOBAL,
+          [BC_CALL]              = &&L_BC_CALL,
+          [BC_TAIL_CALL_GLOBAL]  = &&L_BC_TAIL_CALL_GLOBAL,
+          [BC_TAIL_CALL]         = &&L_BC_TAIL_CALL,
+          [BC_JUMP]              = &&L_BC_JUMP,
+          [BC_JUMP_IF_FALSE]     = &&L_BC_JUMP_IF_FALSE,
+          [BC_CLOSURE]           = &&L_BC_CLOSURE,
+          [BC_EQP]               = &&L_BC_EQP,
+          [BC_CAR]               = &&L_BC_CAR,
+          [BC_CDR]               = &&L_BC_CDR,
+          [BC_NOT]               = &&L_BC_NOT,
+          [BC_NULLP]             = &&L_BC_NULLP,
+          [BC_GET_ENV]           = &&L_BC_GET_ENV,
+          [BC_FAST_OP]           = &&L_BC_FAST_OP,
+          [BC_RETURN]            = &&L_BC_RETURN,
+     };
+
+     BC_NEXT();
+#else
+     for(;;) switch(FIXNM(*pc++)) {
+#endif
+
+     BC_OP(BC_LITERAL)
+          acc = *pc++;
+          BC_NEXT();
+
+     BC_OP(BC_GLOBAL_REF)
+          sym = *pc++;
+          acc = SYMBOL_VCELL(sym);
+
+          if (UNBOUND_MARKER_P(acc))
+               vmerror_unbound(sym);
+
+          BC_NEXT();
+
+     BC_OP(BC_GLOBAL_SET)
+          sym = *pc++;
+
+          if (UNBOUND_MARKER_P(SYMBOL_VCELL(sym)))
+               vmerror_unbound(sym);
+
+          SET_SYMBOL_VCELL(sym, acc);
+          BC_NEXT();
+
+     BC_OP(BC_GLOBAL_DEF)
+          acc = lidefine_global(pc[0], pc[1]);
+          pc += 2;
+          BC_NEXT();
+
+     BC_OP(BC_LOCAL_REF)
+          acc = lenvlookup_by_index(FIXNM(pc[0]), FIXNM(pc[1]), env);
+          pc += 2;
+          BC_NEXT();
+
+     BC_OP(BC_LOCAL_REF_RESTARG)
+          acc = lenvlookup_restarg_by_index(FIXNM(pc[0]), FIXNM(pc[1]), env);
+          pc += 2;
+          BC_NEXT();
+
+     BC_OP(BC_LOCAL_SET)
+          lenvlookup_set_by_index(FIXNM(pc[0]), FIXNM(pc[1]), env, acc);
+          pc += 2;
+          BC_NEXT();
+
+     BC_OP(BC_STACK_LOCAL_REF)
+          acc = locals[FIXNM(*pc++)];
+
+          if (UNBOUND_MARKER_P(acc))
+               vmerror_arg_out_of_range(NIL, _T("too few arguments"));
+
+          BC_NEXT();
+
+     BC_OP(BC_STACK_LOCAL_SET)
+          if (UNBOUND_MARKER_P(locals[FIXNM(*pc)]))
+               vmerror_arg_out_of_range(NIL, _T("too few arguments (no binding cell)"));
+
+          locals[FIXNM(*pc++)] = acc;
+          BC_NEXT();
+
+     BC_OP(BC_PUSH)
+          *sp++ = acc;
+          BC_NEXT();
+
+     BC_OP(BC_CALL_GLOBAL)
+          sym = pc[0];
+          n = (size_t)FIXNM(pc[1]);
+
+          val = SYMBOL_VCELL(sym);
+          sp -= n;
+
+          /* Subrs are applied directly, since their arity is no
+           * further away than the cache would be. */
+          if (SUBRP(val))
+               acc = bytecode_apply(val, n, sp);
+          else
+               acc = bytecode_apply_cached(call_site_cache(pc, sym, val), val, n, sp);
+
+          pc += 2;
+          BC_NEXT();
+
+     BC_OP(BC_CALL)
+          n = (size_t)FIXNM(*pc++);
+
+          sp -= n + 1;
+          acc = bytecode_apply(sp[0], n, sp + 1);
+          BC_NEXT();
+
+     BC_OP(BC_TAIL_CALL_GLOBAL)
+          sym = pc[0];
+          n = (size_t)FIXNM(pc[1]);
+
+          val = SYMBOL_VCELL(sym);
+          *cache = call_site_cache(pc, sym, val);
+
+          sp -= n;
+          goto tail_call;
+
+     BC_OP(BC_TAIL_CALL)
+          n = (size_t)FIXNM(*pc);
+
+          sp -= n + 1;
+          val = *sp++;
+          goto tail_call;
+
+     BC_OP(BC_JUMP)
+          target = code + FIXNM(*pc);
+
+          if (target < pc)
+               _process_interrupts();
+
+          pc = target;
+          BC_NEXT();
+
+     BC_OP(BC_JUMP_IF_FALSE)
+          if (TRUEP(acc))
+               pc++;
+          else
+               pc = code + FIXNM(*pc);
+          BC_NEXT();
+
+     BC_OP(BC_CLOSURE)
+          acc = lclosurecons(env, lcons(lcar(pc[0]), pc[1]), lcdr(pc[0]));
+          pc += 2;
+          BC_NEXT();
+
+     BC_OP(BC_EQP)
+          sp--;
+          acc = boolcons(EQ(*sp, acc));
+          BC_NEXT();
+
+     BC_OP(BC_CAR)
+          acc = lcar(acc);
+          BC_NEXT();
+
+     BC_OP(BC_CDR)
+          acc = lcdr(acc);
+          BC_NEXT();
+
+     BC_OP(BC_NOT)
+          acc = boolcons(!TRUEP(acc));
+          BC_NEXT();
+
+     BC_OP(BC_NULLP)
+          acc = boolcons(NULLP(acc));
+          BC_NEXT();
+
+     BC_OP(BC_GET_ENV)
+          acc = env;
+          BC_NEXT();
+
+     BC_OP(BC_FAST_OP)
+          acc = execute_fast_op(*pc++, env, locals);
+          BC_NEXT();
+
+     BC_OP(BC_RETURN)
+          *retval = acc;
+          CURRENT_TIB()->fsp = fsp;
+          return false;
+
+#ifndef BC_THREADED_DISPATCH
+     default:
+          panic("Unsupported bytecode");
+     }
+#endif
+
+tail_call:
+     if (n > ARG_BUF_LEN)
+          vmerror_unsupported(_T("too many actual arguments"));
+
+     for (size_t ii = 0; ii < n; ii++)
+          argv[ii] = sp[ii];
+
+     *fn = val;
+     *argc = n;
+
+     CURRENT_TIB()->fsp = fsp;
+
+     return true;
+}
+
+#undef BC_OP
+#undef BC_NEXT
+
+static lref_t execute_fast_op(lref_t fop, lref_t env, lref_t *locals)
 {
      lref_t retval = NIL;
      lref_t sym;
      lref_t binding;
      lref_t fn;
+     struct call_site_cache_t *cache;
      lref_t args;
      size_t argc;
      lref_t argv[ARG_BUF_LEN];
@@ -476,6 +1313,11 @@ static lref_t execute_fast_op(lref_t fop, lref_t env)
 
      fstack_enter_eval_frame(&fop, fop, env);
 
+     /* Stack allocated locals for a closure applied by this invocation
+      * live just past the eval frame, and are released when the next
+      * tail call is made. */
+     lref_t *frame_fsp = CURRENT_TIB()->fsp;
+
      while(!NULLP(fop)) {
           switch(fop->header.opcode)
           {
@@ -511,9 +1353,7 @@ static lref_t execute_fast_op(lref_t fop, lref_t env)
           case FOP_APPLY_GLOBAL:
                sym = fop->as.fast_op.arg1;
                fn = SYMBOL_VCELL(sym);
-
-               if (UNBOUND_MARKER_P(fn))
-                    vmerror_unbound(sym);
+               cache = call_site_cache(fop, sym, fn);
 
                argc = 0;
                args = fop->as.fast_op.arg2;
@@ -524,7 +1364,7 @@ static lref_t execute_fast_op(lref_t fop, lref_t env)
                          break;
                     }
 
-                    argv[argc] = execute_fast_op(CAR(args), env);
+                    argv[argc] = execute_fast_op(CAR(args), env, locals);
 
                     args = CDR(args);
                     argc++;
@@ -534,12 +1374,13 @@ static lref_t execute_fast_op(lref_t fop, lref_t env)
                     vmerror_arg_out_of_range(fop->as.fast_op.arg2,
                                              _T("bad formal argument list"));
 
-               fop = apply(fn, argc, argv, &env, &retval);
+               CURRENT_TIB()->fsp = frame_fsp;
+               fop = apply_cached(cache, fn, argc, argv, &env, &locals, &retval);
                break;
 
           case FOP_APPLY:
                argc = 0;
-               fn = execute_fast_op(fop->as.fast_op.arg1, env);
+               fn = execute_fast_op(fop->as.fast_op.arg1, env, locals);
                args = fop->as.fast_op.arg2;
 
                while (CONSP(args)) {
@@ -548,7 +1389,7 @@ static lref_t execute_fast_op(lref_t fop, lref_t env)
                          break;
                     }
 
-                    argv[argc] = execute_fast_op(CAR(args), env);
+                    argv[argc] = execute_fast_op(CAR(args), env, locals);
 
                     args = CDR(args);
                     argc++;
@@ -558,7 +1399,8 @@ static lref_t execute_fast_op(lref_t fop, lref_t env)
                     vmerror_arg_out_of_range(fop->as.fast_op.arg2,
                                              _T("bad formal argument list"));
 
-               fop = apply(fn, argc, argv, &env, &retval);
+               CURRENT_TIB()->fsp = frame_fsp;
+               fop = apply(fn, argc, argv, &env, &locals, &retval);
                break;
 
           case FOP_IF_TRUE:
@@ -573,14 +1415,14 @@ static lref_t execute_fast_op(lref_t fop, lref_t env)
                break;
 
           case FOP_SEQUENCE:
-               retval = execute_fast_op(fop->as.fast_op.arg1, env);
+               retval = execute_fast_op(fop->as.fast_op.arg1, env, locals);
 
                fop = fop->as.fast_op.arg2;
                break;
 
           case FOP_THROW:
-               tag = execute_fast_op(fop->as.fast_op.arg1, env);
-               escape_retval = execute_fast_op(fop->as.fast_op.arg2, env);
+               tag = execute_fast_op(fop->as.fast_op.arg1, env, locals);
+               escape_retval = execute_fast_op(fop->as.fast_op.arg2, env, locals);
 
                dscwritef(DF_SHOW_THROWS, (_T("; DEBUG: throw ~a, retval = ~a\n"), tag, escape_retval));
 
@@ -601,14 +1443,14 @@ static lref_t execute_fast_op(lref_t fop, lref_t env)
                break;
 
           case FOP_CATCH:
-               tag = execute_fast_op(fop->as.fast_op.arg1, env);
+               tag = execute_fast_op(fop->as.fast_op.arg1, env, locals);
 
                jmpbuf = fstack_enter_catch_frame(tag, CURRENT_TIB()->frame);
 
                dscwritef(DF_SHOW_THROWS, (_T("; DEBUG: setjmp tag: ~a, frame: ~c&, jmpbuf: ~c&\n"), tag, CURRENT_TIB()->frame, jmpbuf));
 
                if (setjmp(*jmpbuf) == 0) {
-                    retval = execute_fast_op(fop->as.fast_op.arg2, env);
+                    retval = execute_fast_op(fop->as.fast_op.arg2, env, locals);
                } else {
                     dscwritef(DF_SHOW_THROWS, (_T("; DEBUG: catch, retval = ~a\n"), CURRENT_TIB()->escape_value));
 
@@ -622,9 +1464,9 @@ static lref_t execute_fast_op(lref_t fop, lref_t env)
                break;
 
           case FOP_WITH_UNWIND_FN:
-               fstack_enter_unwind_frame(execute_fast_op(fop->as.fast_op.arg1, env));
+               fstack_enter_unwind_frame(execute_fast_op(fop->as.fast_op.arg1, env, locals));
 
-               retval = execute_fast_op(fop->as.fast_op.arg2, env);
+               retval = execute_fast_op(fop->as.fast_op.arg2, env, locals);
 
                after = CURRENT_TIB()->frame[FOFS_UNWIND_AFTER];
 
@@ -664,8 +1506,8 @@ static lref_t execute_fast_op(lref_t fop, lref_t env)
                break;
 
           case FOP_EQP:
-               retval = boolcons(EQ(execute_fast_op(fop->as.fast_op.arg1, env),
-                                    execute_fast_op(fop->as.fast_op.arg2, env)));
+               retval = boolcons(EQ(execute_fast_op(fop->as.fast_op.arg1, env, locals),
+                                    execute_fast_op(fop->as.fast_op.arg2, env, locals)));
                fop = fop->as.fast_op.next;
                break;
 
@@ -695,7 +1537,7 @@ static lref_t execute_fast_op(lref_t fop, lref_t env)
                break;
 
           case FOP_SET_HFRAMES:
-               CURRENT_TIB()->handler_frames = execute_fast_op(fop->as.fast_op.arg1, env);
+               CURRENT_TIB()->handler_frames = execute_fast_op(fop->as.fast_op.arg1, env, locals);
                fop = fop->as.fast_op.next;
                break;
 
@@ -708,16 +1550,16 @@ static lref_t execute_fast_op(lref_t fop, lref_t env)
 
                SET_SYMBOL_VCELL(sym, fixcons((fixnum_t)CURRENT_TIB()->frame));
 
-               retval = execute_fast_op(fop->as.fast_op.arg2, env);
+               retval = execute_fast_op(fop->as.fast_op.arg2, env, locals);
                fop = fop->as.fast_op.next;
                break;
 
           case FOP_STACK_BOUNDARY:
-               sym = execute_fast_op(fop->as.fast_op.arg1, env);
+               sym = execute_fast_op(fop->as.fast_op.arg1, env, locals);
 
                fstack_enter_boundary_frame(sym);
 
-               retval = execute_fast_op(fop->as.fast_op.arg2, env);
+               retval = execute_fast_op(fop->as.fast_op.arg2, env, locals);
 
                fstack_leave_frame();
 
@@ -725,9 +1567,9 @@ static lref_t execute_fast_op(lref_t fop, lref_t env)
                break;
 
           case FOP_FAST_ENQUEUE_CELL:
-               retval = execute_fast_op(fop->as.fast_op.arg2, env);
+               retval = execute_fast_op(fop->as.fast_op.arg2, env, locals);
 
-               cell = execute_fast_op(fop->as.fast_op.arg1, env);
+               cell = execute_fast_op(fop->as.fast_op.arg1, env, locals);
 
                SET_CDR(CAR(retval), cell);
                SET_CAR(retval, cell);
@@ -736,8 +1578,8 @@ static lref_t execute_fast_op(lref_t fop, lref_t env)
                break;
 
           case FOP_WHILE_TRUE:
-               while(TRUEP(execute_fast_op(fop->as.fast_op.arg1, env))) {
-                    retval = execute_fast_op(fop->as.fast_op.arg2, env);
+               while(TRUEP(execute_fast_op(fop->as.fast_op.arg1, env, locals))) {
+                    retval = execute_fast_op(fop->as.fast_op.arg2, env, locals);
                }
                fop = fop->as.fast_op.next;
                break;
@@ -764,6 +1606,43 @@ static lref_t execute_fast_op(lref_t fop, lref_t env)
                fop = fop->as.fast_op.next;
                break;
 
+          case FOP_STACK_LOCAL_REF:
+               retval = locals[FIXNM(fop->as.fast_op.arg1)];
+
+               if (UNBOUND_MARKER_P(retval))
+                    vmerror_arg_out_of_range(NIL, _T("too few arguments"));
+
+               fop = fop->as.fast_op.next;
+               break;
+
+          case FOP_STACK_LOCAL_SET:
+               if (UNBOUND_MARKER_P(locals[FIXNM(fop->as.fast_op.arg1)]))
+                    vmerror_arg_out_of_range(NIL, _T("too few arguments (no binding cell)"));
+
+               locals[FIXNM(fop->as.fast_op.arg1)] = retval;
+
+               fop = fop->as.fast_op.next;
+               break;
+
+          case FOP_BYTECODE:
+               if (execute_bytecode(fop, env, locals, &retval, &fn, &cache, &argc, argv))
+               {
+                    CURRENT_TIB()->fsp = frame_fsp;
+
+                    if (cache != NULL)
+                         fop = apply_cached(cache, fn, argc, argv, &env, &locals, &retval);
+                    else
+                         fop = apply(fn, argc, argv, &env, &locals, &retval);
+               }
+               else
+                    fop = fop->as.fast_op.next;
+               break;
+
+          case FOP_DEFERRED:
+               /*  Read into place, to be dispatched again. */
+               fasl_load_deferred(fop);
+               break;
+
           default:
                panic("Unsupported fast-op");
           }
@@ -781,12 +1660,17 @@ lref_t apply1(lref_t fn, size_t argc, lref_t argv[])
      lref_t retval = NIL;
 
      lref_t env = NIL;
-     lref_t next_form = apply(fn, argc, argv, &env, &retval);
+     lref_t *locals = NULL;
+     lref_t *fsp = CURRENT_TIB()->fsp;
 
-     if (NULLP(next_form))
-          return retval;
-     else
-          return execute_fast_op(next_form, env);
+     lref_t next_form = apply(fn, argc, argv, &env, &locals, &retval);
+
+     if (!NULLP(next_form))
+          retval = execute_fast_op(next_form, env, locals);
+
+     CURRENT_TIB()->fsp = fsp;
+
+     return retval;
 }
 
 lref_t lapply(size_t argc, lref_t argv[])
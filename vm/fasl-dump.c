@@ -33,15 +33,42 @@ enum
 enum fasl_opcode_t g_reader_definition_ops[MAX_READER_DEFINITIONS];
 fixnum_t g_reader_definition_fixnums[MAX_READER_DEFINITIONS];
 
+/* Recorded objects, by offset from the last FASL_OP_RESET_READER_DEFS */
+size_t g_record_offsets[MAX_READER_DEFINITIONS];
+enum fasl_opcode_t g_record_ops[MAX_READER_DEFINITIONS];
+size_t g_record_count = 0;
+size_t g_record_base = 0;
+
+/* An opcode read and put back, or -1 */
+int g_unread_opcode = -1;
+size_t g_unread_offset = 0;
+
 FILE *g_file = NULL;
 size_t g_current_ofs = 0;
 size_t g_nesting_level = 0;
 
-#define FIXNUM_OP_P(op)     \
-  ((op == FASL_OP_FIX8)     \
-   || (op == FASL_OP_FIX16) \
-   || (op == FASL_OP_FIX32) \
-   || (op == FASL_OP_FIX64))
+/* From the last FASL_OP_FORMAT, or 1 */
+int g_format_version = 1;
+
+#define FIXNUM_OP_P(op)            \
+  ((op == FASL_OP_FIX8)            \
+   || (op == FASL_OP_FIX16)        \
+   || (op == FASL_OP_FIX32)        \
+   || (op == FASL_OP_FIX64)        \
+   || (op == FASL_OP_SMALL_FIXNUM))
+
+#define SMALL_FIXNUM_OP_P(op)                 \
+  ((op >= FASL_OP_SMALL_FIXNUM)               \
+   && (op < FASL_OP_RECORD))
+
+#define LIST_OP_P(op)       \
+  ((op == FASL_OP_CONS)     \
+   || (op == FASL_OP_LIST)  \
+   || (op == FASL_OP_LISTD))
+
+#define RECORDED_OP_P(op)                     \
+  ((op >= FASL_OP_RECORD)                     \
+   && (op < FASL_OP_RESET_READER_DEFS))
 
 void newline()
 {
@@ -56,9 +83,28 @@ void indent()
 
 size_t last_definition_offset = 0;
 
+static void show_field(size_t offset, const _TCHAR *desc)
+{
+  if (g_show_file_offsets)
+       printf(" 0x%08" SCAN_PRIxSIZET "", offset);
+
+  if (g_show_defn_offsets)
+       printf(" (D+0x%08" SCAN_PRIxSIZET ") ", offset - last_definition_offset);
+
+  indent();
+
+  if (desc)
+    printf(" %s=", desc);
+}
+
 void show_opcode(size_t offset, enum fasl_opcode_t opcode, const _TCHAR *desc)
 {
-  const _TCHAR *opcode_name = fasl_opcode_name(opcode);
+  bool recorded = RECORDED_OP_P(opcode);
+  const _TCHAR *opcode_name =
+       fasl_opcode_name(recorded ? (enum fasl_opcode_t)(opcode - FASL_OP_RECORD) : opcode);
+
+  if (SMALL_FIXNUM_OP_P(opcode))
+       opcode_name = fasl_opcode_name(FASL_OP_SMALL_FIXNUM);
 
   newline();
 
@@ -68,16 +114,10 @@ void show_opcode(size_t offset, enum fasl_opcode_t opcode, const _TCHAR *desc)
       newline();
     }
 
-  if (g_show_file_offsets)
-       printf(" 0x%08" SCAN_PRIxSIZET "", offset);
-
-  if (g_show_defn_offsets)
-       printf(" (D+0x%08" SCAN_PRIxSIZET ") ", offset - last_definition_offset);
-
-  indent();
+  show_field(offset, desc);
 
-  if (desc)
-    printf(" %s=", desc);
+  if (recorded)
+    printf("@");
 
   if (opcode_name)
     printf("%s", opcode_name);
@@ -192,21 +232,110 @@ static enum fasl_opcode_t fast_read_opcode(size_t *ofs)
 {
   uint8_t opcode = FASL_OP_EOF;
 
+  if (g_unread_opcode >= 0) {
+       opcode = (uint8_t)g_unread_opcode;
+       *ofs = g_unread_offset;
+
+       g_unread_opcode = -1;
+
+       return (enum fasl_opcode_t)opcode;
+  }
+
   if (fdread_binary_fixnum_uint8(&opcode, ofs))
        return (enum fasl_opcode_t)opcode;
 
   return FASL_OP_EOF;
 }
 
-static void dump_list(bool read_listd)
+static void record_object(size_t offset, enum fasl_opcode_t opcode)
+{
+  if (g_record_count >= MAX_READER_DEFINITIONS)
+       dump_error("too many recorded objects");
+
+  g_record_offsets[g_record_count] = offset - g_record_base;
+  g_record_ops[g_record_count] = opcode;
+
+  g_record_count++;
+}
+
+static size_t find_record(fixnum_t offset)
+{
+  size_t lo = 0;
+  size_t hi = g_record_count;
+
+  while (lo < hi) {
+       size_t mid = lo + (hi - lo) / 2;
+
+       if (g_record_offsets[mid] < (size_t)offset)
+            lo = mid + 1;
+       else
+            hi = mid;
+  }
+
+  if ((lo == g_record_count) || (g_record_offsets[lo] != (size_t)offset))
+       dump_error("reference to an object that was not recorded");
+
+  return lo;
+}
+
+/* Read an unsigned LEB128 varint, as written from format version 2. */
+static fixnum_t fdread_varint()
+{
+  fixnum_t value = 0;
+  uint8_t byte;
+
+  for (unsigned int shift = 0; ; shift += 7) {
+       if (!fdread_binary_fixnum_uint8(&byte, NULL))
+            dump_error("EOF during varint");
+
+       if (shift >= sizeof(fixnum_t) * 8)
+            dump_error("varint too long");
+
+       value |= (fixnum_t)(byte & 0x7F) << shift;
+
+       if (!(byte & 0x80))
+            return value;
+  }
+}
+
+/* Dump a length, offset or index, which version 1 streams write as a
+ * fixnum object, and later versions as a varint. */
+static fixnum_t dump_length(const _TCHAR *desc, const _TCHAR *message)
 {
   fixnum_t length;
-  _TCHAR buf[STRBUF_SIZE];
 
-  enum fasl_opcode_t op = dump_next_object(_T("length"), &length);
+  if (g_format_version < 2) {
+       enum fasl_opcode_t op = dump_next_object(desc, &length);
+
+       if (!FIXNUM_OP_P(op))
+            dump_error(message);
+
+       return length;
+  }
+
+  g_nesting_level++;
+
+  newline();
+  show_field(g_current_ofs, desc);
+
+  length = fdread_varint();
 
-  if (!FIXNUM_OP_P(op))
-    dump_error("lists must have a fixnum length");
+  if (g_show_fixnums)
+       _tprintf(_T("%" SCAN_PRIiFIXNUM), length);
+  else
+       _tprintf(_T("<suppressed>"));
+
+  g_nesting_level--;
+
+  return length;
+}
+
+static void dump_list(bool read_listd)
+{
+  _TCHAR buf[STRBUF_SIZE];
+  enum fasl_opcode_t op;
+
+  fixnum_t length = dump_length(_T("length"), "lists must have a fixnum length");
 
   for(fixnum_t ii = 0; ii < length; ii++) {
       _sntprintf(buf, STRBUF_SIZE, _T("item[%" SCAN_PRIiFIXNUM "]"), ii);
@@ -225,6 +354,35 @@ static void dump_list(bool read_listd)
   }
 }
 
+/* The conses along the cdrs of a list are dumped here, rather than by
+ * recursion, to keep long lists at one level of nesting. */
+static void dump_cons()
+{
+  size_t offset;
+
+  for(;;) {
+       if (dump_next_object(_T("car"), NULL) == FASL_OP_EOF)
+            dump_error("incomplete cons, missing car");
+
+       enum fasl_opcode_t op = fast_read_opcode(&offset);
+
+       if ((op != FASL_OP_CONS) && (op != FASL_OP_RECORD + FASL_OP_CONS)) {
+            g_unread_opcode = op;
+            g_unread_offset = offset;
+
+            if (dump_next_object(_T("cdr"), NULL) == FASL_OP_EOF)
+                 dump_error("incomplete cons, missing cdr");
+
+            return;
+       }
+
+       if (op != FASL_OP_CONS)
+            record_object(offset, FASL_OP_CONS);
+
+       show_opcode(offset, op, _T("cdr"));
+  }
+}
+
 static void dump_character()
 {
   uint8_t data = 0;
@@ -276,12 +434,7 @@ static void dump_flonum(bool complexp)
 
 static void dump_string()
 {
-  fixnum_t length;
-
-  enum fasl_opcode_t op = dump_next_object(_T("length"), &length);
-
-  if (!FIXNUM_OP_P(op))
-    dump_error("strings must have a fixnum length");
+  fixnum_t length = dump_length(_T("length"), "strings must have a fixnum length");
 
   printf(" \"");
 
@@ -308,10 +461,12 @@ static void dump_package()
 
 static void dump_symbol()
 {
-     enum fasl_opcode_t op = dump_next_object(_T("pname"), NULL);
+  enum fasl_opcode_t op;
 
-  if (op != FASL_OP_STRING)
-    dump_error("symbols must have string print names");
+  if (g_format_version >= 2)
+       dump_string();
+  else if (dump_next_object(_T("pname"), NULL) != FASL_OP_STRING)
+       dump_error("symbols must have string print names");
 
   op = dump_next_object(_T("package"), NULL);
 
@@ -329,13 +484,10 @@ static void dump_subr()
 
 static void dump_vector()
 {
-  fixnum_t length;
   _TCHAR buf[STRBUF_SIZE];
+  enum fasl_opcode_t op;
 
-  enum fasl_opcode_t op = dump_next_object(_T("length"), &length);
-
-  if (!FIXNUM_OP_P(op))
-    dump_error("Expected fixnum for vector length");
+  fixnum_t length = dump_length(_T("length"), "Expected fixnum for vector length");
 
   for(fixnum_t ii = 0; ii < length; ii++)
     {
@@ -357,7 +509,7 @@ static void dump_hash()
 
   op = dump_next_object(_T("key/values"), NULL);
 
-  if ((op != FASL_OP_NIL) && (op != FASL_OP_LIST) && (op != FASL_OP_LISTD))
+  if ((op != FASL_OP_NIL) && !LIST_OP_P(op))
     dump_error("malformed key/value list for hash table");
 }
 
@@ -365,17 +517,17 @@ static void dump_closure()
 {
      enum fasl_opcode_t op = dump_next_object(_T("env"), NULL);
 
-  if ((op != FASL_OP_NIL) && (op != FASL_OP_LIST) && (op != FASL_OP_LISTD))
+  if ((op != FASL_OP_NIL) && !LIST_OP_P(op))
     dump_error("malformed closure, bad environment");
 
   op = dump_next_object(_T("code"), NULL);
 
-  if ((op != FASL_OP_NIL) && (op != FASL_OP_LIST) && (op != FASL_OP_LISTD))
+  if ((op != FASL_OP_NIL) && !LIST_OP_P(op))
     dump_error("malformed closure, bad code");
 
   op = dump_next_object(_T("plist"), NULL);
 
-  if ((op != FASL_OP_NIL) && (op != FASL_OP_LIST) && (op != FASL_OP_LISTD))
+  if ((op != FASL_OP_NIL) && !LIST_OP_P(op))
     dump_error("malformed closure, bad property list");
 }
 
@@ -403,25 +555,31 @@ static void dump_structure_layout()
 {
      enum fasl_opcode_t op = dump_next_object(_T("layout-data"), NULL);
 
-  if (op != FASL_OP_LIST)
+  if (!LIST_OP_P(op))
     dump_error("Expected list for structure layout");
 }
 
 static void dump_fast_op(int arity, bool has_next)
 {
   size_t offset;
+  fixnum_t fop_opcode;
 
-  enum fasl_opcode_t opcode = fast_read_opcode(&offset);
+  if (g_format_version >= 2) {
+       newline();
+       show_field(g_current_ofs, _T("opcode"));
 
-  show_opcode(offset, opcode, _T("opcode"));
+       fop_opcode = fdread_varint();
+  } else {
+       enum fasl_opcode_t opcode = fast_read_opcode(&offset);
 
-  if ((opcode != FASL_OP_FIX8) && (opcode != FASL_OP_FIX16))
-       dump_error("FOP opcodes must be specified with FASL_OP_FIX8 or FASL_OP_FIX16");
+       show_opcode(offset, opcode, _T("opcode"));
 
-  fixnum_t fop_opcode;
+       if ((opcode != FASL_OP_FIX8) && (opcode != FASL_OP_FIX16))
+            dump_error("FOP opcodes must be specified with FASL_OP_FIX8 or FASL_OP_FIX16");
 
-  if (!fdread_binary_fixnum((opcode == FASL_OP_FIX8) ? 1 : 2, &fop_opcode, NULL))
-       dump_error("Expected FOP opcode not found");
+       if (!fdread_binary_fixnum((opcode == FASL_OP_FIX8) ? 1 : 2, &fop_opcode, NULL))
+            dump_error("Expected FOP opcode not found");
+  }
 
   const _TCHAR *opcode_name = fast_op_opcode_name((enum fast_op_opcode_t)fop_opcode);
 
@@ -449,7 +607,6 @@ static void dump_fast_op(int arity, bool has_next)
 
 static void dump_structure()
 {
-  fixnum_t length;
   _TCHAR buf[STRBUF_SIZE];
 
   enum fasl_opcode_t op = dump_next_object(_T("layout"), NULL);
@@ -457,10 +614,7 @@ static void dump_structure()
   if (op != FASL_OP_STRUCTURE_LAYOUT)
     dump_error("Expected structure layout");
 
-  op = dump_next_object(_T("length"), &length);
-
-  if (!FIXNUM_OP_P(op))
-    dump_error("Expected fixnum for structure length");
+  fixnum_t length = dump_length(_T("length"), "Expected fixnum for structure length");
 
   for(fixnum_t ii = 0; ii < length; ii++)
     {
@@ -475,19 +629,14 @@ static void dump_structure()
 
 fixnum_t dump_table_index()
 {
-  fixnum_t index;
-
   bool old_g_show_fixnums = g_show_fixnums;
 
   g_show_fixnums = g_show_reader_defn_indicies;
 
-  enum fasl_opcode_t op = dump_next_object(_T("index"), &index);
+  fixnum_t index = dump_length(_T("index"), "Expected fixnum for FASL table index");
 
   g_show_fixnums = old_g_show_fixnums;
 
-  if (!FIXNUM_OP_P(op))
-    dump_error("Expected fixnum for FASL table index");
-
   return index;
 }
 
@@ -554,6 +703,10 @@ static enum fasl_opcode_t dump_next_object(const _TCHAR *desc,
 
     show_opcode(offset, opcode, desc);
 
+    if (RECORDED_OP_P(opcode)) {
+         opcode = (enum fasl_opcode_t)(opcode - FASL_OP_RECORD);
+         record_object(offset, opcode);
+    }
 
     switch(opcode) {
     case FASL_OP_NIL:			                        break;
@@ -562,6 +715,8 @@ static enum fasl_opcode_t dump_next_object(const _TCHAR *desc,
 
     case FASL_OP_CHARACTER:		dump_character();	break;
 
+    case FASL_OP_CONS:			dump_cons();		break;
+
     case FASL_OP_LIST:			dump_list(false);	break;
     case FASL_OP_LISTD:			dump_list(true);	break;
 
@@ -587,13 +742,19 @@ static enum fasl_opcode_t dump_next_object(const _TCHAR *desc,
     case FASL_OP_STRUCTURE:             dump_structure();             break;
     case FASL_OP_STRUCTURE_LAYOUT:      dump_structure_layout();      break;
 
-    case FASL_OP_FAST_OP_0:             dump_fast_op(0, false);       break;
-    case FASL_OP_FAST_OP_1:             dump_fast_op(1, false);       break;
-    case FASL_OP_FAST_OP_2:             dump_fast_op(2, false);       break;
+    case FASL_OP_FAST_OP_0:
+    case FASL_OP_OLD_FAST_OP_0:         dump_fast_op(0, false);       break;
+    case FASL_OP_FAST_OP_1:
+    case FASL_OP_OLD_FAST_OP_1:         dump_fast_op(1, false);       break;
+    case FASL_OP_FAST_OP_2:
+    case FASL_OP_OLD_FAST_OP_2:         dump_fast_op(2, false);       break;
 
-    case FASL_OP_FAST_OP_0N:            dump_fast_op(0, true);        break;
-    case FASL_OP_FAST_OP_1N:            dump_fast_op(1, true);        break;
-    case FASL_OP_FAST_OP_2N:            dump_fast_op(2, true);        break;
+    case FASL_OP_FAST_OP_0N:
+    case FASL_OP_OLD_FAST_OP_0N:        dump_fast_op(0, true);        break;
+    case FASL_OP_FAST_OP_1N:
+    case FASL_OP_OLD_FAST_OP_1N:        dump_fast_op(1, true);        break;
+    case FASL_OP_FAST_OP_2N:
+    case FASL_OP_OLD_FAST_OP_2N:        dump_fast_op(2, true);        break;
 
     case FASL_OP_NOP_1:
     case FASL_OP_NOP_2:
@@ -607,9 +768,48 @@ static enum fasl_opcode_t dump_next_object(const _TCHAR *desc,
       current_read_complete = false;
       break;
 
+    case FASL_OP_FORMAT:
+      {
+           uint8_t version;
+
+           if (!fdread_binary_fixnum_uint8(&version, NULL))
+                dump_error("EOF during FASL format");
+
+           if ((version < 1) || (version > FASL_FORMAT_VERSION))
+                dump_error("unsupported FASL format version");
+
+           printf("%d", (int)version);
+
+           g_format_version = version;
+      }
+      break;
+
+    case FASL_OP_DEFERRED:
+      {
+           fixnum_t length;
+
+           if (!fdread_binary_fixnum(4, &length, NULL))
+                dump_error("EOF during deferred object");
+
+           if (length == 0)
+                printf("shared");
+           else
+                printf("%" SCAN_PRIiFIXNUM " bytes", length);
+
+           size_t start = g_current_ofs;
+
+           opcode = dump_next_object(_T("deferred"), fixnum_value);
+
+           if ((length != 0) && (g_current_ofs != start + (size_t)length))
+                dump_error("deferred object of the wrong length");
+      }
+      break;
+
     case FASL_OP_RESET_READER_DEFS:
       memset(g_reader_definition_ops, 0, sizeof(g_reader_definition_ops));
       memset(g_reader_definition_fixnums, 0, sizeof(g_reader_definition_fixnums));
+      g_record_count = 0;
+      g_record_base = offset;
       break;
 
     case FASL_OP_READER_DEFINITION:
@@ -634,6 +834,13 @@ static enum fasl_opcode_t dump_next_object(const _TCHAR *desc,
 	  *fixnum_value = g_reader_definition_fixnums[index];
       break;
 
+    case FASL_OP_RECORD_REFERENCE:
+      index = (fixnum_t)find_record(dump_table_index());
+      opcode = g_record_ops[index];
+
+      printf(" => 0x%08" SCAN_PRIxSIZET, g_record_base + g_record_offsets[index]);
+      break;
+
     case FASL_OP_EOF: break;
 
     case FASL_OP_LOADER_DEFINEQ:
@@ -657,7 +864,18 @@ static enum fasl_opcode_t dump_next_object(const _TCHAR *desc,
          break;
 
     default:
-      dump_error("invalid opcode");
+      if (!SMALL_FIXNUM_OP_P(opcode))
+           dump_error("invalid opcode");
+
+      if (fixnum_value != NULL)
+           *fixnum_value = opcode - FASL_OP_SMALL_FIXNUM;
+
+      if (g_show_fixnums)
+           _tprintf(_T("%d"), (int)(opcode - FASL_OP_SMALL_FIXNUM));
+      else
+           _tprintf(_T("<suppressed>"));
+
+      opcode = FASL_OP_SMALL_FIXNUM;
     }
   }
 
@@ -680,6 +898,8 @@ int dump_file(char *filename)
 
   fixnum_t object_number = 0;
 
+  g_format_version = 1;
+
   for(;;) {
     _sntprintf(buf, STRBUF_SIZE, _T("top[%" SCAN_PRIiFIXNUM "]"), object_number);
 
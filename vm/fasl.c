@@ -17,47 +17,35 @@
 
 #include "scan-private.h"
 
-/* REVISIT: Possible improvement to FASL read/write
+/* FASL streams are written in a single pass. Each object is written as
+ * it comes, and an object written a second time is written as a
+ * FASL_OP_RECORD_REFERENCE to the byte offset at which it was first
+ * written. Once the writer is done, it goes back and adds FASL_OP_RECORD
+ * to the opcode of each object that was referred to, which has the
+ * reader record the object and its offset as it is read. Conses are
+ * written one at a time with FASL_OP_CONS, so that each has an offset of
+ * its own.
  *
- * Currently, the FASL write process works by accumulating
- * a list of all objects to be written, scanning it to check
- * for shared structure, and then writing it to the stream,
- * adding appropriate definition and reference ops to recreate
- * structure sharing. This works, but it's slow and has the
- * downwside that if an object is mutated before the FASL stream
- * is written to disk, the mutatation is what will be written.
+ * Older streams, with whole lists and numbered reader definitions
+ * written after a separate pass to find shared structure, still load.
  *
- * Switching to a single pass FASL write algorithm would solve
- * a number of these problems. The FASL writer would immediately
- * write objects to the output stream, making a note of each object
- * as it is written, along with its byte offset in the output stream.
- * If an object is written a second time, a reference to the byte
- * offset is written to the stream instead of the object itself.
- * The writer also makes a note of each of these back-references,
- * and, when the output stream is closed, goes back to fix up
- * reference targets with alternate FASL opcode that signals the
- * reader to keep a record of the object as it is read. This
- * would entail the following specific changes:
+ * Version 2 streams begin with FASL_OP_FORMAT. In these, the lengths,
+ * offsets and fast op opcodes that version 1 writes as fixnum objects
+ * are written as unsigned LEB128 varints, and symbol names are written
+ * inline rather than as strings. Fixnums from 0 to 30 are written as
+ * FASL_OP_SMALL_FIXNUM opcodes, in either version.
  *
- * 1) Create a duplicate set of FASL opcodes for each type. The
- *    new opcode signals the reader to make a record of the
- *    object as it is read.
- * 2) Add a stream-seek function to binary output streams, to
- *    allow for writer fixup.
- * 3) Replace the LIST and LISTD opcdes with a CONS opcode. (The
- *    back-reference fixup approach requires each individually
- *    referrable Lisp object to have a unique byte offset within
- *    the output stream.)
- *
- * I know for a fact that this would eliminate the object mutation
- * problem, and I'm guessing that the elimination of the explicit
- * circularity-checking pass would speed things up quite a bit.
- * However, this gain would be somewhat offset by the fact that
- * the writer still has to maintain a per-written-object hash table,
- * so it's worth more formal investigation.
+ * Version 3 adds FASL_OP_DEFERRED, which the writer puts ahead of each
+ * closure body, with its length. A reader that reads in place, from
+ * bytes that stay put, skips the body and leaves a FOP_DEFERRED fast op
+ * in its place, which is read when the closure is first applied. For
+ * that, a deferred object shares nothing with the rest of the stream
+ * but interned symbols and packages, which a reader that skipped their
+ * first appearance rereads from there. A body that shares anything else
+ * is written with a length of zero, and read in place like any other
+ * object.
  */
 
-
 static lref_t faslreadercons(lref_t port)
 {
      lref_t frdr = new_cell(TC_FASL_READER);
@@ -68,11 +56,16 @@ static lref_t faslreadercons(lref_t port)
 
      memset(stream, 0, sizeof(*stream));
 
+     stream->format_version = 1;
+
      SET_FASL_READER_STREAM(frdr, stream);
 
      return frdr;
 }
 
+/* A reader decodes its port's bytes from a window onto them, which it
+ * fills well ahead of the objects read. Nothing else should read from
+ * the port while the reader is in use. */
 lref_t lmake_fasl_reader(lref_t port)
 {
      if (!BINARY_PORTP(port))
@@ -81,12 +74,17 @@ lref_t lmake_fasl_reader(lref_t port)
      return faslreadercons(port);
 }
 
+/* The reader's stack, accumulator and table live in its stream, and
+ * are written through raw pointers. Writes of heap objects into them
+ * still pass through the write barrier, on behalf of the reader (or
+ * the table chunk holding the entry). */
 lref_t fasl_reader_gc_mark(lref_t obj)
 {
      for (size_t ii = 0; ii < FAST_LOAD_STACK_DEPTH; ii++)
           gc_mark(FASL_READER_STREAM(obj)->stack[ii]);
 
      gc_mark(FASL_READER_STREAM(obj)->accum);
+     gc_mark(FASL_READER_STREAM(obj)->deferred_block);
 
      return FASL_READER_STREAM(obj)->table;
 }
@@ -105,40 +103,285 @@ lref_t fasl_reader_gc_mark(lref_t obj)
  *    to update the return value prior to reading any component objects.
  */
 
-/*  REVISIT: The use of reference parameters breaks when the reference
- *  points into the _fasl_table and the FASL table is resized while the
- *  reference is still pending. This needs to be fixed, otherwise funky
- *  stuff happens. (I think this can be resolved by storing conses in the
- *  fasl_table and using references to their CAR's to store table entries...
- *  currently, the CONS will stay put even if the enderlying table is resized. */
+/*  References into the FASL table stay put while the table grows, since
+ *  the table only ever adds chunks, and a chunk never moves. */
 static void fast_read(lref_t reader, lref_t * retval,
                       bool allow_loader_ops /* = false */);
 
+/* Make at least <size> bytes available in the reader's window, returning
+ * false if the port ends first. Ports that can are read in place, all at
+ * once. Otherwise, the bytes left in the window are moved to the start of
+ * the buffer, and the rest of the buffer is filled from the port. */
+static bool fast_fill_window(lref_t reader, size_t size)
+{
+     struct fasl_stream_t *stream = FASL_READER_STREAM(reader);
+     lref_t port = FASL_READER_PORT(reader);
+
+     if (stream->buffer == NULL)
+     {
+          /*  A window read in place already holds all there is. */
+          if (stream->window != NULL)
+               return false;
+
+          size_t length;
+          size_t base = PORT_BYTES_READ(port);
+          const uint8_t *bytes = read_bytes_in_place(port, &length);
+
+          stream->window_pos = 0;
+          stream->window_base = base;
+
+          if (bytes != NULL)
+          {
+               stream->window = bytes;
+               stream->window_length = length;
+
+               return length >= size;
+          }
+
+          stream->window_length = 0;
+     }
+
+     size_t available = stream->window_length - stream->window_pos;
+
+     if (size > stream->buffer_size)
+     {
+          size_t new_size = MAX2(size, (size_t) FASL_READ_BUFFER_SIZE);
+          uint8_t *new_buffer = gc_malloc(new_size);
+
+          if (available > 0)
+               memcpy(new_buffer, stream->window + stream->window_pos, available);
+
+          gc_free(stream->buffer);
+
+          stream->buffer = new_buffer;
+          stream->buffer_size = new_size;
+     }
+     else if (available > 0)
+          memmove(stream->buffer, stream->window + stream->window_pos, available);
+
+     stream->window = stream->buffer;
+     stream->window_base += stream->window_pos;
+     stream->window_pos = 0;
+     stream->window_length = available;
+
+     while (stream->window_length < size)
+     {
+          size_t count = read_bytes(port, stream->buffer + stream->window_length,
+                                    stream->buffer_size - stream->window_length);
+
+          if (count == 0)
+               return false;
+
+          stream->window_length += count;
+     }
+
+     return true;
+}
+
+/* Returns a pointer to the next <size> bytes of the stream, consuming
+ * them, or NULL if the stream ends first. Bytes that were copied into the
+ * buffer stay there only until the window is next filled. */
+static INLINE const uint8_t *fast_read_raw(lref_t reader, size_t size)
+{
+     struct fasl_stream_t *stream = FASL_READER_STREAM(reader);
+
+     if ((stream->window_length - stream->window_pos < size) && !fast_fill_window(reader, size))
+          return NULL;
+
+     const uint8_t *bytes = stream->window + stream->window_pos;
+
+     stream->window_pos += size;
+
+     return bytes;
+}
+
+/* Copy the next <size> bytes of the stream to <buf>, a window at a time,
+ * returning false if the stream ends first. */
+static bool fast_read_bytes(lref_t reader, void *buf, size_t size)
+{
+     struct fasl_stream_t *stream = FASL_READER_STREAM(reader);
+     uint8_t *dest = (uint8_t *) buf;
+
+     while (size > 0)
+     {
+          if ((stream->window_length == stream->window_pos) && !fast_fill_window(reader, 1))
+               return false;
+
+          size_t count = MIN2(size, stream->window_length - stream->window_pos);
+
+          memcpy(dest, stream->window + stream->window_pos, count);
+
+          stream->window_pos += count;
+          dest += count;
+          size -= count;
+     }
+
+     return true;
+}
+
+/* The port offset of the next byte the reader will decode. */
+size_t fasl_reader_position(lref_t reader)
+{
+     struct fasl_stream_t *stream = FASL_READER_STREAM(reader);
+
+     if (stream->window == NULL)
+          return PORT_BYTES_READ(FASL_READER_PORT(reader));
+
+     return stream->window_base + stream->window_pos;
+}
+
 static enum fasl_opcode_t fast_read_opcode(lref_t reader)
 {
-     fixnum_t opcode = FASL_OP_EOF;
+     fixnum_t opcode = FASL_READER_STREAM(reader)->unread_opcode;
+
+     if (opcode != 0)
+     {
+          FASL_READER_STREAM(reader)->unread_opcode = 0;
 
-     if (read_binary_fixnum_uint8(FASL_READER_PORT(reader), &opcode))
           return (enum fasl_opcode_t) opcode;
+     }
+
+     const uint8_t *bytes = fast_read_raw(reader, 1);
+
+     if (bytes != NULL)
+          return (enum fasl_opcode_t) bytes[0];
 
      return FASL_OP_EOF;
 }
 
+/* Put back an opcode, to be read again by the next fast_read_opcode. */
+static void fast_unread_opcode(lref_t reader, enum fasl_opcode_t opcode)
+{
+     assert(FASL_READER_STREAM(reader)->unread_opcode == 0);
+
+     FASL_READER_STREAM(reader)->unread_opcode = opcode;
+}
+
+/* The offset of the next opcode fast_read_opcode will return. */
+static size_t fast_read_opcode_location(lref_t reader)
+{
+     size_t location = fasl_reader_position(reader);
+
+     return (FASL_READER_STREAM(reader)->unread_opcode != 0) ? location - 1 : location;
+}
+
+/* Read an unsigned LEB128 varint: seven bits to a byte, low bits first,
+ * with the high bit set on every byte but the last. */
+static size_t fast_read_varint(lref_t reader)
+{
+     size_t value = 0;
+
+     for (unsigned int shift = 0; ; shift += 7)
+     {
+          const uint8_t *bytes = fast_read_raw(reader, 1);
+
+          if (bytes == NULL)
+               vmerror_fast_read("EOF during varint", reader, NIL);
+
+          if (shift >= sizeof(size_t) * 8)
+               vmerror_fast_read("varint too long", reader, NIL);
+
+          value |= (size_t) (bytes[0] & 0x7F) << shift;
+
+          if (!(bytes[0] & 0x80))
+               return value;
+     }
+}
+
+/* Read a length, offset or index, which version 1 streams write as a
+ * fixnum object. */
+static size_t fast_read_length(lref_t reader, const _TCHAR *what)
+{
+     if (FASL_READER_STREAM(reader)->format_version >= 2)
+          return fast_read_varint(reader);
+
+     lref_t l;
+     fast_read(reader, &l, false);
+
+     if (!FIXNUMP(l) || (FIXNM(l) < 0))
+          vmerror_fast_read(what, reader, l);
+
+     return (size_t) FIXNM(l);
+}
+
+/* Returns a pointer to entry <index> of the reader's table, and the
+ * chunk holding it, for the write barrier. */
+static lref_t *fasl_table_entry(lref_t reader, size_t index, lref_t * chunk)
+{
+     struct fasl_stream_t *stream = FASL_READER_STREAM(reader);
+     size_t chunk_index = index / FASL_TABLE_CHUNK_SIZE;
+
+     if (NULLP(stream->table) || (chunk_index >= stream->table->as.vector.dim))
+     {
+          lref_t table;
+
+          if (NULLP(stream->table))
+               table = vectorcons(chunk_index + 1, NIL);
+          else
+               table = vector_resize(stream->table,
+                                     MAX2(chunk_index + 1, 2 * stream->table->as.vector.dim),
+                                     NIL);
+
+          gc_write_barrier(reader, table);
+          stream->table = table;
+     }
+
+     *chunk = stream->table->as.vector.data[chunk_index];
+
+     if (NULLP(*chunk))
+     {
+          *chunk = vectorcons(FASL_TABLE_CHUNK_SIZE, NIL);
+
+          gc_write_barrier(stream->table, *chunk);
+          stream->table->as.vector.data[chunk_index] = *chunk;
+     }
+
+     return &((*chunk)->as.vector.data[index % FASL_TABLE_CHUNK_SIZE]);
+}
+
+/* Make a record of an object to be read from <location>, returning the
+ * table entry to read it into. Objects are recorded in the order they
+ * appear in the stream, so the offsets stay sorted. */
+static lref_t *fast_record_object(lref_t reader, size_t location, lref_t * chunk)
+{
+     struct fasl_stream_t *stream = FASL_READER_STREAM(reader);
+
+     assert(location >= stream->record_base);
+
+     size_t offset = location - stream->record_base;
+
+     if ((stream->record_count > 0) && (offset <= stream->record_offsets[stream->record_count - 1]))
+          vmerror_fast_read("recorded objects out of order", reader, fixcons(offset));
+
+     if (stream->record_count == stream->record_capacity)
+     {
+          size_t new_capacity = MAX2((size_t) FASL_INITIAL_RECORD_CAPACITY,
+                                     2 * stream->record_capacity);
+          size_t *new_offsets = gc_malloc(new_capacity * sizeof(size_t));
+
+          if (stream->record_count > 0)
+               memcpy(new_offsets, stream->record_offsets, stream->record_count * sizeof(size_t));
+
+          gc_free(stream->record_offsets);
+
+          stream->record_offsets = new_offsets;
+          stream->record_capacity = new_capacity;
+     }
+
+     stream->record_offsets[stream->record_count] = offset;
+
+     return fasl_table_entry(reader, stream->record_count++, chunk);
+}
+
 static void fast_read_list(lref_t reader, bool read_listd, lref_t * list)
 {
      *list = NIL;
      lref_t list_bud = NIL;
      lref_t next_list_cell = NIL;
 
-     lref_t list_length;
-     fast_read(reader, &list_length, false);
-
-     if (!FIXNUMP(list_length))
-          vmerror_fast_read("expected fixnum for list length", reader, list_length);
-
-     *list = NIL;
+     size_t list_length = fast_read_length(reader, "expected fixnum for list length");
 
-     for (fixnum_t ii = 0; ii < FIXNM(list_length); ii++)
+     for (size_t ii = 0; ii < list_length; ii++)
      {
           next_list_cell = lcons(NIL, NIL);
 
@@ -149,30 +392,90 @@ static void fast_read_list(lref_t reader, bool read_listd, lref_t * list)
 
           list_bud = next_list_cell;
 
-          fast_read(reader, &(next_list_cell->as.cons.car), false);
+          lref_t elem;
+          fast_read(reader, &elem, false);
 
-          if (EOFP(CAR(next_list_cell)))
+          if (EOFP(elem))
                vmerror_fast_read("incomplete list definition", reader, NIL);
+
+          SET_CAR(next_list_cell, elem);
      }
 
      if (read_listd)
      {
-          fast_read(reader, &(list_bud->as.cons.cdr), false);
+          lref_t tail;
+          fast_read(reader, &tail, false);
 
-          if (EOFP(CDR(list_bud)))
+          if (EOFP(tail))
                vmerror_fast_read("incomplete list defintion, missing cdr", reader, NIL);
+
+          SET_CDR(list_bud, tail);
+     }
+}
+
+/* The conses along the cdrs of a list are read here, rather than by
+ * recursion, so that long lists don't take deep recursion to read. */
+static void fast_read_cons(lref_t reader, lref_t * retval)
+{
+     lref_t cell = lcons(NIL, NIL);
+
+     *retval = cell;
+
+     for (;;)
+     {
+          lref_t car;
+          fast_read(reader, &car, false);
+
+          if (EOFP(car))
+               vmerror_fast_read("incomplete cons, missing car", reader, NIL);
+
+          SET_CAR(cell, car);
+
+          size_t location = fast_read_opcode_location(reader);
+          enum fasl_opcode_t opcode = fast_read_opcode(reader);
+
+          if ((opcode != FASL_OP_CONS) && (opcode != FASL_OP_RECORD + FASL_OP_CONS))
+          {
+               fast_unread_opcode(reader, opcode);
+
+               lref_t cdr;
+               fast_read(reader, &cdr, false);
+
+               if (EOFP(cdr))
+                    vmerror_fast_read("incomplete cons, missing cdr", reader, NIL);
+
+               SET_CDR(cell, cdr);
+               return;
+          }
+
+          lref_t next = lcons(NIL, NIL);
+
+          SET_CDR(cell, next);
+
+          if (opcode != FASL_OP_CONS)
+          {
+               lref_t chunk;
+               lref_t *entry = fast_record_object(reader, location, &chunk);
+
+               gc_write_barrier(chunk, next);
+               *entry = next;
+          }
+
+          cell = next;
      }
 }
 
 static void fast_read_character(lref_t reader, lref_t * retval)
 {
-     fixnum_t data = 0;
+     const uint8_t *bytes = fast_read_raw(reader, 1);
 
-     if (!read_binary_fixnum_uint8(FASL_READER_PORT(reader), &data)) {
+     if (bytes == NULL) {
           *retval = lmake_eof();
           return;
      }
 
+     fixnum_t data = io_decode_uint8(bytes);
+
      assert((data >= _TCHAR_MIN) && (data <= _TCHAR_MAX));
 
      *retval = charcons((_TCHAR) data);
@@ -181,91 +484,99 @@ static void fast_read_character(lref_t reader, lref_t * retval)
 
 static void fast_read_fixnum_int8(lref_t reader, lref_t * retval)
 {
-     fixnum_t data = 0;
+     const uint8_t *bytes = fast_read_raw(reader, sizeof(int8_t));
 
-     if (read_binary_fixnum_int8(FASL_READER_PORT(reader), &data))
-          *retval = fixcons(data);
-     else
-          *retval = lmake_eof();
+     *retval = (bytes != NULL) ? fixcons(io_decode_int8(bytes)) : lmake_eof();
 }
 
 static void fast_read_fixnum_int16(lref_t reader, lref_t * retval)
 {
-     fixnum_t data = 0;
+     const uint8_t *bytes = fast_read_raw(reader, sizeof(int16_t));
 
-     if (read_binary_fixnum_int16(FASL_READER_PORT(reader), &data))
-          *retval = fixcons(data);
-     else
-          *retval = lmake_eof();
+     *retval = (bytes != NULL) ? fixcons(io_decode_int16(bytes)) : lmake_eof();
 }
 
 static void fast_read_fixnum_int32(lref_t reader, lref_t * retval)
 {
-     fixnum_t data = 0;
+     const uint8_t *bytes = fast_read_raw(reader, sizeof(int32_t));
 
-     if (read_binary_fixnum_int32(FASL_READER_PORT(reader), &data))
-          *retval = fixcons(data);
-     else
-          *retval = lmake_eof();
+     *retval = (bytes != NULL) ? fixcons(io_decode_int32(bytes)) : lmake_eof();
 }
 
 static void fast_read_fixnum_int64(lref_t reader, lref_t * retval)
 {
-     fixnum_t data = 0;
+     const uint8_t *bytes = fast_read_raw(reader, sizeof(int64_t));
 
-     if (read_binary_fixnum_int64(FASL_READER_PORT(reader), &data))
-          *retval = fixcons(data);
-     else
-          *retval = lmake_eof();
+     *retval = (bytes != NULL) ? fixcons(io_decode_int64(bytes)) : lmake_eof();
 }
 
 
 static void fast_read_flonum(lref_t reader, bool complex, lref_t * retval)
 {
-     flonum_t real_part = 0.0;
-     flonum_t imag_part = 0.0;
+     const uint8_t *bytes = fast_read_raw(reader, sizeof(flonum_t));
 
-     if (!read_binary_flonum(FASL_READER_PORT(reader), &real_part)) {
+     if (bytes == NULL) {
           *retval = lmake_eof();
           return;
      }
 
+     flonum_t real_part = io_decode_flonum(bytes);
+
      if (!complex) {
           *retval = flocons(real_part);
           return;
      }
 
-     if (!read_binary_flonum(FASL_READER_PORT(reader), &imag_part))
+     bytes = fast_read_raw(reader, sizeof(flonum_t));
+
+     if (bytes == NULL)
           vmerror_fast_read("incomplete complex number", reader, NIL);
 
-     *retval = cmplxcons(real_part, imag_part);          
+     *retval = cmplxcons(real_part, io_decode_flonum(bytes));
 }
 
 
-static void fast_read_string(lref_t reader, lref_t * retval)
+static size_t fast_read_string_length(lref_t reader)
 {
-     lref_t l;
-     fast_read(reader, &l, false);
+     return fast_read_length(reader, "strings must have a fixnum length");
+}
 
-     if (!FIXNUMP(l))
-          vmerror_fast_read("strings must have a fixnum length", reader, NIL);
+static void fast_read_string(lref_t reader, lref_t * retval)
+{
+     size_t length = fast_read_string_length(reader);
 
-     fixnum_t expected_length = FIXNM(l);
+     *retval = strconsbufn(length, NULL);
 
-     _TCHAR *buf = (_TCHAR *) gc_malloc((size_t) (expected_length + 1));
+     if (!fast_read_bytes(reader, (*retval)->as.string.data, length * sizeof(_TCHAR)))
+          vmerror_fast_read("EOF during string data", reader, NIL);
+}
 
-     memset(buf, 0, (size_t) (expected_length + 1));
+/* Read the characters of a string. Characters read in place are used
+ * where they lie. Otherwise they're copied out of the buffer before it
+ * can be refilled: into <buf> if there are no more than <buf_length> of
+ * them, or into a new buffer, returned in <allocated>, if there are. */
+static const _TCHAR *fast_read_string_chars(lref_t reader, _TCHAR *buf, size_t buf_length,
+                                            size_t *length, _TCHAR **allocated)
+{
+     *length = fast_read_string_length(reader);
+     *allocated = NULL;
 
-     fixnum_t actual_length =
-          read_bytes(FASL_READER_PORT(reader), buf, (size_t)(expected_length * sizeof(_TCHAR)));
+     const uint8_t *bytes = fast_read_raw(reader, *length * sizeof(_TCHAR));
 
-     if (actual_length != expected_length) {
-          gc_free(buf);
+     if (bytes == NULL)
           vmerror_fast_read("EOF during string data", reader, NIL);
-     }
 
-     *retval = strconsbufn((size_t) actual_length, buf);
-     gc_free(buf);
+     if (FASL_READER_STREAM(reader)->buffer == NULL)
+          return (const _TCHAR *) bytes;
+
+     _TCHAR *chars = buf;
+
+     if (*length > buf_length)
+          chars = *allocated = (_TCHAR *) gc_malloc(*length * sizeof(_TCHAR));
+
+     memcpy(chars, bytes, *length * sizeof(_TCHAR));
+
+     return chars;
 }
 
 
@@ -276,6 +587,17 @@ lref_t lset_fasl_package_list(lref_t packages)
      return NIL;
 }
 
+/* Set whether readers skip over deferred objects, as -Xfasl-lazy-load
+ * does, returning the previous setting. */
+lref_t lset_fasl_lazy_load(lref_t lazy)
+{
+     lref_t previous = boolcons(interp.fasl_lazy_load);
+
+     interp.fasl_lazy_load = TRUEP(lazy);
+
+     return previous;
+}
+
 static lref_t find_package(lref_t name)
 {
      for (lref_t l = interp.fasl_package_list; CONSP(l); l = CDR(l))
@@ -306,21 +628,54 @@ static void fast_read_package(lref_t reader, lref_t * package)
           vmerror_fast_read("package not found", reader, name);
 }
 
+/* Print names are nearly always written in place, rather than shared,
+ * so they're read as characters and interned from there. Only the
+ * names of new symbols become strings. */
 static void fast_read_symbol(lref_t reader, lref_t * retval)
 {
-     lref_t print_name;
-     fast_read(reader, &print_name, false);
+     _TCHAR name_buf[STACK_STRBUF_LEN];
+     _TCHAR *name_allocated = NULL;
+     const _TCHAR *name = NULL;
+     size_t name_length = 0;
+     lref_t print_name = NIL;
 
-     if (!STRINGP(print_name))
-          vmerror_fast_read("symbols must have string print names", reader, print_name);
+     enum fasl_opcode_t opcode =
+          (FASL_READER_STREAM(reader)->format_version >= 2) ? FASL_OP_STRING : fast_read_opcode(reader);
+
+     if (opcode == FASL_OP_STRING)
+     {
+          name = fast_read_string_chars(reader, name_buf, STACK_STRBUF_LEN,
+                                        &name_length, &name_allocated);
+     }
+     else
+     {
+          fast_unread_opcode(reader, opcode);
+          fast_read(reader, &print_name, false);
+
+          if (!STRINGP(print_name))
+               vmerror_fast_read("symbols must have string print names", reader, print_name);
+     }
 
      lref_t home;
      fast_read(reader, &home, false);
 
      if (!(PACKAGEP(home) || NULLP(home) || FALSEP(home)))
+     {
+          gc_free(name_allocated);
+
           vmerror_fast_read("a symbol must either have a package or NIL/#f for home", reader, home);
+     }
 
-     if (NULLP(home) || FALSEP(home))
+     if (name != NULL)
+     {
+          if (NULLP(home) || FALSEP(home))
+               *retval = symcons(strconsbufn(name_length, name), NIL);
+          else
+               *retval = intern_chars(name, name_length, home);
+
+          gc_free(name_allocated);
+     }
+     else if (NULLP(home) || FALSEP(home))
           *retval = symcons(print_name, NIL);
      else
           *retval = simple_intern(print_name, home);
@@ -348,15 +703,11 @@ static void fast_read_subr(lref_t reader, lref_t * retval)
 
 static void fast_read_vector(lref_t reader, lref_t * vec)
 {
-     lref_t vec_length;
-     fast_read(reader, &vec_length, false);
+     size_t vec_length = fast_read_length(reader, "Expected fixnum for vector length");
 
-     if (!FIXNUMP(vec_length))
-          vmerror_fast_read("Expected fixnum for vector length", reader, vec_length);
+     *vec = vectorcons(vec_length, NIL);
 
-     *vec = vectorcons(FIXNM(vec_length), NIL);
-
-     for (fixnum_t ii = 0; ii < FIXNM(vec_length); ii++)
+     for (size_t ii = 0; ii < vec_length; ii++)
      {
           lref_t object;
           fast_read(reader, &object, false);
@@ -364,6 +715,7 @@ static void fast_read_vector(lref_t reader, lref_t * vec)
           if (EOFP(object))
                vmerror_fast_read("incomplete vector definition", reader, *vec);
 
+          gc_write_barrier(*vec, object);
           (*vec)->as.vector.data[ii] = object;
      }
 }
@@ -380,11 +732,7 @@ static void fast_read_fast_op(int fast_op_arity, bool has_next, lref_t reader, l
 {
      assert((fast_op_arity >= 0) && (fast_op_arity <= 2));
 
-     lref_t opcode_obj;
-     fast_read(reader, &opcode_obj, false);
-
-     if (!FIXNUMP(opcode_obj))
-          vmerror_fast_read("Expected fixnum for opcode.", reader, opcode_obj);
+     size_t opcode = fast_read_length(reader, "Expected fixnum for opcode.");
 
      lref_t op_arg1 = NIL;
      lref_t op_arg2 = NIL;
@@ -399,7 +747,7 @@ static void fast_read_fast_op(int fast_op_arity, bool has_next, lref_t reader, l
      if (has_next)
           fast_read(reader, &next, false);
 
-     *fop = fast_op((int) FIXNM(opcode_obj), op_arg1, op_arg2, next);
+     *fop = fast_op((int) opcode, op_arg1, op_arg2, next);
 }
 
 static void fast_read_structure(lref_t reader, lref_t * st)
@@ -410,15 +758,11 @@ static void fast_read_structure(lref_t reader, lref_t * st)
      if (!CONSP(st_meta))
           vmerror_fast_read("Expected list for structure metadata", reader, st_meta);
 
-     lref_t st_length;
-     fast_read(reader, &st_length, false);
+     size_t st_length = fast_read_length(reader, "Expected fixnum for structure length");
 
-     if (!FIXNUMP(st_length))
-          vmerror_fast_read("Expected fixnum for structure length", reader, st_length);
+     *st = lstructurecons(vectorcons(st_length, NIL), st_meta);
 
-     *st = lstructurecons(vectorcons(FIXNM(st_length), NIL), st_meta);
-
-     for (fixnum_t ii = 0; ii < FIXNM(st_length); ii++)
+     for (size_t ii = 0; ii < st_length; ii++)
      {
           lref_t object;
           fast_read(reader, &object, false);
@@ -494,8 +838,14 @@ static void fast_read_to_newline(lref_t reader)
      _TCHAR ch = _T('\0');
 
      while ((ch != _T('\n')) && (ch != _T('\r')))
-          if (read_bytes(FASL_READER_PORT(reader), &ch, sizeof(_TCHAR)) == 0)
+     {
+          const uint8_t *bytes = fast_read_raw(reader, sizeof(_TCHAR));
+
+          if (bytes == NULL)
                break;
+
+          ch = (_TCHAR) bytes[0];
+     }
 }
 
 static void fast_read_macro(lref_t reader, lref_t * retval)
@@ -504,57 +854,201 @@ static void fast_read_macro(lref_t reader, lref_t * retval)
      fast_read(reader, &macro_transformer, false);
 
      if (!CLOSUREP(macro_transformer))
-          vmerror_fast_read("malformed macro, bad transformer", macro_transformer, false);
+          vmerror_fast_read("malformed macro, bad transformer", reader, macro_transformer);
 
      *retval = macrocons(macro_transformer);
 }
 
-/* REVISIT: Fasl table entries move around upon resize, which can screw up FASL load if
- * the loader as a pointer into the fasl table during a resize. */
+static lref_t *fast_read_table_entry(lref_t reader, lref_t * chunk)
+{
+     size_t index = fast_read_length(reader, "Expected fixnum >= 0 for FASL table index");
+
+     return fasl_table_entry(reader, index, chunk);
+}
 
-static void fasl_ensure_valid_table_index(lref_t reader, size_t index)
+/* Read an object with an opcode that has FASL_OP_RECORD added to it,
+ * recording it before any of its components are read. */
+static void fast_read_recorded(lref_t reader, enum fasl_opcode_t opcode, size_t location,
+                               lref_t * retval)
 {
-     if (NULLP(FASL_READER_STREAM(reader)->table))
+     if (FASL_READER_STREAM(reader)->replaying)
      {
-          FASL_READER_STREAM(reader)->table =
-               vectorcons((index >=
-                           DEFAULT_FASL_TABLE_SIZE) ? index +
-                          DEFAULT_FASL_TABLE_SIZE : DEFAULT_FASL_TABLE_SIZE, NIL);
+          fast_unread_opcode(reader, (enum fasl_opcode_t) (opcode - FASL_OP_RECORD));
+          fast_read(reader, retval, false);
+
+          return;
      }
-     else
+
+     lref_t chunk;
+     lref_t *entry = fast_record_object(reader, location, &chunk);
+
+     fast_unread_opcode(reader, (enum fasl_opcode_t) (opcode - FASL_OP_RECORD));
+     fast_read(reader, entry, false);
+
+     gc_write_barrier(chunk, *entry);
+
+     *retval = *entry;
+}
+
+/* Reread the object at <offset>, which wasn't recorded because the
+ * reader skipped over it, or started after it. Only interned symbols
+ * and packages are referred to like this, and rereading them finds the
+ * same object. Anything they in turn refer to is reread too. */
+static void fast_reread_object(lref_t reader, size_t offset, lref_t * retval)
+{
+     struct fasl_stream_t *stream = FASL_READER_STREAM(reader);
+     size_t location = stream->record_base + offset;
+
+     if ((stream->buffer != NULL)
+         || (location < stream->window_base)
+         || (location - stream->window_base >= stream->window_pos))
+          vmerror_fast_read("reference to an object that was not recorded", reader, fixcons(offset));
+
+     size_t window_pos = stream->window_pos;
+     bool replaying = stream->replaying;
+
+     stream->window_pos = location - stream->window_base;
+     stream->replaying = true;
+
+     fast_read(reader, retval, false);
+
+     stream->window_pos = window_pos;
+     stream->replaying = replaying;
+
+     if (!((SYMBOLP(*retval) && !NULLP(SYMBOL_HOME(*retval))) || PACKAGEP(*retval)))
+          vmerror_fast_read("reference to an object that was not recorded", reader, fixcons(offset));
+}
+
+static void fast_read_record_reference(lref_t reader, lref_t * retval)
+{
+     struct fasl_stream_t *stream = FASL_READER_STREAM(reader);
+
+     size_t offset = fast_read_length(reader, "Expected fixnum offset for FASL record reference");
+
+     size_t lo = 0;
+     size_t hi = stream->record_count;
+
+     while (lo < hi)
      {
-          lref_t fasl_table = FASL_READER_STREAM(reader)->table;
-          assert(VECTORP(fasl_table));
-          size_t old_len = fasl_table->as.vector.dim;
+          size_t mid = lo + (hi - lo) / 2;
 
-          if (index >= old_len)
-          {
-               size_t new_len =
-                   (index >= old_len * 2) ? index + DEFAULT_FASL_TABLE_SIZE : (old_len * 2);
+          if (stream->record_offsets[mid] < offset)
+               lo = mid + 1;
+          else
+               hi = mid;
+     }
 
-               FASL_READER_STREAM(reader)->table =
-                    vector_resize(fasl_table, new_len > SIZE_MAX ? SIZE_MAX : (size_t) new_len, NIL);
-          }
+     if ((lo == stream->record_count) || (stream->record_offsets[lo] != offset))
+     {
+          fast_reread_object(reader, offset, retval);
+
+          return;
      }
 
-     assert(VECTORP(FASL_READER_STREAM(reader)->table));
-     assert(index < (FASL_READER_STREAM(reader)->table)->as.vector.dim);
+     lref_t chunk;
+
+     *retval = *fasl_table_entry(reader, lo, &chunk);
 }
 
-static fixnum_t fast_read_table_index(lref_t reader)
+static void fast_read_format(lref_t reader)
 {
-     lref_t index;
-     fast_read(reader, &index, false);
+     const uint8_t *bytes = fast_read_raw(reader, 1);
 
-     if (!FIXNUMP(index))
-          vmerror_fast_read("Expected fixnum for FASL table index", reader, index);
+     if (bytes == NULL)
+          vmerror_fast_read("EOF during FASL format", reader, NIL);
 
-     if (FIXNM(index) < 0)
-          vmerror_fast_read("FASL table indicies must be >=0", reader, index);
+     if ((bytes[0] < 1) || (bytes[0] > FASL_FORMAT_VERSION))
+          vmerror_fast_read("unsupported FASL format version", reader, fixcons(bytes[0]));
 
-     fasl_ensure_valid_table_index(reader, (size_t) FIXNM(index));
+     FASL_READER_STREAM(reader)->format_version = bytes[0];
+     FASL_READER_STREAM(reader)->deferred_block = NIL;
+}
 
-     return FIXNM(index);
+/* A deferred object is read as it comes, unless the reader reads in
+ * place. In that case, the object's bytes will still be there when it's
+ * needed, and it's skipped. Objects of length zero share structure with
+ * the rest of the stream, and are always read as they come. */
+static void fast_read_deferred(lref_t reader, lref_t * retval)
+{
+     struct fasl_stream_t *stream = FASL_READER_STREAM(reader);
+     const uint8_t *bytes = fast_read_raw(reader, sizeof(uint32_t));
+
+     if (bytes == NULL)
+          vmerror_fast_read("EOF during deferred object", reader, NIL);
+
+     size_t length = (size_t) io_decode_uint32(bytes);
+     size_t position = fasl_reader_position(reader);
+
+     if ((length == 0) || !interp.fasl_lazy_load || (stream->buffer != NULL))
+     {
+          fast_read(reader, retval, false);
+
+          if ((length != 0) && (fasl_reader_position(reader) != position + length))
+               vmerror_fast_read("deferred object of the wrong length", reader, fixcons(length));
+
+          return;
+     }
+
+     if (length > stream->window_length - stream->window_pos)
+          vmerror_fast_read("incomplete deferred object", reader, fixcons(length));
+
+     if (NULLP(stream->deferred_block))
+     {
+          lref_t block = lcons(fixcons(stream->record_base), fixcons(stream->format_version));
+
+          gc_write_barrier(reader, block);
+          stream->deferred_block = block;
+     }
+
+     stream->window_pos += length;
+
+     *retval = fast_op(FOP_DEFERRED, reader, fixcons(position), stream->deferred_block);
+}
+
+/* Read the object deferred by <fop>, a FOP_DEFERRED fast op, into <fop>
+ * itself. Every closure with the deferred body shares the fast op, so
+ * each sees the body once it's read. The object is read by a reader of
+ * its own, from the window of the reader that skipped it. */
+void fasl_load_deferred(lref_t fop)
+{
+     assert(FAST_OP_P(fop) && (fop->header.opcode == FOP_DEFERRED));
+
+     lref_t source = fop->as.fast_op.arg1;
+     lref_t block = fop->as.fast_op.next;
+     size_t position = (size_t) FIXNM(fop->as.fast_op.arg2);
+
+     struct fasl_stream_t *source_stream = FASL_READER_STREAM(source);
+
+     lref_t reader = faslreadercons(FASL_READER_PORT(source));
+     struct fasl_stream_t *stream = FASL_READER_STREAM(reader);
+
+     stream->window = source_stream->window;
+     stream->window_length = source_stream->window_length;
+     stream->window_base = source_stream->window_base;
+     stream->window_pos = position - source_stream->window_base;
+
+     stream->record_base = (size_t) FIXNM(CAR(block));
+     stream->format_version = (int) FIXNM(CDR(block));
+
+     dscwritef(DF_SHOW_FAST_LOAD_FORMS,
+               (_T("; DEBUG: FASL reading deferred object at ~cd\n"), (long) position));
+
+     lref_t object;
+     fast_read(reader, &object, false);
+
+     if (!FAST_OP_P(object))
+          vmerror_fast_read("deferred object is not a fast op", reader, object);
+
+     fop->header.opcode = object->header.opcode;
+
+     gc_write_barrier(fop, object->as.fast_op.arg1);
+     fop->as.fast_op.arg1 = object->as.fast_op.arg1;
+
+     gc_write_barrier(fop, object->as.fast_op.arg2);
+     fop->as.fast_op.arg2 = object->as.fast_op.arg2;
+
+     gc_write_barrier(fop, object->as.fast_op.next);
+     fop->as.fast_op.next = object->as.fast_op.next;
 }
 
 static void fast_read_loader_definition(lref_t reader, enum fasl_opcode_t opcode)
@@ -594,6 +1088,7 @@ static void fast_loader_stack_push(lref_t reader, lref_t val)
      if (FASL_READER_STREAM(reader)->sp == FAST_LOAD_STACK_DEPTH - 1)
           vmerror_fast_read(_T("Fast loader stack overflow."), reader, NIL);
 
+     gc_write_barrier(reader, val);
      FASL_READER_STREAM(reader)->stack[FASL_READER_STREAM(reader)->sp] = val;
      FASL_READER_STREAM(reader)->sp++;
 }
@@ -653,12 +1148,16 @@ static void fast_read_loader_application(lref_t reader, enum fasl_opcode_t opcod
 
      dscwritef(DF_SHOW_FAST_LOAD_FORMS, (_T("; DEBUG: FASL applying ~s (argc=~cd)\n"), argv[0], argc));
 
-     FASL_READER_STREAM(reader)->accum = lapply(argc + 1, argv);
+     lref_t accum = lapply(argc + 1, argv);
+
+     gc_write_barrier(reader, accum);
+     FASL_READER_STREAM(reader)->accum = accum;
 }
 
 static void fast_read(lref_t reader, lref_t * retval, bool allow_loader_ops /* = false */ )
 {
-     lref_t *fasl_table_entry = NULL;
+     lref_t *entry = NULL;
+     lref_t chunk;
 
      *retval = NIL;
 
@@ -677,10 +1176,9 @@ static void fast_read(lref_t reader, lref_t * retval, bool allow_loader_ops /* =
           /*  Assume we're going to complete the read unless we find out otherwise.. */
           current_read_complete = true;
 
-          size_t opcode_location = PORT_BYTES_READ(FASL_READER_PORT(reader));
+          size_t opcode_location = fast_read_opcode_location(reader);
 
           enum fasl_opcode_t opcode = fast_read_opcode(reader);
-          fixnum_t index = 0;
           lref_t name;
 
           if (DEBUG_FLAG(DF_FASL_SHOW_OPCODES))
@@ -710,6 +1208,10 @@ static void fast_read(lref_t reader, lref_t * retval, bool allow_loader_ops /* =
                fast_read_character(reader, retval);
                break;
 
+          case FASL_OP_CONS:
+               fast_read_cons(reader, retval);
+               break;
+
           case FASL_OP_LIST:
                fast_read_list(reader, false, retval);
                break;
@@ -783,26 +1285,32 @@ static void fast_read(lref_t reader, lref_t * retval, bool allow_loader_ops /* =
                break;
 
           case FASL_OP_FAST_OP_0:
+          case FASL_OP_OLD_FAST_OP_0:
                fast_read_fast_op(0, false, reader, retval);
                break;
 
           case FASL_OP_FAST_OP_1:
+          case FASL_OP_OLD_FAST_OP_1:
                fast_read_fast_op(1, false, reader, retval);
                break;
 
           case FASL_OP_FAST_OP_2:
+          case FASL_OP_OLD_FAST_OP_2:
                fast_read_fast_op(2, false, reader, retval);
                break;
 
           case FASL_OP_FAST_OP_0N:
+          case FASL_OP_OLD_FAST_OP_0N:
                fast_read_fast_op(0, true, reader, retval);
                break;
 
           case FASL_OP_FAST_OP_1N:
+          case FASL_OP_OLD_FAST_OP_1N:
                fast_read_fast_op(1, true, reader, retval);
                break;
 
           case FASL_OP_FAST_OP_2N:
+          case FASL_OP_OLD_FAST_OP_2N:
                fast_read_fast_op(2, true, reader, retval);
                break;
 
@@ -820,27 +1328,37 @@ static void fast_read(lref_t reader, lref_t * retval, bool allow_loader_ops /* =
 
           case FASL_OP_RESET_READER_DEFS:
                FASL_READER_STREAM(reader)->table = NIL;
+               FASL_READER_STREAM(reader)->record_count = 0;
+               FASL_READER_STREAM(reader)->record_base = opcode_location;
+               FASL_READER_STREAM(reader)->deferred_block = NIL;
                current_read_complete = false;
                break;
 
-          case FASL_OP_READER_DEFINITION:
-               index = fast_read_table_index(reader);
+          case FASL_OP_FORMAT:
+               fast_read_format(reader);
+               current_read_complete = false;
+               break;
 
-               fasl_table_entry = &(FASL_READER_STREAM(reader)->table->as.vector.data[index]);
+          case FASL_OP_DEFERRED:
+               fast_read_deferred(reader, retval);
+               break;
+
+          case FASL_OP_READER_DEFINITION:
+               entry = fast_read_table_entry(reader, &chunk);
 
-               fast_read(reader, fasl_table_entry, allow_loader_ops);
+               fast_read(reader, entry, allow_loader_ops);
 
-               /* This should throw if the FASL table was resized
-                * during the call to read. */
-               assert(fasl_table_entry == &(FASL_READER_STREAM(reader)->table->as.vector.data[index]));
+               gc_write_barrier(chunk, *entry);
 
-               *retval = *fasl_table_entry;
+               *retval = *entry;
                break;
 
           case FASL_OP_READER_REFERENCE:
-               index = fast_read_table_index(reader);
+               *retval = *fast_read_table_entry(reader, &chunk);
+               break;
 
-               *retval = FASL_READER_STREAM(reader)->table->as.vector.data[index];
+          case FASL_OP_RECORD_REFERENCE:
+               fast_read_record_reference(reader, retval);
                break;
 
           case FASL_OP_EOF:
@@ -891,7 +1409,15 @@ static void fast_read(lref_t reader, lref_t * retval, bool allow_loader_ops /* =
                break;
 
           default:
-               vmerror_fast_read("invalid opcode", reader, fixcons(opcode));
+               /*  The small fixnums run up to FASL_OP_RECORD. Every opcode
+                *  from there to the reader ops is an object opcode with
+                *  FASL_OP_RECORD added. */
+               if ((opcode >= FASL_OP_SMALL_FIXNUM) && (opcode < FASL_OP_RECORD))
+                    *retval = fixcons(opcode - FASL_OP_SMALL_FIXNUM);
+               else if ((opcode >= FASL_OP_RECORD) && (opcode < FASL_OP_RESET_READER_DEFS))
+                    fast_read_recorded(reader, opcode, opcode_location, retval);
+               else
+                    vmerror_fast_read("invalid opcode", reader, fixcons(opcode));
           }
      }
 }
@@ -0,0 +1,191 @@
+/*
+ * hash-bench.c --
+ *
+ * A micro-benchmark comparing the two hash table layouts on identity
+ * hashes. Tables of each layout are filled to a range of load factors
+ * up to HASH_MAX_LOAD_FACTOR, and then timed on lookups of keys that
+ * are present and keys that are not. Then tables of each layout are
+ * filled with BENCH_FILL_KEYS keys, timing the slowest insertion along
+ * with the average:
+ *
+ *   ./hash-bench
+ *
+ * (C) Copyright 2001-2014 East Coast Toolworks Inc.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "scan-private.h"
+
+enum
+{
+     /*  Tables are filled to at least this many entries before timing.
+      *  This is the first size both layouts grow to, past the point at
+      *  which tables stop growing by HASH_LARGE_ENLARGE_FACTOR. */
+     BENCH_MIN_TABLE_SIZE = 262144,
+
+     /*  Load factors below this can't be had at BENCH_MIN_TABLE_SIZE */
+     BENCH_MIN_LOAD_FACTOR = 40,
+
+     /*  The number of keys allocated for the tables, and again for misses */
+     BENCH_KEY_COUNT = 4 * BENCH_MIN_TABLE_SIZE,
+
+     /*  The number of lookups timed at each load factor */
+     BENCH_LOOKUPS = 4000000,
+
+     /*  The number of keys inserted when timing insertions */
+     BENCH_FILL_KEYS = 4000000
+};
+
+static lref_t bench_keys = NULL;
+
+static size_t table_size(lref_t hash)
+{
+     return hash->as.hash.table->mask + 1;
+}
+
+/* The order in which keys are looked up. Keys are allocated in
+ * sequence, so looking them up in that order would favor layouts that
+ * keep them in address order. */
+static size_t lookup_order[BENCH_LOOKUPS];
+
+/* Fill a new identity hash until it has at least BENCH_MIN_TABLE_SIZE
+ * entries, and another key would take it past <load_percent> full. */
+static lref_t fill_table(enum hash_layout_t layout, size_t load_percent, size_t *count)
+{
+     lref_t hash = hashcons_with_layout(true, layout);
+     size_t ii;
+
+     for (ii = 0; ii < BENCH_KEY_COUNT; ii++)
+     {
+          if ((table_size(hash) >= BENCH_MIN_TABLE_SIZE)
+              && ((ii + 1) * 100 > table_size(hash) * load_percent))
+               break;
+
+          lhash_set(hash, bench_keys->as.vector.data[ii], fixcons(ii));
+     }
+
+     *count = ii;
+
+     return hash;
+}
+
+/* Returns the average time taken to look up a key, in nanoseconds.
+ * Keys are taken from the first <count> keys, or from the keys after
+ * the ones in the table if <hits> is false. */
+static double time_lookups(lref_t hash, size_t count, bool hits)
+{
+     lref_t *keys = bench_keys->as.vector.data + (hits ? 0 : BENCH_KEY_COUNT);
+     size_t found = 0;
+     lref_t val;
+
+     double start = sys_runtime();
+
+     for (size_t ii = 0; ii < BENCH_LOOKUPS; ii++)
+          if (hash_ref(hash, keys[lookup_order[ii] % count], &val))
+               found++;
+
+     double elapsed = sys_runtime() - start;
+
+     if (found != (hits ? (size_t) BENCH_LOOKUPS : 0))
+          panic("hash-bench lookup returned the wrong result");
+
+     return elapsed * 1e9 / BENCH_LOOKUPS;
+}
+
+static void bench_load_factor(size_t load_percent)
+{
+     static const struct
+     {
+          enum hash_layout_t layout;
+          const _TCHAR *name;
+     } layouts[] = {
+          { HASH_LINEAR_PROBING, _T("linear") },
+          { HASH_GROUP_PROBING,  _T("group") }
+     };
+
+     for (size_t ii = 0; ii < sizeof(layouts) / sizeof(layouts[0]); ii++)
+     {
+          size_t count;
+          lref_t hash = fill_table(layouts[ii].layout, load_percent, &count);
+
+          fprintf(stderr, "%-8s %5.1f%% %8lu %8lu %10.1f %10.1f\n",
+                  layouts[ii].name,
+                  100.0 * count / table_size(hash),
+                  (unsigned long) count,
+                  (unsigned long) table_size(hash),
+                  time_lookups(hash, count, true),
+                  time_lookups(hash, count, false));
+     }
+}
+
+/* Fill a new table with fixnum keys, and report the average and the
+ * longest time taken by an insertion, in nanoseconds. */
+static void bench_insertions(enum hash_layout_t layout, const _TCHAR *name)
+{
+     lref_t hash = hashcons_with_layout(layout == HASH_GROUP_PROBING, layout);
+     double slowest = 0.0;
+
+     double start = sys_realtime();
+
+     for (size_t ii = 0; ii < BENCH_FILL_KEYS; ii++)
+     {
+          double insert_start = sys_realtime();
+
+          lhash_set(hash, fixcons(ii), fixcons(ii));
+
+          slowest = MAX2(slowest, sys_realtime() - insert_start);
+     }
+
+     double elapsed = sys_realtime() - start;
+
+     fprintf(stderr, "%-8s %8lu %10.1f %12.1f\n",
+             name,
+             (unsigned long) table_size(hash),
+             elapsed * 1e9 / BENCH_FILL_KEYS,
+             slowest * 1e9);
+}
+
+int _tmain(int argc, _TCHAR * argv[])
+{
+     sys_init();
+     init0(argc, argv, DF_NONE);
+
+     gc_protect(_T("bench-keys"), &bench_keys, 1);
+
+     bench_keys = vectorcons(2 * BENCH_KEY_COUNT, NIL);
+
+     for (size_t ii = 0; ii < 2 * BENCH_KEY_COUNT; ii++)
+     {
+          lref_t key = lcons(NIL, NIL);
+
+          gc_write_barrier(bench_keys, key);
+          bench_keys->as.vector.data[ii] = key;
+     }
+
+     srand(1);
+
+     for (size_t ii = 0; ii < BENCH_LOOKUPS; ii++)
+          lookup_order[ii] = (size_t) rand() * ((size_t) RAND_MAX + 1) + (size_t) rand();
+
+     fprintf(stderr, ";;; hash-bench - %s\n", scan_vm_build_id_string());
+     fprintf(stderr, "layout     load  entries     size    hit-ns    miss-ns\n");
+
+     for (size_t load = BENCH_MIN_LOAD_FACTOR; load < HASH_MAX_LOAD_FACTOR; load += 10)
+          bench_load_factor(load);
+
+     bench_load_factor(HASH_MAX_LOAD_FACTOR);
+
+     fprintf(stderr, "\nlayout       size  insert-ns   slowest-ns\n");
+
+     bench_insertions(HASH_LINEAR_PROBING, _T("linear"));
+     bench_insertions(HASH_GROUP_PROBING, _T("group"));
+
+     shutdown();
+
+     return 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * hash-stress.c --
+ *
+ * A stress test and benchmark for concurrent hash tables. A number of
+ * reader threads look keys up in a concurrent identity hash while one
+ * writer thread repeatedly clears it, fills it and removes half of its
+ * keys, so the table is resized under the readers over and over:
+ *
+ *   ./hash-stress [readers]
+ *
+ * Every value stored in the table is the index of its key, and half of
+ * the keys are never stored, so readers can check each lookup. The
+ * same lookups are then timed without the writer.
+ *
+ * (C) Copyright 2001-2014 East Coast Toolworks Inc.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ */
+
+#include <memory.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "scan-private.h"
+
+enum
+{
+     /*  The number of keys the writer stores. As many again are never stored. */
+     STRESS_KEY_COUNT = 65536,
+
+     /*  The number of times the writer refills the table */
+     STRESS_WRITER_ROUNDS = 64,
+
+     STRESS_DEFAULT_READERS = 4,
+     STRESS_MAX_READERS = 64
+};
+
+static lref_t stress_keys = NULL;
+static lref_t stress_hash = NULL;
+
+/*  Set to non-NULL once the writer (or the timer standing in for it)
+ *  is done. */
+static void *volatile stress_done;
+
+static bool stress_writing;
+static double stress_phase_time;
+
+struct reader_stats_t
+{
+     size_t lookups;
+     size_t hits;
+     size_t errors;
+};
+
+static struct reader_stats_t reader_stats[STRESS_MAX_READERS + 1];
+
+static lref_t stress_key(size_t index)
+{
+     return stress_keys->as.vector.data[index];
+}
+
+static void fill_table(void)
+{
+     for (size_t ii = 0; ii < STRESS_KEY_COUNT; ii++)
+          lhash_set(stress_hash, stress_key(ii), fixcons(ii));
+}
+
+static void run_writer(void)
+{
+     for (size_t round = 0; round < STRESS_WRITER_ROUNDS; round++)
+     {
+          lhash_clear(stress_hash);
+
+          fill_table();
+
+          for (size_t ii = round & 1; ii < STRESS_KEY_COUNT; ii += 2)
+               lhash_remove(stress_hash, stress_key(ii));
+     }
+}
+
+static void run_reader(struct reader_stats_t *stats, uint64_t seed)
+{
+     uint64_t state = seed;
+
+     while (sys_atomic_load_ptr(&stress_done) == NULL)
+     {
+          for (size_t ii = 0; ii < 1024; ii++)
+          {
+               state ^= state << 13;
+               state ^= state >> 7;
+               state ^= state << 17;
+
+               size_t index = (size_t) (state % (2 * STRESS_KEY_COUNT));
+               lref_t val;
+
+               stats->lookups++;
+
+               if (!hash_ref(stress_hash, stress_key(index), &val))
+                    continue;
+
+               stats->hits++;
+
+               if ((index >= STRESS_KEY_COUNT) || !EQ(val, fixcons(index)))
+                    stats->errors++;
+          }
+     }
+}
+
+static void stress_thread(size_t thread_index, void *arg)
+{
+     UNREFERENCED(arg);
+
+     if (thread_index > 0)
+     {
+          run_reader(&reader_stats[thread_index], 88172645463325252ULL + thread_index);
+          return;
+     }
+
+     double start = sys_realtime();
+
+     if (stress_writing)
+          run_writer();
+     else
+          sys_sleep((uintptr_t) (stress_phase_time * 1000));
+
+     stress_phase_time = sys_realtime() - start;
+
+     sys_atomic_store_ptr(&stress_done, (void *) &stress_done);
+}
+
+static void run_phase(size_t readers, bool writing)
+{
+     memset(reader_stats, 0, sizeof(reader_stats));
+
+     stress_done = NULL;
+     stress_writing = writing;
+
+     sys_run_threads(readers + 1, stress_thread, NULL);
+
+     struct reader_stats_t total = { 0, 0, 0 };
+
+     for (size_t ii = 1; ii <= readers; ii++)
+     {
+          total.lookups += reader_stats[ii].lookups;
+          total.hits += reader_stats[ii].hits;
+          total.errors += reader_stats[ii].errors;
+     }
+
+     fprintf(stderr, "%-8s %8.3f %12lu %6.1f%% %10.1f\n",
+             writing ? "writer" : "none",
+             stress_phase_time,
+             (unsigned long) total.lookups,
+             (total.lookups > 0) ? 100.0 * total.hits / total.lookups : 0.0,
+             (total.lookups > 0) ? stress_phase_time * readers * 1e9 / total.lookups : 0.0);
+
+     if (total.errors > 0)
+          panic("hash-stress reader found a wrong value");
+}
+
+/* Check the table the writer left behind. Its last round removed the
+ * odd keys. */
+static void check_table(void)
+{
+     for (size_t ii = 0; ii < 2 * STRESS_KEY_COUNT; ii++)
+     {
+          lref_t val;
+          bool expected = (ii < STRESS_KEY_COUNT) && ((ii & 1) == 0);
+
+          if (hash_ref(stress_hash, stress_key(ii), &val) != expected)
+               panic("hash-stress table has the wrong keys");
+
+          if (expected && !EQ(val, fixcons(ii)))
+               panic("hash-stress table has a wrong value");
+     }
+
+     if (hash_length(stress_hash) != STRESS_KEY_COUNT / 2)
+          panic("hash-stress table has the wrong count");
+}
+
+int _tmain(int argc, _TCHAR * argv[])
+{
+     size_t readers = STRESS_DEFAULT_READERS;
+
+     if ((argc > 1) && (argv[1][0] != _T('-')))
+          readers = MIN2((size_t) atoi(argv[1]), (size_t) STRESS_MAX_READERS);
+
+     sys_init();
+     init0(argc, argv, DF_NONE);
+
+     gc_protect(_T("stress-keys"), &stress_keys, 1);
+     gc_protect(_T("stress-hash"), &stress_hash, 1);
+
+     stress_keys = vectorcons(2 * STRESS_KEY_COUNT, NIL);
+
+     for (size_t ii = 0; ii < 2 * STRESS_KEY_COUNT; ii++)
+     {
+          lref_t key = lcons(NIL, NIL);
+
+          gc_write_barrier(stress_keys, key);
+          stress_keys->as.vector.data[ii] = key;
+     }
+
+     stress_hash = concurrent_hashcons(true);
+
+     fprintf(stderr, ";;; hash-stress - %s\n", scan_vm_build_id_string());
+     fprintf(stderr, ";;; %lu readers, %d keys, %d writer rounds\n",
+             (unsigned long) readers, STRESS_KEY_COUNT, STRESS_WRITER_ROUNDS);
+     fprintf(stderr, "writes     time      lookups   hits  lookup-ns\n");
+
+     run_phase(readers, true);
+     check_table();
+
+     fill_table();
+     run_phase(readers, false);
+
+     shutdown();
+
+     return 0;
+}
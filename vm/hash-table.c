@@ -11,11 +11,21 @@
  * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
  */
 
+#include <memory.h>
+
 #include "scan-private.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#  define HASH_GROUP_SSE2
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#  define HASH_GROUP_NEON
+#  include <arm_neon.h>
+#endif
+
 INLINE fixnum_t HASH_COMBINE(fixnum_t _h1, fixnum_t _h2)
 {
-     return (_h1 * 17 + 1) ^ _h2;
+     return (fixnum_t) (((unsigned_fixnum_t) _h1 * 17 + 1) ^ (unsigned_fixnum_t) _h2);
 }
 
 INLINE size_t HASH_MASK(lref_t obj)
@@ -57,6 +67,27 @@ INLINE bool HASH_SHALLOW(lref_t hash)
      return hash->as.hash.table->is_shallow;
 }
 
+INLINE enum hash_weakness_t HASH_WEAKNESS(lref_t hash)
+{
+     assert(HASHP(hash));
+
+     return hash->as.hash.table->weakness;
+}
+
+INLINE bool HASH_CONCURRENT(lref_t hash)
+{
+     assert(HASHP(hash));
+
+     return hash->as.hash.table->is_concurrent;
+}
+
+INLINE size_t HASH_DELETED(lref_t hash)
+{
+     assert(HASHP(hash));
+
+     return hash->as.hash.table->deleted;
+}
+
 INLINE void SET_HASH_COUNT(lref_t hash, unsigned int count)
 {
      assert(HASHP(hash));
@@ -75,6 +106,7 @@ static void init_hash_entry(struct hash_entry_t * entry)
 {
      entry->key = UNBOUND_MARKER;
      entry->val = UNBOUND_MARKER;
+     entry->hash = 0;
 }
 
 static void delete_hash_entry(struct hash_entry_t * entry)
@@ -98,10 +130,23 @@ static bool hash_entry_deleted_p(struct hash_entry_t * entry)
      return UNBOUND_MARKER_P(entry->key) && NULLP(entry->val);
 }
 
+/* Entries of concurrent tables can have a key and no value. (See
+ * hash_concurrent_remove.) */
+static bool hash_entry_bound_p(struct hash_entry_t * entry)
+{
+     return hash_entry_used_p(entry) && !UNBOUND_MARKER_P(entry->val);
+}
+
+/* Iteration finishes any incremental resize in progress first, which
+ * costs no more than the iteration itself. (See hash_migrate.) */
+static void hash_finish_migration(lref_t hash);
+
 void hash_iter_begin(lref_t hash, hash_iter_t * iter)
 {
      assert(HASHP(hash));
 
+     hash_finish_migration(hash);
+
      *iter = 0;
 }
 
@@ -111,7 +156,7 @@ bool hash_iter_next(lref_t hash, hash_iter_t * iter, lref_t * key, lref_t * val)
 
      while (*iter < HASH_SIZE(hash))
      {
-          if (hash_entry_used_p(HASH_ENTRY(hash, *iter)))
+          if (hash_entry_bound_p(HASH_ENTRY(hash, *iter)))
           {
                if (key)
                     *key = HASH_ENTRY(hash, *iter)->key;
@@ -130,6 +175,79 @@ bool hash_iter_next(lref_t hash, hash_iter_t * iter, lref_t * key, lref_t * val)
      return false;
 }
 
+/*** String hashing
+ *
+ * Strings are hashed a word at a time in the manner of xxHash: each
+ * word is multiplied and rotated into an accumulator, and the result
+ * goes through a final avalanche so that every bit of the input can
+ * affect every bit of the hash. A string caches its hash in its cell
+ * until its contents next change. Symbols hash as their print names,
+ * which are hashed as each symbol is made, so hashing a symbol never
+ * has to look at its characters.
+ */
+
+static const uint64_t HASH_PRIME_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t HASH_PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t HASH_PRIME_3 = 0x165667B19E3779F9ULL;
+static const uint64_t HASH_PRIME_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t HASH_PRIME_5 = 0x27D4EB2F165667C5ULL;
+
+static uint64_t hash_rotate_left(uint64_t x, int bits)
+{
+     return (x << bits) | (x >> (64 - bits));
+}
+
+uint64_t hash_bytes(const void *buf, size_t len)
+{
+     const uint8_t *bytes = (const uint8_t *) buf;
+     uint64_t hash = HASH_PRIME_5 + (uint64_t) len;
+     size_t ii = 0;
+
+     for (; ii + sizeof(uint64_t) <= len; ii += sizeof(uint64_t))
+     {
+          uint64_t word;
+
+          memcpy(&word, bytes + ii, sizeof(word));
+
+          hash ^= hash_rotate_left(word * HASH_PRIME_2, 31) * HASH_PRIME_1;
+          hash = hash_rotate_left(hash, 27) * HASH_PRIME_1 + HASH_PRIME_4;
+     }
+
+     for (; ii < len; ii++)
+     {
+          hash ^= bytes[ii] * HASH_PRIME_5;
+          hash = hash_rotate_left(hash, 11) * HASH_PRIME_1;
+     }
+
+     hash ^= hash >> 33;
+     hash *= HASH_PRIME_2;
+     hash ^= hash >> 29;
+     hash *= HASH_PRIME_3;
+     hash ^= hash >> 32;
+
+     return hash;
+}
+
+/* The hash of a string holding the <length> characters at <chars>.
+ * Hashes are positive fixnums, since 0 marks a string's hash as not
+ * yet known. */
+fixnum_t sxhash_chars(const _TCHAR *chars, size_t length)
+{
+     fixnum_t hash = (fixnum_t) (hash_bytes(chars, length * sizeof(_TCHAR)) & FIXNUM_MAX);
+
+     return (hash == 0) ? 1 : hash;
+}
+
+fixnum_t sxhash_string(lref_t str)
+{
+     assert(STRINGP(str));
+
+     if (str->as.string.hash == 0)
+          str->as.string.hash = sxhash_chars(str->as.string.data, str->as.string.dim);
+
+     return str->as.string.hash;
+}
+
 fixnum_t sxhash_eq(lref_t obj)
 {
      /* Slice off the tag bits, assuming that hashes will be mostly
@@ -172,7 +290,7 @@ fixnum_t sxhash(lref_t obj)
           break;
 
      case TC_SYMBOL:
-          hash = sxhash(SYMBOL_PNAME(obj));
+          hash = sxhash_string(SYMBOL_PNAME(obj));
           break;
 
      case TC_SUBR:
@@ -180,8 +298,7 @@ fixnum_t sxhash(lref_t obj)
           break;
 
      case TC_STRING:
-          for (ii = 0; ii < obj->as.string.dim; ii++)
-               hash = (hash << 5) - hash + obj->as.string.data[ii];
+          hash = sxhash_string(obj);
           break;
 
      case TC_VECTOR:
@@ -197,6 +314,8 @@ fixnum_t sxhash(lref_t obj)
           break;
 
      case TC_HASH:
+          hash_finish_migration(obj);
+
           for (ii = 0; ii < HASH_SIZE(obj); ii++)
           {
                hash = HASH_COMBINE(hash, sxhash(HASH_ENTRY(obj, ii)->key));
@@ -208,11 +327,8 @@ fixnum_t sxhash(lref_t obj)
           hash = 0;
      }
 
-     /*  REVISIT: still needed? */
-     if (hash < 0)
-          hash = -hash;
-
-     return hash;
+     /*  Keep hashes positive, and small enough to be fixnums. */
+     return hash & FIXNUM_MAX;
 }
 
 lref_t lsxhash(lref_t obj, lref_t hash)       /*  if hash is bound, lsxhash matches its hash function */
@@ -245,6 +361,31 @@ lref_t lsxhash(lref_t obj, lref_t hash)       /*  if hash is bound, lsxhash matc
 
 }
 
+/* A key being looked up. Keys are usually objects, but a string key
+ * can also be looked up by its characters, without making a string of
+ * them. */
+struct hash_probe_t
+{
+     lref_t key;
+     const _TCHAR *chars;    /*  The characters of a string key, or NULL */
+     size_t length;
+};
+
+static bool hash_probe_matches(struct hash_table_t *table, const struct hash_probe_t *probe,
+                               lref_t entry_key)
+{
+     if (probe->chars != NULL)
+          return STRINGP(entry_key)
+               && (entry_key->as.string.dim == probe->length)
+               && (memcmp(entry_key->as.string.data, probe->chars,
+                          probe->length * sizeof(_TCHAR)) == 0);
+
+     if (table->is_shallow)
+          return EQ(probe->key, entry_key);
+     else
+          return equalp(probe->key, entry_key);
+}
+
 static size_t round_up_to_power_of_two(size_t val)
 {
      size_t rounded = 1;
@@ -260,36 +401,311 @@ static size_t round_up_to_power_of_two(size_t val)
      return rounded;
 }
 
+/*** Group probing
+ *
+ * Tables laid out for group probing keep a control byte for each
+ * entry, after the entries themselves. The control byte of a used
+ * entry holds seven bits of its key's hash, and the others mark empty
+ * and deleted entries. The table is divided into groups of
+ * HASH_GROUP_WIDTH entries, and a lookup compares the control bytes of
+ * a whole group with its key's at once, with SIMD instructions where
+ * they're available. Only the entries with matching control bytes
+ * need their keys compared, and a lookup that reaches a group with an
+ * empty entry is done. Groups are probed in a triangular sequence,
+ * which visits every group of a power of two sized table.
+ *
+ * Identity hashes use this layout, since their keys are cheap to
+ * compare but poorly distributed. The entries are kept in the same
+ * form as they are in linearly probed tables, so iteration, binding
+ * vectors, and the collector don't need to know about the layout.
+ */
+
+#define HASH_GROUP_WIDTH 16
+
+enum
+{
+     HASH_CONTROL_EMPTY = 0x80,
+     HASH_CONTROL_DELETED = 0xFE
+};
+
+#if defined(HASH_GROUP_NEON)
+/* NEON match masks have four bits per entry, of which only the top
+ * one is kept. */
+#  define HASH_GROUP_MASK_SHIFT 2
+#else
+#  define HASH_GROUP_MASK_SHIFT 0
+#endif
+
+typedef uint64_t hash_group_mask_t;
+
+static size_t hash_group_mask_index(hash_group_mask_t mask)
+{
+#if defined(__GNUC__)
+     return (size_t) __builtin_ctzll(mask) >> HASH_GROUP_MASK_SHIFT;
+#else
+     size_t bit = 0;
+
+     while (!(mask & 1))
+     {
+          mask >>= 1;
+          bit++;
+     }
+
+     return bit >> HASH_GROUP_MASK_SHIFT;
+#endif
+}
+
+#if defined(HASH_GROUP_NEON)
+static hash_group_mask_t hash_group_neon_mask(uint8x16_t matches)
+{
+     uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(matches), 4);
+
+     return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0) & 0x8888888888888888ULL;
+}
+#endif
+
+/* Returns a mask of the entries in <group> with the control byte <control>. */
+static hash_group_mask_t hash_group_match(const uint8_t *group, uint8_t control)
+{
+#if defined(HASH_GROUP_SSE2)
+     __m128i bytes = _mm_loadu_si128((const __m128i *) group);
+
+     return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char) control)));
+#elif defined(HASH_GROUP_NEON)
+     return hash_group_neon_mask(vceqq_u8(vld1q_u8(group), vdupq_n_u8(control)));
+#else
+     hash_group_mask_t mask = 0;
+
+     for (size_t ii = 0; ii < HASH_GROUP_WIDTH; ii++)
+          if (group[ii] == control)
+               mask |= (hash_group_mask_t) 1 << ii;
+
+     return mask;
+#endif
+}
+
+/* Returns a mask of the empty and deleted entries in <group>, the ones
+ * with the high bit of their control byte set. */
+static hash_group_mask_t hash_group_match_free(const uint8_t *group)
+{
+#if defined(HASH_GROUP_SSE2)
+     return (uint32_t) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) group));
+#elif defined(HASH_GROUP_NEON)
+     return hash_group_neon_mask(vcltzq_s8(vreinterpretq_s8_u8(vld1q_u8(group))));
+#else
+     hash_group_mask_t mask = 0;
+
+     for (size_t ii = 0; ii < HASH_GROUP_WIDTH; ii++)
+          if (group[ii] & 0x80)
+               mask |= (hash_group_mask_t) 1 << ii;
+
+     return mask;
+#endif
+}
+
+/* Mix the bits of a hash, which for identity hashes are mostly in its
+ * low bits, so that both the group index and the control byte taken
+ * from it are well distributed. */
+static uint64_t hash_group_mix(fixnum_t hashed)
+{
+     uint64_t mixed = (uint64_t) hashed * 0x9E3779B97F4A7C15ULL;
+
+     return mixed ^ (mixed >> 32);
+}
+
+static uint8_t hash_group_control(uint64_t mixed)
+{
+     return (uint8_t) (mixed >> 57);
+}
+
+static size_t hash_group_count(struct hash_table_t *table)
+{
+     return (table->mask + 1) / HASH_GROUP_WIDTH;
+}
+
+static struct hash_entry_t *hash_group_lookup(struct hash_table_t *table,
+                                              const struct hash_probe_t *probe, fixnum_t hashed)
+{
+     uint64_t mixed = hash_group_mix(hashed);
+     uint8_t control = hash_group_control(mixed);
+     size_t group_mask = hash_group_count(table) - 1;
+     size_t group = (size_t) mixed & group_mask;
+
+     for (size_t step = 1; step <= group_mask + 1; step++)
+     {
+          size_t base = group * HASH_GROUP_WIDTH;
+          const uint8_t *group_control = &(table->control[base]);
+
+          for (hash_group_mask_t matches = hash_group_match(group_control, control);
+               matches;
+               matches &= matches - 1)
+          {
+               struct hash_entry_t *entry =
+                    &(table->data[base + hash_group_mask_index(matches)]);
+
+               if (entry->hash != hashed)
+                    continue;
+
+               if (hash_probe_matches(table, probe, entry->key))
+                    return entry;
+          }
+
+          if (hash_group_match(group_control, HASH_CONTROL_EMPTY))
+               break;
+
+          group = (group + step) & group_mask;
+     }
+
+     return NULL;
+}
+
+/* Insert a key known not to be in <table> into the first empty or
+ * deleted entry along its probe sequence. */
+static void hash_group_insert(struct hash_table_t *table, lref_t key, lref_t val, fixnum_t hashed)
+{
+     uint64_t mixed = hash_group_mix(hashed);
+     size_t group_mask = hash_group_count(table) - 1;
+     size_t group = (size_t) mixed & group_mask;
+
+     for (size_t step = 1;; step++)
+     {
+          size_t base = group * HASH_GROUP_WIDTH;
+          hash_group_mask_t available = hash_group_match_free(&(table->control[base]));
+
+          if (available)
+          {
+               size_t index = base + hash_group_mask_index(available);
+
+               if (table->control[index] == HASH_CONTROL_DELETED)
+                    table->deleted--;
+
+               table->control[index] = hash_group_control(mixed);
+               table->data[index].key = key;
+               table->data[index].val = val;
+               table->data[index].hash = hashed;
+
+               return;
+          }
+
+          group = (group + step) & group_mask;
+     }
+}
+
+/* Remove the entry at <index>. Lookups stop at any group with an empty
+ * entry, so the entry only needs to be marked as deleted if its group
+ * has none. */
+static void hash_group_delete(struct hash_table_t *table, size_t index)
+{
+     size_t base = index & ~(size_t) (HASH_GROUP_WIDTH - 1);
+
+     if (hash_group_match(&(table->control[base]), HASH_CONTROL_EMPTY))
+     {
+          table->control[index] = HASH_CONTROL_EMPTY;
+          init_hash_entry(&(table->data[index]));
+     }
+     else
+     {
+          table->control[index] = HASH_CONTROL_DELETED;
+          delete_hash_entry(&(table->data[index]));
+          table->deleted++;
+     }
+}
+
 static void clear_hash_data(struct hash_table_t *table)
 {
      for (size_t ii = 0; ii < table->mask + 1; ii++)
           init_hash_entry(&table->data[ii]);
+
+     if (table->control != NULL)
+          memset(table->control, HASH_CONTROL_EMPTY, table->mask + 1);
+
+     table->deleted = 0;
 }
 
-static struct hash_table_t *allocate_hash_data(size_t size)
+static struct hash_table_t *allocate_hash_data(size_t size, enum hash_layout_t layout)
 {
+     size_t control_size = (layout == HASH_GROUP_PROBING) ? size : 0;
+
      struct hash_table_t *table =
           gc_malloc(sizeof(struct hash_table_t)
-                    + size * sizeof(struct hash_entry_t));
+                    + size * sizeof(struct hash_entry_t)
+                    + control_size);
 
      table->mask = size - 1;
+     table->weakness = HASH_STRONG;
+     table->is_concurrent = false;
+     table->retired_next = NULL;
+     table->migrating = NULL;
+     table->migrate_index = 0;
+     table->stamp = 0;
+     table->control = (control_size > 0) ? (uint8_t *) &(table->data[size]) : NULL;
 
      clear_hash_data(table);
 
      return table;
 }
 
-lref_t hashcons(bool shallow)
+static enum hash_layout_t hash_layout(struct hash_table_t *table)
+{
+     return (table->control != NULL) ? HASH_GROUP_PROBING : HASH_LINEAR_PROBING;
+}
+
+/* The smallest size of a table with the given layout. Group probed
+ * tables need at least one full group. */
+static size_t hash_min_size(enum hash_layout_t layout)
+{
+     if (layout == HASH_GROUP_PROBING)
+          return MAX2((size_t) HASH_DEFAULT_INITIAL_SIZE, (size_t) HASH_GROUP_WIDTH);
+     else
+          return HASH_DEFAULT_INITIAL_SIZE;
+}
+
+lref_t hashcons_with_layout(bool shallow, enum hash_layout_t layout)
 {
      lref_t hash = new_cell(TC_HASH);
 
-     size_t size = round_up_to_power_of_two(HASH_DEFAULT_INITIAL_SIZE);
+     hash_init_cell(hash, shallow, layout, 0);
+
+     return hash;
+}
+
+/* Make <hash>, a hash cell allocated by the caller, an empty table
+ * with room for <count> entries. */
+void hash_init_cell(lref_t hash, bool shallow, enum hash_layout_t layout, size_t count)
+{
+     size_t size = round_up_to_power_of_two(hash_min_size(layout));
+
+     while (count > size * (HASH_MAX_LOAD_FACTOR / 100.0))
+          size *= 2;
 
-     hash->as.hash.table = allocate_hash_data(size);
+     hash->as.hash.table = allocate_hash_data(size, layout);
 
      SET_HASH_MASK(hash, size - 1);
      SET_HASH_SHALLOW(hash, shallow);
      SET_HASH_COUNT(hash, 0);
+}
+
+lref_t hashcons(bool shallow)
+{
+     return hashcons_with_layout(shallow, shallow ? HASH_GROUP_PROBING : HASH_LINEAR_PROBING);
+}
+
+/* Concurrent tables are linear probed, without Robin Hood placement.
+ * (See hash_concurrent_set.) */
+lref_t concurrent_hashcons(bool shallow)
+{
+     lref_t hash = hashcons_with_layout(shallow, HASH_LINEAR_PROBING);
+
+     hash->as.hash.table->is_concurrent = true;
+
+     return hash;
+}
+
+lref_t hashcons_with_weakness(bool shallow, enum hash_weakness_t weakness)
+{
+     lref_t hash = hashcons(shallow);
+
+     hash->as.hash.table->weakness = weakness;
 
      return hash;
 }
@@ -323,14 +739,39 @@ bool hash_equal(lref_t a, lref_t b)
      return true;
 }
 
-lref_t lmake_hash()
+/* Hashes are made concurrent by passing :concurrent to their
+ * constructor. */
+static lref_t make_hash_of_kind(bool shallow, lref_t kind)
+{
+     if (NULLP(kind) || FALSEP(kind))
+          return hashcons(shallow);
+
+     if (kind != keyword_intern(_T("concurrent")))
+          vmerror_arg_out_of_range(kind, _T(":concurrent"));
+
+     return concurrent_hashcons(shallow);
+}
+
+lref_t lmake_hash(lref_t kind)
+{
+     return make_hash_of_kind(false, kind);
+}
+
+lref_t lmake_identity_hash(lref_t kind)
+{
+     return make_hash_of_kind(true, kind);
+}
+
+/* Weak keys are compared by identity, since a key that is equal? to a
+ * dead key can't be used to find its entry once the entry is gone. */
+lref_t lmake_weak_key_hash()
 {
-     return hashcons(false);
+     return hashcons_with_weakness(true, HASH_WEAK_KEYS);
 }
 
-lref_t lmake_identity_hash()
+lref_t lmake_weak_value_hash()
 {
-     return hashcons(true);
+     return hashcons_with_weakness(false, HASH_WEAK_VALUES);
 }
 
 lref_t lhashp(lref_t obj)
@@ -341,127 +782,702 @@ lref_t lhashp(lref_t obj)
           return boolcons(false);
 }
 
-static fixnum_t href_index(bool shallow_p, size_t mask, lref_t key)
-{
-     fixnum_t index;
+/*** Robin Hood probing
+ *
+ * Entries are placed by linear probing from their home index, the low
+ * bits of their hash. On insertion, an entry that has probed further
+ * from its home than the entry in the slot it reaches takes that slot,
+ * and the displaced entry continues on in its place. This keeps every
+ * entry close to its home, and lets a lookup stop as soon as it
+ * reaches an entry closer to its own home than the key being sought
+ * would be. Each entry keeps the full hash of its key, so probing can
+ * skip entries without comparing keys, and resizing doesn't have to
+ * rehash them. Deleted entries keep their hash too, so that they still
+ * mark the length of the probe sequences running through them. They're
+ * counted, and purged once they take up too much of the table.
+ */
 
+static fixnum_t hash_key(bool shallow_p, lref_t key)
+{
      if (shallow_p)
-          index = sxhash_eq(key);
+          return sxhash_eq(key);
      else
-          index = sxhash(key);
-
-     return index & mask;
+          return sxhash(key);
 }
 
-static fixnum_t href_next_index(size_t mask, fixnum_t index)
+static size_t href_next_index(size_t mask, size_t index)
 {
      return (index + 1) & mask;
 }
 
-lref_t hash_set(lref_t table, lref_t key, lref_t value, bool check_for_expand);
-
-static bool enlarge_hash(lref_t hash)
+/* The number of slots <entry> has been displaced from its home
+ * index. */
+static size_t href_distance(size_t mask, struct hash_entry_t *entry, size_t index)
 {
-     assert(HASHP(hash));
+     return (index - (size_t) entry->hash) & mask;
+}
 
-     size_t current_size = HASH_SIZE(hash);
-     size_t new_size;
+static bool hash_entry_empty_p(struct hash_entry_t * entry)
+{
+     return hash_entry_unused_p(entry) && !hash_entry_deleted_p(entry);
+}
 
-     if (HASH_COUNT(hash) > HASH_SMALL_ENLARGE_THRESHOLD)
-          new_size = current_size * HASH_SMALL_ENLARGE_FACTOR;
-     else
-          new_size = current_size * HASH_LARGE_ENLARGE_FACTOR;
+/* Insert a key known not to be in <table>. */
+static void hash_insert_entry(struct hash_table_t *table, lref_t key, lref_t val, fixnum_t hashed)
+{
+     if (table->control != NULL)
+     {
+          hash_group_insert(table, key, val, hashed);
+          return;
+     }
 
-     if (new_size < current_size)
-          return false;
+     struct hash_entry_t carried = { key, val, hashed };
+     size_t mask = table->mask;
+     size_t distance = 0;
 
-     struct hash_table_t *new_data = allocate_hash_data(new_size);
+     for (size_t index = (size_t) hashed & mask;; index = href_next_index(mask, index), distance++)
+     {
+          struct hash_entry_t *entry = &(table->data[index]);
 
-     new_data->mask = new_size - 1;
-     new_data->is_shallow = HASH_SHALLOW(hash);
-     new_data->count = HASH_COUNT(hash);
+          if (hash_entry_empty_p(entry))
+          {
+               *entry = carried;
+               return;
+          }
 
-     lref_t key, val;
+          size_t entry_distance = href_distance(mask, entry, index);
 
-     hash_iter_t ii;
-     hash_iter_begin(hash, &ii);
-     while (hash_iter_next(hash, &ii, &key, &val))
-     {
-          for (fixnum_t index = href_index(HASH_SHALLOW(hash), new_size - 1, key);;
-               index = href_next_index(new_size - 1, index))
+          /*  A deleted entry can be reused by anything that would
+           *  otherwise take its slot. */
+          if (hash_entry_deleted_p(entry) && (entry_distance <= distance))
           {
-               struct hash_entry_t *entry = &(new_data->data[index]);
+               *entry = carried;
+               table->deleted--;
+               return;
+          }
 
-               if (hash_entry_unused_p(entry))
-               {
-                    entry->key = key;
-                    entry->val = val;
+          if (entry_distance < distance)
+          {
+               struct hash_entry_t displaced = *entry;
 
-                    break;
-               }
+               *entry = carried;
+               carried = displaced;
+               distance = entry_distance;
           }
      }
-
-     gc_free(hash->as.hash.table);
-
-     hash->as.hash.table = new_data;
-
-     return true;
 }
 
-static struct hash_entry_t *hash_lookup_entry(lref_t hash, lref_t key)
+/* Remove the deleted entry at <index>, shifting the entries that
+ * follow it back a slot toward their home indices. */
+static void hash_shift_back(struct hash_table_t *table, size_t index)
 {
-     assert(HASHP(hash));
+     size_t mask = table->mask;
 
-     for (fixnum_t index = href_index(HASH_SHALLOW(hash), HASH_MASK(hash), key);;
-          index = href_next_index(HASH_MASK(hash), index))
+     for (;;)
      {
-          struct hash_entry_t *entry = HASH_ENTRY(hash, index);
-
-          if (hash_entry_deleted_p(entry))
-               continue;
+          size_t next = href_next_index(mask, index);
+          struct hash_entry_t *entry = &(table->data[next]);
 
-          if (hash_entry_unused_p(entry))
+          if (hash_entry_empty_p(entry) || (href_distance(mask, entry, next) == 0))
                break;
 
-          if (HASH_SHALLOW(hash))
-          {
-               if (EQ(key, entry->key))
-                    return entry;
-          }
-          else
-          {
-               if (equalp(key, entry->key))
-                    return entry;
-          }
+          table->data[index] = *entry;
+          index = next;
      }
 
-     return NULL;
+     init_hash_entry(&(table->data[index]));
+
+     table->deleted--;
 }
 
-bool hash_ref(lref_t hash, lref_t key, lref_t *value_result)
+/* Delete an entry, leaving the other entries of the table in place. */
+static void hash_table_delete(struct hash_table_t *table, struct hash_entry_t *entry)
 {
-     struct hash_entry_t *entry = hash_lookup_entry(hash, key);
+     if (table->control != NULL)
+          hash_group_delete(table, (size_t) (entry - table->data));
+     else
+     {
+          delete_hash_entry(entry);
+          table->deleted++;
+     }
+}
 
-     if (entry == NULL)
-          return false;
+/*** Incremental resizing
+ *
+ * Enlarging a table rehashes all of its entries, which stalls the
+ * insertion that triggers it for as long as that takes. Tables of
+ * HASH_INCREMENTAL_RESIZE_SIZE entries or more are enlarged a little
+ * at a time instead. Their old entries are kept to one side, and each
+ * lookup, insertion and removal moves the next HASH_MIGRATE_STEP of
+ * them into the new entries, deleting them from the old ones so that
+ * the probe sequences of the rest stay intact. Lookups search both
+ * until the move is done. That happens well before the new entries can
+ * fill up, but anything that needs all of a table's entries in one
+ * place (iteration, or another resize) finishes the move first.
+ */
 
-     *value_result = entry->val;
+static void hash_migrate(lref_t hash, size_t steps)
+{
+     struct hash_table_t *table = hash->as.hash.table;
+     struct hash_table_t *old_table = table->migrating;
 
-     return true;
-}
+     if (old_table == NULL)
+          return;
 
-lref_t lhash_refs(lref_t hash, lref_t key)
-{
-     if (!HASHP(hash))
-          vmerror_wrong_type_n(1, hash);
+     table->stamp++;
 
-     struct hash_entry_t *entry = hash_lookup_entry(hash, key);
+     size_t old_size = old_table->mask + 1;
+     size_t end = old_size;
+
+     if (steps < old_size - table->migrate_index)
+          end = table->migrate_index + steps;
+
+     for (size_t ii = table->migrate_index; ii < end; ii++)
+     {
+          struct hash_entry_t *entry = &(old_table->data[ii]);
+
+          if (!hash_entry_used_p(entry))
+               continue;
+
+          hash_insert_entry(table, entry->key, entry->val, entry->hash);
+          hash_table_delete(old_table, entry);
+     }
+
+     table->migrate_index = end;
+
+     if (end == old_size)
+     {
+          gc_free(old_table);
+
+          table->migrating = NULL;
+          table->migrate_index = 0;
+     }
+}
+
+static void hash_finish_migration(lref_t hash)
+{
+     hash_migrate(hash, SIZE_MAX);
+}
+
+/* Purge the deleted entries from a table without reallocating it.
+ * Entries shifted back across the end of the table can carry a deleted
+ * entry into a slot already passed, so this can take more than one
+ * pass. */
+static void resize_hash(lref_t hash, size_t new_size);
+
+static void rehash_in_place(lref_t hash)
+{
+     assert(HASHP(hash));
+
+     hash_finish_migration(hash);
+
+     struct hash_table_t *table = hash->as.hash.table;
+
+     table->stamp++;
+
+     /*  Group probed tables are rebuilt at the same size. */
+     if (table->control != NULL)
+     {
+          resize_hash(hash, table->mask + 1);
+          return;
+     }
+
+     while (table->deleted > 0)
+     {
+          for (size_t ii = 0; ii < table->mask + 1; ii++)
+               while (hash_entry_deleted_p(&(table->data[ii])))
+                    hash_shift_back(table, ii);
+     }
+}
+
+lref_t hash_set(lref_t table, lref_t key, lref_t value, bool check_for_expand);
+
+static void resize_hash(lref_t hash, size_t new_size)
+{
+     assert(HASHP(hash));
+
+     hash_finish_migration(hash);
+
+     size_t current_size = HASH_SIZE(hash);
+
+     struct hash_table_t *new_data = allocate_hash_data(new_size,
+                                                         hash_layout(hash->as.hash.table));
+
+     new_data->mask = new_size - 1;
+     new_data->is_shallow = HASH_SHALLOW(hash);
+     new_data->weakness = HASH_WEAKNESS(hash);
+     new_data->count = HASH_COUNT(hash);
+     new_data->stamp = hash->as.hash.table->stamp + 1;
+
+     if ((new_size > current_size) && (current_size >= HASH_INCREMENTAL_RESIZE_SIZE))
+     {
+          new_data->migrating = hash->as.hash.table;
+          hash->as.hash.table = new_data;
+
+          return;
+     }
+
+     for (size_t ii = 0; ii < current_size; ii++)
+     {
+          struct hash_entry_t *entry = HASH_ENTRY(hash, ii);
+
+          if (hash_entry_used_p(entry))
+               hash_insert_entry(new_data, entry->key, entry->val, entry->hash);
+     }
+
+     gc_free(hash->as.hash.table);
+
+     hash->as.hash.table = new_data;
+}
+
+static bool enlarge_hash(lref_t hash)
+{
+     assert(HASHP(hash));
+
+     size_t current_size = HASH_SIZE(hash);
+     size_t new_size;
+
+     if (HASH_COUNT(hash) > HASH_SMALL_ENLARGE_THRESHOLD)
+          new_size = current_size * HASH_SMALL_ENLARGE_FACTOR;
+     else
+          new_size = current_size * HASH_LARGE_ENLARGE_FACTOR;
+
+     if (new_size < current_size)
+          return false;
+
+     resize_hash(hash, new_size);
+
+     return true;
+}
+
+/* Shrink a table that has fallen below the minimum load factor to
+ * about half full, or purge its deleted entries if there are too many
+ * of them. */
+static void compact_hash(lref_t hash)
+{
+     assert(HASHP(hash));
+
+     size_t current_size = HASH_SIZE(hash);
+
+     size_t min_size = hash_min_size(hash_layout(hash->as.hash.table));
+
+     if ((current_size > min_size)
+         && (HASH_COUNT(hash) < current_size * (HASH_MIN_LOAD_FACTOR / 100.0)))
+     {
+          size_t new_size = round_up_to_power_of_two(MAX2((size_t) HASH_COUNT(hash) * 2,
+                                                          min_size));
+
+          if (new_size < current_size)
+          {
+               resize_hash(hash, new_size);
+               return;
+          }
+     }
+
+     if (HASH_DELETED(hash) > current_size * (HASH_MAX_DELETED_FACTOR / 100.0))
+          rehash_in_place(hash);
+}
+
+static struct hash_entry_t *hash_table_lookup(struct hash_table_t *table,
+                                              const struct hash_probe_t *probe, fixnum_t hashed)
+{
+     if (table->control != NULL)
+          return hash_group_lookup(table, probe, hashed);
+
+     size_t mask = table->mask;
+     size_t distance = 0;
+
+     for (size_t index = (size_t) hashed & mask;; index = href_next_index(mask, index), distance++)
+     {
+          struct hash_entry_t *entry = &(table->data[index]);
+
+          if (hash_entry_empty_p(entry))
+               break;
+
+          if (href_distance(mask, entry, index) < distance)
+               break;
+
+          if (hash_entry_deleted_p(entry) || (entry->hash != hashed))
+               continue;
+
+          if (hash_probe_matches(table, probe, entry->key))
+               return entry;
+     }
+
+     return NULL;
+}
+
+/* Entries that haven't been migrated out of a table's old entries are
+ * found there. */
+static struct hash_entry_t *hash_lookup_probe(lref_t hash, const struct hash_probe_t *probe,
+                                              fixnum_t hashed)
+{
+     assert(HASHP(hash));
+
+     struct hash_table_t *table = hash->as.hash.table;
+
+     struct hash_entry_t *entry = hash_table_lookup(table, probe, hashed);
+
+     if ((entry == NULL) && (table->migrating != NULL))
+          entry = hash_table_lookup(table->migrating, probe, hashed);
+
+     return entry;
+}
+
+static struct hash_entry_t *hash_lookup_hashed_entry(lref_t hash, lref_t key, fixnum_t hashed)
+{
+     struct hash_probe_t probe = { key, NULL, 0 };
+
+     return hash_lookup_probe(hash, &probe, hashed);
+}
+
+static struct hash_entry_t *hash_lookup_entry(lref_t hash, lref_t key)
+{
+     return hash_lookup_hashed_entry(hash, key, hash_key(HASH_SHALLOW(hash), key));
+}
+
+/*** Concurrent tables
+ *
+ * A concurrent table can be read by any number of threads while other
+ * threads write to it. Readers take no locks. Entries are linear
+ * probed, but never move once placed: a writer claims an empty slot
+ * for a key with a compare and exchange, and then stores its value.
+ * Removing a key unbinds its value and leaves the key in place, so
+ * the probe sequences a reader follows never change under it. A key
+ * without a value is treated as absent, and counted with the deleted
+ * entries until the table is next copied.
+ *
+ * Writers hold one of the HASH_LOCK_STRIPES locks, picked by the hash
+ * of the key, so writes to the same key are serialized and writes to
+ * different keys only meet in the slots they claim. A table that fills
+ * up is copied into a new one with every stripe held, and the new
+ * table is published with a single store. Readers already in the old
+ * table finish there, so it is retired rather than freed. Threads must
+ * not be reading a concurrent table while the garbage collector runs,
+ * and retired tables are freed at the start of the next collection.
+ */
+
+static struct sys_mutex_t *hash_stripe_lock(fixnum_t hashed)
+{
+     return interp.hash_locks[hash_group_mix(hashed) & (HASH_LOCK_STRIPES - 1)];
+}
+
+static void hash_lock_all_stripes()
+{
+     for (size_t ii = 0; ii < HASH_LOCK_STRIPES; ii++)
+          sys_lock_mutex(interp.hash_locks[ii]);
+}
+
+static void hash_unlock_all_stripes()
+{
+     for (size_t ii = HASH_LOCK_STRIPES; ii > 0; ii--)
+          sys_unlock_mutex(interp.hash_locks[ii - 1]);
+}
+
+static lref_t hash_load_slot(lref_t *slot)
+{
+     return (lref_t) sys_atomic_load_ptr((void *volatile *) slot);
+}
+
+static void hash_store_slot(lref_t *slot, lref_t value)
+{
+     sys_atomic_store_ptr((void *volatile *) slot, value);
+}
+
+static void hash_count_binding(struct hash_table_t *table, bool bound)
+{
+     sys_atomic_fetch_add((volatile uintptr_t *) &(table->count), bound ? 1 : (uintptr_t) -1);
+     sys_atomic_fetch_add((volatile uintptr_t *) &(table->deleted), bound ? (uintptr_t) -1 : 1);
+}
+
+static bool hash_keys_match(bool shallow_p, lref_t key, lref_t entry_key)
+{
+     if (shallow_p)
+          return EQ(key, entry_key);
+     else
+          return equalp(key, entry_key);
+}
+
+/* Find the entry holding <key>, or claim an empty one for it if
+ * <claim> is true. Entry hashes are written after their keys, so they
+ * aren't used to skip entries. Returns NULL if there's no such entry. */
+static struct hash_entry_t *hash_concurrent_entry(struct hash_table_t *table, lref_t key,
+                                                  fixnum_t hashed, bool claim)
+{
+     size_t mask = table->mask;
+     size_t index = (size_t) hashed & mask;
+
+     for (size_t probes = 0; probes <= mask; probes++, index = href_next_index(mask, index))
+     {
+          struct hash_entry_t *entry = &(table->data[index]);
+          lref_t entry_key = hash_load_slot(&(entry->key));
+
+          if (UNBOUND_MARKER_P(entry_key))
+          {
+               if (!claim)
+                    return NULL;
+
+               if (sys_atomic_compare_exchange_ptr((void *volatile *) &(entry->key),
+                                                   UNBOUND_MARKER, key))
+               {
+                    entry->hash = hashed;
+                    sys_atomic_fetch_add((volatile uintptr_t *) &(table->deleted), 1);
+
+                    return entry;
+               }
+
+               /*  Another writer claimed the slot first. */
+               entry_key = hash_load_slot(&(entry->key));
+          }
+
+          if (hash_keys_match(table->is_shallow, key, entry_key))
+               return entry;
+     }
+
+     return NULL;
+}
+
+static bool hash_concurrent_ref(struct hash_table_t *table, lref_t key, fixnum_t hashed,
+                                lref_t *key_result, lref_t *value_result)
+{
+     struct hash_entry_t *entry = hash_concurrent_entry(table, key, hashed, false);
+
+     if (entry == NULL)
+          return false;
+
+     lref_t value = hash_load_slot(&(entry->val));
+
+     if (UNBOUND_MARKER_P(value))
+          return false;
+
+     *key_result = entry->key;
+     *value_result = value;
+
+     return true;
+}
+
+static void hash_retire_table(struct hash_table_t *table)
+{
+     table->retired_next = interp.hash_retired_tables;
+     interp.hash_retired_tables = table;
+}
+
+static void hash_publish_table(lref_t hash, struct hash_table_t *new_table)
+{
+     struct hash_table_t *table = hash->as.hash.table;
+
+     new_table->is_shallow = table->is_shallow;
+     new_table->weakness = table->weakness;
+     new_table->is_concurrent = true;
+
+     sys_atomic_store_ptr((void *volatile *) &(hash->as.hash.table), new_table);
+
+     hash_retire_table(table);
+}
+
+/* Copy a full table into one with room for its bound entries to
+ * double. Unbound keys are left behind. */
+static void hash_concurrent_resize(lref_t hash)
+{
+     hash_lock_all_stripes();
+
+     struct hash_table_t *table = hash->as.hash.table;
+     size_t size = table->mask + 1;
+
+     if (table->count + table->deleted > size * (HASH_MAX_LOAD_FACTOR / 100.0))
+     {
+          size_t new_size = size;
+
+          while (table->count * 2 > new_size * (HASH_MAX_LOAD_FACTOR / 100.0))
+               new_size *= 2;
+
+          struct hash_table_t *new_table = allocate_hash_data(new_size, HASH_LINEAR_PROBING);
+
+          for (size_t ii = 0; ii < size; ii++)
+          {
+               struct hash_entry_t *entry = &(table->data[ii]);
+
+               if (!hash_entry_bound_p(entry))
+                    continue;
+
+               size_t index = (size_t) entry->hash & new_table->mask;
+
+               while (hash_entry_used_p(&(new_table->data[index])))
+                    index = href_next_index(new_table->mask, index);
+
+               new_table->data[index] = *entry;
+          }
+
+          new_table->count = table->count;
+
+          hash_publish_table(hash, new_table);
+     }
+
+     hash_unlock_all_stripes();
+}
+
+static void hash_concurrent_set(lref_t hash, lref_t key, lref_t value, fixnum_t hashed)
+{
+     for (;;)
+     {
+          struct sys_mutex_t *lock = hash_stripe_lock(hashed);
+
+          sys_lock_mutex(lock);
+
+          struct hash_table_t *table = hash->as.hash.table;
+          struct hash_entry_t *entry = hash_concurrent_entry(table, key, hashed, true);
+
+          if (entry != NULL)
+          {
+               lref_t old_value = hash_load_slot(&(entry->val));
+
+               hash_store_slot(&(entry->val), value);
+
+               if (UNBOUND_MARKER_P(old_value))
+                    hash_count_binding(table, true);
+          }
+
+          sys_unlock_mutex(lock);
+
+          if (table->count + table->deleted > (table->mask + 1) * (HASH_MAX_LOAD_FACTOR / 100.0))
+               hash_concurrent_resize(hash);
+
+          /*  If writers to other stripes filled the table first, it's
+           *  been resized, and the key can be added to the new one. */
+          if (entry != NULL)
+               return;
+     }
+}
+
+static void hash_concurrent_remove(lref_t hash, lref_t key, fixnum_t hashed)
+{
+     struct sys_mutex_t *lock = hash_stripe_lock(hashed);
+
+     sys_lock_mutex(lock);
+
+     struct hash_table_t *table = hash->as.hash.table;
+     struct hash_entry_t *entry = hash_concurrent_entry(table, key, hashed, false);
+
+     if ((entry != NULL) && !UNBOUND_MARKER_P(entry->val))
+     {
+          hash_store_slot(&(entry->val), UNBOUND_MARKER);
+          hash_count_binding(table, false);
+     }
+
+     sys_unlock_mutex(lock);
+}
+
+static void hash_concurrent_clear(lref_t hash)
+{
+     hash_lock_all_stripes();
+
+     struct hash_table_t *new_table =
+          allocate_hash_data(round_up_to_power_of_two(HASH_DEFAULT_INITIAL_SIZE),
+                             HASH_LINEAR_PROBING);
+
+     new_table->count = 0;
+
+     hash_publish_table(hash, new_table);
+
+     hash_unlock_all_stripes();
+}
+
+void hash_free_retired_tables()
+{
+     while (interp.hash_retired_tables != NULL)
+     {
+          struct hash_table_t *table = interp.hash_retired_tables;
+
+          interp.hash_retired_tables = table->retired_next;
+
+          gc_free(table);
+     }
+}
+
+void init_hash_locks()
+{
+     for (size_t ii = 0; ii < HASH_LOCK_STRIPES; ii++)
+          interp.hash_locks[ii] = sys_create_mutex();
+}
+
+void release_hash_locks()
+{
+     hash_free_retired_tables();
+
+     for (size_t ii = 0; ii < HASH_LOCK_STRIPES; ii++)
+          sys_destroy_mutex(interp.hash_locks[ii]);
+}
+
+/* Look up <key>, returning the key and value of its entry. */
+static bool hash_find(lref_t hash, lref_t key, lref_t *key_result, lref_t *value_result)
+{
+     assert(HASHP(hash));
+
+     /*  A concurrent table can be replaced while this runs. */
+     struct hash_table_t *table =
+          (struct hash_table_t *) sys_atomic_load_ptr((void *volatile *) &(hash->as.hash.table));
+
+     fixnum_t hashed = hash_key(table->is_shallow, key);
+
+     if (table->is_concurrent)
+          return hash_concurrent_ref(table, key, hashed, key_result, value_result);
+
+     hash_migrate(hash, HASH_MIGRATE_STEP);
+
+     struct hash_entry_t *entry = hash_lookup_hashed_entry(hash, key, hashed);
 
      if (entry == NULL)
+          return false;
+
+     *key_result = entry->key;
+     *value_result = entry->val;
+
+     return true;
+}
+
+bool hash_ref(lref_t hash, lref_t key, lref_t *value_result)
+{
+     lref_t entry_key;
+
+     return hash_find(hash, key, &entry_key, value_result);
+}
+
+/* Look up the string key holding the <length> characters at <chars>
+ * in an equal? hash, without making a string of them. */
+bool hash_ref_chars(lref_t hash, const _TCHAR *chars, size_t length, lref_t *value_result)
+{
+     assert(HASHP(hash));
+     assert(!HASH_SHALLOW(hash));
+     assert(chars != NULL);
+
+     if (HASH_CONCURRENT(hash))
+          return hash_ref(hash, strconsbufn(length, chars), value_result);
+
+     hash_migrate(hash, HASH_MIGRATE_STEP);
+
+     struct hash_probe_t probe = { NIL, chars, length };
+
+     struct hash_entry_t *entry = hash_lookup_probe(hash, &probe, sxhash_chars(chars, length));
+
+     if (entry == NULL)
+          return false;
+
+     *value_result = entry->val;
+
+     return true;
+}
+
+lref_t lhash_refs(lref_t hash, lref_t key)
+{
+     if (!HASHP(hash))
+          vmerror_wrong_type_n(1, hash);
+
+     lref_t entry_key, value;
+
+     if (!hash_find(hash, key, &entry_key, &value))
           return boolcons(false);
 
-     return lcons(entry->key, entry->val);
+     return lcons(entry_key, value);
 }
 
 
@@ -483,12 +1499,12 @@ lref_t lhash_ref(size_t argc, lref_t argv[])
      if (!HASHP(hash))
           vmerror_wrong_type_n(1, hash);
 
-     struct hash_entry_t *entry = hash_lookup_entry(hash, key);
+     lref_t value;
 
-     if (entry == NULL)
+     if (!hash_ref(hash, key, &value))
           return defaultValue;
      else
-          return entry->val;
+          return value;
 }
 
 lref_t lhash_hasp(lref_t hash, lref_t key)
@@ -496,46 +1512,65 @@ lref_t lhash_hasp(lref_t hash, lref_t key)
      if (!HASHP(hash))
           vmerror_wrong_type_n(1, hash);
 
-     if (hash_lookup_entry(hash, key) == NULL)
+     lref_t value;
+
+     if (!hash_ref(hash, key, &value))
           return boolcons(false);
      else
           return hash;
 }
 
-lref_t hash_set(lref_t hash, lref_t key, lref_t value, bool check_for_expand)
+/* Add an entry for a key known not to be in <hash>. */
+static void hash_add_entry(lref_t hash, lref_t key, lref_t value, fixnum_t hashed)
 {
-     assert(HASHP(hash));
+     struct hash_table_t *table = hash->as.hash.table;
 
-     struct hash_entry_t *entry = hash_lookup_entry(hash, key);
+     hash_insert_entry(table, key, value, hashed);
 
-     if (entry != NULL)
+     table->stamp++;
+
+     SET_HASH_COUNT(hash, HASH_COUNT(hash) + 1);
+}
+
+static void hash_check_size(lref_t hash)
+{
+     if (HASH_COUNT(hash) > HASH_SIZE(hash) * (HASH_MAX_LOAD_FACTOR / 100.0))
+          enlarge_hash(hash);
+     else if (HASH_DELETED(hash) > HASH_SIZE(hash) * (HASH_MAX_DELETED_FACTOR / 100.0))
+          compact_hash(hash);
+}
+
+static void hash_set_hashed(lref_t hash, lref_t key, lref_t value, fixnum_t hashed,
+                            bool check_for_expand)
+{
+     gc_write_barrier(hash, key);
+     gc_write_barrier(hash, value);
+
+     if (HASH_CONCURRENT(hash))
      {
-          entry->val = value;
+          hash_concurrent_set(hash, key, value, hashed);
+
+          return;
      }
-     else
-     {
-          for (fixnum_t index = href_index(HASH_SHALLOW(hash), HASH_MASK(hash), key);;
-               index = href_next_index(HASH_MASK(hash), index))
-          {
-               struct hash_entry_t *entry = HASH_ENTRY(hash, index);
 
-               if (hash_entry_unused_p(entry))
-               {
-                    entry->key = key;
-                    entry->val = value;
+     hash_migrate(hash, HASH_MIGRATE_STEP);
 
-                    SET_HASH_COUNT(hash, HASH_COUNT(hash) + 1);
+     struct hash_entry_t *entry = hash_lookup_hashed_entry(hash, key, hashed);
 
-                    break;
-               }
-          }
-     }
+     if (entry != NULL)
+          entry->val = value;
+     else
+          hash_add_entry(hash, key, value, hashed);
 
      if (check_for_expand)
-     {
-          if (HASH_COUNT(hash) > HASH_SIZE(hash) * (HASH_MAX_LOAD_FACTOR / 100.0))
-               enlarge_hash(hash);
-     }
+          hash_check_size(hash);
+}
+
+lref_t hash_set(lref_t hash, lref_t key, lref_t value, bool check_for_expand)
+{
+     assert(HASHP(hash));
+
+     hash_set_hashed(hash, key, value, hash_key(HASH_SHALLOW(hash), key), check_for_expand);
 
      return hash;
 }
@@ -569,29 +1604,114 @@ lref_t lhash_set_multiple(lref_t hash, lref_t bindings)
      return hash;
 }
 
+static void hash_remove_entry(lref_t hash, struct hash_entry_t *entry)
+{
+     struct hash_table_t *table = hash->as.hash.table;
+     struct hash_table_t *old_table = table->migrating;
+
+     if ((old_table != NULL)
+         && (entry >= old_table->data)
+         && (entry <= &(old_table->data[old_table->mask])))
+          hash_table_delete(old_table, entry);
+     else
+          hash_table_delete(table, entry);
+
+     table->stamp++;
+
+     SET_HASH_COUNT(hash, HASH_COUNT(hash) - 1);
+}
+
 lref_t lhash_remove(lref_t hash, lref_t key)
 {
      if (!HASHP(hash))
           vmerror_wrong_type_n(1, hash);
 
+     if (HASH_CONCURRENT(hash))
+     {
+          hash_concurrent_remove(hash, key, hash_key(HASH_SHALLOW(hash), key));
+
+          return hash;
+     }
+
+     hash_migrate(hash, HASH_MIGRATE_STEP);
+
      struct hash_entry_t *entry = hash_lookup_entry(hash, key);
 
      if (entry != NULL)
      {
-          delete_hash_entry(entry);
-          SET_HASH_COUNT(hash, HASH_COUNT(hash) - 1);
+          hash_remove_entry(hash, entry);
+
+          compact_hash(hash);
      }
 
      return hash;
 }
 
+/* An object that the collector has found to be garbage. Only valid
+ * once marking is done. */
+static bool hash_dead_object_p(lref_t obj)
+{
+     return !NULLP(obj) && !LREF_IMMEDIATE_P(obj) && !GC_MARK(obj);
+}
+
+/* hash_gc_remove_dead_entries
+ *
+ * Remove the entries of a weak hash whose weak part is garbage. This is
+ * called by the collector after marking, so it can't allocate, and the
+ * entries are left deleted in place. The table is compacted by the next
+ * hash_set that finds too many of them. */
+void hash_gc_remove_dead_entries(lref_t hash)
+{
+     assert(HASHP(hash));
+
+     enum hash_weakness_t weakness = HASH_WEAKNESS(hash);
+
+     for (struct hash_table_t *table = hash->as.hash.table; table != NULL; table = table->migrating)
+     {
+          for (size_t ii = 0; ii < table->mask + 1; ii++)
+          {
+               struct hash_entry_t *entry = &(table->data[ii]);
+
+               if (!hash_entry_used_p(entry))
+                    continue;
+
+               if (((weakness == HASH_WEAK_KEYS) && hash_dead_object_p(entry->key))
+                   || ((weakness == HASH_WEAK_VALUES) && hash_dead_object_p(entry->val)))
+                    hash_remove_entry(hash, entry);
+          }
+     }
+}
+
+void hash_gc_free(lref_t hash)
+{
+     assert(HASHP(hash));
+
+     gc_free(hash->as.hash.table->migrating);
+     gc_free(hash->as.hash.table);
+}
+
 lref_t lhash_clear(lref_t hash)
 {
      if (!HASHP(hash))
           vmerror_wrong_type_n(1, hash);
 
+     if (HASH_CONCURRENT(hash))
+     {
+          hash_concurrent_clear(hash);
+
+          return hash;
+     }
+
+     struct hash_table_t *table = hash->as.hash.table;
+
+     gc_free(table->migrating);
+
+     table->migrating = NULL;
+     table->migrate_index = 0;
+     table->stamp++;
+
      SET_HASH_COUNT(hash, 0);
-     clear_hash_data(hash->as.hash.table);
+     clear_hash_data(table);
 
      return hash;
 }
@@ -609,6 +1729,8 @@ lref_t lihash_binding_vector(lref_t hash)
      if (!HASHP(hash))
           vmerror_wrong_type_n(1, hash);
 
+     hash_finish_migration(hash);
+
      size_t hash_size = HASH_SIZE(hash);
 
      lref_t btable = vectorcons(hash_size, NIL);
@@ -619,13 +1741,15 @@ lref_t lihash_binding_vector(lref_t hash)
 
           lref_t btelem;
 
-          if (hash_entry_deleted_p(entry))
+          if (hash_entry_deleted_p(entry)
+              || (hash_entry_used_p(entry) && !hash_entry_bound_p(entry)))
                btelem = boolcons(false);
           else if (hash_entry_unused_p(entry))
                btelem = NIL;
           else
                btelem = lcons(entry->key, entry->val);
 
+          gc_write_barrier(btable, btelem);
           btable->as.vector.data[ii] = btelem;
      }
 
@@ -671,19 +1795,196 @@ lref_t lidentity_hash_p(lref_t obj)
      return boolcons(HASHP(obj) && HASH_SHALLOW(obj));
 }
 
-lref_t lhash_copy(lref_t hash)
+/*** Bulk operations
+ *
+ * These call back into Scheme once per entry, straight from the loop
+ * over the table, rather than building a list of its entries first.
+ * What happens to the iteration if the callback changes the table is
+ * unspecified, though it's safe.
+ */
+
+lref_t lhash_for_each(lref_t fn, lref_t hash)
 {
+     if (!PROCEDUREP(fn))
+          vmerror_wrong_type_n(1, fn);
+
      if (!HASHP(hash))
-          vmerror_wrong_type_n(1, hash);
+          vmerror_wrong_type_n(2, hash);
 
-     lref_t target_hash = hashcons(HASH_SHALLOW(hash));
+     lref_t argv[2];
 
-     lref_t key, val;
+     hash_iter_t ii;
+     hash_iter_begin(hash, &ii);
+     while (hash_iter_next(hash, &ii, &argv[0], &argv[1]))
+          apply1(fn, 2, argv);
+
+     return NIL;
+}
+
+lref_t lhash_fold(lref_t fn, lref_t initial, lref_t hash)
+{
+     if (!PROCEDUREP(fn))
+          vmerror_wrong_type_n(1, fn);
+
+     if (!HASHP(hash))
+          vmerror_wrong_type_n(3, hash);
+
+     lref_t argv[3];
+     lref_t accum = initial;
 
      hash_iter_t ii;
      hash_iter_begin(hash, &ii);
-     while (hash_iter_next(hash, &ii, &key, &val))
-          lhash_set(target_hash, key, val);
+     while (hash_iter_next(hash, &ii, &argv[0], &argv[1]))
+     {
+          argv[2] = accum;
+
+          accum = apply1(fn, 3, argv);
+     }
+
+     return accum;
+}
+
+/* lhash_update
+ *
+ * Replace the value of <key> with the result of calling <fn> on it, or
+ * on <default> if <key> isn't in the table, and return the new value.
+ * The key is hashed and looked up once. Its entry is reused after the
+ * call unless the call has changed the table in a way that might have
+ * moved entries, which the table's stamp shows. Concurrent tables are
+ * updated with a separate lookup and store, so another writer's store
+ * to the same key can be lost.
+ */
+lref_t lhash_update(size_t argc, lref_t argv[])
+{
+     lref_t hash = (argc > 0) ? argv[0] : NIL;
+     lref_t key = (argc > 1) ? argv[1] : NIL;
+     lref_t fn = (argc > 2) ? argv[2] : NIL;
+     lref_t value = (argc > 3) ? argv[3] : boolcons(false);
+
+     if (!HASHP(hash))
+          vmerror_wrong_type_n(1, hash);
+
+     if (!PROCEDUREP(fn))
+          vmerror_wrong_type_n(3, fn);
+
+     if (HASH_CONCURRENT(hash))
+     {
+          hash_ref(hash, key, &value);
+
+          value = apply1(fn, 1, &value);
+
+          hash_set(hash, key, value, true);
+
+          return value;
+     }
+
+     fixnum_t hashed = hash_key(HASH_SHALLOW(hash), key);
+
+     hash_migrate(hash, HASH_MIGRATE_STEP);
+
+     struct hash_entry_t *entry = hash_lookup_hashed_entry(hash, key, hashed);
+
+     if (entry != NULL)
+          value = entry->val;
+
+     size_t stamp = hash->as.hash.table->stamp;
+
+     value = apply1(fn, 1, &value);
+
+     if (hash->as.hash.table->stamp != stamp)
+     {
+          hash_set_hashed(hash, key, value, hashed, true);
+
+          return value;
+     }
+
+     gc_write_barrier(hash, key);
+     gc_write_barrier(hash, value);
+
+     if (entry != NULL)
+     {
+          entry->val = value;
+     }
+     else
+     {
+          hash_add_entry(hash, key, value, hashed);
+          hash_check_size(hash);
+     }
+
+     return value;
+}
+
+/* Enlarge <hash>, if need be, to hold <count> entries without passing
+ * its maximum load factor. */
+static void hash_reserve(lref_t hash, size_t count)
+{
+     if (HASH_CONCURRENT(hash))
+          return;
+
+     size_t size = HASH_SIZE(hash);
+
+     while (count > size * (HASH_MAX_LOAD_FACTOR / 100.0))
+          size *= 2;
+
+     if (size > HASH_SIZE(hash))
+          resize_hash(hash, size);
+}
+
+/* Store every entry of <source> in <target>, sizing <target> for them
+ * all up front. Tables that hash alike share the hashes kept in the
+ * entries of <source>, so its keys aren't hashed again. */
+static void hash_merge(lref_t target, lref_t source)
+{
+     assert(HASHP(target));
+     assert(HASHP(source));
+
+     if (target == source)
+          return;
+
+     hash_reserve(target, HASH_COUNT(target) + HASH_COUNT(source));
+
+     bool same_hashes = (HASH_SHALLOW(target) == HASH_SHALLOW(source)) && !HASH_CONCURRENT(source);
+
+     hash_finish_migration(source);
+
+     for (size_t ii = 0; ii < HASH_SIZE(source); ii++)
+     {
+          struct hash_entry_t *entry = HASH_ENTRY(source, ii);
+
+          if (!hash_entry_bound_p(entry))
+               continue;
+
+          fixnum_t hashed = same_hashes ? entry->hash : hash_key(HASH_SHALLOW(target), entry->key);
+
+          hash_set_hashed(target, entry->key, entry->val, hashed, true);
+     }
+}
+
+lref_t lhash_merge(lref_t target, lref_t source)
+{
+     if (!HASHP(target))
+          vmerror_wrong_type_n(1, target);
+
+     if (!HASHP(source))
+          vmerror_wrong_type_n(2, source);
+
+     hash_merge(target, source);
+
+     return target;
+}
+
+lref_t lhash_copy(lref_t hash)
+{
+     if (!HASHP(hash))
+          vmerror_wrong_type_n(1, hash);
+
+     lref_t target_hash = hashcons_with_layout(HASH_SHALLOW(hash),
+                                               hash_layout(hash->as.hash.table));
+
+     target_hash->as.hash.table->weakness = HASH_WEAKNESS(hash);
+     target_hash->as.hash.table->is_concurrent = HASH_CONCURRENT(hash);
+
+     hash_merge(target_hash, hash);
 
      return target_hash;
 }
@@ -0,0 +1,824 @@
+/*
+ * heap-image.c --
+ *
+ * Heap images: snapshots of the heap that can be loaded at startup in
+ * place of the boot code.
+ *
+ * (C) Copyright 2001-2014 East Coast Toolworks Inc.
+ *
+ * See the file "license.terms" for information on usage and redistribution
+ * of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+ */
+
+#include <memory.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "scan-private.h"
+
+/*** Heap images
+ *
+ * A heap image holds every object reachable from the roots that make
+ * up the global environment: the trap handlers, the control fields and
+ * the package list, and through the packages their symbol tables and
+ * global bindings. Loading an image at startup stands in for loading
+ * the boot code, which interns every symbol, conses every fast-op and
+ * evaluates every definition on each launch. -Xdump-boot-image=<file>
+ * writes an image once the boot code has been loaded, in place of
+ * running it, and -Xboot-image=<file> loads one.
+ *
+ * An image is a header, followed by the cells of its objects, the
+ * values of its roots and the out of line data of its objects, such as
+ * string text and vector elements. References are written as cell
+ * numbers. The file is mapped into memory and its cells are copied into
+ * tenured runs, translating cell numbers to addresses on the way. The
+ * out of line data is copied to fresh blocks, since the collector frees
+ * that of dead objects, and hash tables are rebuilt, since identity
+ * hashes are keyed on object addresses.
+ *
+ * Subrs and the standard ports belong to the VM that loads the image.
+ * They're written as cells of their own, naming the subr or the control
+ * field of the port, and are looked up as the image is loaded. No other
+ * ports, nor FASL readers, can be written to an image.
+ *
+ * Images hold cells as they are laid out in memory, so they can only
+ * be loaded by the build of the VM that wrote them.
+ */
+
+#define IMAGE_MAGIC "VCSHIMG1"
+
+enum
+{
+     IMAGE_BUILD_ID_SIZE = 64,
+
+     /*  Out of line data is aligned to this many bytes. */
+     IMAGE_DATA_ALIGNMENT = sizeof(uint64_t),
+
+     /*  The port number of the debugger output port. Other standard
+      *  ports are numbered by their control field. */
+     IMAGE_DEBUGGER_PORT = VMCTRL_LAST + 1,
+
+     INITIAL_IMAGE_TABLE_SIZE = 4096
+};
+
+struct image_header_t
+{
+     char magic[8];
+     char build_id[IMAGE_BUILD_ID_SIZE];
+     uint64_t cell_bytes;
+     uint64_t cell_count;
+     uint64_t root_words;
+     uint64_t data_bytes;
+};
+
+/* The header of the data of a hash table, followed by the key and the
+ * value of each of its entries. */
+struct image_hash_t
+{
+     uint8_t shallow;
+     uint8_t layout;
+     uint8_t weakness;
+     uint8_t concurrent;
+     uint64_t count;
+};
+
+/* The global roots held in an image. The others, such as the startup
+ * arguments and the subr table, belong to the VM loading the image. */
+static const _TCHAR *image_root_names[] = {
+     _T("trap-handlers"),
+     _T("control-fields"),
+     _T("fasl-package-list")
+};
+
+#define IMAGE_ROOT_COUNT (sizeof(image_root_names) / sizeof(image_root_names[0]))
+
+static struct gc_root_t *image_find_root(const _TCHAR * name)
+{
+     for (size_t ii = 0; ii < MAX_GC_ROOTS; ii++)
+     {
+          struct gc_root_t *root = &(CURRENT_TIB()->gc_roots[ii]);
+
+          if ((root->name != NULL) && (_tcscmp(root->name, name) == 0))
+               return root;
+     }
+
+     panic("Heap image root not found");
+
+     return NULL;
+}
+
+static bool image_reference_p(lref_t ref)
+{
+     return !NULLP(ref) && !LREF_IMMEDIATE_P(ref);
+}
+
+
+/*** Image writing ***/
+
+struct image_buffer_t
+{
+     uint8_t *bytes;
+     size_t size;
+     size_t capacity;
+};
+
+struct image_writer_t
+{
+     /*  Every object written, in cell number order */
+     lref_t *objects;
+     size_t count;
+     size_t capacity;
+
+     /*  Cell numbers, in an open addressed table keyed on address */
+     lref_t *keys;
+     size_t *numbers;
+     size_t mask;
+
+     struct image_buffer_t cells;
+     struct image_buffer_t roots;
+     struct image_buffer_t data;
+};
+
+/* Append <size> bytes from <src> to <buf>, and return their offset. */
+static size_t image_buffer_append(struct image_buffer_t *buf, const void *src, size_t size)
+{
+     size_t offset = buf->size;
+
+     while (offset + size > buf->capacity)
+     {
+          size_t new_capacity = MAX2(buf->capacity * 2, (size_t) INITIAL_IMAGE_TABLE_SIZE);
+          uint8_t *new_bytes = (uint8_t *) gc_malloc(new_capacity);
+
+          if (buf->size > 0)
+               memcpy(new_bytes, buf->bytes, buf->size);
+
+          gc_free(buf->bytes);
+
+          buf->bytes = new_bytes;
+          buf->capacity = new_capacity;
+     }
+
+     memcpy(buf->bytes + offset, src, size);
+     buf->size += size;
+
+     return offset;
+}
+
+/* Append <size> bytes to the data of an image, aligned for any of the
+ * data written there. */
+static size_t image_append_data(struct image_writer_t *w, const void *src, size_t size)
+{
+     static const uint8_t padding[IMAGE_DATA_ALIGNMENT] = { 0 };
+
+     size_t offset = image_buffer_append(&w->data, src, size);
+
+     if (size % IMAGE_DATA_ALIGNMENT)
+          image_buffer_append(&w->data, padding, IMAGE_DATA_ALIGNMENT - size % IMAGE_DATA_ALIGNMENT);
+
+     return offset;
+}
+
+static size_t image_address_hash(lref_t obj)
+{
+     return (size_t) (((uintptr_t) obj / sizeof(struct lobject_t)) * 0x9E3779B97F4A7C15ULL
+                      >> 16);
+}
+
+static void image_grow_numbers(struct image_writer_t *w)
+{
+     size_t new_size = MAX2((w->mask + 1) * 2, (size_t) INITIAL_IMAGE_TABLE_SIZE);
+     lref_t *new_keys = (lref_t *) gc_malloc(new_size * sizeof(lref_t));
+     size_t *new_numbers = (size_t *) gc_malloc(new_size * sizeof(size_t));
+
+     memset(new_keys, 0, new_size * sizeof(lref_t));
+
+     for (size_t ii = 0; (w->keys != NULL) && (ii <= w->mask); ii++)
+     {
+          if (NULLP(w->keys[ii]))
+               continue;
+
+          size_t jj = image_address_hash(w->keys[ii]) & (new_size - 1);
+
+          while (!NULLP(new_keys[jj]))
+               jj = (jj + 1) & (new_size - 1);
+
+          new_keys[jj] = w->keys[ii];
+          new_numbers[jj] = w->numbers[ii];
+     }
+
+     gc_free(w->keys);
+     gc_free(w->numbers);
+
+     w->keys = new_keys;
+     w->numbers = new_numbers;
+     w->mask = new_size - 1;
+}
+
+/* Returns the cell number of <obj>, numbering it and queueing it to
+ * be written if it hasn't been seen yet. */
+static size_t image_number(struct image_writer_t *w, lref_t obj)
+{
+     if ((w->keys == NULL) || (w->count * 2 >= w->mask + 1))
+          image_grow_numbers(w);
+
+     size_t ii = image_address_hash(obj) & w->mask;
+
+     for (; !NULLP(w->keys[ii]); ii = (ii + 1) & w->mask)
+          if (EQ(w->keys[ii], obj))
+               return w->numbers[ii];
+
+     if (w->count >= w->capacity)
+     {
+          size_t new_capacity = MAX2(w->capacity * 2, (size_t) INITIAL_IMAGE_TABLE_SIZE);
+          lref_t *new_objects = (lref_t *) gc_malloc(new_capacity * sizeof(lref_t));
+
+          if (w->count > 0)
+               memcpy(new_objects, w->objects, w->count * sizeof(lref_t));
+
+          gc_free(w->objects);
+
+          w->objects = new_objects;
+          w->capacity = new_capacity;
+     }
+
+     w->keys[ii] = obj;
+     w->numbers[ii] = w->count;
+     w->objects[w->count] = obj;
+
+     return w->count++;
+}
+
+/* References to objects are written as their cell number plus one,
+ * shifted so that they look like references rather than immediates. */
+static lref_t image_encode(struct image_writer_t *w, lref_t obj)
+{
+     if (!image_reference_p(obj))
+          return obj;
+
+     return (lref_t) ((image_number(w, obj) + 1) << LREF1_TAG_SHIFT);
+}
+
+static size_t image_append_refs(struct image_writer_t *w, lref_t *refs, size_t count)
+{
+     size_t offset = w->data.size;
+
+     for (size_t ii = 0; ii < count; ii++)
+     {
+          lref_t ref = image_encode(w, refs[ii]);
+
+          image_append_data(w, &ref, sizeof(ref));
+     }
+
+     return offset;
+}
+
+static size_t image_append_hash(struct image_writer_t *w, lref_t hash)
+{
+     struct hash_table_t *table = hash->as.hash.table;
+     struct image_hash_t header;
+
+     lref_t key;
+     lref_t val;
+     hash_iter_t ii;
+
+     hash_iter_begin(hash, &ii);
+
+     memset(&header, 0, sizeof(header));
+
+     header.shallow = table->is_shallow;
+     header.layout = (uint8_t) ((table->control != NULL) ? HASH_GROUP_PROBING : HASH_LINEAR_PROBING);
+     header.weakness = (uint8_t) table->weakness;
+     header.concurrent = table->is_concurrent;
+     header.count = 0;
+
+     size_t offset = image_append_data(w, &header, sizeof(header));
+
+     while (hash_iter_next(hash, &ii, &key, &val))
+     {
+          image_append_refs(w, &key, 1);
+          image_append_refs(w, &val, 1);
+
+          header.count++;
+     }
+
+     memcpy(w->data.bytes + offset, &header, sizeof(header));
+
+     return offset;
+}
+
+static uintptr_t image_port_number(lref_t port)
+{
+     for (uintptr_t ii = 0; ii <= VMCTRL_CURRENT_DEBUG_PORT; ii++)
+          if (EQ(port, interp.control_fields[ii]))
+               return ii;
+
+     if (EQ(port, interp.debugger_output))
+          return IMAGE_DEBUGGER_PORT;
+
+     vmerror_wrong_type(port);
+
+     return 0;
+}
+
+/* Write the cell of <obj>, numbering the objects it refers to. */
+static void image_write_object(struct image_writer_t *w, lref_t obj)
+{
+     struct lobject_t cell;
+
+     memcpy(&cell, obj, sizeof(cell));
+     SET_GC_REMEMBERED(&cell, 0);
+
+     switch (TYPE(obj))
+     {
+     case TC_CONS:
+          cell.as.cons.car = image_encode(w, obj->as.cons.car);
+          cell.as.cons.cdr = image_encode(w, obj->as.cons.cdr);
+          break;
+
+     case TC_FLONUM:
+          cell.as.flonum.im_part = image_encode(w, obj->as.flonum.im_part);
+          break;
+
+     case TC_SYMBOL:
+          cell.as.symbol.props = image_encode(w, obj->as.symbol.props);
+          cell.as.symbol.vcell = image_encode(w, obj->as.symbol.vcell);
+          cell.as.symbol.home = image_encode(w, obj->as.symbol.home);
+          break;
+
+     case TC_PACKAGE:
+          cell.as.package.name = image_encode(w, obj->as.package.name);
+          cell.as.package.bindings = image_encode(w, obj->as.package.bindings);
+          cell.as.package.use_list = image_encode(w, obj->as.package.use_list);
+          break;
+
+     case TC_CLOSURE:
+          cell.as.closure.env = image_encode(w, obj->as.closure.env);
+          cell.as.closure.code = image_encode(w, obj->as.closure.code);
+          cell.as.closure.property_list = image_encode(w, obj->as.closure.property_list);
+          break;
+
+     case TC_MACRO:
+          cell.as.macro.transformer = image_encode(w, obj->as.macro.transformer);
+          break;
+
+     case TC_VALUES_TUPLE:
+          cell.as.values_tuple.values = image_encode(w, obj->as.values_tuple.values);
+          break;
+
+     case TC_FAST_OP:
+          cell.as.fast_op.next = image_encode(w, obj->as.fast_op.next);
+          cell.as.fast_op.arg1 = image_encode(w, obj->as.fast_op.arg1);
+          cell.as.fast_op.arg2 = image_encode(w, obj->as.fast_op.arg2);
+          break;
+
+     case TC_STRING:
+          cell.as.string.data =
+               (_TCHAR *) image_append_data(w, obj->as.string.data,
+                                            obj->as.string.dim * sizeof(_TCHAR));
+          break;
+
+     case TC_VECTOR:
+          cell.as.vector.data =
+               (lref_t *) image_append_refs(w, obj->as.vector.data, obj->as.vector.dim);
+          cell.as.vector.layout = NIL;
+          break;
+
+     case TC_STRUCTURE:
+          cell.as.vector.data =
+               (lref_t *) image_append_refs(w, STRUCTURE_DATA(obj), STRUCTURE_DIM(obj));
+          cell.as.vector.layout = image_encode(w, STRUCTURE_LAYOUT(obj));
+          break;
+
+     case TC_ENVIRONMENT:
+          /* The slot count is in the header. The last field holds
+           * either the frame's one slot or its first slot cell. */
+          cell.as.environment.parent = image_encode(w, obj->as.environment.parent);
+          cell.as.environment.formals = image_encode(w, obj->as.environment.formals);
+          cell.as.environment.slots = image_encode(w, obj->as.environment.slots);
+          break;
+
+     case TC_ENVIRONMENT_SLOTS:
+          for (size_t ii = 0; ii < 3; ii++)
+               cell.as.environment_slots.slot[ii] = image_encode(w, obj->as.environment_slots.slot[ii]);
+          break;
+
+     case TC_HASH:
+          cell.as.hash.table = (struct hash_table_t *) image_append_hash(w, obj);
+          break;
+
+     case TC_SUBR:
+          cell.as.subr.name = image_encode(w, SUBR_NAME(obj));
+          cell.as.subr.code.ptr = NULL;
+          break;
+
+     case TC_PORT:
+          cell.as.port.klass = (struct port_class_t *) image_port_number(obj);
+          cell.as.port.pinf = NULL;
+          cell.as.port.text_info = NULL;
+          break;
+
+     default:
+          vmerror_wrong_type(obj);
+     }
+
+     image_buffer_append(&w->cells, &cell, sizeof(cell));
+}
+
+static void image_write_file(struct image_writer_t *w, const _TCHAR * filename)
+{
+     struct image_header_t header;
+
+     memset(&header, 0, sizeof(header));
+
+     memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+     strncpy(header.build_id, scan_vm_build_id_string(), IMAGE_BUILD_ID_SIZE - 1);
+
+     header.cell_bytes = sizeof(struct lobject_t);
+     header.cell_count = w->count;
+     header.root_words = w->roots.size / sizeof(uint64_t);
+     header.data_bytes = w->data.size;
+
+     FILE *f = fopen(filename, "wb");
+
+     if (f == NULL)
+          vmerror_io_error(_T("cannot open heap image"), strconsbuf(filename));
+
+     bool written = (fwrite(&header, sizeof(header), 1, f) == 1)
+          && (fwrite(w->cells.bytes, 1, w->cells.size, f) == w->cells.size)
+          && (fwrite(w->roots.bytes, 1, w->roots.size, f) == w->roots.size)
+          && (fwrite(w->data.bytes, 1, w->data.size, f) == w->data.size);
+
+     if ((fclose(f) != 0) || !written)
+          vmerror_io_error(_T("cannot write heap image"), strconsbuf(filename));
+}
+
+void dump_boot_image(const _TCHAR * filename)
+{
+     struct image_writer_t w;
+
+     memset(&w, 0, sizeof(w));
+
+     for (size_t ii = 0; ii < IMAGE_ROOT_COUNT; ii++)
+     {
+          struct gc_root_t *root = image_find_root(image_root_names[ii]);
+          uint64_t length = root->length;
+
+          image_buffer_append(&w.roots, &length, sizeof(length));
+
+          for (size_t jj = 0; jj < root->length; jj++)
+          {
+               lref_t ref = image_encode(&w, root->location[jj]);
+
+               image_buffer_append(&w.roots, &ref, sizeof(ref));
+          }
+     }
+
+     /*  Writing an object numbers the objects it refers to, which are
+      *  written in turn as the loop reaches them. */
+     for (size_t ii = 0; ii < w.count; ii++)
+          image_write_object(&w, w.objects[ii]);
+
+     image_write_file(&w, filename);
+
+     dscwritef(DF_SHOW_GC_DETAILS, (";;; wrote heap image of ~cd cells to ~cs\n",
+                                    (long) w.count, filename));
+
+     gc_free(w.objects);
+     gc_free(w.keys);
+     gc_free(w.numbers);
+     gc_free(w.cells.bytes);
+     gc_free(w.roots.bytes);
+     gc_free(w.data.bytes);
+}
+
+
+/*** Image loading ***/
+
+struct image_reader_t
+{
+     const _TCHAR *filename;
+
+     struct image_header_t *header;
+     struct lobject_t *cells;
+     uint64_t *roots;
+     uint8_t *data;
+
+     /*  The object loaded for each cell */
+     lref_t *objects;
+};
+
+static void image_load_failed(struct image_reader_t *r, const _TCHAR * reason)
+{
+     dscwritef(DF_ALWAYS, ("Cannot load heap image \"~cs\": ~cs\n", r->filename, reason));
+     panic("Aborting Run");
+}
+
+static struct lobject_t *image_cell(struct image_reader_t *r, lref_t ref)
+{
+     size_t number = ((uintptr_t) ref >> LREF1_TAG_SHIFT) - 1;
+
+     if (number >= r->header->cell_count)
+          image_load_failed(r, _T("bad reference"));
+
+     return &(r->cells[number]);
+}
+
+static lref_t image_decode(struct image_reader_t *r, lref_t ref)
+{
+     if (!image_reference_p(ref))
+          return ref;
+
+     return r->objects[image_cell(r, ref) - r->cells];
+}
+
+/* Decode the reference held in one of the fields of <obj>. */
+static void image_decode_field(struct image_reader_t *r, lref_t obj, lref_t *field)
+{
+     lref_t val = image_decode(r, *field);
+
+     /*  Loaded objects are old, but subrs and ports needn't be. */
+     gc_write_barrier(obj, val);
+
+     *field = val;
+}
+
+static void *image_data(struct image_reader_t *r, const void *offset, size_t size)
+{
+     if ((uintptr_t) offset + size > r->header->data_bytes)
+          image_load_failed(r, _T("bad data offset"));
+
+     return r->data + (uintptr_t) offset;
+}
+
+static lref_t *image_load_refs(struct image_reader_t *r, lref_t obj, const void *offset, size_t count)
+{
+     lref_t *refs = (lref_t *) image_data(r, offset, count * sizeof(lref_t));
+     lref_t *slots = (lref_t *) gc_malloc(count * sizeof(lref_t));
+
+     for (size_t ii = 0; ii < count; ii++)
+     {
+          slots[ii] = refs[ii];
+          image_decode_field(r, obj, &slots[ii]);
+     }
+
+     return slots;
+}
+
+static void image_map(struct image_reader_t *r, void *base, size_t size)
+{
+     struct image_header_t *header = (struct image_header_t *) base;
+
+     r->header = header;
+
+     if ((size < sizeof(*header)) || (memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0))
+          image_load_failed(r, _T("not a heap image"));
+
+     if ((strncmp(header->build_id, scan_vm_build_id_string(), IMAGE_BUILD_ID_SIZE - 1) != 0)
+         || (header->cell_bytes != sizeof(struct lobject_t)))
+          image_load_failed(r, _T("written by another build of the VM"));
+
+     if ((header->cell_count > size / sizeof(struct lobject_t))
+         || (header->root_words > size / sizeof(uint64_t))
+         || (header->data_bytes > size)
+         || (sizeof(*header)
+             + header->cell_count * sizeof(struct lobject_t)
+             + header->root_words * sizeof(uint64_t)
+             + header->data_bytes != size))
+          image_load_failed(r, _T("truncated"));
+
+     r->cells = (struct lobject_t *) (header + 1);
+     r->roots = (uint64_t *) (r->cells + header->cell_count);
+     r->data = (uint8_t *) (r->roots + header->root_words);
+}
+
+static lref_t image_find_subr(struct image_reader_t *r, struct lobject_t *cell)
+{
+     struct lobject_t *name = image_cell(r, cell->as.subr.name);
+     lref_t subr;
+
+     if (name->header.type != TC_STRING)
+          image_load_failed(r, _T("bad subr name"));
+
+     _TCHAR *chars = (_TCHAR *) image_data(r, name->as.string.data, name->as.string.dim);
+
+     if (!hash_ref_chars(interp.subr_table, chars, name->as.string.dim, &subr)
+         || (SUBR_TYPE(subr) != cell->as.subr.type))
+          image_load_failed(r, _T("subr not found"));
+
+     return subr;
+}
+
+static lref_t image_find_port(struct image_reader_t *r, struct lobject_t *cell)
+{
+     uintptr_t port = (uintptr_t) cell->as.port.klass;
+
+     if (port == IMAGE_DEBUGGER_PORT)
+          return interp.debugger_output;
+
+     if (port > VMCTRL_CURRENT_DEBUG_PORT)
+          image_load_failed(r, _T("bad port"));
+
+     return interp.control_fields[port];
+}
+
+/* Find an object for every cell of the image: the subrs and ports that
+ * the cells stand for, and tenured cells for everything else. */
+static void image_allocate_objects(struct image_reader_t *r)
+{
+     lref_t next = NIL;
+     lref_t limit = NIL;
+
+     for (size_t ii = 0; ii < r->header->cell_count; ii++)
+     {
+          struct lobject_t *cell = &(r->cells[ii]);
+
+          if (cell->header.type == TC_SUBR)
+               r->objects[ii] = image_find_subr(r, cell);
+          else if (cell->header.type == TC_PORT)
+               r->objects[ii] = image_find_port(r, cell);
+          else
+          {
+               if (next >= limit)
+                    gc_claim_tenured_run(&next, &limit);
+
+               SET_GC_MARK(next, 1);
+
+               r->objects[ii] = next++;
+          }
+     }
+
+     gc_release_tenured_run(next, limit);
+}
+
+static void image_load_hash(struct image_reader_t *r, lref_t obj, struct lobject_t *cell)
+{
+     struct image_hash_t *header =
+          (struct image_hash_t *) image_data(r, cell->as.hash.table, sizeof(struct image_hash_t));
+
+     hash_init_cell(obj, header->shallow, (enum hash_layout_t) header->layout, (size_t) header->count);
+
+     obj->as.hash.table->weakness = (enum hash_weakness_t) header->weakness;
+     obj->as.hash.table->is_concurrent = header->concurrent;
+}
+
+/* Fill in the entries of a hash table once every object they might be
+ * hashed by has been loaded. */
+static void image_fill_hash(struct image_reader_t *r, lref_t obj, struct lobject_t *cell)
+{
+     struct image_hash_t *header =
+          (struct image_hash_t *) image_data(r, cell->as.hash.table, sizeof(struct image_hash_t));
+
+     lref_t *entries = (lref_t *) image_data(r, (uint8_t *) cell->as.hash.table + sizeof(*header),
+                                             (size_t) header->count * 2 * sizeof(lref_t));
+
+     for (size_t ii = 0; ii < header->count; ii++)
+          lhash_set(obj, image_decode(r, entries[2 * ii]), image_decode(r, entries[2 * ii + 1]));
+}
+
+static void image_load_object(struct image_reader_t *r, lref_t obj, struct lobject_t *cell)
+{
+     memcpy(obj, cell, sizeof(*obj));
+
+     switch (TYPE(obj))
+     {
+     case TC_CONS:
+          image_decode_field(r, obj, &(obj->as.cons.car));
+          image_decode_field(r, obj, &(obj->as.cons.cdr));
+          break;
+
+     case TC_FLONUM:
+          image_decode_field(r, obj, &(obj->as.flonum.im_part));
+          break;
+
+     case TC_SYMBOL:
+          image_decode_field(r, obj, &(obj->as.symbol.props));
+          image_decode_field(r, obj, &(obj->as.symbol.vcell));
+          image_decode_field(r, obj, &(obj->as.symbol.home));
+          break;
+
+     case TC_PACKAGE:
+          image_decode_field(r, obj, &(obj->as.package.name));
+          image_decode_field(r, obj, &(obj->as.package.bindings));
+          image_decode_field(r, obj, &(obj->as.package.use_list));
+          break;
+
+     case TC_CLOSURE:
+          image_decode_field(r, obj, &(obj->as.closure.env));
+          image_decode_field(r, obj, &(obj->as.closure.code));
+          image_decode_field(r, obj, &(obj->as.closure.property_list));
+          break;
+
+     case TC_MACRO:
+          image_decode_field(r, obj, &(obj->as.macro.transformer));
+          break;
+
+     case TC_VALUES_TUPLE:
+          image_decode_field(r, obj, &(obj->as.values_tuple.values));
+          break;
+
+     case TC_FAST_OP:
+          image_decode_field(r, obj, &(obj->as.fast_op.next));
+          image_decode_field(r, obj, &(obj->as.fast_op.arg1));
+          image_decode_field(r, obj, &(obj->as.fast_op.arg2));
+          break;
+
+     case TC_STRING:
+          string_init_cell(obj, cell->as.string.dim,
+                           (_TCHAR *) image_data(r, cell->as.string.data,
+                                                 cell->as.string.dim * sizeof(_TCHAR)));
+          obj->as.string.hash = cell->as.string.hash;
+          break;
+
+     case TC_VECTOR:
+          obj->as.vector.data = image_load_refs(r, obj, cell->as.vector.data, cell->as.vector.dim);
+          break;
+
+     case TC_STRUCTURE:
+          obj->as.vector.data = image_load_refs(r, obj, cell->as.vector.data, cell->as.vector.dim);
+          image_decode_field(r, obj, &(obj->as.vector.layout));
+          break;
+
+     case TC_ENVIRONMENT:
+          image_decode_field(r, obj, &(obj->as.environment.parent));
+          image_decode_field(r, obj, &(obj->as.environment.formals));
+          image_decode_field(r, obj, &(obj->as.environment.slots));
+          break;
+
+     case TC_ENVIRONMENT_SLOTS:
+          for (size_t ii = 0; ii < 3; ii++)
+               image_decode_field(r, obj, &(obj->as.environment_slots.slot[ii]));
+          break;
+
+     case TC_HASH:
+          image_load_hash(r, obj, cell);
+          break;
+
+     default:
+          image_load_failed(r, _T("bad object type"));
+     }
+}
+
+static void image_load_roots(struct image_reader_t *r)
+{
+     uint64_t *pos = r->roots;
+     uint64_t *end = r->roots + r->header->root_words;
+
+     for (size_t ii = 0; ii < IMAGE_ROOT_COUNT; ii++)
+     {
+          struct gc_root_t *root = image_find_root(image_root_names[ii]);
+
+          if ((pos >= end) || (*pos != root->length) || (root->length > (size_t) (end - pos - 1)))
+               image_load_failed(r, _T("bad roots"));
+
+          lref_t *refs = (lref_t *) (pos + 1);
+
+          for (size_t jj = 0; jj < root->length; jj++)
+               root->location[jj] = image_decode(r, refs[jj]);
+
+          pos += root->length + 1;
+     }
+}
+
+void load_boot_image(const _TCHAR * filename)
+{
+     struct image_reader_t r;
+     void *base;
+     size_t size;
+
+     memset(&r, 0, sizeof(r));
+
+     r.filename = filename;
+
+     if (sys_map_file(filename, &base, &size) != SYS_OK)
+          image_load_failed(&r, _T("cannot open file"));
+
+     image_map(&r, base, size);
+
+     size_t cell_count = (size_t) r.header->cell_count;
+
+     r.objects = (lref_t *) gc_malloc(cell_count * sizeof(lref_t));
+
+     /*  Nothing here allocates through new_cell, so the heap isn't
+      *  collected while objects are half loaded. */
+     image_allocate_objects(&r);
+
+     for (size_t ii = 0; ii < cell_count; ii++)
+          if ((r.cells[ii].header.type != TC_SUBR) && (r.cells[ii].header.type != TC_PORT))
+               image_load_object(&r, r.objects[ii], &r.cells[ii]);
+
+     for (size_t ii = 0; ii < cell_count; ii++)
+          if (r.cells[ii].header.type == TC_HASH)
+               image_fill_hash(&r, r.objects[ii], &r.cells[ii]);
+
+     image_load_roots(&r);
+
+     flush_call_site_caches();
+
+     interp.gc_total_cells_allocated += cell_count;
+
+     dscwritef(DF_SHOW_GC_DETAILS, (";;; loaded heap image of ~cd cells from ~cs\n",
+                                    (long) cell_count, filename));
+
+     gc_free(r.objects);
+     sys_unmap_file(base, size);
+}
@@ -22,7 +22,7 @@ void io_encode_uint8(uint8_t *buf, unsigned_fixnum_t num)
      buf[0] = (uint8_t)num;
 }
 
-unsigned_fixnum_t io_decode_uint8(uint8_t *buf)
+unsigned_fixnum_t io_decode_uint8(const uint8_t *buf)
 {
      return (uint8_t)buf[0];
 }
@@ -34,7 +34,7 @@ void io_encode_int8(uint8_t *buf, fixnum_t num)
      buf[0] = (uint8_t)num;
 }
 
-fixnum_t io_decode_int8(uint8_t *buf)
+fixnum_t io_decode_int8(const uint8_t *buf)
 {
      return (int8_t)buf[0];
 }
@@ -47,7 +47,7 @@ void io_encode_uint16(uint8_t *buf, unsigned_fixnum_t num)
      buf[1] = (uint8_t)num;
 }
 
-unsigned_fixnum_t io_decode_uint16(uint8_t *buf)
+unsigned_fixnum_t io_decode_uint16(const uint8_t *buf)
 {
      return (((uint16_t)buf[0] <<  8) +
              ((uint16_t)buf[1]));
@@ -61,7 +61,7 @@ void io_encode_int16(uint8_t *buf, fixnum_t num)
      buf[1] = (uint8_t)num;
 }
 
-fixnum_t io_decode_int16(uint8_t *buf)
+fixnum_t io_decode_int16(const uint8_t *buf)
 {
      return ((int16_t)(buf[0] << 8) +
              (int16_t)buf[1]);
@@ -77,7 +77,7 @@ void io_encode_uint32(uint8_t *buf, unsigned_fixnum_t num)
      buf[3] = (uint8_t)num;
 }
 
-unsigned_fixnum_t io_decode_uint32(uint8_t *buf)
+unsigned_fixnum_t io_decode_uint32(const uint8_t *buf)
 {
      return (((uint32_t)buf[0] << 24) +
              ((uint32_t)buf[1] << 16) +
@@ -95,7 +95,7 @@ void io_encode_int32(uint8_t *buf, fixnum_t num)
      buf[3] = (uint8_t)num;
 }
 
-fixnum_t io_decode_int32(uint8_t *buf)
+fixnum_t io_decode_int32(const uint8_t *buf)
 {
      return (((int32_t)(buf[0] << 24)) +
              ((int32_t)(buf[1] << 16)) +
@@ -117,7 +117,7 @@ void io_encode_uint64(uint8_t *buf, unsigned_fixnum_t num)
      buf[7] = (uint8_t)num;
 }
 
-unsigned_fixnum_t io_decode_uint64(uint8_t *buf)
+unsigned_fixnum_t io_decode_uint64(const uint8_t *buf)
 {
      return (((unsigned_fixnum_t)buf[0] << 56) +
              ((unsigned_fixnum_t)buf[1] << 48) +
@@ -143,7 +143,7 @@ void io_encode_int64(uint8_t *buf, fixnum_t num)
      buf[7] = (uint8_t)num;
 }
 
-fixnum_t io_decode_int64(uint8_t *buf)
+fixnum_t io_decode_int64(const uint8_t *buf)
 {
      return (((fixnum_t)buf[0] << 56) +
              ((fixnum_t)buf[1] << 48) +
@@ -162,7 +162,7 @@ void io_encode_flonum(uint8_t *buf, flonum_t num)
      memcpy(buf, &num, sizeof(flonum_t));
 }
 
-flonum_t io_decode_flonum(uint8_t *buf)
+flonum_t io_decode_flonum(const uint8_t *buf)
 {
      flonum_t value;
 
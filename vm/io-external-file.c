@@ -98,6 +98,15 @@ void file_port_flush(lref_t port)
      fflush(f);
 }
 
+bool file_port_seek(lref_t port, size_t position)
+{
+     FILE *f = PORT_FILE(port);
+
+     assert(f);
+
+     return fseek(f, (long) position, SEEK_SET) == 0;
+}
+
 void file_port_close(lref_t port)
 {
      FILE *f = PORT_FILE(port);;
@@ -125,6 +134,8 @@ struct port_class_t file_port_class = {
      file_port_close,       // close
      NULL,                  // gc_free
      NULL,                  // length
+     file_port_seek,        // seek
+     NULL,                  // read_in_place
 };
 
 bool get_c_port_mode(lref_t mode)
@@ -191,6 +202,8 @@ struct port_class_t stdin_port_class = {
      stdio_port_close,       // close
      NULL,                   // gc_free
      NULL,                   // length
+     NULL,                   // seek
+     NULL,                   // read_in_place
 };
 
 void stdout_port_open(lref_t obj)
@@ -212,6 +225,8 @@ struct port_class_t stdout_port_class = {
      stdio_port_close,      // close
      NULL,                  // gc_free
      NULL,                  // length
+     NULL,                  // seek
+     NULL,                  // read_in_place
 };
 
 void stderr_port_open(lref_t obj)
@@ -233,6 +248,8 @@ struct port_class_t stderr_port_class = {
      stdio_port_close,      // close
      NULL,                  // gc_free
      NULL,                  // length
+     NULL,                  // seek
+     NULL,                  // read_in_place
 };
 
 
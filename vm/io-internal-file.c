@@ -42,6 +42,24 @@ size_t c_data_port_read_bytes(lref_t port, void *buf, size_t size)
      return size;
 }
 
+const void *c_data_port_read_in_place(lref_t port, size_t *size)
+{
+     *size = 0;
+
+     if (!PORT_INPUTP(port))
+          return NULL;
+
+     struct c_data_port_state *ps =
+          (struct c_data_port_state *) (PORT_PINFO(port)->user_data);
+
+     const void *bytes = &(ps->buf[ps->buf_pos]);
+
+     *size = ps->buf_size - ps->buf_pos;
+     ps->buf_pos = ps->buf_size;
+
+     return bytes;
+}
+
 void c_data_port_gc_free(lref_t obj)
 {
      assert(PORT_PINFO(obj)->user_data);
@@ -76,6 +94,8 @@ struct port_class_t c_data_port_class = {
      NULL,                   // close
      c_data_port_gc_free,    // gc_free
      c_data_port_length,     // length
+     NULL,                   // seek
+     c_data_port_read_in_place, // read_in_place
 };
 
 
@@ -95,6 +115,25 @@ lref_t open_c_data_input(struct internal_file_t *data)
      return portcons(&c_data_port_class, NIL, PORT_INPUT, NIL, ps);
 }
 
+/* Open a C-data port on a copy of the bytes of <string>, so they can be
+ * read in place as an internal file's are. The port holds on to the
+ * copy, which keeps the bytes it hands out where they are for as long
+ * as the port is reachable. */
+lref_t liopen_c_data_input_string(lref_t string)
+{
+     if (!STRINGP(string))
+          vmerror_wrong_type_n(1, string);
+
+     lref_t copy = strconsdup(string);
+     struct c_data_port_state *ps = gc_malloc(sizeof(*ps));
+
+     ps->buf      = (unsigned char *) copy->as.string.data;
+     ps->buf_size = copy->as.string.dim;
+     ps->buf_pos  = 0;
+
+     return portcons(&c_data_port_class, NIL, PORT_INPUT, copy, ps);
+}
+
 void register_internal_file(struct internal_file_t *data)
 {
      lref_t file_record = lcons(strconsbuf(data->_name), open_c_data_input(data));
@@ -75,6 +75,8 @@ struct port_class_t input_string_port_class = {
      NULL,                         // close
      NULL,                         // gc_free
      input_string_port_length,     // length
+     NULL,                         // seek
+     NULL,                         // read_in_place
 };
 
 lref_t lopen_input_string(lref_t string)
@@ -135,6 +137,8 @@ struct port_class_t output_string_port_class = {
      NULL,                           // close
      NULL,                           // gc_free
      output_string_port_length,      // length
+     NULL,                           // seek
+     NULL,                           // read_in_place
 };
 
 lref_t lopen_output_string()
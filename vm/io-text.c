@@ -529,6 +529,11 @@ void text_port_flush(lref_t obj)
 
 void text_port_close(lref_t obj)
 {
+     /* When a text port and its underlying port are garbage collected
+      * together, the underlying port may have been swept first. */
+     if (!PORTP(PORT_USER_OBJECT(obj)))
+          return;
+
      lclose_port(PORT_UNDERLYING(obj));
 }
 
@@ -545,7 +550,9 @@ struct port_class_t text_port_class = {
      text_port_flush,       // flush
      text_port_close,       // close
      NULL,                  // gc_free
-     NULL                   // length
+     NULL,                  // length
+     NULL,                  // seek
+     NULL                   // read_in_place
 };
 
 lref_t lopen_text_input_port(lref_t underlying)
@@ -75,6 +75,8 @@ lref_t initialize_port(lref_t port,
      PORT_PINFO(port)->user_data = user_data;
      PORT_PINFO(port)->user_object = user_object;
      PORT_PINFO(port)->mode = mode;
+     PORT_PINFO(port)->bytes_read = 0;
+     PORT_PINFO(port)->write_position = 0;
 
      SET_PORT_TEXT_INFO(port, NULL);;
 
@@ -99,7 +101,12 @@ size_t write_bytes(lref_t port, const void *buf, size_t size)
      assert(!NULLP(port));
      assert(PORT_CLASS(port)->write_bytes);
 
-     return PORT_CLASS(port)->write_bytes(port, buf, size);
+     size_t actual_count =
+          PORT_CLASS(port)->write_bytes(port, buf, size);
+
+     PORT_PINFO(port)->write_position += actual_count;
+
+     return actual_count;
 }
 
 size_t read_bytes(lref_t port, void *buf, size_t size)
@@ -115,6 +122,23 @@ size_t read_bytes(lref_t port, void *buf, size_t size)
      return actual_count;
 }
 
+/* Returns a pointer to the rest of the port's input where it already
+ * lies in memory, consuming it, or NULL if the port's class can't read
+ * in place. */
+const void *read_bytes_in_place(lref_t port, size_t *size)
+{
+     assert(!NULLP(port));
+
+     if (PORT_CLASS(port)->read_in_place == NULL)
+          return NULL;
+
+     const void *bytes = PORT_CLASS(port)->read_in_place(port, size);
+
+     PORT_PINFO(port)->bytes_read += *size;
+
+     return bytes;
+}
+
 lref_t portcons(struct port_class_t * cls,
                 lref_t port_name,
                 enum port_mode_t mode,
@@ -194,6 +218,41 @@ lref_t lport_class_name(lref_t port)
      return strconsbuf(PORT_CLASS(port)->name);
 }
 
+/* The byte offset of a binary port: the number of bytes read from an
+ * input port, or the offset of the next byte written to an output port. */
+lref_t lport_position(lref_t port)
+{
+     if (!BINARY_PORTP(port))
+          vmerror_wrong_type_n(1, port);
+
+     if (PORT_OUTPUTP(port))
+          return fixcons(PORT_PINFO(port)->write_position);
+
+     return fixcons(PORT_PINFO(port)->bytes_read);
+}
+
+lref_t lport_set_position(lref_t port, lref_t position)
+{
+     if (!BINARY_PORTP(port))
+          vmerror_wrong_type_n(1, port);
+
+     if (!FIXNUMP(position) || (FIXNM(position) < 0))
+          vmerror_wrong_type_n(2, position);
+
+     if (PORT_CLASS(port)->seek == NULL)
+          vmerror_unsupported(_T("port cannot seek"));
+
+     if (!PORT_CLASS(port)->seek(port, (size_t) FIXNM(position)))
+          vmerror_io_error(_T("error seeking port."), port);
+
+     if (PORT_OUTPUTP(port))
+          PORT_PINFO(port)->write_position = (size_t) FIXNM(position);
+     else
+          PORT_PINFO(port)->bytes_read = (size_t) FIXNM(position);
+
+     return port;
+}
+
 lref_t lclose_port(lref_t port)
 {
      if (!PORTP(port))
@@ -441,6 +500,8 @@ struct port_class_t null_port_class = {
      NULL,                  // close
      NULL,                  // gc_free
      NULL,                  // length
+     NULL,                  // seek
+     NULL,                  // read_in_place
 };
 
 lref_t lopen_null_port()
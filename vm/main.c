@@ -115,6 +115,52 @@ static void process_vm_arg_max_heap_segments(_TCHAR * arg_name, _TCHAR * arg_val
      interp.gc_max_heap_segments = process_vm_int_argument_value(arg_name, arg_value);
 }
 
+static void process_vm_arg_max_heap_size(_TCHAR * arg_name, _TCHAR * arg_value)
+{
+     interp.gc_max_heap_bytes = process_vm_int_argument_value(arg_name, arg_value);
+}
+
+static void process_vm_arg_gc_min_free(_TCHAR * arg_name, _TCHAR * arg_value)
+{
+     interp.gc_min_free_percent = process_vm_int_argument_value(arg_name, arg_value);
+}
+
+static void process_vm_arg_gc_target_free(_TCHAR * arg_name, _TCHAR * arg_value)
+{
+     interp.gc_target_free_percent = process_vm_int_argument_value(arg_name, arg_value);
+}
+
+static void process_vm_arg_gc_max_free(_TCHAR * arg_name, _TCHAR * arg_value)
+{
+     interp.gc_max_free_percent = process_vm_int_argument_value(arg_name, arg_value);
+}
+
+static void process_vm_arg_nursery_size(_TCHAR * arg_name, _TCHAR * arg_value)
+{
+     interp.gc_nursery_size =
+         process_vm_int_argument_value(arg_name, arg_value)
+          / sizeof(struct lobject_t);
+}
+
+static void process_vm_arg_gc_pause_budget(_TCHAR * arg_name, _TCHAR * arg_value)
+{
+     /* The budget is given in microseconds. */
+     interp.gc_pause_budget =
+         process_vm_int_argument_value(arg_name, arg_value) / 1000000.0;
+}
+
+static void process_vm_arg_gc_threads(_TCHAR * arg_name, _TCHAR * arg_value)
+{
+     interp.gc_threads =
+          MIN2(MAX2(process_vm_int_argument_value(arg_name, arg_value), (size_t) 1),
+               (size_t) GC_MAX_THREADS);
+}
+
+static void process_vm_arg_fasl_lazy_load(_TCHAR * arg_name, _TCHAR * arg_value)
+{
+     interp.fasl_lazy_load = (process_vm_int_argument_value(arg_name, arg_value) != 0);
+}
+
 static void process_vm_arg_init_load(_TCHAR * arg_name, _TCHAR * arg_value)
 {
      UNREFERENCED(arg_name);
@@ -127,6 +173,20 @@ static void process_vm_arg_init_load(_TCHAR * arg_name, _TCHAR * arg_value)
      interp.init_load_file_count++;
 }
 
+static void process_vm_arg_boot_image(_TCHAR * arg_name, _TCHAR * arg_value)
+{
+     UNREFERENCED(arg_name);
+
+     interp.boot_image_file_name = arg_value;
+}
+
+static void process_vm_arg_dump_boot_image(_TCHAR * arg_name, _TCHAR * arg_value)
+{
+     UNREFERENCED(arg_name);
+
+     interp.dump_boot_image_file_name = arg_value;
+}
+
 /* *INDENT-OFF* */
   static struct {
     const _TCHAR *vm_arg_name;
@@ -135,7 +195,17 @@ static void process_vm_arg_init_load(_TCHAR * arg_name, _TCHAR * arg_value)
     { "debug-flags",       process_vm_arg_debug_flags },
     { "heap-segment-size", process_vm_arg_heap_segment_size },
     { "max-heap-segments", process_vm_arg_max_heap_segments },
+    { "max-heap-size",     process_vm_arg_max_heap_size },
+    { "gc-min-free",       process_vm_arg_gc_min_free },
+    { "gc-target-free",    process_vm_arg_gc_target_free },
+    { "gc-max-free",       process_vm_arg_gc_max_free },
+    { "nursery-size",      process_vm_arg_nursery_size },
+    { "gc-pause-budget",   process_vm_arg_gc_pause_budget },
+    { "gc-threads",        process_vm_arg_gc_threads },
+    { "fasl-lazy-load",    process_vm_arg_fasl_lazy_load },
     { "init-load",         process_vm_arg_init_load },
+    { "boot-image",        process_vm_arg_boot_image },
+    { "dump-boot-image",   process_vm_arg_dump_boot_image },
     { NULL, NULL }
   };
 /* *INDENT-ON* */
@@ -244,6 +314,7 @@ static void init_base_scheme_objects(void)
 static void register_main_subrs()
 {
 /* *INDENT-OFF* */
+    register_subr(_T("%bytecode-operand-count"),          SUBR_1,     (void*)lbytecode_operand_count             );
     register_subr(_T("%closure"),                         SUBR_3,     (void*)lclosurecons                        );
     register_subr(_T("%closure-code"),                    SUBR_1,     (void*)lclosure_code                       );
     register_subr(_T("%closure-env"),                     SUBR_1,     (void*)lclosure_env                        );
@@ -255,9 +326,11 @@ static void register_main_subrs()
     register_subr(_T("%directory"),                       SUBR_2,     (void*)lidirectory                         );
     register_subr(_T("%dump-heap-state"),                 SUBR_1,     (void*)ldump_heap_state                    );
     register_subr(_T("%%fasl-load"),                      SUBR_1,     (void*)liifasl_load                        );
+    register_subr(_T("%environment-frames"),              SUBR_1,     (void*)lenvironment_frames                 );
     register_subr(_T("%fast-op"),                         SUBR_4,     (void*)lfast_op                            );
     register_subr(_T("%fast-op-args"),                    SUBR_1,     (void*)lfast_op_args                       );
     register_subr(_T("%fast-op-opcode"),                  SUBR_1,     (void*)lfast_op_opcode                     );
+    register_subr(_T("%fast-op-deferred?"),               SUBR_1,     (void*)lfast_op_deferredp                  );
     register_subr(_T("%fast-op-next"),                    SUBR_1,     (void*)lfast_op_next                       );
     register_subr(_T("identity-hash?"),                   SUBR_1,     (void*)lidentity_hash_p                    );
     register_subr(_T("%file-details"),                    SUBR_2,     (void*)lifile_details                      );
@@ -270,6 +343,7 @@ static void register_main_subrs()
     register_subr(_T("%make-eof"),                        SUBR_0,     (void*)lmake_eof                           );
     register_subr(_T("%memref"),                          SUBR_1,     (void*)lmemref                             );
     register_subr(_T("%obaddr"),                          SUBR_1,     (void*)lobaddr                             );
+    register_subr(_T("%open-c-data-input-string"),        SUBR_1,     (void*)liopen_c_data_input_string          );
     register_subr(_T("%package-bindings"),                SUBR_1,     (void*)lpackage_bindings                   );
     register_subr(_T("%package-use-list"),                SUBR_1,     (void*)lpackage_use_list                   );
     register_subr(_T("%packagecons"),                     SUBR_1,     (void*)lipackagecons                       );
@@ -280,6 +354,7 @@ static void register_main_subrs()
     register_subr(_T("%set-closure-env"),                 SUBR_2,     (void*)lset_closure_env                    );
     register_subr(_T("%set-control-field"),               SUBR_2,     (void*)liset_control_field                 );
     register_subr(_T("%set-debug-flags"),                 SUBR_1,     (void*)lset_debug_flags                    );
+    register_subr(_T("%set-fasl-lazy-load!"),             SUBR_1,     (void*)lset_fasl_lazy_load                 );
     register_subr(_T("%set-fasl-package-list!"),          SUBR_1,     (void*)lset_fasl_package_list              );
     register_subr(_T("%set-interrupt-mask!"),             SUBR_1,     (void*)lset_interrupt_mask                 );
     register_subr(_T("%set-package-name"),                SUBR_2,     (void*)lset_package_name                   );
@@ -374,12 +449,16 @@ static void register_main_subrs()
     register_subr(_T("hash->p-list"),                     SUBR_1,     (void*)lhash2list                          );
     register_subr(_T("hash-clear!"),                      SUBR_1,     (void*)lhash_clear                         );
     register_subr(_T("hash-copy"),                        SUBR_1,     (void*)lhash_copy                          );
+    register_subr(_T("hash-fold"),                        SUBR_3,     (void*)lhash_fold                          );
+    register_subr(_T("hash-for-each"),                    SUBR_2,     (void*)lhash_for_each                      );
     register_subr(_T("hash-has?"),                        SUBR_2,     (void*)lhash_hasp                          );
+    register_subr(_T("hash-merge!"),                      SUBR_2,     (void*)lhash_merge                         );
     register_subr(_T("hash-ref"),                         SUBR_ARGC,  (void*)lhash_ref                           );
     register_subr(_T("hash-ref*"),                        SUBR_2,     (void*)lhash_refs                          );
     register_subr(_T("hash-remove!"),                     SUBR_2,     (void*)lhash_remove                        );
     register_subr(_T("hash-set!"),                        SUBR_3,     (void*)lhash_set                           );
     register_subr(_T("hash-set-multiple!"),               SUBR_2,     (void*)lhash_set_multiple                  );
+    register_subr(_T("hash-update!"),                     SUBR_ARGC,  (void*)lhash_update                        );
     register_subr(_T("hash?"),                            SUBR_1,     (void*)lhashp                              );
     register_subr(_T("imag-part"),                        SUBR_1,     (void*)limag_part                          );
     register_subr(_T("inexact->display-string"),          SUBR_4,     (void*)linexact2display_string             );
@@ -396,11 +475,13 @@ static void register_main_subrs()
     register_subr(_T("macro?"),                           SUBR_1,     (void*)lmacrop                             );
     register_subr(_T("magnitude"),                        SUBR_1,     (void*)lmagnitude                          );
     register_subr(_T("make-fasl-reader"),                 SUBR_1,     (void*)lmake_fasl_reader                   );
-    register_subr(_T("make-hash"),                        SUBR_0,     (void*)lmake_hash                          );
-    register_subr(_T("make-identity-hash"),               SUBR_0,     (void*)lmake_identity_hash                 );
+    register_subr(_T("make-hash"),                        SUBR_1,     (void*)lmake_hash                          );
+    register_subr(_T("make-identity-hash"),               SUBR_1,     (void*)lmake_identity_hash                 );
     register_subr(_T("make-polar"),                       SUBR_2,     (void*)lmake_polar                         );
     register_subr(_T("make-rectangular"),                 SUBR_2,     (void*)lmake_rectangular                   );
     register_subr(_T("make-vector"),                      SUBR_2,     (void*)lmake_vector                        );
+    register_subr(_T("make-weak-key-hash"),               SUBR_0,     (void*)lmake_weak_key_hash                 );
+    register_subr(_T("make-weak-value-hash"),             SUBR_0,     (void*)lmake_weak_value_hash               );
     register_subr(_T("modulo"),                           SUBR_2,     (void*)lmodulo                             );
     register_subr(_T("nan?"),                             SUBR_1,     (void*)lnanp                               );
     register_subr(_T("newline"),                          SUBR_1,     (void*)lnewline                            );
@@ -428,6 +509,7 @@ static void register_main_subrs()
     register_subr(_T("port-row"),                         SUBR_1,     (void*)lport_row                           );
     register_subr(_T("port-name"),                        SUBR_1,     (void*)lport_name                          );
     register_subr(_T("port-open?"),                       SUBR_1,     (void*)lport_openp                         );
+    register_subr(_T("port-position"),                    SUBR_1,     (void*)lport_position                      );
     register_subr(_T("port-translate-mode"),              SUBR_1,     (void*)lport_translate_mode                );
     register_subr(_T("primitive?"),                       SUBR_1,     (void*)lprimitivep                         );
     register_subr(_T("procedure?"),                       SUBR_1,     (void*)lprocedurep                         );
@@ -457,6 +539,7 @@ static void register_main_subrs()
     register_subr(_T("set-car!"),                         SUBR_2,     (void*)lsetcar                             );
     register_subr(_T("set-cdr!"),                         SUBR_2,     (void*)lsetcdr                             );
     register_subr(_T("set-environment-variable!"),        SUBR_2,     (void*)lset_environment_variable           );
+    register_subr(_T("set-port-position!"),               SUBR_2,     (void*)lport_set_position                  );
     register_subr(_T("set-port-translate-mode!"),         SUBR_2,     (void*)lport_set_translate_mode            );
     register_subr(_T("set-random-seed!"),                 SUBR_1,     (void*)lset_random_seed                    );
     register_subr(_T("set-symbol-package!"),              SUBR_2,     (void*)lset_symbol_package                 );
@@ -567,6 +650,9 @@ void init0(int argc, _TCHAR * argv[], enum debug_flag_t initial_debug_flags)
 
      interp.init_load_file_count = 0;
 
+     interp.boot_image_file_name = NULL;
+     interp.dump_boot_image_file_name = NULL;
+
      interp.intr_pending = VMINTR_NONE;
      interp.intr_masked = false;
 
@@ -575,12 +661,50 @@ void init0(int argc, _TCHAR * argv[], enum debug_flag_t initial_debug_flags)
      interp.fasl_package_list = NIL;
      gc_protect(_T("fasl-package-list"), &interp.fasl_package_list, 1);
 
+     /*  Only readers with the stream's bytes in place can skip deferred
+      *  objects, and nothing loaded by default is read that way, so lazy
+      *  loading is asked for with -Xfasl-lazy-load=1. */
+     interp.fasl_lazy_load = false;
+
      /*  Statistics Counters */
      interp.gc_heap_segment_size = DEFAULT_HEAP_SEGMENT_SIZE;
      interp.gc_max_heap_segments = DEFAULT_MAX_HEAP_SEGMENTS;
+     interp.gc_max_heap_bytes = 0;
      interp.gc_current_heap_segments = 0;
      interp.gc_heap_segments = NULL;
 
+     interp.gc_min_free_percent = DEFAULT_GC_MIN_FREE_PERCENT;
+     interp.gc_target_free_percent = DEFAULT_GC_TARGET_FREE_PERCENT;
+     interp.gc_max_free_percent = DEFAULT_GC_MAX_FREE_PERCENT;
+     interp.gc_segments_to_release = 0;
+
+     interp.gc_nursery_size = DEFAULT_NURSERY_SIZE;
+     interp.gc_nursery_cells = 0;
+
+     interp.gc_remembered_set_size = 0;
+     interp.gc_remembered_set_capacity = 0;
+     interp.gc_remembered_set = NULL;
+
+     interp.gc_mark_stack_size = 0;
+     interp.gc_mark_stack_capacity = 0;
+     interp.gc_mark_stack = NULL;
+
+     interp.gc_pause_budget = 0.0;
+     interp.gc_phase = GC_IDLE;
+     interp.gc_incremental_slices = 0;
+     interp.gc_max_slice_time = 0.0;
+
+     interp.gc_threads = DEFAULT_GC_THREADS;
+     interp.gc_workers = NULL;
+     interp.gc_work_lock = NULL;
+
+     interp.gc_root_time = 0.0;
+     interp.gc_mark_time = 0.0;
+     interp.gc_sweep_time = 0.0;
+
+     interp.gc_minor_collections = 0;
+     interp.gc_major_collections = 0;
+
      interp.gc_total_cells_allocated = 0;
 
      interp.gc_malloc_bytes_threshold = (sizeof(struct lobject_t) * interp.gc_heap_segment_size);
@@ -588,16 +712,24 @@ void init0(int argc, _TCHAR * argv[], enum debug_flag_t initial_debug_flags)
      interp.gc_total_run_time = 0.0;
      interp.gc_start_time = 0.0;
 
+     interp.hash_retired_tables = NULL;
+
      interp.thread.fsp = &(interp.thread.frame_stack[FRAME_STACK_SIZE]);
      interp.thread.frame = NULL;
 
      process_vm_arguments(argc, argv);
 
+     /*  Objects still to be read hold on to their FASL readers, which
+      *  can't be written to a heap image. */
+     if (interp.dump_boot_image_file_name != NULL)
+          interp.fasl_lazy_load = false;
+
      if (interp.debug_flags != DF_NONE)
           dscwritef(DF_ALWAYS, ("; DEBUG: debug_flags=0x~cx\n", interp.debug_flags));
 
     /*** Create the gc heap and populate it with the standard objects */
      gc_initialize_heap();
+     init_hash_locks();
 
      create_initial_packages();
      init_base_scheme_objects();
@@ -607,13 +739,19 @@ void init0(int argc, _TCHAR * argv[], enum debug_flag_t initial_debug_flags)
 
      gc_protect(_T("handler-frames"), &(CURRENT_TIB()->handler_frames), 1);
 
-     gc_protect(_T("frame-stack"), (struct lobject_t **)&(CURRENT_TIB()->frame_stack[0]), sizeof(CURRENT_TIB()->frame_stack) / sizeof(lref_t));
-
      accept_command_line_arguments(argc, argv);
 
+     if (interp.boot_image_file_name != NULL)
+          load_boot_image(interp.boot_image_file_name);
+
      load_init_load_files();
 }
 
+bool boot_image_loaded()
+{
+     return interp.boot_image_file_name != NULL;
+}
+
 
 flonum_t time_since_launch()
 {
@@ -626,12 +764,22 @@ lref_t run()
      if (DEBUG_FLAG(DF_NO_STARTUP))
           return NIL;
 
+     /*  The image is dumped once the boot code has been loaded, before
+      *  any of it has run. */
+     if (interp.dump_boot_image_file_name != NULL)
+     {
+          dump_boot_image(interp.dump_boot_image_file_name);
+
+          return fixcons(0);
+     }
+
      return vmtrap(TRAP_RUN0, VMT_MANDATORY_TRAP, 0);
 }
 
 void shutdown()
 {
      gc_release_heap();
+     release_hash_locks();
 }
 
 
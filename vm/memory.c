@@ -2,7 +2,7 @@
  * memory.c --
  *
  * Garbage collected heap management. The GC heap is a heap of lobject_t's
- * managed by a conservative mark and sweep  garbage collector.
+ * managed by a conservative, generational mark and sweep garbage collector.
  *
  * (C) Copyright 2001-2014 East Coast Toolworks Inc.
  * (C) Portions Copyright 1988-1994 Paradigm Associates Inc.
@@ -14,6 +14,7 @@
 #include "scan-private.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 
 /**** The C Heap
@@ -88,6 +89,29 @@ static double gc_end_timer()
 }
 
 
+/* gc_grow_table
+ *
+ * Double the capacity of a table of <elem_size> byte entries
+ * allocated with gc_malloc, or allocate it with <initial_capacity>
+ * entries if it's empty.
+ */
+static void *gc_grow_table(void *table, size_t elem_size,
+                           size_t *capacity, size_t initial_capacity)
+{
+     size_t new_capacity = (*capacity == 0) ? initial_capacity : *capacity * 2;
+
+     void *new_table = gc_malloc(elem_size * new_capacity);
+
+     if (table != NULL)
+          memcpy(new_table, table, elem_size * *capacity);
+
+     gc_free(table);
+
+     *capacity = new_capacity;
+
+     return new_table;
+}
+
 /*** GC Root Registry ***/
 
 static size_t gc_find_free_root()
@@ -120,440 +144,1692 @@ void gc_protect(const _TCHAR * name, lref_t * location, size_t n)
 static void gc_init_cell(lref_t obj)
 {
      obj->header.type = TC_FREE_CELL;
-     SET_GC_MARK(obj, 0);
+     SET_GC_REMEMBERED(obj, 0);
 }
 
-static int gc_sub_freelist_length(lref_t current_freelist)
+/*** Allocation runs
+ *
+ * The heap is divided into allocation runs of ALLOCATION_RUN_SIZE
+ * contiguous cells, each aligned on its size in bytes. The first
+ * GC_RUN_BITMAP_CELLS cells of a run hold the mark bitmap of the run,
+ * and the rest are available for allocation. After a sweep, every unmarked
+ * cell in a run is free, and every marked cell belongs to an object that
+ * has survived a collection. The allocator claims one run at a time, and
+ * new_cell bumps a pointer through it, skipping the cells in use.
+ *
+ * Runs with no surviving objects are kept in interp.gc_free_runs, and
+ * are claimed first, so that the common case of a nursery that dies
+ * young is allocated without skipping anything. Runs that are at least
+ * half free are kept in interp.gc_partial_runs, and are claimed once
+ * the free runs are exhausted. The free cells in the remaining runs are
+ * not reused until a full collection.
+ */
+
+static void gc_run_table_push(struct gc_run_table_t *table,
+                              lref_t start, lref_t end, size_t free_cells)
 {
-     int len = 0;
+     if (table->count >= table->capacity)
+          table->runs = gc_grow_table(table->runs, sizeof(struct gc_run_t),
+                                      &table->capacity, INITIAL_RUN_TABLE_SIZE);
 
-     for (lref_t cell = current_freelist;
-          cell != NULL;
-          cell = NEXT_FREE_CELL(cell))
-          len++;
+     struct gc_run_t *run = &table->runs[table->count++];
 
-     return len;
+     run->start = start;
+     run->end = end;
+     run->free_cells = free_cells;
 }
 
-void gc_dump_freelists()
+static void gc_push_free_run(lref_t start, lref_t end, size_t free_cells)
+{
+     if (free_cells == (size_t)(end - start))
+          gc_run_table_push(&interp.gc_free_runs, start, end, free_cells);
+     else if (free_cells >= (size_t)(end - start) / 2)
+          gc_run_table_push(&interp.gc_partial_runs, start, end, free_cells);
+     else
+          return;
+
+     interp.gc_free_cells += free_cells;
+}
+
+static void gc_dump_run_table(struct gc_run_table_t *table)
 {
-     for (lref_t flist = interp.gc_global_freelist;
-          flist != NULL;
-          flist = NEXT_FREE_LIST(flist))
+     for (size_t ii = 0; ii < table->count; ii++)
      {
-          dscwritef(DF_ALWAYS, ("{~c&:~cd}",
-                                flist, gc_sub_freelist_length(flist)));
+          struct gc_run_t *run = &table->runs[ii];
+
+          dscwritef(DF_ALWAYS, ("{~c&:~cd/~cd}",
+                                run->start,
+                                (long)run->free_cells,
+                                (long)(run->end - run->start)));
      }
 
      dscwritef(DF_ALWAYS, ("\n"));
 }
 
+void gc_dump_freelists()
+{
+     gc_dump_run_table(&interp.gc_free_runs);
+     gc_dump_run_table(&interp.gc_partial_runs);
+}
+
 static size_t gc_heap_freelist_length(void)
 {
-     size_t count = 0;
+     return interp.gc_free_runs.count + interp.gc_partial_runs.count;
+}
+
+static void gc_clear_run_marks(lref_t run)
+{
+     memset(GC_MARK_BITMAP(run), 0, GC_RUN_BITMAP_WORDS * sizeof(uintptr_t));
+}
+
+/* Returns the number of allocatable cells in the heap, not counting
+ * the cells that hold mark bitmaps. */
+static size_t gc_heap_cells(void)
+{
+     size_t runs = interp.gc_heap_segment_size / ALLOCATION_RUN_SIZE;
 
-     for (lref_t flist = interp.gc_global_freelist;
-          flist != NULL;
-          flist = NEXT_FREE_LIST(flist))
-          count++;
+     return interp.gc_current_heap_segments
+          * (interp.gc_heap_segment_size - runs * GC_RUN_BITMAP_CELLS);
+}
+
+/* Cells that are free once marking is done, including those still
+ * waiting to be swept. */
+static fixnum_t gc_unmarked_cells(void)
+{
+     return gc_heap_cells() - interp.gc_marked_cells;
+}
+
+/*** Static cells
+ *
+ * A few objects are needed before the GC heap exists, and are never
+ * collected. They are allocated from a run of their own, outside the
+ * heap, so that they have a mark bitmap like every other cell.
+ */
+
+lref_t gc_allocate_static_cell()
+{
+     if (interp.gc_static_run == NULL)
+     {
+          uint8_t *block = (uint8_t *) gc_malloc(2 * GC_RUN_BYTES);
+
+          interp.gc_static_run =
+               (lref_t) (((uintptr_t) block + GC_RUN_BYTES - 1) & ~(uintptr_t) (GC_RUN_BYTES - 1));
+          interp.gc_static_cells = GC_RUN_BITMAP_CELLS;
+
+          gc_clear_run_marks(interp.gc_static_run);
+     }
+
+     if (interp.gc_static_cells >= ALLOCATION_RUN_SIZE)
+          panic("Static cells exhausted");
+
+     lref_t obj = &interp.gc_static_run[interp.gc_static_cells++];
+
+     gc_init_cell(obj);
 
-     return count;
+     return obj;
 }
 
 /*** The heap segment allocator
  *
  * The GC heap is maintained as a variable sized array of heap segments. The VM
  * starts out with one subheap, and will allocate up to as many as
- * HEAP_SEGMENT_LIMIT heaps, on an as-needed basis.
+ * interp.gc_max_heap_segments heaps, on an as-needed basis. Segments
+ * are mapped directly from the operating system, and are unmapped
+ * again when the heap shrinks.
+ *
+ * interp.gc_heap_segment_index holds the numbers of the allocated
+ * segments, sorted by base address, so that the segment containing an
+ * address can be found by binary search.
  */
 
-static void gc_init_heap_segment(lref_t seg_base)
+/* The size of the block mapped for a heap segment, including the
+ * slack needed to align it. */
+static size_t gc_heap_segment_bytes(void)
 {
-     lref_t current_sub_freelist = NIL;
-     size_t current_sub_freelist_size = 0;
+     return sizeof(struct lobject_t) * interp.gc_heap_segment_size + GC_RUN_BYTES;
+}
 
-     for (size_t ofs = 0; ofs < interp.gc_heap_segment_size; ofs++)
-     {
-          lref_t cell = &seg_base[ofs];
+static void gc_index_heap_segment(size_t seg_idx)
+{
+     lref_t seg_base = interp.gc_heap_segments[seg_idx];
+     size_t *index = interp.gc_heap_segment_index;
+     size_t ii = seg_idx;
 
-          gc_init_cell(cell);
+     for (; (ii > 0) && (interp.gc_heap_segments[index[ii - 1]] > seg_base); ii--)
+          index[ii] = index[ii - 1];
 
-          SET_NEXT_FREE_CELL(cell, current_sub_freelist);
-          current_sub_freelist = cell;
+     index[ii] = seg_idx;
 
-          current_sub_freelist_size++;
+     interp.gc_heap_low = interp.gc_heap_segments[index[0]];
+     interp.gc_heap_high = interp.gc_heap_segments[index[seg_idx]] + interp.gc_heap_segment_size;
+}
 
-          if (current_sub_freelist_size >= SUB_FREELIST_SIZE)
-          {
-               interp.gc_global_freelist =
-                    SET_NEXT_FREE_LIST(current_sub_freelist,
-                                       interp.gc_global_freelist);
+/* Returns the number of the heap segment containing <p>, or
+ * gc_max_heap_segments if there is none. */
+static size_t gc_find_heap_segment(lref_t p)
+{
+     if ((p < interp.gc_heap_low) || (p >= interp.gc_heap_high))
+          return interp.gc_max_heap_segments;
 
-               current_sub_freelist_size = 0;
-               current_sub_freelist = NIL;
-          }
+     size_t *index = interp.gc_heap_segment_index;
+     size_t lo = 0;
+     size_t hi = interp.gc_current_heap_segments;
+
+     /* Find the last segment based at or below p. */
+     while (hi - lo > 1)
+     {
+          size_t mid = lo + (hi - lo) / 2;
+
+          if (interp.gc_heap_segments[index[mid]] <= p)
+               lo = mid;
+          else
+               hi = mid;
      }
 
-     if (!NULLP(current_sub_freelist))
-          interp.gc_global_freelist = SET_NEXT_FREE_LIST(current_sub_freelist,
-                                                         interp.gc_global_freelist);
+     if (p >= interp.gc_heap_segments[index[lo]] + interp.gc_heap_segment_size)
+          return interp.gc_max_heap_segments;
+
+     return index[lo];
+}
+
+/* Segments are mapped zeroed, which leaves every cell free (TC_FREE_CELL
+ * is zero) and every mark bit clear, so their pages aren't touched
+ * until they're allocated from. */
+static void gc_init_heap_segment(lref_t seg_base)
+{
+     for (size_t ofs = 0; ofs < interp.gc_heap_segment_size; ofs += ALLOCATION_RUN_SIZE)
+     {
+          lref_t run = &seg_base[ofs];
+
+          gc_push_free_run(run + GC_RUN_BITMAP_CELLS, run + ALLOCATION_RUN_SIZE,
+                           ALLOCATION_RUN_SIZE - GC_RUN_BITMAP_CELLS);
+     }
 }
 
 static bool gc_enlarge_heap()
 {
      dscwritef(DF_SHOW_GC_DETAILS, (";;; attempting to enlarge heap\n"));
 
-     if (interp.gc_current_heap_segments > interp.gc_max_heap_segments)
+     if (interp.gc_current_heap_segments >= interp.gc_max_heap_segments)
      {
           dscwritef(DF_SHOW_GC_DETAILS,
                     (";;; HEAP ENLARGE FAILED! Too many segments.\n"));
           return false;
      }
 
-     gc_begin_timer();
+     gc_begin_timer();
+
+     /* Segments are aligned on allocation run boundaries, so that
+      * every run can find its mark bitmap from any of its cells. */
+     uint8_t *block = (uint8_t *) sys_allocate_pages(gc_heap_segment_bytes());
+
+     if (block == NULL)
+     {
+          gc_end_timer();
+
+          dscwritef(DF_SHOW_GC_DETAILS,
+                    (";;; HEAP ENLARGE FAILED! Out of memory.\n"));
+          return false;
+     }
+
+     lref_t seg_base =
+          (lref_t) (((uintptr_t) block + GC_RUN_BYTES - 1) & ~(uintptr_t) (GC_RUN_BYTES - 1));
+
+     size_t seg_idx = interp.gc_current_heap_segments;
+
+     interp.gc_current_heap_segments++;
+
+     interp.gc_malloc_bytes_threshold += (sizeof(struct lobject_t) * interp.gc_heap_segment_size);
+
+     interp.gc_heap_segments[seg_idx] = seg_base;
+     interp.gc_heap_segment_blocks[seg_idx] = block;
+
+     gc_index_heap_segment(seg_idx);
+
+     gc_init_heap_segment(seg_base);
+
+     gc_end_timer();
+
+     return true;
+}
+
+/*** Heap sizing
+ *
+ * The heap is sized by the share of it that a full collection leaves
+ * free. When less than interp.gc_min_free_percent of the heap is
+ * free, it is grown right away to leave interp.gc_target_free_percent
+ * free, up to the segment limit. When more than
+ * interp.gc_max_free_percent is free, the heap is shrunk toward the
+ * same target. Only segments with no live objects can be released,
+ * so they're found and unmapped once the sweep is done.
+ */
+
+static void gc_size_heap(void)
+{
+     size_t heap_cells = gc_heap_cells();
+     size_t free_cells = gc_unmarked_cells();
+     size_t segment_cells = heap_cells / interp.gc_current_heap_segments;
+
+     size_t target_cells = (heap_cells - free_cells) * 100
+          / (100 - interp.gc_target_free_percent);
+
+     interp.gc_segments_to_release = 0;
+
+     if (free_cells * 100 < heap_cells * interp.gc_min_free_percent)
+     {
+          size_t target_segments =
+               MIN2((target_cells + segment_cells - 1) / segment_cells,
+                    interp.gc_max_heap_segments);
+
+          dscwritef(DF_SHOW_GC_DETAILS, (";;; growing heap to ~cd segments\n", target_segments));
+
+          while (interp.gc_current_heap_segments < target_segments)
+               if (!gc_enlarge_heap())
+                    break;
+     }
+     else if (free_cells * 100 > heap_cells * interp.gc_max_free_percent)
+     {
+          interp.gc_segments_to_release = (heap_cells - target_cells) / segment_cells;
+
+          if (interp.gc_segments_to_release > 0)
+               dscwritef(DF_SHOW_GC_DETAILS, (";;; shrinking heap by up to ~cd segments\n",
+                                              interp.gc_segments_to_release));
+     }
+}
+
+/* Release up to interp.gc_segments_to_release heap segments that are
+ * made up entirely of free runs, keeping at least one segment. The
+ * last segments in the table are moved into the freed slots. */
+static void gc_release_empty_segments(void)
+{
+     size_t segment_runs = interp.gc_heap_segment_size / ALLOCATION_RUN_SIZE;
+     size_t *free_runs = interp.gc_heap_segment_free_runs;
+     size_t released = 0;
+
+     if (interp.gc_segments_to_release == 0)
+          return;
+
+     for (size_t jj = 0; jj < interp.gc_current_heap_segments; jj++)
+          free_runs[jj] = 0;
+
+     for (size_t ii = 0; ii < interp.gc_free_runs.count; ii++)
+          free_runs[gc_find_heap_segment(interp.gc_free_runs.runs[ii].start)]++;
+
+     /* free_runs[jj] is reused to flag the segments to release. */
+     for (size_t jj = interp.gc_current_heap_segments; jj > 0; jj--)
+     {
+          bool release = (free_runs[jj - 1] == segment_runs)
+               && (released < interp.gc_segments_to_release)
+               && (released + 1 < interp.gc_current_heap_segments);
+
+          if (release)
+               released++;
+
+          free_runs[jj - 1] = release;
+     }
+
+     interp.gc_segments_to_release = 0;
+
+     if (released == 0)
+          return;
+
+     size_t kept = 0;
+
+     for (size_t ii = 0; ii < interp.gc_free_runs.count; ii++)
+     {
+          struct gc_run_t *run = &interp.gc_free_runs.runs[ii];
+
+          if (free_runs[gc_find_heap_segment(run->start)])
+               interp.gc_free_cells -= run->free_cells;
+          else
+               interp.gc_free_runs.runs[kept++] = *run;
+     }
+
+     interp.gc_free_runs.count = kept;
+
+     for (size_t jj = interp.gc_current_heap_segments; jj > 0; jj--)
+     {
+          if (!free_runs[jj - 1])
+               continue;
+
+          size_t last = interp.gc_current_heap_segments - 1;
+
+          sys_release_pages(interp.gc_heap_segment_blocks[jj - 1], gc_heap_segment_bytes());
+
+          interp.gc_heap_segments[jj - 1] = interp.gc_heap_segments[last];
+          interp.gc_heap_segment_blocks[jj - 1] = interp.gc_heap_segment_blocks[last];
+
+          interp.gc_heap_segments[last] = NULL;
+          interp.gc_heap_segment_blocks[last] = NULL;
+
+          interp.gc_current_heap_segments--;
+
+          interp.gc_malloc_bytes_threshold -= sizeof(struct lobject_t) * interp.gc_heap_segment_size;
+     }
+
+     for (size_t jj = 0; jj < interp.gc_current_heap_segments; jj++)
+          gc_index_heap_segment(jj);
+
+     dscwritef(DF_SHOW_GC_DETAILS, (";;; released ~cd heap segments\n", released));
+}
+
+/*** The Mark-and-Sweep garbage collection algorithm
+ *
+ * The collector is generational, but non-moving. Cells claimed by the
+ * allocator since the last collection make up the nursery, and hold
+ * the young generation. Objects keep their mark bits between
+ * collections, so every object that has survived a collection is old,
+ * and marking stops at it. A minor collection marks from the stack,
+ * the roots and the remembered set, and sweeps only the nursery. Its
+ * survivors are promoted in place, by staying marked. A full
+ * collection clears every mark bit, and marks and sweeps the entire
+ * heap.
+ *
+ * Objects can't be moved out of the nursery: the stack and the roots
+ * are scanned conservatively, and identity hashes are keyed on object
+ * addresses.
+ */
+
+/* Unmarked cells that a pending lazy sweep has yet to reach belong to
+ * objects that were garbage when marking finished. (See gc_sweep_lazily.) */
+static bool gc_unswept_garbage_p(size_t segment, lref_t p)
+{
+     if ((interp.gc_phase != GC_SWEEPING) || GC_MARK(p))
+          return false;
+
+     if ((segment < interp.gc_cursor_segment) || (segment >= interp.gc_cursor_limit))
+          return false;
+
+     return (segment > interp.gc_cursor_segment)
+          || NULLP(interp.gc_cursor)
+          || (p >= interp.gc_cursor);
+}
+
+/* possible_heap_pointer_p
+ *
+ * Heuristic used to determine if a value is conceivably a pointer.
+ */
+static bool gc_possible_heap_pointer_p(lref_t p)
+{
+     /*  Pointers are aligned at lobject_t boundaries. (Heap segments
+      *  are aligned on allocation run boundaries.) */
+     if (((uintptr_t) p % sizeof(struct lobject_t)) != 0)
+          return false;
+
+     /*  Pointers point into gc_heap_segments */
+     size_t segment = gc_find_heap_segment(p);
+
+     if (segment == interp.gc_max_heap_segments)
+          return false;
+
+     /*  Pointers don't refer to mark bitmaps */
+     if (GC_BITMAP_CELL_P(p))
+          return false;
+
+     /*  Pointers have types */
+     if (FREE_CELL_P(p))
+          return false;
+
+     /*  Pointers refer to live objects */
+     return !gc_unswept_garbage_p(segment, p);
+}
+
+
+/*** The mark stack
+ *
+ * Marking is tri-color. Unmarked objects are white. Marked objects are
+ * grey while they wait on the mark stack to be scanned, and black once
+ * gc_scan_object has marked their referents. The stack replaces
+ * recursion on the C stack, and lets an incremental collection stop
+ * marking at any point and resume later.
+ */
+
+/* The parallel collector thread running on this thread, if any. (See
+ * gc_mark_in_parallel.) */
+static SYS_THREAD_LOCAL struct gc_worker_t *gc_current_worker = NULL;
+
+static void gc_push_mark_stack(lref_t obj)
+{
+     if (interp.gc_mark_stack_size >= interp.gc_mark_stack_capacity)
+          interp.gc_mark_stack =
+               gc_grow_table(interp.gc_mark_stack, sizeof(lref_t),
+                             &interp.gc_mark_stack_capacity,
+                             INITIAL_MARK_STACK_SIZE);
+
+     interp.gc_mark_stack[interp.gc_mark_stack_size++] = obj;
+}
+
+/* Parallel collector threads share the allocation counters in
+ * gc_malloc, so they grow their tables with the work lock held. */
+static lref_t *gc_grow_worker_table(lref_t *table, size_t *capacity)
+{
+     sys_lock_mutex(interp.gc_work_lock);
+
+     table = gc_grow_table(table, sizeof(lref_t), capacity, INITIAL_MARK_STACK_SIZE);
+
+     sys_unlock_mutex(interp.gc_work_lock);
+
+     return table;
+}
+
+static void gc_push_worker_mark_stack(struct gc_worker_t *worker, lref_t obj)
+{
+     if (worker->mark_stack_size >= worker->mark_stack_capacity)
+          worker->mark_stack =
+               gc_grow_worker_table(worker->mark_stack, &worker->mark_stack_capacity);
+
+     worker->mark_stack[worker->mark_stack_size++] = obj;
+}
+
+/* Sets the mark bit of an unmarked object. Parallel collector threads
+ * set mark bits atomically, since they share bitmap words, and this
+ * returns false if another thread marked the object first. */
+static bool gc_set_mark(lref_t obj)
+{
+     if (gc_current_worker == NULL)
+     {
+          SET_GC_MARK(obj, 1);
+          interp.gc_marked_cells++;
+
+          return true;
+     }
+
+     size_t index = GC_RUN_INDEX(obj);
+     uintptr_t bit = (uintptr_t) 1 << (index % GC_MARK_WORD_BITS);
+
+     if (sys_atomic_fetch_or(&GC_MARK_BITMAP(obj)[index / GC_MARK_WORD_BITS], bit) & bit)
+          return false;
+
+     gc_current_worker->marked_cells++;
+
+     return true;
+}
+
+/* gc_mark
+ *
+ * Mark an object as being reachable, and queue it to have its
+ * descendants marked. */
+void gc_mark(lref_t obj)
+{
+     if (NULLP(obj) || LREF_IMMEDIATE_P(obj) || GC_MARK(obj))
+          return;
+
+     if (!gc_set_mark(obj))
+          return;
+
+     if (gc_current_worker == NULL)
+          gc_push_mark_stack(obj);
+     else
+          gc_push_worker_mark_stack(gc_current_worker, obj);
+}
+
+/* Marks the last referent of an object being scanned, which is scanned
+ * next without a trip through the mark stack. Returns NIL if there's
+ * nothing left to scan. */
+static lref_t gc_mark_tail(lref_t obj)
+{
+     if (NULLP(obj) || LREF_IMMEDIATE_P(obj) || GC_MARK(obj))
+          return NIL;
+
+     if (!gc_set_mark(obj))
+          return NIL;
+
+     return obj;
+}
+
+/*** Weak hashes
+ *
+ * The weak keys or values of a weak hash aren't marked when it is
+ * scanned. The hash is recorded instead, and once marking is done,
+ * gc_remove_dead_weak_entries removes its entries whose weak part
+ * wasn't marked. Old weak hashes that have had young objects stored
+ * into them are in the remembered set, so minor collections clear
+ * them too.
+ */
+
+static void gc_record_weak_hash(lref_t hash)
+{
+     if (gc_current_worker != NULL)
+          sys_lock_mutex(interp.gc_work_lock);
+
+     if (interp.gc_weak_hashes_size >= interp.gc_weak_hashes_capacity)
+          interp.gc_weak_hashes =
+               gc_grow_table(interp.gc_weak_hashes, sizeof(lref_t),
+                             &interp.gc_weak_hashes_capacity,
+                             INITIAL_WEAK_HASH_TABLE_SIZE);
+
+     interp.gc_weak_hashes[interp.gc_weak_hashes_size++] = hash;
+
+     if (gc_current_worker != NULL)
+          sys_unlock_mutex(interp.gc_work_lock);
+}
+
+static void gc_scan_hash(lref_t hash)
+{
+     struct hash_table_t *table = hash->as.hash.table;
+
+     if (table->weakness != HASH_STRONG)
+          gc_record_weak_hash(hash);
+
+     for (; table != NULL; table = table->migrating)
+     {
+          for (size_t jj = 0; jj < table->mask + 1; jj++) {
+               if (table->weakness != HASH_WEAK_KEYS)
+                    gc_mark(table->data[jj].key);
+
+               if (table->weakness != HASH_WEAK_VALUES)
+                    gc_mark(table->data[jj].val);
+          }
+     }
+}
+
+static void gc_remove_dead_weak_entries(void)
+{
+     for (size_t ii = 0; ii < interp.gc_weak_hashes_size; ii++)
+          hash_gc_remove_dead_entries(interp.gc_weak_hashes[ii]);
+
+     interp.gc_weak_hashes_size = 0;
+}
+
+/* gc_scan_object
+ *
+ * Mark the referents of a marked object. */
+static lref_t gc_scan_object(lref_t obj)
+{
+     switch (TYPE(obj))
+     {
+     case TC_CONS:
+          gc_mark(CAR(obj));
+          return gc_mark_tail(CDR(obj));
+
+     case TC_SYMBOL:
+          gc_mark(obj->as.symbol.props);
+          return gc_mark_tail(SYMBOL_VCELL(obj));
+
+     case TC_PACKAGE:
+          gc_mark(obj->as.package.bindings);
+          gc_mark(obj->as.package.use_list);
+          return gc_mark_tail(obj->as.package.name);
+
+     case TC_CLOSURE:
+          gc_mark(CLOSURE_CODE(obj));
+          gc_mark(CLOSURE_PROPERTY_LIST(obj));
+          return gc_mark_tail(CLOSURE_ENV(obj));
+
+     case TC_ENVIRONMENT:
+          gc_mark(ENVIRONMENT_FORMALS(obj));
+          gc_mark(obj->as.environment.slots);
+          return gc_mark_tail(ENVIRONMENT_PARENT(obj));
+
+     case TC_ENVIRONMENT_SLOTS:
+          gc_mark(obj->as.environment_slots.slot[0]);
+          gc_mark(obj->as.environment_slots.slot[1]);
+          return gc_mark_tail(obj->as.environment_slots.slot[2]);
+
+     case TC_MACRO:
+          return gc_mark_tail(obj->as.macro.transformer);
+
+     case TC_FLONUM:
+          return gc_mark_tail(FLOIM(obj));
+
+     case TC_SUBR:
+          return gc_mark_tail(SUBR_NAME(obj));
+
+     case TC_HASH:
+          gc_scan_hash(obj);
+          return NIL;
+
+     case TC_PORT:
+          return gc_mark_tail(port_gc_mark(obj));
+
+     case TC_VECTOR:
+          for (size_t jj = 0; jj < obj->as.vector.dim; jj++)
+               gc_mark(obj->as.vector.data[jj]);
+          return NIL;
+
+     case TC_STRUCTURE:
+          for (size_t jj = 0; jj < STRUCTURE_DIM(obj); jj++)
+               gc_mark(STRUCTURE_ELEM(obj, jj));
+          return gc_mark_tail(STRUCTURE_LAYOUT(obj));
+
+     case TC_VALUES_TUPLE:
+          return gc_mark_tail(obj->as.values_tuple.values);
+
+     case TC_FAST_OP:
+          gc_mark(obj->as.fast_op.arg1);
+          gc_mark(obj->as.fast_op.arg2);
+          return gc_mark_tail(obj->as.fast_op.next);
+
+     case TC_FASL_READER:
+          return gc_mark_tail(fasl_reader_gc_mark(obj));
+
+     default:
+          /* By default, objects are either immediate or otherwise self
+           * contained, and do not need special-case handling in
+           * gc_scan_object.
+           */
+          return NIL;
+     }
+}
+
+/* gc_drain_mark_stack
+ *
+ * Scan up to <limit> objects from the mark stack, and return true if
+ * the stack has been emptied. */
+static bool gc_drain_mark_stack(size_t limit)
+{
+     lref_t obj = NIL;
+
+     for (size_t scanned = 0; scanned < limit; scanned++)
+     {
+          if (NULLP(obj))
+          {
+               if (interp.gc_mark_stack_size == 0)
+                    return true;
+
+               obj = interp.gc_mark_stack[--interp.gc_mark_stack_size];
+          }
+
+          obj = gc_scan_object(obj);
+     }
+
+     if (!NULLP(obj))
+          gc_push_mark_stack(obj);
+
+     return interp.gc_mark_stack_size == 0;
+}
+
+static void gc_mark_transitive_closure(void)
+{
+     gc_drain_mark_stack(SIZE_MAX);
+}
+
+
+/*** Parallel marking
+ *
+ * With more than one GC thread, full collections mark in parallel.
+ * The stack and the roots are scanned by the mutator thread, as usual,
+ * and the grey objects they leave on interp.gc_mark_stack are then
+ * marked by every collector thread. Each thread keeps a mark stack of
+ * its own, and takes work from the shared stack a packet of
+ * GC_MARK_PACKET_SIZE objects at a time. A thread with a deep stack
+ * gives a packet back while other threads are waiting for work.
+ * Marking is done once every thread is waiting, and the shared stack
+ * is empty.
+ */
+
+static void gc_share_mark_work(struct gc_worker_t *worker)
+{
+     sys_lock_mutex(interp.gc_work_lock);
+
+     for (size_t ii = 0; ii < GC_MARK_PACKET_SIZE; ii++)
+          gc_push_mark_stack(worker->mark_stack[--worker->mark_stack_size]);
+
+     sys_unlock_mutex(interp.gc_work_lock);
+}
+
+/* Wait for a packet of grey objects from the shared mark stack, and
+ * return false if marking is done. */
+static bool gc_take_mark_work(struct gc_worker_t *worker)
+{
+     lref_t packet[GC_MARK_PACKET_SIZE];
+     size_t count = 0;
+
+     sys_lock_mutex(interp.gc_work_lock);
+
+     interp.gc_workers_idle++;
+
+     while ((interp.gc_mark_stack_size == 0)
+            && (interp.gc_workers_idle < interp.gc_workers_started))
+     {
+          sys_unlock_mutex(interp.gc_work_lock);
+          sys_yield_thread();
+          sys_lock_mutex(interp.gc_work_lock);
+     }
+
+     while ((interp.gc_mark_stack_size > 0) && (count < GC_MARK_PACKET_SIZE))
+          packet[count++] = interp.gc_mark_stack[--interp.gc_mark_stack_size];
+
+     if (count > 0)
+          interp.gc_workers_idle--;
+
+     sys_unlock_mutex(interp.gc_work_lock);
+
+     for (size_t ii = 0; ii < count; ii++)
+          gc_push_worker_mark_stack(worker, packet[ii]);
+
+     return count > 0;
+}
+
+static void gc_mark_worker(size_t thread_index, void *arg)
+{
+     UNREFERENCED(arg);
+
+     struct gc_worker_t *worker = &interp.gc_workers[thread_index];
+
+     gc_current_worker = worker;
+
+     sys_lock_mutex(interp.gc_work_lock);
+     interp.gc_workers_started++;
+     sys_unlock_mutex(interp.gc_work_lock);
+
+     while (gc_take_mark_work(worker))
+     {
+          lref_t obj = NIL;
+
+          for (;;)
+          {
+               if (NULLP(obj))
+               {
+                    if (worker->mark_stack_size == 0)
+                         break;
+
+                    obj = worker->mark_stack[--worker->mark_stack_size];
+               }
+
+               obj = gc_scan_object(obj);
+
+               /* These are read without the lock, and only have to be
+                * right eventually. */
+               if ((worker->mark_stack_size >= 2 * GC_MARK_PACKET_SIZE)
+                   && (*(volatile size_t *) &interp.gc_workers_idle > 0)
+                   && (*(volatile size_t *) &interp.gc_mark_stack_size == 0))
+                    gc_share_mark_work(worker);
+          }
+     }
+
+     gc_current_worker = NULL;
+}
+
+static void gc_mark_in_parallel(void)
+{
+     interp.gc_workers_started = 0;
+     interp.gc_workers_idle = 0;
+
+     for (size_t ii = 0; ii < interp.gc_threads; ii++)
+          interp.gc_workers[ii].marked_cells = 0;
+
+     sys_run_threads(interp.gc_threads, gc_mark_worker, NULL);
+
+     for (size_t ii = 0; ii < interp.gc_threads; ii++)
+          interp.gc_marked_cells += interp.gc_workers[ii].marked_cells;
+}
+
+
+/*** The remembered set
+ *
+ * Old objects that have had references to young objects stored into
+ * them since the last collection. See gc_write_barrier.
+ */
+
+static void gc_remember(lref_t obj)
+{
+     if (interp.gc_remembered_set_size >= interp.gc_remembered_set_capacity)
+          interp.gc_remembered_set =
+               gc_grow_table(interp.gc_remembered_set, sizeof(lref_t),
+                             &interp.gc_remembered_set_capacity,
+                             INITIAL_REMEMBERED_SET_SIZE);
+
+     SET_GC_REMEMBERED(obj, 1);
+
+     interp.gc_remembered_set[interp.gc_remembered_set_size++] = obj;
+}
+
+/* A fasl reader stores into itself and its definition table through
+ * raw pointers while a read is in progress, bypassing the write
+ * barrier. Since a read in progress keeps its reader on the stack,
+ * old readers found on the stack are remembered, along with their
+ * tables and table chunks. */
+static void gc_remember_fasl_reader(lref_t reader)
+{
+     gc_remember(reader);
+
+     lref_t table = FASL_READER_STREAM(reader)->table;
+
+     if (NULLP(table))
+          return;
+
+     if (GC_MARK(table) && !GC_REMEMBERED(table))
+          gc_remember(table);
+
+     for (size_t ii = 0; ii < table->as.vector.dim; ii++)
+     {
+          lref_t chunk = table->as.vector.data[ii];
+
+          if (!NULLP(chunk) && GC_MARK(chunk) && !GC_REMEMBERED(chunk))
+               gc_remember(chunk);
+     }
+}
+
+static void gc_mark_remembered_set(void)
+{
+     for (size_t ii = 0; ii < interp.gc_remembered_set_size; ii++)
+     {
+          lref_t obj = interp.gc_remembered_set[ii];
+
+          /* Remembered objects are old, and already marked, so they
+           * go straight onto the mark stack to have their young
+           * referents traced. */
+          gc_push_mark_stack(obj);
+     }
+}
+
+/* gc_record_store
+ *
+ * The slow path of gc_write_barrier, taken when a reference to an
+ * unmarked object is stored into a marked object. */
+void gc_record_store(lref_t obj, lref_t new_value)
+{
+     switch (interp.gc_phase)
+     {
+     case GC_CLEARING:
+          /* Mark bits are being cleared, and nothing is old. */
+          break;
+
+     case GC_MARKING:
+          gc_mark(new_value);
+          break;
+
+     default:
+          gc_remember(obj);
+          break;
+     }
+}
+
+static void gc_forget_remembered_set(void)
+{
+     for (size_t ii = 0; ii < interp.gc_remembered_set_size; ii++)
+          SET_GC_REMEMBERED(interp.gc_remembered_set[ii], 0);
+
+     interp.gc_remembered_set_size = 0;
+}
+
+static void gc_mark_range_array(lref_t * base, size_t n)
+{
+     for (size_t jj = 0; jj < n; ++jj)
+     {
+          lref_t p = base[jj];
+
+          if (!gc_possible_heap_pointer_p(p))
+               continue;
+
+          if (FASL_READER_P(p) && GC_MARK(p) && !GC_REMEMBERED(p))
+               gc_remember_fasl_reader(p);
+
+          gc_mark(p);
+     }
+}
+
+static void gc_mark_roots(void)
+{
+     for (size_t root_idx = 0; root_idx < MAX_GC_ROOTS; root_idx++)
+          gc_mark_range_array(interp.thread.gc_roots[root_idx].location,
+                              interp.thread.gc_roots[root_idx].length);
+
+     /* Only the live part of the frame stack is scanned. Slots below
+      * the frame stack pointer can hold stale references that would
+      * otherwise keep garbage alive. */
+     lref_t *fsp = CURRENT_TIB()->fsp;
+
+     gc_mark_range_array(fsp, &(CURRENT_TIB()->frame_stack[FRAME_STACK_SIZE]) - fsp);
+}
+
+static void gc_mark_range(lref_t * start, lref_t * end)
+{
+     if (start > end)
+     {
+          lref_t *tmp = start;
+          start = end;
+          end = tmp;
+     }
+
+     size_t n = end - start;
+
+     gc_mark_range_array(start, n);
+}
+
+static void gc_clear_cell(lref_t obj)
+{
+     switch (TYPE(obj))
+     {
+     case TC_STRING:
+          gc_free(obj->as.string.data);
+          break;
+
+     case TC_STRUCTURE:
+          gc_free(STRUCTURE_DATA(obj));;
+          break;
+
+     case TC_VECTOR:
+          gc_free(obj->as.vector.data);
+          break;
+
+     case TC_HASH:
+          hash_gc_free(obj);
+          break;
+
+     case TC_PORT:
+          port_gc_free(obj);
+          break;
+
+     case TC_FASL_READER:
+          gc_free(FASL_READER_STREAM(obj)->record_offsets);
+          gc_free(FASL_READER_STREAM(obj)->buffer);
+          gc_free(FASL_READER_STREAM(obj));
+          break;
+
+     default:
+          /*  By default, objects are either immediate or otherwise self
+           * contained, and do not need special-case handling in
+           * gc_clear_cell. */
+          break;
+
+     }
+
+     gc_init_cell(obj);
+}
+
+
+/* Closing a port can flush it to another port. A lazy sweep might
+ * already have freed and reused the cell of that other port, so garbage
+ * ports found by a lazy sweep are finalized only once the sweep is
+ * complete. */
+static void gc_defer_port_finalization(lref_t port)
+{
+     struct gc_worker_t *worker = gc_current_worker;
+
+     if (worker != NULL)
+     {
+          if (worker->finalize_queue_size >= worker->finalize_queue_capacity)
+               worker->finalize_queue =
+                    gc_grow_worker_table(worker->finalize_queue,
+                                         &worker->finalize_queue_capacity);
+
+          worker->finalize_queue[worker->finalize_queue_size++] = port;
+
+          return;
+     }
+
+     if (interp.gc_finalize_queue_size >= interp.gc_finalize_queue_capacity)
+          interp.gc_finalize_queue =
+               gc_grow_table(interp.gc_finalize_queue, sizeof(lref_t),
+                             &interp.gc_finalize_queue_capacity,
+                             INITIAL_MARK_STACK_SIZE);
+
+     interp.gc_finalize_queue[interp.gc_finalize_queue_size++] = port;
+}
+
+static fixnum_t gc_finalize_deferred_ports(void)
+{
+     fixnum_t cells_freed = interp.gc_finalize_queue_size;
+
+     for (size_t ii = 0; ii < interp.gc_finalize_queue_size; ii++)
+          gc_clear_cell(interp.gc_finalize_queue[ii]);
+
+     interp.gc_finalize_queue_size = 0;
+
+     return cells_freed;
+}
+
+static size_t gc_lowest_set_bit(uintptr_t word)
+{
+#if defined(__GNUC__)
+     return (size_t) __builtin_ctzll((unsigned long long) word);
+#else
+     size_t bit = 0;
+
+     while (!(word & 1))
+     {
+          word >>= 1;
+          bit++;
+     }
+
+     return bit;
+#endif
+}
+
+/* gc_sweep_run_cells
+ *
+ * Sweeps the unmarked cells in the allocation run starting at <start>,
+ * calling the appropriate gc_free hooks along the way, and returns the
+ * number of free cells in the run. Marked cells keep their marks, and
+ * remain old until the next full collection.
+ *
+ * The run's mark bitmap is scanned a word at a time, so that runs of
+ * surviving objects are skipped without touching their cells.
+ */
+static size_t gc_sweep_run_cells(lref_t start, fixnum_t *cells_freed)
+{
+     lref_t run = start - GC_RUN_BITMAP_CELLS;
+     uintptr_t *bitmap = GC_MARK_BITMAP(start);
+     size_t run_free_cells = 0;
+
+     assert((uintptr_t *) run == bitmap);
+
+     for (size_t ww = 0; ww < GC_RUN_BITMAP_WORDS; ww++)
+     {
+          uintptr_t unmarked = ~bitmap[ww];
+
+          /* The bitmap's own cells are never swept. */
+          if (ww == 0)
+               unmarked &= ~(((uintptr_t) 1 << GC_RUN_BITMAP_CELLS) - 1);
+
+          while (unmarked)
+          {
+               lref_t obj = run + ww * GC_MARK_WORD_BITS + gc_lowest_set_bit(unmarked);
+
+               unmarked &= unmarked - 1;
+
+               if (FREE_CELL_P(obj))
+                    run_free_cells++;
+               else if (PORTP(obj) && (interp.gc_phase == GC_SWEEPING))
+                    gc_defer_port_finalization(obj);
+               else
+               {
+                    (*cells_freed)++;
+                    run_free_cells++;
+
+                    gc_clear_cell(obj);
+               }
+          }
+     }
+
+     return run_free_cells;
+}
+
+/* gc_sweep_run
+ *
+ * Sweeps the allocation run [start, end), and returns it to the
+ * allocator.
+ */
+static void gc_sweep_run(lref_t start, lref_t end,
+                         fixnum_t *free_cells, fixnum_t *cells_freed)
+{
+     assert(end == start - GC_RUN_BITMAP_CELLS + ALLOCATION_RUN_SIZE);
+
+     size_t run_free_cells = gc_sweep_run_cells(start, cells_freed);
+
+     gc_push_free_run(start, end, run_free_cells);
+
+     *free_cells += run_free_cells;
+}
+
+/* gc_sweep
+ *
+ * Sweeps every heap segment, rebuilding the allocator's run tables
+ * from scratch.
+ */
+static fixnum_t gc_sweep()
+{
+     fixnum_t free_cells = 0;
+     fixnum_t cells_freed = 0;
+
+     interp.gc_free_runs.count = 0;
+     interp.gc_partial_runs.count = 0;
+     interp.gc_free_cells = 0;
+
+     for (size_t heap_num = 0;
+          heap_num < interp.gc_max_heap_segments;
+          heap_num++)
+     {
+          if (interp.gc_heap_segments[heap_num] == NULL)
+               continue;
+
+          lref_t org = interp.gc_heap_segments[heap_num];
+          lref_t end = org + interp.gc_heap_segment_size;
+
+          for (lref_t run = org; run < end; run += ALLOCATION_RUN_SIZE)
+               gc_sweep_run(run + GC_RUN_BITMAP_CELLS, run + ALLOCATION_RUN_SIZE,
+                            &free_cells, &cells_freed);
+     }
+
+     interp.gc_nursery_runs.count = 0;
+     interp.gc_nursery_cells = 0;
+
+     dscwritef(DF_SHOW_GC_DETAILS, (";;; GC sweep done, freed:~cd, free:~cd\n",
+                                    cells_freed, free_cells));
+
+     return free_cells;
+}
+
+/* gc_sweep_nursery
+ *
+ * Sweeps only the allocation runs claimed by the allocator since the
+ * last collection.
+ */
+static fixnum_t gc_sweep_nursery()
+{
+     fixnum_t free_cells = 0;
+     fixnum_t cells_freed = 0;
+
+     for (size_t ii = 0; ii < interp.gc_nursery_runs.count; ii++)
+          gc_sweep_run(interp.gc_nursery_runs.runs[ii].start,
+                       interp.gc_nursery_runs.runs[ii].end,
+                       &free_cells, &cells_freed);
+
+     interp.gc_nursery_runs.count = 0;
+     interp.gc_nursery_cells = 0;
+
+     dscwritef(DF_SHOW_GC_DETAILS, (";;; GC nursery sweep done, freed:~cd, free:~cd\n",
+                                    cells_freed, free_cells));
+
+     return free_cells;
+}
+
+static void gc_clear_marks()
+{
+     interp.gc_marked_cells = 0;
+
+     for (size_t heap_num = 0;
+          heap_num < interp.gc_max_heap_segments;
+          heap_num++)
+     {
+          if (interp.gc_heap_segments[heap_num] == NULL)
+               continue;
+
+          lref_t org = interp.gc_heap_segments[heap_num];
+          lref_t end = org + interp.gc_heap_segment_size;
+
+          for (lref_t run = org; run < end; run += ALLOCATION_RUN_SIZE)
+               gc_clear_run_marks(run);
+     }
+}
+
+static void gc_mark_stack()
+{
+     jmp_buf registers;
+     lref_t stack_end;
+
+     setjmp(registers);
+
+     gc_mark_range((lref_t *) registers,
+                   (lref_t *) (((uint8_t *) registers) + sizeof(registers)));
+
+     gc_mark_range((lref_t *) sys_get_stack_start(),
+                   (lref_t *) & stack_end);
+}
+
+static void gc_begin_stats(bool minor)
+{
+     gc_begin_timer();
+
+     if (!DEBUG_FLAG(DF_SHOW_GC))
+          return;
+
+     if ((interp.gc_malloc_bytes > 0) || (interp.gc_malloc_blocks > 0))
+          dscwritef(DF_ALWAYS, (_T("; ~cd/~cd C bytes/blocks allocated since last GC.\n"),
+                     interp.gc_malloc_bytes, interp.gc_malloc_blocks));
+
+     dscwritef(DF_ALWAYS, (_T("; ~cs @ T+~cf:"),
+                           minor ? "Minor GC" : "GC", time_since_launch()));
+}
+
+static double gc_end_stats(void)
+{
+     interp.gc_malloc_bytes = 0;
+     interp.gc_malloc_blocks = 0;
+
+     return gc_end_timer();
+}
+
+/* The current allocation run is swept along with the rest of the
+ * heap, so it must be given up before a collection. */
+static void gc_release_allocation_run(void)
+{
+     CURRENT_TIB()->alloc_next = NIL;
+     CURRENT_TIB()->alloc_limit = NIL;
+}
+
+
+/*** Lazy sweeping
+ *
+ * A full collection doesn't sweep the heap once marking is done.
+ * Instead, it empties the allocator's run tables, and the heap is
+ * swept an allocation run at a time, as the allocator needs runs to
+ * claim. Each run is returned to the allocator as soon as it has been
+ * swept, so objects allocated after marking are never seen by the
+ * sweep. Minor collections can run while a sweep is pending:
+ * unmarked cells that the sweep has yet to reach are garbage, and are
+ * not taken as conservative roots. Heap segments added while a sweep
+ * is pending start out free, and are not swept.
+ */
+
+static void gc_reset_cursor(void)
+{
+     interp.gc_cursor_segment = 0;
+     interp.gc_cursor = NIL;
+     interp.gc_cursor_limit = interp.gc_current_heap_segments;
+}
+
+/* Find the next allocation run at the collector's cursor. Returns
+ * false once every heap segment has been visited. */
+static bool gc_next_cursor_run(lref_t *start, lref_t *end)
+{
+     for (; interp.gc_cursor_segment < interp.gc_cursor_limit; interp.gc_cursor_segment++)
+     {
+          lref_t org = interp.gc_heap_segments[interp.gc_cursor_segment];
+          lref_t seg_end = org + interp.gc_heap_segment_size;
+
+          if (NULLP(interp.gc_cursor))
+               interp.gc_cursor = org;
+
+          if (interp.gc_cursor < seg_end)
+          {
+               *start = interp.gc_cursor + GC_RUN_BITMAP_CELLS;
+               *end = interp.gc_cursor + ALLOCATION_RUN_SIZE;
+
+               interp.gc_cursor = *end;
+
+               return true;
+          }
+
+          interp.gc_cursor = NIL;
+     }
+
+     return false;
+}
+
+static void gc_begin_sweep(void)
+{
+     gc_forget_remembered_set();
+
+     flush_call_site_caches();
+
+     gc_release_allocation_run();
+
+     interp.gc_free_runs.count = 0;
+     interp.gc_partial_runs.count = 0;
+     interp.gc_free_cells = 0;
+
+     interp.gc_nursery_runs.count = 0;
+     interp.gc_nursery_cells = 0;
+
+     interp.gc_cycle_free_cells = 0;
+     interp.gc_cycle_cells_freed = 0;
+
+     gc_reset_cursor();
+
+     interp.gc_phase = GC_SWEEPING;
+     interp.gc_major_collections++;
+}
+
+static void gc_sweep_step(void)
+{
+     lref_t start, end;
+
+     if (gc_next_cursor_run(&start, &end))
+     {
+          gc_sweep_run(start, end,
+                       &interp.gc_cycle_free_cells, &interp.gc_cycle_cells_freed);
+
+          return;
+     }
+
+     interp.gc_cycle_cells_freed += gc_finalize_deferred_ports();
+
+     gc_release_empty_segments();
+
+     interp.gc_phase = GC_IDLE;
 
-     lref_t seg_base = gc_malloc(sizeof(struct lobject_t) * interp.gc_heap_segment_size);
+     dscwritef(DF_SHOW_GC_DETAILS, (";;; GC sweep done, freed:~cd, free:~cd\n",
+                                    interp.gc_cycle_cells_freed, interp.gc_cycle_free_cells));
+}
 
-     size_t seg_idx = interp.gc_current_heap_segments;
+/* Sweep until the allocator has a run to claim, or the sweep is
+ * done. */
+static void gc_sweep_lazily(void)
+{
+     if (interp.gc_phase != GC_SWEEPING)
+          return;
 
-     interp.gc_current_heap_segments++;
+     gc_begin_timer();
 
-     interp.gc_malloc_bytes_threshold += (sizeof(struct lobject_t) * interp.gc_heap_segment_size);
+     double start_time = sys_realtime();
 
-     interp.gc_heap_segments[seg_idx] = seg_base;
+     while ((interp.gc_phase == GC_SWEEPING) && (gc_heap_freelist_length() == 0))
+          gc_sweep_step();
 
-     gc_init_heap_segment(seg_base);
+     interp.gc_sweep_time += sys_realtime() - start_time;
 
      gc_end_timer();
-
-     return true;
 }
 
-/*** The Mark-and-Sweep garbage collection algorithm ***/
-
-/* possible_heap_pointer_p
+/*** Parallel sweeping
  *
- * Heuristic used to determine if a value is conceivably a pointer.
+ * With more than one GC thread, the runs left to be swept when a sweep
+ * is finished all at once are divided among the collector threads, a
+ * chunk of GC_SWEEP_CHUNK_RUNS runs at a time. The threads only sweep
+ * cells. The runs are handed back to the allocator afterwards, in
+ * heap order, by the mutator thread.
  */
-static bool gc_possible_heap_pointer_p(lref_t p)
+
+struct gc_parallel_sweep_t
 {
-     for (size_t jj = 0; jj < interp.gc_max_heap_segments; jj++)
+     size_t run_count;
+     size_t next_run;
+     lref_t *run_starts;
+     size_t *run_free_cells;
+};
+
+static void gc_sweep_worker(size_t thread_index, void *arg)
+{
+     struct gc_parallel_sweep_t *sweep = (struct gc_parallel_sweep_t *) arg;
+     struct gc_worker_t *worker = &interp.gc_workers[thread_index];
+
+     gc_current_worker = worker;
+
+     for (;;)
      {
-          lref_t h = interp.gc_heap_segments[jj];
+          sys_lock_mutex(interp.gc_work_lock);
 
-          /*  Skip unallocated gc_heap_segments; */
-          if (h == NULL)
-               continue;
+          size_t first = sweep->next_run;
 
-          /*  Pointers point into gc_heap_segments */
-          if ((p < h) || (p >= (h + interp.gc_heap_segment_size)))
-               continue;
+          sweep->next_run = MIN2(first + GC_SWEEP_CHUNK_RUNS, sweep->run_count);
 
-          /*  Pointers are aligned at lobject_t boundaries */
-          if (((((uint8_t *) p) - ((uint8_t *) h)) % sizeof(struct lobject_t)) != 0)
-               continue;
+          sys_unlock_mutex(interp.gc_work_lock);
 
-          /*  Pointers have types */
-          if (FREE_CELL_P(p))
-               continue;
+          if (first >= sweep->run_count)
+               break;
 
-          return true;
+          for (size_t ii = first; ii < MIN2(first + GC_SWEEP_CHUNK_RUNS, sweep->run_count); ii++)
+               sweep->run_free_cells[ii] =
+                    gc_sweep_run_cells(sweep->run_starts[ii], &worker->cells_freed);
      }
 
-     return false;
+     gc_current_worker = NULL;
 }
 
-
-/* gc_mark
- *
- * Mark an object and its descendants as being reachable. */
-void gc_mark(lref_t initial_obj)
+static void gc_sweep_in_parallel(void)
 {
-     lref_t obj = initial_obj;
+     struct gc_parallel_sweep_t sweep;
+     lref_t start, end;
+
+     size_t max_runs = (interp.gc_current_heap_segments * interp.gc_heap_segment_size)
+          / ALLOCATION_RUN_SIZE;
+
+     sweep.run_count = 0;
+     sweep.next_run = 0;
+     sweep.run_starts = (lref_t *) gc_malloc(sizeof(lref_t) * max_runs);
+     sweep.run_free_cells = (size_t *) gc_malloc(sizeof(size_t) * max_runs);
+
+     while (gc_next_cursor_run(&start, &end))
+          sweep.run_starts[sweep.run_count++] = start;
 
-     while (!NULLP(obj) && !LREF_IMMEDIATE_P(obj) && !GC_MARK(obj))
+     for (size_t ii = 0; ii < interp.gc_threads; ii++)
+          interp.gc_workers[ii].cells_freed = 0;
+
+     sys_run_threads(interp.gc_threads, gc_sweep_worker, &sweep);
+
+     for (size_t ii = 0; ii < sweep.run_count; ii++)
      {
-          SET_GC_MARK(obj, 1);
+          lref_t run_start = sweep.run_starts[ii];
 
-          switch (TYPE(obj))
-          {
-          case TC_CONS:
-               gc_mark(CAR(obj));
+          gc_push_free_run(run_start, run_start - GC_RUN_BITMAP_CELLS + ALLOCATION_RUN_SIZE,
+                           sweep.run_free_cells[ii]);
 
-               obj = CDR(obj);
-               break;
+          interp.gc_cycle_free_cells += sweep.run_free_cells[ii];
+     }
 
-          case TC_SYMBOL:
-               gc_mark(obj->as.symbol.props);
-               obj = SYMBOL_VCELL(obj);
-               break;
+     for (size_t ii = 0; ii < interp.gc_threads; ii++)
+     {
+          struct gc_worker_t *worker = &interp.gc_workers[ii];
 
-          case TC_PACKAGE:
-               gc_mark(obj->as.package.bindings);
-               gc_mark(obj->as.package.use_list);
+          interp.gc_cycle_cells_freed += worker->cells_freed;
 
-               obj = obj->as.package.name;
-               break;
+          for (size_t jj = 0; jj < worker->finalize_queue_size; jj++)
+               gc_defer_port_finalization(worker->finalize_queue[jj]);
 
-          case TC_CLOSURE:
-               gc_mark(CLOSURE_CODE(obj));
-               gc_mark(CLOSURE_PROPERTY_LIST(obj));
+          worker->finalize_queue_size = 0;
+     }
 
-               obj = CLOSURE_ENV(obj);
-               break;
+     gc_free(sweep.run_starts);
+     gc_free(sweep.run_free_cells);
+}
 
-          case TC_MACRO:
-               obj = obj->as.macro.transformer;
-               break;
+static void gc_finish_sweep(void)
+{
+     if (interp.gc_phase != GC_SWEEPING)
+          return;
 
-          case TC_FLONUM:
-               obj = FLOIM(obj);
-               break;
+     double start_time = sys_realtime();
 
-          case TC_SUBR:
-               obj = SUBR_NAME(obj);
-               break;
+     if (interp.gc_threads > 1)
+          gc_sweep_in_parallel();
 
-          case TC_HASH:
-               for (size_t jj = 0; jj < obj->as.hash.table->mask + 1; jj++) {
-                    gc_mark(obj->as.hash.table->data[jj].key);
-                    gc_mark(obj->as.hash.table->data[jj].val);
-               }
+     while (interp.gc_phase == GC_SWEEPING)
+          gc_sweep_step();
 
-               obj = NIL;
-               break;
+     interp.gc_sweep_time += sys_realtime() - start_time;
+}
 
-          case TC_PORT:
-               obj = port_gc_mark(obj);
-               break;
+static fixnum_t gc_mark_and_sweep(double *pause_time)
+{
+     gc_begin_stats(false);
 
-          case TC_VECTOR:
-               for (size_t jj = 0; jj < obj->as.vector.dim; jj++)
-                    gc_mark(obj->as.vector.data[jj]);
+     gc_finish_sweep();
 
-               obj = NIL;
-               break;
+     hash_free_retired_tables();
 
-          case TC_STRUCTURE:
-               for (size_t jj = 0; jj < STRUCTURE_DIM(obj); jj++)
-                    gc_mark(STRUCTURE_ELEM(obj, jj));
+     gc_clear_marks();
 
-               obj = STRUCTURE_LAYOUT(obj);
-               break;
+     double phase_start = sys_realtime();
 
-          case TC_VALUES_TUPLE:
-               obj = obj->as.values_tuple.values;
-               break;
+     gc_mark_stack();
+     gc_mark_roots();
 
-          case TC_FAST_OP:
-               gc_mark(obj->as.fast_op.arg1);
-               gc_mark(obj->as.fast_op.arg2);
-               obj = obj->as.fast_op.next;
-               break;
+     interp.gc_root_time += sys_realtime() - phase_start;
+     phase_start = sys_realtime();
 
-          case TC_FASL_READER:
-               obj = fasl_reader_gc_mark(obj);
-               break;
+     if (interp.gc_threads > 1)
+          gc_mark_in_parallel();
+     else
+          gc_mark_transitive_closure();
 
-          default:
-               /* By default, objects are either immediate or otherwise self
-                * contained, and do not need special-case handling in gc_mark.
-                */
-               break;
-          }
-     }
-}
+     gc_remove_dead_weak_entries();
 
+     interp.gc_mark_time += sys_realtime() - phase_start;
 
-static void gc_mark_range_array(lref_t * base, size_t n)
-{
-     for (size_t jj = 0; jj < n; ++jj)
-     {
-          lref_t p = base[jj];
+     gc_begin_sweep();
 
-          if (gc_possible_heap_pointer_p(p))
-               gc_mark(p);
-     }
-}
+     fixnum_t free_cells = gc_unmarked_cells();
 
-static void gc_mark_roots(void)
-{
-     for (size_t root_idx = 0; root_idx < MAX_GC_ROOTS; root_idx++)
-          gc_mark_range_array(interp.thread.gc_roots[root_idx].location,
-                              interp.thread.gc_roots[root_idx].length);
-}
+     double gc_run_time  = gc_end_stats();
 
-static void gc_mark_range(lref_t * start, lref_t * end)
-{
-     if (start > end)
-     {
-          lref_t *tmp = start;
-          start = end;
-          end = tmp;
-     }
+     dscwritef(DF_SHOW_GC, (" ~cfs., ~cd free cells\n", gc_run_time, free_cells));
 
-     size_t n = end - start;
+     *pause_time = gc_run_time;
 
-     gc_mark_range_array(start, n);
+     return free_cells;
 }
 
-static void gc_clear_cell(lref_t obj)
+static fixnum_t gc_mark_and_sweep_nursery(void)
 {
-     switch (TYPE(obj))
-     {
-     case TC_STRING:
-          gc_free(obj->as.string.data);
-          break;
+     gc_begin_stats(true);
 
-     case TC_STRUCTURE:
-          gc_free(STRUCTURE_DATA(obj));;
-          break;
+     gc_release_allocation_run();
 
-     case TC_VECTOR:
-          gc_free(obj->as.vector.data);
-          break;
+     hash_free_retired_tables();
 
-     case TC_HASH:
-          gc_free(obj->as.hash.table);
-          break;
+     gc_mark_stack();
+     gc_mark_roots();
+     gc_mark_remembered_set();
+     gc_mark_transitive_closure();
+     gc_remove_dead_weak_entries();
 
-     case TC_PORT:
-          port_gc_free(obj);
-          break;
+     flush_call_site_caches();
 
-     case TC_FASL_READER:
-          gc_free(FASL_READER_STREAM(obj));
-          break;
+     fixnum_t free_cells = gc_sweep_nursery();
 
-     default:
-          /*  By default, objects are either immediate or otherwise self
-           * contained, and do not need special-case handling in
-           * gc_clear_cell. */
-          break;
+     gc_forget_remembered_set();
 
-     }
+     interp.gc_minor_collections++;
 
-     gc_init_cell(obj);
+     double gc_run_time  = gc_end_stats();
+
+     dscwritef(DF_SHOW_GC, (" ~cfs., ~cd free nursery cells\n", gc_run_time, free_cells));
+
+     return free_cells;
 }
 
+/* Minor collections can't run while a full collection is clearing or
+ * marking. */
+static bool gc_minor_collection_due_p(void)
+{
+     return (interp.gc_nursery_size > 0)
+          && (interp.gc_nursery_cells >= interp.gc_nursery_size)
+          && ((interp.gc_phase == GC_IDLE) || (interp.gc_phase == GC_SWEEPING));
+}
 
-/* gc_sweep
+
+/*** Incremental collection
  *
- * Sweeps all unmarked memory cells back into the interp.gc_heap_freelist,
- * calling the appropriate gc_free hooks along the way.
+ * When the VM is given a pause budget, full collections are done
+ * incrementally, in slices of at most that length (apart from the
+ * atomic start and end of marking) run from gc_claim_freelist every
+ * GC_SLICE_INTERVAL allocated cells. A cycle starts once less than
+ * 1/GC_CYCLE_TRIGGER_DIVISOR of the heap is available to the
+ * allocator, and then clears the mark bits and marks the heap an
+ * allocation run at a time. Slices also do the lazy sweep that
+ * follows. Minor collections are suspended until marking is done.
+ *
+ * Objects are allocated unmarked throughout the cycle. While marking,
+ * the write barrier marks unmarked objects stored into marked ones, so
+ * no marked object that has been scanned can refer to an unmarked
+ * object that is only reachable through it. Marking finishes by
+ * rescanning the stack and the roots.
  */
-static fixnum_t gc_sweep()
+
+static bool gc_cycle_due_p(void)
 {
-     fixnum_t free_cells = 0;
-     fixnum_t cells_freed = 0;
+     return (interp.gc_malloc_bytes > interp.gc_malloc_bytes_threshold)
+          || (interp.gc_free_cells < gc_heap_cells() / GC_CYCLE_TRIGGER_DIVISOR);
+}
 
-     lref_t current_sub_freelist = NIL;
-     size_t current_sub_freelist_size = 0;
+static void gc_begin_cycle(void)
+{
+     dscwritef(DF_SHOW_GC, (_T("; Incremental GC cycle @ T+~cf\n"), time_since_launch()));
 
+     gc_forget_remembered_set();
 
-     for (size_t heap_num = 0;
-          heap_num < interp.gc_max_heap_segments;
-          heap_num++)
-     {
-          if (interp.gc_heap_segments[heap_num] == NULL)
-               continue;
+     hash_free_retired_tables();
 
-          lref_t org = interp.gc_heap_segments[heap_num];
-          lref_t end = org + interp.gc_heap_segment_size;
+     interp.gc_malloc_bytes = 0;
+     interp.gc_malloc_blocks = 0;
 
-          for (lref_t obj = org; obj < end; ++obj)
-          {
-               if (GC_MARK(obj))
-               {
-                    SET_GC_MARK(obj, 0);
-                    continue;
-               }
+     interp.gc_marked_cells = 0;
+     interp.gc_cells_since_slice = 0;
 
-               free_cells++;
+     gc_reset_cursor();
 
-               if (FREE_CELL_P(obj))
-                    continue;
+     interp.gc_phase = GC_CLEARING;
+}
 
-               cells_freed++;
+static void gc_clear_step(void)
+{
+     lref_t start, end;
 
-               gc_clear_cell(obj);
+     if (gc_next_cursor_run(&start, &end))
+     {
+          gc_clear_run_marks(start);
 
-               current_sub_freelist_size++;
-               current_sub_freelist =
-                    SET_NEXT_FREE_CELL(obj, current_sub_freelist);
+          return;
+     }
 
-               if (current_sub_freelist_size >= SUB_FREELIST_SIZE)
-               {
-                    interp.gc_global_freelist =
-                         SET_NEXT_FREE_LIST(obj, interp.gc_global_freelist);
+     interp.gc_phase = GC_MARKING;
 
-                    current_sub_freelist_size = 0;
-                    current_sub_freelist = NIL;
-               }
-          }
-     }
+     gc_mark_stack();
+     gc_mark_roots();
+}
 
-     if (!NULLP(current_sub_freelist))
-          interp.gc_global_freelist =
-               SET_NEXT_FREE_LIST(current_sub_freelist,
-                                  interp.gc_global_freelist);
+static void gc_mark_step(void)
+{
+     if (!gc_drain_mark_stack(GC_SLICE_MARK_STEP))
+          return;
 
-     dscwritef(DF_SHOW_GC_DETAILS, (";;; GC sweep done, freed:~cd, free:~cd\n",
-                                    cells_freed, free_cells));
+     gc_mark_stack();
+     gc_mark_roots();
+     gc_mark_remembered_set();
+     gc_mark_transitive_closure();
+     gc_remove_dead_weak_entries();
 
-     return free_cells;
+     gc_begin_sweep();
+
+     dscwritef(DF_SHOW_GC, (_T("; Incremental GC marking done, ~cd free cells\n"),
+                            gc_unmarked_cells()));
 }
 
-static void gc_mark_stack()
+static void gc_collect_step(void)
 {
-     jmp_buf registers;
-     lref_t stack_end;
+     switch (interp.gc_phase)
+     {
+     case GC_CLEARING:
+          gc_clear_step();
+          break;
 
-     setjmp(registers);
+     case GC_MARKING:
+          gc_mark_step();
+          break;
 
-     gc_mark_range((lref_t *) registers,
-                   (lref_t *) (((uint8_t *) registers) + sizeof(registers)));
+     case GC_SWEEPING:
+          gc_sweep_step();
+          break;
 
-     gc_mark_range((lref_t *) sys_get_stack_start(),
-                   (lref_t *) & stack_end);
+     case GC_IDLE:
+          break;
+     }
 }
 
-static void gc_begin_stats(void)
+/* gc_collect_slice
+ *
+ * Advance the current collection cycle until the pause budget is
+ * spent. Work continues past the budget while the allocator has
+ * nothing to claim. Returns the length of the slice.
+ */
+static double gc_collect_slice(void)
 {
      gc_begin_timer();
 
-     if (!DEBUG_FLAG(DF_SHOW_GC))
-          return;
+     do
+          gc_collect_step();
+     while ((interp.gc_phase != GC_IDLE)
+            && ((gc_heap_freelist_length() == 0)
+                || (sys_runtime() - interp.gc_start_time < interp.gc_pause_budget)));
 
-     if ((interp.gc_malloc_bytes > 0) || (interp.gc_malloc_blocks > 0))
-          dscwritef(DF_ALWAYS, (_T("; ~cd/~cd C bytes/blocks allocated since last GC.\n"),
-                     interp.gc_malloc_bytes, interp.gc_malloc_blocks));
+     interp.gc_cells_since_slice = 0;
 
-     dscwritef(DF_ALWAYS, (_T("; GC @ T+~cf:"), time_since_launch()));
-}
+     double slice_time = gc_end_timer();
 
-static double gc_end_stats(void)
-{
-     interp.gc_malloc_bytes = 0;
-     interp.gc_malloc_blocks = 0;
+     interp.gc_incremental_slices++;
+     interp.gc_max_slice_time = MAX2(interp.gc_max_slice_time, slice_time);
 
-     return gc_end_timer();
+     return slice_time;
 }
 
-static fixnum_t gc_mark_and_sweep(void)
+static void gc_collect_incrementally(void)
 {
-     gc_begin_stats();
-
-     gc_mark_stack();
-     gc_mark_roots();
+     if ((interp.gc_phase == GC_IDLE) && gc_cycle_due_p())
+          gc_begin_cycle();
+     else if (gc_minor_collection_due_p())
+          gc_mark_and_sweep_nursery();
+
+     if ((interp.gc_phase == GC_IDLE)
+         || ((interp.gc_cells_since_slice < GC_SLICE_INTERVAL)
+             && (gc_heap_freelist_length() > 0)))
+          return;
 
-     fixnum_t free_cells = gc_sweep();
+     size_t major_collections = interp.gc_major_collections;
 
-     double gc_run_time  = gc_end_stats();
+     double slice_time = gc_collect_slice();
 
-     dscwritef(DF_SHOW_GC, (" ~cfs., ~cd free cells\n", gc_run_time, free_cells));
+     if (interp.gc_major_collections > major_collections)
+          gc_size_heap();
 
-     return free_cells;
+     /* Slices report the cells available once marking is done, or #f
+      * if the slice didn't finish marking. */
+     vmtrap(TRAP_AFTER_GC, VMT_OPTIONAL_TRAP, 2,
+            (interp.gc_major_collections > major_collections)
+            ? fixcons(gc_unmarked_cells()) : boolcons(false),
+            flocons(slice_time));
 }
 
 
@@ -561,41 +1837,123 @@ static fixnum_t gc_mark_and_sweep(void)
 
 static fixnum_t gc_collect_garbage(void)
 {
-     fixnum_t free_cells = gc_mark_and_sweep();
+     fixnum_t free_cells;
+     double pause_time;
+
+     if ((interp.gc_phase == GC_CLEARING) || (interp.gc_phase == GC_MARKING))
+     {
+          /* Finish the incremental cycle in progress. */
+          gc_begin_timer();
+
+          while (interp.gc_phase != GC_SWEEPING)
+               gc_collect_step();
+
+          free_cells = gc_unmarked_cells();
+          pause_time = gc_end_timer();
+     }
+     else
+          free_cells = gc_mark_and_sweep(&pause_time);
 
-     if (NULLP(interp.gc_global_freelist))
+     gc_size_heap();
+
+     gc_sweep_lazily();
+
+     if (gc_heap_freelist_length() == 0)
           gc_enlarge_heap();
 
-     if (NULLP(interp.gc_global_freelist))
+     if (gc_heap_freelist_length() == 0)
           panic("ran out of storage");
 
-     vmtrap(TRAP_AFTER_GC, VMT_OPTIONAL_TRAP, 1, fixcons(free_cells));
+     vmtrap(TRAP_AFTER_GC, VMT_OPTIONAL_TRAP, 2, fixcons(free_cells), flocons(pause_time));
 
      return free_cells;
 }
+
 /*** Global freelist enqueue and dequeue */
 
-lref_t gc_claim_freelist()
+void gc_claim_freelist()
 {
-     lref_t new_freelist = NIL;
+     if (interp.gc_pause_budget > 0.0)
+          gc_collect_incrementally();
+     else if ((interp.gc_malloc_bytes > interp.gc_malloc_bytes_threshold) || ALWAYS_GC)
+          gc_collect_garbage();
+     else if (gc_minor_collection_due_p())
+          gc_mark_and_sweep_nursery();
 
-     if (NULLP(interp.gc_global_freelist)
-         || (interp.gc_malloc_bytes > interp.gc_malloc_bytes_threshold)
-         || ALWAYS_GC)
+     /* Runs the last full collection left unswept come first. */
+     gc_sweep_lazily();
+
+     if (gc_heap_freelist_length() == 0)
           gc_collect_garbage();
 
-     if (NULLP(interp.gc_global_freelist))
+     /* The after-GC trap handler can claim the runs the collection
+      * made available. If it has, and sweeping the rest of the heap
+      * turns up nothing more, the heap is grown or storage has run
+      * out. Collecting again would free only what the handler
+      * dropped, and the next handler would claim it all over again. */
+     gc_sweep_lazily();
+
+     if (gc_heap_freelist_length() == 0)
           gc_enlarge_heap();
 
-     assert(!NULLP(interp.gc_global_freelist));
+     if (gc_heap_freelist_length() == 0)
+          panic("ran out of storage");
+
+     struct gc_run_table_t *table = (interp.gc_free_runs.count > 0)
+          ? &interp.gc_free_runs
+          : &interp.gc_partial_runs;
+
+     struct gc_run_t *run = &table->runs[--table->count];
+
+     interp.gc_free_cells -= run->free_cells;
+     interp.gc_cells_since_slice += run->free_cells;
+
+     if (interp.gc_nursery_size > 0)
+     {
+          gc_run_table_push(&interp.gc_nursery_runs,
+                            run->start, run->end, run->free_cells);
+
+          interp.gc_nursery_cells += run->free_cells;
+     }
+
+     CURRENT_TIB()->alloc_next = run->start;
+     CURRENT_TIB()->alloc_limit = run->end;
+}
+
+/*** Tenured runs
+ *
+ * Objects loaded from a heap image are long lived, and are allocated
+ * straight into the old generation. A tenured run is a free run that
+ * is claimed outside the nursery, and whose cells are filled in
+ * directly by the caller and marked as if they had survived a
+ * collection. Claiming one never collects garbage, so cells can be
+ * left half built from one claim to the next. The heap is enlarged
+ * instead when it runs out of free runs.
+ */
+
+void gc_claim_tenured_run(lref_t *start, lref_t *end)
+{
+     if ((interp.gc_free_runs.count == 0) && !gc_enlarge_heap())
+          panic("Out of heap space for a tenured run");
+
+     struct gc_run_t *run = &interp.gc_free_runs.runs[--interp.gc_free_runs.count];
 
-     new_freelist = interp.gc_global_freelist;
+     interp.gc_free_cells -= run->free_cells;
+
+     *start = run->start;
+     *end = run->end;
+}
 
-     interp.gc_global_freelist = NEXT_FREE_LIST(interp.gc_global_freelist);
+/* Return the unused cells, from <start> to <end>, at the end of a
+ * tenured run to the allocator. */
+void gc_release_tenured_run(lref_t start, lref_t end)
+{
+     if (start >= end)
+          return;
 
-     SET_NEXT_FREE_LIST(new_freelist, NIL);
+     gc_run_table_push(&interp.gc_partial_runs, start, end, (size_t) (end - start));
 
-     return new_freelist;
+     interp.gc_free_cells += (size_t) (end - start);
 }
 
 static size_t gc_count_active_heap_segments(void)
@@ -613,12 +1971,50 @@ static size_t gc_count_active_heap_segments(void)
 
 void gc_initialize_heap()
 {
+     /* Heap segments are made up of whole allocation runs. */
+     interp.gc_heap_segment_size =
+          MAX2(interp.gc_heap_segment_size + ALLOCATION_RUN_SIZE - 1, (size_t) ALLOCATION_RUN_SIZE)
+          & ~(size_t) (ALLOCATION_RUN_SIZE - 1);
+
+     if (interp.gc_max_heap_bytes > 0)
+          interp.gc_max_heap_segments =
+               MAX2(interp.gc_max_heap_bytes
+                    / (sizeof(struct lobject_t) * interp.gc_heap_segment_size), (size_t) 1);
+
+     /* The sizing targets must leave some of the heap free, and be in
+      * order. */
+     interp.gc_target_free_percent = MIN2(interp.gc_target_free_percent, (size_t) 99);
+     interp.gc_min_free_percent = MIN2(interp.gc_min_free_percent, interp.gc_target_free_percent);
+     interp.gc_max_free_percent = MAX2(interp.gc_max_free_percent, interp.gc_target_free_percent);
+
      /* Initialize the heap table */
      interp.gc_heap_segments =
           (lref_t *) gc_malloc(sizeof(lref_t) * interp.gc_max_heap_segments);
+     interp.gc_heap_segment_blocks =
+          (void **) gc_malloc(sizeof(void *) * interp.gc_max_heap_segments);
+     interp.gc_heap_segment_index =
+          (size_t *) gc_malloc(sizeof(size_t) * interp.gc_max_heap_segments);
+     interp.gc_heap_segment_free_runs =
+          (size_t *) gc_malloc(sizeof(size_t) * interp.gc_max_heap_segments);
 
      for (size_t jj = 0; jj < interp.gc_max_heap_segments; jj++)
+     {
           interp.gc_heap_segments[jj] = NULL;
+          interp.gc_heap_segment_blocks[jj] = NULL;
+     }
+
+     interp.gc_heap_low = NULL;
+     interp.gc_heap_high = NULL;
+
+     if (interp.gc_threads > 1)
+     {
+          interp.gc_workers =
+               (struct gc_worker_t *) gc_malloc(sizeof(struct gc_worker_t) * interp.gc_threads);
+
+          memset(interp.gc_workers, 0, sizeof(struct gc_worker_t) * interp.gc_threads);
+
+          interp.gc_work_lock = sys_create_mutex();
+     }
 
      /* Get us started with one heap */
      gc_enlarge_heap();
@@ -626,11 +2022,35 @@ void gc_initialize_heap()
 
 void gc_release_heap()
 {
+     gc_finish_sweep();
+
+     interp.gc_phase = GC_IDLE;
+
+     gc_release_allocation_run();
+     gc_clear_marks();
      gc_sweep();
 
-     for (size_t jj = 0; jj < interp.gc_max_heap_segments; jj++)
-          if (interp.gc_heap_segments[jj])
-               gc_free(interp.gc_heap_segments[jj]);
+     for (size_t jj = 0; jj < interp.gc_current_heap_segments; jj++)
+          sys_release_pages(interp.gc_heap_segment_blocks[jj], gc_heap_segment_bytes());
+     gc_free(interp.gc_free_runs.runs);
+     gc_free(interp.gc_partial_runs.runs);
+     gc_free(interp.gc_nursery_runs.runs);
+     gc_free(interp.gc_remembered_set);
+     gc_free(interp.gc_weak_hashes);
+     gc_free(interp.gc_mark_stack);
+     gc_free(interp.gc_finalize_queue);
+
+     if (interp.gc_workers != NULL)
+     {
+          for (size_t ii = 0; ii < interp.gc_threads; ii++)
+          {
+               gc_free(interp.gc_workers[ii].mark_stack);
+               gc_free(interp.gc_workers[ii].finalize_queue);
+          }
+
+          gc_free(interp.gc_workers);
+          sys_destroy_mutex(interp.gc_work_lock);
+     }
 }
 
 /**** Scheme interface functions */
@@ -648,7 +2068,8 @@ lref_t lirequest_heap_size(lref_t c)
           if ((r < 1) || ((size_t) r > interp.gc_max_heap_segments))
                vmerror_arg_out_of_range(c, _T("[1,MAX_HEAPS]"));
 
-          requested = (size_t) r - interp.gc_current_heap_segments;
+          requested = ((size_t) r > interp.gc_current_heap_segments)
+               ? (size_t) r - interp.gc_current_heap_segments : 0;
      }
 
      for (created = 0; created < requested; created++)
@@ -670,7 +2091,7 @@ lref_t lgc()
 
 lref_t lgc_info()
 {
-     lref_t argv[7];
+     lref_t argv[16];
 
      argv[0] = fixcons(gc_count_active_heap_segments());
      argv[1] = fixcons(interp.gc_heap_segment_size);
@@ -679,6 +2100,15 @@ lref_t lgc_info()
      argv[4] = fixcons(interp.gc_total_cells_allocated);
      argv[5] = fixcons(interp.gc_malloc_bytes);
      argv[6] = fixcons(interp.gc_malloc_blocks);
-
-     return lvector(7, argv);
+     argv[7] = fixcons(interp.gc_nursery_size);
+     argv[8] = fixcons(interp.gc_minor_collections);
+     argv[9] = fixcons(interp.gc_major_collections);
+     argv[10] = fixcons(interp.gc_incremental_slices);
+     argv[11] = flocons(interp.gc_max_slice_time);
+     argv[12] = fixcons(interp.gc_threads);
+     argv[13] = flocons(interp.gc_root_time);
+     argv[14] = flocons(interp.gc_mark_time);
+     argv[15] = flocons(interp.gc_sweep_time);
+
+     return lvector(16, argv);
 }
@@ -96,6 +96,7 @@ lref_t lset_package_name(lref_t p, lref_t new_name)   /*  ONLY SCHEME */
      if (!STRINGP(new_name))
           vmerror_wrong_type_n(2, new_name);
 
+     gc_write_barrier(p, new_name);
      p->as.package.name = new_name;
 
      return p;
@@ -125,6 +126,7 @@ lref_t lset_package_use_list(lref_t p, lref_t use_list)
      if (!list_of_packages_p(use_list))
           vmerror_arg_out_of_range(use_list, _T("bad use list"));
 
+     gc_write_barrier(p, use_list);
      p->as.package.use_list = use_list;
 
      return p;
@@ -190,6 +192,9 @@ lref_t symcons(lref_t pname, lref_t home)
      SET_SYMBOL_VCELL(sym, UNBOUND_MARKER);
      SET_SYMBOL_HOME(sym, home);
 
+     /*  Symbols hash as their print names, so hash it now, once. */
+     sxhash_string(pname);
+
      return sym;
 }
 
@@ -236,10 +241,30 @@ lref_t simple_intern(lref_t print_name, lref_t package)
 }
 
 
+/* simple_intern for a name given as the <length> characters at
+ * <chars>. Finding a symbol that already exists allocates nothing; the
+ * characters are only made into a string for a new symbol. */
+lref_t intern_chars(const _TCHAR *chars, size_t length, lref_t package)
+{
+     if (!PACKAGEP(package) || (length <= 0))
+          return NIL;
+
+     lref_t sym_rec;
+
+     if (hash_ref_chars(package->as.package.bindings, chars, length, &sym_rec))
+          return CAR(sym_rec);
+
+     lref_t sym = symcons(strconsbufn(length, chars), package);
+
+     ladd_symbol_to_package(sym, package);
+
+     return sym;
+}
+
 lref_t keyword_intern(const _TCHAR * name)
 {
-     return simple_intern(strconsbuf(name),
-                          interp.control_fields[VMCTRL_PACKAGE_KEYWORD]);
+     return intern_chars(name, _tcslen(name),
+                         interp.control_fields[VMCTRL_PACKAGE_KEYWORD]);
 }
 
 /*** Symbol primitives ***/
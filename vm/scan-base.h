@@ -231,8 +231,26 @@ enum
      /*  Default limit on the Maximum number of heap segments */
      DEFAULT_MAX_HEAP_SEGMENTS = 32,
 
-     /*  Default size for FASL loader tables */
-     DEFAULT_FASL_TABLE_SIZE = 16384,
+     /*  The heap grows when a full collection leaves less than this percent free */
+     DEFAULT_GC_MIN_FREE_PERCENT = 50,
+
+     /*  The percent of the heap a full collection grows or shrinks it to leave free */
+     DEFAULT_GC_TARGET_FREE_PERCENT = 75,
+
+     /*  The heap shrinks when a full collection leaves more than this percent free */
+     DEFAULT_GC_MAX_FREE_PERCENT = 90,
+
+     /*  Default number of cells allocated between minor collections */
+     DEFAULT_NURSERY_SIZE = 262144,
+
+     /*  FASL loader tables grow by chunks of this many entries */
+     FASL_TABLE_CHUNK_SIZE = 1024,
+
+     /*  The number of record offsets a FASL loader keeps room for at first */
+     FASL_INITIAL_RECORD_CAPACITY = 1024,
+
+     /*  The number of bytes a FASL loader reads from its port at a time */
+     FASL_READ_BUFFER_SIZE = 65536,
 
      /*  Local (stack) string buffer size */
      STACK_STRBUF_LEN = 256,
@@ -249,8 +267,39 @@ enum
      /*  The number of arguments contained in argment buffers */
      ARG_BUF_LEN = 32,
 
-     /*  The number of cells on a sub-freelist */
-     SUB_FREELIST_SIZE = 1024,
+     /*  The number of heap cells in each allocation run */
+     ALLOCATION_RUN_SIZE = 1024,
+
+     /*  Initial capacity of the free and nursery allocation run tables */
+     INITIAL_RUN_TABLE_SIZE = 256,
+
+     /*  Initial capacity of the generational remembered set */
+     INITIAL_REMEMBERED_SET_SIZE = 1024,
+
+     /*  Initial capacity of the table of weak hashes found while marking */
+     INITIAL_WEAK_HASH_TABLE_SIZE = 64,
+
+     /*  Initial capacity of the garbage collector's mark stack */
+     INITIAL_MARK_STACK_SIZE = 4096,
+
+     /*  Cells allocated between incremental collection slices */
+     GC_SLICE_INTERVAL = 65536,
+
+     /*  Objects marked between checks of the slice time budget */
+     GC_SLICE_MARK_STEP = 256,
+
+     /*  Incremental collections start when less than 1/N of the heap is free */
+     GC_CYCLE_TRIGGER_DIVISOR = 4,
+
+     /*  Default and maximum number of threads used by full collections */
+     DEFAULT_GC_THREADS = 1,
+     GC_MAX_THREADS = 64,
+
+     /*  Objects moved at a time between a parallel marker and the shared mark stack */
+     GC_MARK_PACKET_SIZE = 256,
+
+     /*  Allocation runs claimed at a time by a parallel sweeper */
+     GC_SWEEP_CHUNK_RUNS = 64,
 
      /*  The maximum number of GC roots per thread */
      MAX_GC_ROOTS = 32,
@@ -264,6 +313,9 @@ enum
      /* The number of lref_t's that can be stored on the frame stack. */
      FRAME_STACK_SIZE = 65536,
 
+     /* The number of entries in the call site cache. Must be a power of two. */
+     CALL_SITE_CACHE_SIZE = 1024,
+
      /*  Default initial size for hash tables */
      HASH_DEFAULT_INITIAL_SIZE = 8,
 
@@ -271,6 +323,17 @@ enum
       * used table entries exceeds this, then the hash table is enlarged. */
      HASH_MAX_LOAD_FACTOR = 67, /* percent */
 
+     /* The minimum load factor for a hash table larger than the default
+      * initial size. Tables that fall below it are shrunk. */
+     HASH_MIN_LOAD_FACTOR = 12, /* percent */
+
+     /* The maximum fraction of a hash table's entries that can be deleted
+      * entries. Past this, the table is rehashed in place to purge them. */
+     HASH_MAX_DELETED_FACTOR = 20, /* percent */
+
+     /* The number of locks shared by writers to concurrent hash tables. */
+     HASH_LOCK_STRIPES = 64,
+
      /* The factor by which 'small' hash tables are enlarged. */
      HASH_SMALL_ENLARGE_FACTOR = 2,
 
@@ -281,6 +344,14 @@ enum
       * be considered 'large'. */
      HASH_SMALL_ENLARGE_THRESHOLD = 50000,
 
+     /* Hash tables with at least this many entries are enlarged
+      * incrementally. */
+     HASH_INCREMENTAL_RESIZE_SIZE = 16384,
+
+     /* The number of entries migrated to an enlarged hash table's new
+      * entries by each operation on the table. */
+     HASH_MIGRATE_STEP = 16,
+
      /* The maximum size of blocks of text sent to the debug port. */
      DEBUG_PORT_BLOCK_SIZE = 256,
 
@@ -69,6 +69,7 @@ BEGIN_VM_CONSTANT_TABLE(fasl_opcode_t, fasl_opcode_name)
     VM_CONSTANT(FASL_OP_TRUE,                 2  )
     VM_CONSTANT(FASL_OP_FALSE,                3  )
     VM_CONSTANT(FASL_OP_CHARACTER,            4  )
+    VM_CONSTANT(FASL_OP_CONS,                 5  )
     VM_CONSTANT(FASL_OP_LIST,                 8  )
     VM_CONSTANT(FASL_OP_LISTD,                9  )
     VM_CONSTANT(FASL_OP_NOP_1,                10 ) /* #\newline */
@@ -90,23 +91,44 @@ BEGIN_VM_CONSTANT_TABLE(fasl_opcode_t, fasl_opcode_name)
     VM_CONSTANT(FASL_OP_COMMENT_1,            35 ) /* #\# */
     VM_CONSTANT(FASL_OP_CLOSURE,              36 )
     VM_CONSTANT(FASL_OP_MACRO,                37 )
+    VM_CONSTANT(FASL_OP_FAST_OP_0,            40 )
+    VM_CONSTANT(FASL_OP_FAST_OP_1,            41 )
+    VM_CONSTANT(FASL_OP_FAST_OP_2,            42 )
+    VM_CONSTANT(FASL_OP_FAST_OP_0N,           43 )
+    VM_CONSTANT(FASL_OP_FAST_OP_1N,           44 )
+    VM_CONSTANT(FASL_OP_FAST_OP_2N,           45 )
     VM_CONSTANT(FASL_OP_SYMBOL,               48 )
     VM_CONSTANT(FASL_OP_SUBR,                 50 )
     VM_CONSTANT(FASL_OP_COMMENT_2,            59 ) /* #\; */
     VM_CONSTANT(FASL_OP_STRUCTURE,            60 )
     VM_CONSTANT(FASL_OP_STRUCTURE_LAYOUT,     61 )
 
-    VM_CONSTANT(FASL_OP_FAST_OP_0,            64 )
-    VM_CONSTANT(FASL_OP_FAST_OP_1,            65 )
-    VM_CONSTANT(FASL_OP_FAST_OP_2,            66 )
-    VM_CONSTANT(FASL_OP_FAST_OP_0N,           67 )
-    VM_CONSTANT(FASL_OP_FAST_OP_1N,           68 )
-    VM_CONSTANT(FASL_OP_FAST_OP_2N,           69 )
+     /*  Fast ops were written with 64-69 before objects could be
+      *  recorded, which takes an opcode below 64. */
+    VM_CONSTANT(FASL_OP_OLD_FAST_OP_0,        64 )
+    VM_CONSTANT(FASL_OP_OLD_FAST_OP_1,        65 )
+    VM_CONSTANT(FASL_OP_OLD_FAST_OP_2,        66 )
+    VM_CONSTANT(FASL_OP_OLD_FAST_OP_0N,       67 )
+    VM_CONSTANT(FASL_OP_OLD_FAST_OP_1N,       68 )
+    VM_CONSTANT(FASL_OP_OLD_FAST_OP_2N,       69 )
+     /*  Followed by the length of the object after it, in four bytes,
+      *  so that a reader can skip the object and read it when it's
+      *  first needed. Objects within refer to none outside but interned
+      *  symbols and packages. A length of zero marks an object that
+      *  shares more than that, which is read in place. */
+    VM_CONSTANT(FASL_OP_DEFERRED,             70 )
 
     VM_CONSTANT(FASL_OP_INSTANCE_MAP,         96 )
+     /*  97-127 are the fixnums 0-30 in one byte. Small fixnums are
+      *  never recorded, so they can take opcodes above 63. */
+    VM_CONSTANT(FASL_OP_SMALL_FIXNUM,         97 )
+     /*  Added to an object opcode below 64, to have the reader record
+      *  the object by its offset for later FASL_OP_RECORD_REFERENCEs. */
+    VM_ANON_CONSTANT(FASL_OP_RECORD,          128)
     VM_CONSTANT(FASL_OP_RESET_READER_DEFS,    192)
     VM_CONSTANT(FASL_OP_READER_DEFINITION,    193)
     VM_CONSTANT(FASL_OP_READER_REFERENCE,     194)
+    VM_CONSTANT(FASL_OP_RECORD_REFERENCE,     195)
     VM_CONSTANT(FASL_OP_LOADER_DEFINEQ,       208)
      /*  209 is the former FASL_OP_LOADER_DEFINE (which invoked
       * the evaluator to determine the definition value.) */
@@ -117,6 +139,13 @@ BEGIN_VM_CONSTANT_TABLE(fasl_opcode_t, fasl_opcode_name)
     VM_CONSTANT(FASL_OP_END_LOAD_UNIT,        225)
     VM_CONSTANT(FASL_OP_LOADER_PUSH,          228)
     VM_CONSTANT(FASL_OP_LOADER_DROP,          229)
+     /*  Followed by a byte giving the format version of the stream
+      *  from there on. Streams without one are version 1. */
+    VM_CONSTANT(FASL_OP_FORMAT,               240)
+     /*  The version written. From version 2, lengths, offsets and fast
+      *  op opcodes are varints, and symbol names are written inline.
+      *  Version 3 adds FASL_OP_DEFERRED. */
+    VM_ANON_CONSTANT(FASL_FORMAT_VERSION,     3  )
     VM_CONSTANT(FASL_OP_EOF,                  253)
     /*  254, 255 reserved for Unicode Byte Order Marker */
 END_VM_CONSTANT_TABLE(fasl_opcode_t, fasl_opcode_name)
@@ -152,8 +181,48 @@ BEGIN_VM_CONSTANT_TABLE(fast_op_opcode_t, fast_op_opcode_name)
     VM_CONSTANT(FOP_LOCAL_REF_BY_INDEX,       29 )
     VM_CONSTANT(FOP_LOCAL_REF_RESTARG,        30 )
     VM_CONSTANT(FOP_LOCAL_SET_BY_INDEX,       31 )
+    VM_CONSTANT(FOP_STACK_FRAME,              32 )
+    VM_CONSTANT(FOP_STACK_LOCAL_REF,          33 )
+    VM_CONSTANT(FOP_STACK_LOCAL_SET,          34 )
+    VM_CONSTANT(FOP_BYTECODE,                 35 )
+     /*  A closure body not yet read from a FASL stream, which is read
+      *  into the fast op in its place when it's first applied. */
+    VM_CONSTANT(FOP_DEFERRED,                 36 )
 END_VM_CONSTANT_TABLE(fast_op_opcode_t, fast_op_opcode_name)
 
+/* Bytecode opcodes. These must be densely numbered from zero, since
+ * the threaded interpreter dispatches through a table indexed by
+ * opcode. */
+BEGIN_VM_CONSTANT_TABLE(bytecode_opcode_t, bytecode_opcode_name)
+    VM_CONSTANT(BC_LITERAL,                   0  )
+    VM_CONSTANT(BC_GLOBAL_REF,                1  )
+    VM_CONSTANT(BC_GLOBAL_SET,                2  )
+    VM_CONSTANT(BC_GLOBAL_DEF,                3  )
+    VM_CONSTANT(BC_LOCAL_REF,                 4  )
+    VM_CONSTANT(BC_LOCAL_REF_RESTARG,         5  )
+    VM_CONSTANT(BC_LOCAL_SET,                 6  )
+    VM_CONSTANT(BC_STACK_LOCAL_REF,           7  )
+    VM_CONSTANT(BC_STACK_LOCAL_SET,           8  )
+    VM_CONSTANT(BC_PUSH,                      9  )
+    VM_CONSTANT(BC_CALL_GLOBAL,               10 )
+    VM_CONSTANT(BC_CALL,                      11 )
+    VM_CONSTANT(BC_TAIL_CALL_GLOBAL,          12 )
+    VM_CONSTANT(BC_TAIL_CALL,                 13 )
+    VM_CONSTANT(BC_JUMP,                      14 )
+    VM_CONSTANT(BC_JUMP_IF_FALSE,             15 )
+    VM_CONSTANT(BC_CLOSURE,                   16 )
+    VM_CONSTANT(BC_EQP,                       17 )
+    VM_CONSTANT(BC_CAR,                       18 )
+    VM_CONSTANT(BC_CDR,                       19 )
+    VM_CONSTANT(BC_NOT,                       20 )
+    VM_CONSTANT(BC_NULLP,                     21 )
+    VM_CONSTANT(BC_GET_ENV,                   22 )
+    VM_CONSTANT(BC_FAST_OP,                   23 )
+    VM_CONSTANT(BC_RETURN,                    24 )
+
+    VM_ANON_CONSTANT(BC_LAST,                 24 )
+END_VM_CONSTANT_TABLE(bytecode_opcode_t, bytecode_opcode_name)
+
 BEGIN_VM_CONSTANT_TABLE(trap_type_t, trap_type_name)
     VM_CONSTANT(TRAP_BAD_APPLY                  , 0 )
     VM_CONSTANT(TRAP_DEFINE                     , 1 )
@@ -212,8 +281,10 @@ BEGIN_VM_CONSTANT_TABLE(typecode_t, typecode_name)
     VM_CONSTANT(TC_GC_TRIP_WIRE,              21 )
     VM_CONSTANT(TC_FAST_OP,                   22 )
     VM_CONSTANT(TC_FASL_READER,               23 )
+    VM_CONSTANT(TC_ENVIRONMENT,               24 )
+    VM_CONSTANT(TC_ENVIRONMENT_SLOTS,         25 )
 
-    VM_ANON_CONSTANT(LAST_INTERNAL_TYPEC,     23 )
+    VM_ANON_CONSTANT(LAST_INTERNAL_TYPEC,     25 )
 END_VM_CONSTANT_TABLE(typecode_t, typecode_name)
 
 BEGIN_VM_CONSTANT_TABLE(subr_arity_t, subr_arity_name)
@@ -26,9 +26,69 @@ struct gc_root_t
      size_t length;
 };
 
+struct gc_run_t
+{
+     lref_t start;
+     lref_t end;
+     size_t free_cells;
+};
+
+struct gc_run_table_t
+{
+     size_t count;
+     size_t capacity;
+     struct gc_run_t *runs;
+};
+
+/* The phases of an incremental full collection. */
+enum gc_phase_t
+{
+     GC_IDLE,
+     GC_CLEARING,
+     GC_MARKING,
+     GC_SWEEPING
+};
+
+/* How a cached FOP_APPLY_GLOBAL callee is applied. */
+enum call_site_kind_t
+{
+     CALL_SITE_UNCACHED, /*  Not a procedure, or nothing cached: use apply */
+     CALL_SITE_SUBR,
+     CALL_SITE_CLOSURE,
+     CALL_SITE_STACK_CLOSURE /*  Locals are bound on the frame stack */
+};
+
+/* A call site's last callee, and what applying it needs from it. */
+struct call_site_cache_t
+{
+     lref_t callee;
+     enum call_site_kind_t kind;
+     enum subr_arity_t subr_type;
+     lref_t body;    /*  The first fast op to run, for closures */
+     lref_t formals;
+     size_t dim;     /*  The number of local slots the formals bind */
+     bool rest;
+};
+
+/* The private state of a parallel collector thread. */
+struct gc_worker_t
+{
+     size_t mark_stack_size;
+     size_t mark_stack_capacity;
+     lref_t *mark_stack;
+
+     size_t finalize_queue_size;
+     size_t finalize_queue_capacity;
+     lref_t *finalize_queue;
+
+     size_t marked_cells;
+     fixnum_t cells_freed;
+};
+
 struct interpreter_thread_info_block_t
 {
-     lref_t freelist;
+     lref_t alloc_next;
+     lref_t alloc_limit;
      void *stack_base;
      struct gc_root_t gc_roots[MAX_GC_ROOTS];
 
@@ -44,10 +104,10 @@ struct interpreter_thread_info_block_t
 
 struct interpreter_t
 {
-     /*  A statically allocated lobject_t used to hold a debugger output port.
-      *  This is intended to be available before the GC heap is operational,
-      *  so it has to be located here, and not on the heap. */
-     struct lobject_t debugger_output;
+     /*  A static cell used to hold a debugger output port. This is
+      *  intended to be available before the GC heap is operational, so
+      *  it is allocated with gc_allocate_static_cell, and not on the heap. */
+     lref_t debugger_output;
 
      /* Debugger flags. */
      enum debug_flag_t debug_flags;
@@ -63,10 +123,18 @@ struct interpreter_t
      size_t init_load_file_count;
      _TCHAR *init_load_file_name[MAX_INIT_LOAD_FILES];
 
+     /*  The heap images named by -Xboot-image and -Xdump-boot-image, or NULL */
+     _TCHAR *boot_image_file_name;
+     _TCHAR *dump_boot_image_file_name;
+
      flonum_t launch_realtime;
 
      lref_t fasl_package_list;
 
+     /*  Whether readers that read in place skip deferred objects,
+      *  to read them when they're first needed (-Xfasl-lazy-load) */
+     bool fasl_lazy_load;
+
      lref_t base_instance;
 
      lref_t internal_files;
@@ -76,10 +144,69 @@ struct interpreter_t
      /* GC-specific info. */
      size_t gc_heap_segment_size;
      size_t gc_max_heap_segments;
+     size_t gc_max_heap_bytes;
      size_t gc_current_heap_segments;
+     size_t gc_min_free_percent;
+     size_t gc_target_free_percent;
+     size_t gc_max_free_percent;
+     size_t gc_segments_to_release;
      lref_t *gc_heap_segments;
-
-     lref_t gc_global_freelist;
+     void **gc_heap_segment_blocks;
+     size_t *gc_heap_segment_index;
+     size_t *gc_heap_segment_free_runs;
+     lref_t gc_heap_low;
+     lref_t gc_heap_high;
+
+     lref_t gc_static_run;
+     size_t gc_static_cells;
+
+     struct gc_run_table_t gc_free_runs;
+     struct gc_run_table_t gc_partial_runs;
+
+     size_t gc_nursery_size;
+     size_t gc_nursery_cells;
+     struct gc_run_table_t gc_nursery_runs;
+
+     size_t gc_remembered_set_size;
+     size_t gc_remembered_set_capacity;
+     lref_t *gc_remembered_set;
+
+     size_t gc_weak_hashes_size;
+     size_t gc_weak_hashes_capacity;
+     lref_t *gc_weak_hashes;
+
+     size_t gc_mark_stack_size;
+     size_t gc_mark_stack_capacity;
+     lref_t *gc_mark_stack;
+
+     flonum_t gc_pause_budget;
+     enum gc_phase_t gc_phase;
+     size_t gc_free_cells;
+     size_t gc_cells_since_slice;
+     size_t gc_marked_cells;
+     size_t gc_cursor_segment;
+     size_t gc_cursor_limit;
+     lref_t gc_cursor;
+     fixnum_t gc_cycle_free_cells;
+     fixnum_t gc_cycle_cells_freed;
+     size_t gc_finalize_queue_size;
+     size_t gc_finalize_queue_capacity;
+     lref_t *gc_finalize_queue;
+     size_t gc_incremental_slices;
+     flonum_t gc_max_slice_time;
+
+     size_t gc_threads;
+     struct gc_worker_t *gc_workers;
+     struct sys_mutex_t *gc_work_lock;
+     size_t gc_workers_started;
+     size_t gc_workers_idle;
+
+     flonum_t gc_root_time;
+     flonum_t gc_mark_time;
+     flonum_t gc_sweep_time;
+
+     size_t gc_minor_collections;
+     size_t gc_major_collections;
 
      size_t gc_total_cells_allocated;
 
@@ -90,6 +217,11 @@ struct interpreter_t
      flonum_t gc_total_run_time;
      flonum_t gc_start_time;
 
+     struct call_site_cache_t call_site_caches[CALL_SITE_CACHE_SIZE];
+
+     struct sys_mutex_t *hash_locks[HASH_LOCK_STRIPES];
+     struct hash_table_t *hash_retired_tables;
+
      /* Per-thread info. */
      struct interpreter_thread_info_block_t thread;
 };
@@ -139,7 +271,7 @@ void scan_postmortem_dump();
 
 INLINE lref_t VM_DEBUG_PORT()
 {
-     return (&interp.debugger_output);
+     return interp.debugger_output;
 }
 
 INLINE bool DEBUG_FLAG(enum debug_flag_t flag)
@@ -153,31 +285,31 @@ INLINE bool DEBUG_FLAG(enum debug_flag_t flag)
 /***** I/O Encode and Decode *****/
 
 void io_encode_uint8(uint8_t *buf, unsigned_fixnum_t num);
-unsigned_fixnum_t io_decode_uint8(uint8_t *buf);
+unsigned_fixnum_t io_decode_uint8(const uint8_t *buf);
 
 void io_encode_int8(uint8_t *buf, fixnum_t num);
-fixnum_t io_decode_int8(uint8_t *buf);
+fixnum_t io_decode_int8(const uint8_t *buf);
 
 void io_encode_uint16(uint8_t *buf, unsigned_fixnum_t num);
-unsigned_fixnum_t io_decode_uint16(uint8_t *buf);
+unsigned_fixnum_t io_decode_uint16(const uint8_t *buf);
 
 void io_encode_int16(uint8_t *buf, fixnum_t num);
-fixnum_t io_decode_int16(uint8_t *buf);
+fixnum_t io_decode_int16(const uint8_t *buf);
 
 void io_encode_uint32(uint8_t *buf, unsigned_fixnum_t num);
-unsigned_fixnum_t io_decode_uint32(uint8_t *buf);
+unsigned_fixnum_t io_decode_uint32(const uint8_t *buf);
 
 void io_encode_int32(uint8_t *buf, fixnum_t num);
-fixnum_t io_decode_int32(uint8_t *buf);
+fixnum_t io_decode_int32(const uint8_t *buf);
 
 void io_encode_uint64(uint8_t *buf, unsigned_fixnum_t num);
-unsigned_fixnum_t io_decode_uint64(uint8_t *buf);
+unsigned_fixnum_t io_decode_uint64(const uint8_t *buf);
 
 void io_encode_int64(uint8_t *buf, fixnum_t num);
-fixnum_t io_decode_int64(uint8_t *buf);
+fixnum_t io_decode_int64(const uint8_t *buf);
 
 void io_encode_flonum(uint8_t *buf, flonum_t num);
-flonum_t io_decode_flonum(uint8_t *buf);
+flonum_t io_decode_flonum(const uint8_t *buf);
 
 /***** Memory Management *****/
 
@@ -186,9 +318,14 @@ void gc_release_heap();
 
 void gc_protect(const _TCHAR * name, lref_t * location, size_t n);
 
+lref_t gc_allocate_static_cell();
+
 void gc_mark(lref_t obj);
 
-lref_t gc_claim_freelist();
+void gc_claim_freelist();
+
+void gc_claim_tenured_run(lref_t *start, lref_t *end);
+void gc_release_tenured_run(lref_t start, lref_t end);
 
 void *gc_malloc(size_t size);
 void gc_free(void *mem);
@@ -197,19 +334,28 @@ INLINE lref_t new_cell(enum typecode_t type)
 {
      struct interpreter_thread_info_block_t *thread = CURRENT_TIB();
 
-     if (NULLP(thread->freelist))
-          thread->freelist = gc_claim_freelist();
+     lref_t cell;
 
-     ++interp.gc_total_cells_allocated;
+     /* Cells in an allocation run that aren't free hold objects that
+      * have survived a collection, and are skipped. */
+     do
+     {
+          if (thread->alloc_next >= thread->alloc_limit)
+               gc_claim_freelist();
 
-     lref_t cell = thread->freelist;
-     thread->freelist = NEXT_FREE_CELL(thread->freelist);
+          cell = thread->alloc_next++;
+     } while (!FREE_CELL_P(cell));
+
+     ++interp.gc_total_cells_allocated;
 
      cell->header.type = type;
 
      return cell;
 }
 
+lref_t new_environment(lref_t parent, lref_t formals, size_t dim,
+                       size_t argc, lref_t argv[]);
+
 /**** VM Unit Tests ****/
 
 size_t execute_vm_tests();
@@ -220,11 +366,19 @@ void create_initial_packages();
 
 void init_stdio_ports();
 
+void init_hash_locks();
+void release_hash_locks();
+
 /**** Structure/Instance ****/
 
 void port_gc_free(lref_t port);
+void hash_gc_free(lref_t hash);
 lref_t port_gc_mark(lref_t obj);
 lref_t fasl_reader_gc_mark(lref_t obj);
+size_t fasl_reader_position(lref_t reader);
+void fasl_load_deferred(lref_t fop);
+void hash_gc_remove_dead_entries(lref_t hash);
+void hash_free_retired_tables();
 
 /**** Subr Binding ****/
 
@@ -261,6 +415,16 @@ bool fast_op_equal(lref_t a, lref_t b);
 
 flonum_t time_since_launch();
 
+/**** Hashing ****/
+
+uint64_t hash_bytes(const void *buf, size_t len);
+fixnum_t sxhash_chars(const _TCHAR *chars, size_t length);
+fixnum_t sxhash_string(lref_t str);
+
+/**** Hash Table Cells ****/
+
+void hash_init_cell(lref_t hash, bool shallow, enum hash_layout_t layout, size_t count);
+
 /**** Vector Resizing ****/
 
 lref_t vector_resize(lref_t vec, size_t new_size, lref_t new_element);
@@ -270,6 +434,7 @@ lref_t vector_resize(lref_t vec, size_t new_size, lref_t new_element);
 void string_appendd(lref_t str, const _TCHAR *buf, size_t len);
 
 size_t string_length(lref_t str);
+void string_init_cell(lref_t str, size_t length, const _TCHAR *buffer);
 _TCHAR string_ref(lref_t str, size_t index);
 
 /**** Macro constructor ****/
@@ -279,5 +444,15 @@ lref_t macrocons(lref_t t);
 /**** Fast Op Constructor ****/
 
 lref_t fast_op(int opcode, lref_t arg1, lref_t arg2, lref_t next);
+void validate_bytecode(lref_t code, lref_t depth);
+
+/**** Evaluator ****/
+
+void flush_call_site_caches();
+
+/**** Heap Images ****/
+
+void load_boot_image(const _TCHAR *filename);
+void dump_boot_image(const _TCHAR *filename);
 
 #endif
@@ -163,6 +163,107 @@ void *sys_set_stack_limit(size_t new_size_limit);
 
 void sys_sleep(uintptr_t duration_ms);
 
+/*** Pages ***/
+
+/* Allocates <size> bytes of zeroed memory directly from the operating
+ * system, returning NULL on failure. */
+void *sys_allocate_pages(size_t size);
+
+/* Returns memory allocated by sys_allocate_pages to the operating system. */
+void sys_release_pages(void *base, size_t size);
+
+/*** Mapped files ***/
+
+/* Maps the whole of the file <path> into memory, read only, returning
+ * its address in <base> and its size in <size>. Empty files can't be
+ * mapped. */
+enum sys_retcode_t sys_map_file(const _TCHAR * path, void **base, size_t * size);
+
+/* Unmaps a file mapped by sys_map_file. */
+void sys_unmap_file(void *base, size_t size);
+
+/*** Threads ***/
+
+#if defined(_MSC_VER)
+#  define SYS_THREAD_LOCAL __declspec(thread)
+#else
+#  define SYS_THREAD_LOCAL _Thread_local
+#endif
+
+typedef void (*sys_thread_proc_t) (size_t thread_index, void *arg);
+
+/* Runs proc once for each thread index in [0, thread_count), the first
+ * on the calling thread and the rest on new threads, and returns once
+ * every call has returned. */
+void sys_run_threads(size_t thread_count, sys_thread_proc_t proc, void *arg);
+
+void sys_yield_thread(void);
+
+struct sys_mutex_t;
+
+struct sys_mutex_t *sys_create_mutex(void);
+void sys_destroy_mutex(struct sys_mutex_t *mutex);
+void sys_lock_mutex(struct sys_mutex_t *mutex);
+void sys_unlock_mutex(struct sys_mutex_t *mutex);
+
+INLINE uintptr_t sys_atomic_fetch_or(volatile uintptr_t * word, uintptr_t bits)
+{
+#if defined(__GNUC__)
+     return __atomic_fetch_or(word, bits, __ATOMIC_RELAXED);
+#elif defined(_M_X64)
+     return (uintptr_t) _InterlockedOr64((volatile __int64 *) word, (__int64) bits);
+#else
+     return (uintptr_t) _InterlockedOr((volatile long *) word, (long) bits);
+#endif
+}
+
+INLINE uintptr_t sys_atomic_fetch_add(volatile uintptr_t * word, uintptr_t n)
+{
+#if defined(__GNUC__)
+     return __atomic_fetch_add(word, n, __ATOMIC_RELAXED);
+#elif defined(_M_X64)
+     return (uintptr_t) _InterlockedExchangeAdd64((volatile __int64 *) word, (__int64) n);
+#else
+     return (uintptr_t) _InterlockedExchangeAdd((volatile long *) word, (long) n);
+#endif
+}
+
+/* Pointer loads and stores that order the memory accesses around them,
+ * so that a pointer stored by one thread after initializing what it
+ * points to can be loaded by another and followed. */
+INLINE void *sys_atomic_load_ptr(void *volatile *location)
+{
+#if defined(__GNUC__)
+     return __atomic_load_n(location, __ATOMIC_ACQUIRE);
+#else
+     void *value = *location;
+     _ReadWriteBarrier();
+     return value;
+#endif
+}
+
+INLINE void sys_atomic_store_ptr(void *volatile *location, void *value)
+{
+#if defined(__GNUC__)
+     __atomic_store_n(location, value, __ATOMIC_RELEASE);
+#else
+     _ReadWriteBarrier();
+     *location = value;
+#endif
+}
+
+/* Stores <desired> at <location> if it holds <expected>, returning true
+ * if it did. */
+INLINE bool sys_atomic_compare_exchange_ptr(void *volatile *location, void *expected, void *desired)
+{
+#if defined(__GNUC__)
+     return __atomic_compare_exchange_n(location, &expected, desired, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#else
+     return _InterlockedCompareExchangePointer(location, desired, expected) == expected;
+#endif
+}
+
 /*** String Utilities ***/
 const _TCHAR *strchrnul(const _TCHAR * s, int c);
 
@@ -114,6 +114,22 @@ struct hash_entry_t
 {
      lref_t key; /*  == UNBOUND_MARKER for empty. */
      lref_t val;
+     fixnum_t hash; /*  The full hash of key, kept for probing and resizing. */
+};
+
+enum hash_layout_t
+{
+     HASH_LINEAR_PROBING,
+     HASH_GROUP_PROBING
+};
+
+/* Weak hash tables don't keep their keys or values alive. Entries are
+ * removed by the garbage collector once their weak part is garbage. */
+enum hash_weakness_t
+{
+     HASH_STRONG,
+     HASH_WEAK_KEYS,
+     HASH_WEAK_VALUES
 };
 
 struct hash_table_t
@@ -121,6 +137,14 @@ struct hash_table_t
      size_t mask;
      bool is_shallow;
      size_t count;
+     size_t deleted; /*  Deleted entries still occupying slots */
+     uint8_t *control; /*  Control bytes for group probing, or NULL */
+     enum hash_weakness_t weakness;
+     bool is_concurrent;
+     struct hash_table_t *retired_next; /*  Next retired concurrent table */
+     struct hash_table_t *migrating; /*  Entries still to be moved here, or NULL */
+     size_t migrate_index; /*  The next entry of migrating to move */
+     size_t stamp; /*  Changed whenever entries might move */
 
      struct hash_entry_t data[0];
 };
@@ -136,7 +160,10 @@ struct lobject_t
           {
                enum typecode_t type:8;
                unsigned int opcode:8;
-               unsigned int gc_mark:1;
+               unsigned int gc_remembered:1;
+
+               /* The slot count of an environment frame. */
+               unsigned int env_dim:15;
           } header;
 
           /* Headers must be at least one pointer in size. */
@@ -178,9 +205,24 @@ struct lobject_t
                lref_t transformer;
           } macro;
           struct
+          {
+               lref_t parent;
+               lref_t formals;
+               union
+               {
+                    lref_t slot;
+                    lref_t slots;
+               };
+          } environment;
+          struct
+          {
+               lref_t slot[3];
+          } environment_slots;
+          struct
           {
                size_t dim;
                _TCHAR *data;
+               fixnum_t hash; /*  The cached sxhash of data, or 0 if not yet known */
           } string;
           struct
           {
@@ -251,16 +293,92 @@ INLINE bool NULLP(lref_t x)
 
 /*** Accessors for box header fields ***/
 
+/*** Mark bits
+ *
+ * Mark bits are kept out of the cells they mark. Allocation runs are
+ * aligned on their size, and the first GC_RUN_BITMAP_CELLS cells of
+ * each run hold a bitmap of the mark bits of every cell in the run.
+ * Bitmap cells are never allocated.
+ */
+
+enum
+{
+     GC_RUN_BYTES = ALLOCATION_RUN_SIZE * sizeof(struct lobject_t),
+     GC_MARK_WORD_BITS = 8 * sizeof(uintptr_t),
+     GC_RUN_BITMAP_WORDS = ALLOCATION_RUN_SIZE / GC_MARK_WORD_BITS,
+     GC_RUN_BITMAP_CELLS = (GC_RUN_BITMAP_WORDS * sizeof(uintptr_t) + sizeof(struct lobject_t) - 1)
+                           / sizeof(struct lobject_t)
+};
+
+INLINE uintptr_t *GC_MARK_BITMAP(lref_t object)
+{
+     return (uintptr_t *) ((uintptr_t) object & ~(uintptr_t) (GC_RUN_BYTES - 1));
+}
+
+INLINE size_t GC_RUN_INDEX(lref_t object)
+{
+     return ((uintptr_t) object & (uintptr_t) (GC_RUN_BYTES - 1)) / sizeof(struct lobject_t);
+}
+
+INLINE bool GC_BITMAP_CELL_P(lref_t object)
+{
+     return GC_RUN_INDEX(object) < GC_RUN_BITMAP_CELLS;
+}
+
 INLINE void SET_GC_MARK(lref_t object, int new_gc_mark_bit)
 {
      checked_assert(!LREF_IMMEDIATE_P(object));
 
-     object->header.gc_mark = new_gc_mark_bit;
+     size_t index = GC_RUN_INDEX(object);
+     uintptr_t *word = &GC_MARK_BITMAP(object)[index / GC_MARK_WORD_BITS];
+     uintptr_t bit = (uintptr_t) 1 << (index % GC_MARK_WORD_BITS);
+
+     if (new_gc_mark_bit)
+          *word |= bit;
+     else
+          *word &= ~bit;
 }
 
 INLINE int GC_MARK(lref_t object)
 {
-     return object->header.gc_mark;
+     size_t index = GC_RUN_INDEX(object);
+
+     return (GC_MARK_BITMAP(object)[index / GC_MARK_WORD_BITS] >> (index % GC_MARK_WORD_BITS)) & 1;
+}
+
+INLINE void SET_GC_REMEMBERED(lref_t object, int new_gc_remembered_bit)
+{
+     checked_assert(!LREF_IMMEDIATE_P(object));
+
+     object->header.gc_remembered = new_gc_remembered_bit;
+}
+
+INLINE int GC_REMEMBERED(lref_t object)
+{
+     return object->header.gc_remembered;
+}
+
+/*** The generational write barrier
+ *
+ * Objects that survive a collection keep their mark bits, and are
+ * old until the next full collection. Storing a reference to a young
+ * (unmarked) object into an old object adds the old object to the
+ * remembered set, which minor collections scan as an extra root.
+ * While an incremental collection is marking, the young object is
+ * marked instead, since the old object may already have been
+ * scanned.
+ */
+
+void gc_record_store(lref_t obj, lref_t new_value);   /*  Forward decl */
+
+INLINE void gc_write_barrier(lref_t obj, lref_t new_value)
+{
+     if (GC_MARK(obj)
+         && !GC_REMEMBERED(obj)
+         && !NULLP(new_value)
+         && !LREF_IMMEDIATE_P(new_value)
+         && !GC_MARK(new_value))
+          gc_record_store(obj, new_value);
 }
 
 INLINE bool REFTYPEP(lref_t object, enum typecode_t type)
@@ -322,6 +440,7 @@ INLINE bool MACROP(lref_t x)           { return REFTYPEP(x, TC_MACRO);
 INLINE bool VALUES_TUPLE_P(lref_t x)   { return REFTYPEP(x, TC_VALUES_TUPLE);                                         }
 INLINE bool FAST_OP_P(lref_t x)        { return REFTYPEP(x, TC_FAST_OP);                                              }
 INLINE bool FASL_READER_P(lref_t x)    { return REFTYPEP(x, TC_FASL_READER);                                          }
+INLINE bool ENVIRONMENTP(lref_t x)     { return REFTYPEP(x, TC_ENVIRONMENT);                                          }
 INLINE bool TRUEP(lref_t x)            { return (x) != MAKE_LREF2(LREF2_BOOL, 0);                                     }
 INLINE bool FALSEP(lref_t x)           { return !TRUEP(x);                                                            }
 
@@ -345,6 +464,7 @@ INLINE lref_t CAR(lref_t x)
 INLINE void SET_CAR(lref_t x, lref_t nv)
 {
      checked_assert(CONSP(x));
+     gc_write_barrier(x, nv);
      x->as.cons.car = nv;
 }
 
@@ -357,6 +477,7 @@ INLINE lref_t CDR(lref_t x)
 INLINE void SET_CDR(lref_t x, lref_t nv)
 {
      checked_assert(CONSP(x));
+     gc_write_barrier(x, nv);
      x->as.cons.cdr = nv;
 }
 
@@ -459,6 +580,7 @@ INLINE lref_t STRUCTURE_LAYOUT(lref_t obj)
 INLINE void SET_STRUCTURE_LAYOUT(lref_t obj, lref_t new_layout)
 {
      checked_assert(STRUCTUREP(obj));
+     gc_write_barrier(obj, new_layout);
      obj->as.vector.layout = new_layout;
 }
 
@@ -471,6 +593,7 @@ INLINE lref_t STRUCTURE_ELEM(lref_t obj, fixnum_t index)
 INLINE void SET_STRUCTURE_ELEM(lref_t obj, fixnum_t index, lref_t new_value)
 {
      checked_assert(STRUCTUREP(obj));
+     gc_write_barrier(obj, new_value);
      obj->as.vector.data[index] = new_value;
 }
 
@@ -499,6 +622,7 @@ INLINE void SET_SYMBOL_PNAME(lref_t sym, lref_t pname)
      checked_assert(SYMBOLP(sym));
      checked_assert(STRINGP(pname));
 
+     gc_write_barrier(sym, pname);
      sym->as.symbol.props = pname;
 }
 
@@ -524,7 +648,10 @@ INLINE void SET_SYMBOL_PROPS(lref_t sym, lref_t props)
 
      if (STRINGP(sym->as.symbol.props))
      {
-          sym->as.symbol.props = lcons((*sym).as.symbol.props, props);
+          lref_t new_props = lcons((*sym).as.symbol.props, props);
+
+          gc_write_barrier(sym, new_props);
+          sym->as.symbol.props = new_props;
      }
      else
      {
@@ -542,6 +669,7 @@ INLINE lref_t SYMBOL_VCELL(lref_t sym)
 INLINE void SET_SYMBOL_VCELL(lref_t sym, lref_t value)
 {
      checked_assert(SYMBOLP(sym));
+     gc_write_barrier(sym, value);
      sym->as.symbol.vcell = value;
 }
 
@@ -554,6 +682,7 @@ INLINE lref_t SYMBOL_HOME(lref_t x)
 INLINE void SET_SYMBOL_HOME(lref_t x, lref_t home)
 {
      checked_assert(SYMBOLP(x));
+     gc_write_barrier(x, home);
      x->as.symbol.home = home;
 }
 
@@ -580,6 +709,7 @@ INLINE void SET_SUBR_NAME(lref_t x, lref_t name)
 {
      checked_assert(SUBRP(x));
      checked_assert(STRINGP(name));
+     gc_write_barrier(x, name);
      x->as.subr.name = name;
 }
 
@@ -633,6 +763,7 @@ INLINE lref_t CLOSURE_CODE(lref_t x)
 INLINE void SET_CLOSURE_CODE(lref_t x, lref_t code)
 {
      checked_assert(CLOSUREP(x));
+     gc_write_barrier(x, code);
      x->as.closure.code = code;
 }
 
@@ -645,6 +776,7 @@ INLINE lref_t CLOSURE_ENV(lref_t x)
 INLINE void SET_CLOSURE_ENV(lref_t x, lref_t env)
 {
      checked_assert(CLOSUREP(x));
+     gc_write_barrier(x, env);
      x->as.closure.env = env;
 }
 
@@ -657,9 +789,107 @@ INLINE lref_t CLOSURE_PROPERTY_LIST(lref_t x)
 INLINE void SET_CLOSURE_PROPERTY_LIST(lref_t x, lref_t plist)
 {
      checked_assert(CLOSUREP(x));
+     gc_write_barrier(x, plist);
      x->as.closure.property_list = plist;
 }
 
+/*** environment ***/
+
+/* A lexical environment frame holds a parent pointer, the formals
+ * list of the lambda that created it, and its slots. There is one slot
+ * per formal, plus one for the rest argument (or for the entire
+ * argument list, if the formals are a single symbol). Fixed arguments
+ * that were not supplied by the caller hold UNBOUND_MARKER.
+ *
+ * The slot count is kept in the header. A frame of one slot holds it
+ * in the frame cell itself. Larger frames keep theirs in a chain of
+ * TC_ENVIRONMENT_SLOTS cells, allocated with the frame and private to
+ * it. Each of those cells holds two slots and a link to the next,
+ * except the last, which holds up to three. Frames of up to three
+ * slots thus need a single slot cell, and a slot of a larger frame is
+ * one link away for every two slots before it. */
+
+#define ENVIRONMENT_MAX_DIM ((1 << 15) - 1)
+
+INLINE lref_t ENVIRONMENT_PARENT(lref_t x)
+{
+     checked_assert(ENVIRONMENTP(x));
+     return x->as.environment.parent;
+}
+
+INLINE void SET_ENVIRONMENT_PARENT(lref_t x, lref_t parent)
+{
+     checked_assert(ENVIRONMENTP(x));
+     gc_write_barrier(x, parent);
+     x->as.environment.parent = parent;
+}
+
+INLINE lref_t ENVIRONMENT_FORMALS(lref_t x)
+{
+     checked_assert(ENVIRONMENTP(x));
+     return x->as.environment.formals;
+}
+
+INLINE void SET_ENVIRONMENT_FORMALS(lref_t x, lref_t formals)
+{
+     checked_assert(ENVIRONMENTP(x));
+     gc_write_barrier(x, formals);
+     x->as.environment.formals = formals;
+}
+
+INLINE size_t ENVIRONMENT_DIM(lref_t x)
+{
+     checked_assert(ENVIRONMENTP(x));
+     return x->header.env_dim;
+}
+
+/* The number of TC_ENVIRONMENT_SLOTS cells in a frame of <dim> slots. */
+INLINE size_t ENVIRONMENT_SLOT_CELLS(size_t dim)
+{
+     return (dim < 2) ? 0 : dim / 2;
+}
+
+/* The cell holding slot <ii> of <x>, which is either <x> itself or
+ * one of its slot cells. The slot's address within that cell is
+ * returned in <slot>. */
+INLINE lref_t ENVIRONMENT_SLOT_CELL(lref_t x, size_t ii, lref_t **slot)
+{
+     checked_assert(ENVIRONMENTP(x));
+     checked_assert(ii < x->header.env_dim);
+
+     if (x->header.env_dim == 1)
+     {
+          *slot = &(x->as.environment.slot);
+          return x;
+     }
+
+     lref_t cell = x->as.environment.slots;
+
+     for (size_t left = x->header.env_dim; (left > 3) && (ii >= 2); left -= 2, ii -= 2)
+          cell = cell->as.environment_slots.slot[2];
+
+     *slot = &(cell->as.environment_slots.slot[ii]);
+     return cell;
+}
+
+INLINE lref_t ENVIRONMENT_SLOT(lref_t x, size_t ii)
+{
+     lref_t *slot;
+
+     ENVIRONMENT_SLOT_CELL(x, ii, &slot);
+
+     return *slot;
+}
+
+INLINE void SET_ENVIRONMENT_SLOT(lref_t x, size_t ii, lref_t val)
+{
+     lref_t *slot;
+
+     gc_write_barrier(ENVIRONMENT_SLOT_CELL(x, ii, &slot), val);
+
+     *slot = val;
+}
+
 /*** fasl-stream ***/
 
 INLINE lref_t FASL_READER_PORT(lref_t obj)
@@ -671,6 +901,7 @@ INLINE lref_t FASL_READER_PORT(lref_t obj)
 INLINE void SET_FASL_READER_PORT(lref_t obj, lref_t port)
 {
      checked_assert(FASL_READER_P(obj));
+     gc_write_barrier(obj, port);
      obj->as.fasl_reader.port = port;
 }
 
@@ -718,10 +949,34 @@ struct port_text_info_t
 
 struct fasl_stream_t
 {
-     lref_t table;
+     lref_t table;           /*  A vector of FASL_TABLE_CHUNK_SIZE entry vectors */
      lref_t stack[FAST_LOAD_STACK_DEPTH];
      size_t sp;
      lref_t accum;
+     fixnum_t unread_opcode; /*  An opcode read and put back, or 0 */
+     int format_version;     /*  From the last FASL_OP_FORMAT, or 1 */
+
+     /*  The offsets of recorded objects, relative to record_base, in the
+      *  order they were read. Record <n> is table entry <n>. */
+     size_t *record_offsets;
+     size_t record_count;
+     size_t record_capacity;
+     size_t record_base;     /*  The offset of the last FASL_OP_RESET_READER_DEFS */
+
+     /*  (record_base . format_version), shared by the objects deferred
+      *  since the last reset, or NIL */
+     lref_t deferred_block;
+     bool replaying;         /*  Rereading an object that wasn't recorded */
+
+     /*  The bytes being decoded, either in <buffer> or in place in the
+      *  port's own storage. */
+     const uint8_t *window;
+     size_t window_pos;
+     size_t window_length;
+     size_t window_base;     /*  The port offset of window[0] */
+
+     uint8_t *buffer;        /*  Bytes copied from the port, if not read in place */
+     size_t buffer_size;
 };
 
 struct port_info_t
@@ -734,6 +989,7 @@ struct port_info_t
      enum port_mode_t mode;
 
      size_t bytes_read;
+     size_t write_position;  /*  The offset of the next byte written */
 };
 
 struct port_class_t
@@ -754,6 +1010,8 @@ struct port_class_t
      void   (* close)       (lref_t port);
      void   (* gc_free)     (lref_t port);
      size_t (* length)      (lref_t port);
+     bool   (* seek)        (lref_t port, size_t position);
+     const void *(* read_in_place) (lref_t port, size_t *size);
 };
 
 INLINE struct port_info_t *PORT_PINFO(lref_t x)
@@ -844,6 +1102,7 @@ INLINE lref_t PORT_USER_OBJECT(lref_t x)
 INLINE void SET_PORT_USER_OBJECT(lref_t x, lref_t user_object)
 {
      checked_assert(PORTP(x));
+     gc_write_barrier(x, user_object);
      PORT_PINFO(x)->user_object = user_object;
 }
 
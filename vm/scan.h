@@ -28,6 +28,8 @@
 void init0(int argc, _TCHAR * argv[], enum debug_flag_t initial_debug_flags);
 void init(int argc, _TCHAR * argv[], enum debug_flag_t initial_debug_flags);
 
+bool boot_image_loaded();
+
 lref_t run();
 
 void signal_interrupt(enum vminterrupt_t intr);
@@ -80,6 +82,7 @@ lref_t charcons(_TCHAR ch);
 lref_t symcons(lref_t pname, lref_t home);
 
 lref_t simple_intern(lref_t name, lref_t package);
+lref_t intern_chars(const _TCHAR *chars, size_t length, lref_t package);
 
 lref_t intern(lref_t name, lref_t package);
 lref_t keyword_intern(const _TCHAR * name);
@@ -99,8 +102,12 @@ int get_c_string(lref_t obj, size_t buflen, _TCHAR *buf);
 /**** Hash Tables ****/
 
 lref_t hashcons(bool shallow);
+lref_t hashcons_with_layout(bool shallow, enum hash_layout_t layout);
+lref_t hashcons_with_weakness(bool shallow, enum hash_weakness_t weakness);
+lref_t concurrent_hashcons(bool shallow);
 
 bool hash_ref(lref_t table, lref_t key, lref_t *result);
+bool hash_ref_chars(lref_t table, const _TCHAR *chars, size_t length, lref_t *result);
 
 typedef size_t hash_iter_t;
 void hash_iter_begin(lref_t hash, hash_iter_t * iter);
@@ -115,6 +122,7 @@ lref_t portcons(struct port_class_t * cls,
                 void *user_data);
 
 size_t read_bytes(lref_t port, void *buf, size_t size);
+const void *read_bytes_in_place(lref_t port, size_t *size);
 size_t write_bytes(lref_t port, const void *buf, size_t size);
 
 void write_char(lref_t port, _TCHAR ch);
@@ -197,6 +205,7 @@ lref_t lbitwise_shl(lref_t x, lref_t n);
 lref_t lbitwise_shr(lref_t x, lref_t n);
 lref_t lbitwise_xor(lref_t x, lref_t y);
 lref_t lbooleanp(lref_t x);
+lref_t lbytecode_operand_count(lref_t opcode);
 lref_t lcar(lref_t x);
 lref_t lcdr(lref_t x);
 lref_t lcdrs(lref_t x);
@@ -223,6 +232,7 @@ lref_t ldo_external_symbols(lref_t args, lref_t env);
 lref_t ldo_symbols(lref_t args, lref_t env);
 lref_t ldump_heap_state(lref_t port);
 lref_t lenvironment();
+lref_t lenvironment_frames(lref_t env);
 lref_t leof_objectp(lref_t obj);
 lref_t leq(lref_t x, lref_t y);
 lref_t leql(lref_t x, lref_t y);
@@ -234,6 +244,7 @@ lref_t lexpt(lref_t x, lref_t y);
 lref_t lfast_op(lref_t opcode, lref_t arg1, lref_t arg2, lref_t next);
 lref_t lfast_op_args(lref_t fast_op);
 lref_t lfast_op_opcode(lref_t fast_op);
+lref_t lfast_op_deferredp(lref_t fast_op);
 lref_t lfast_op_next(lref_t fast_op);
 lref_t lfast_read(lref_t port);
 lref_t lfile_sha1_digest(lref_t fn);
@@ -251,13 +262,17 @@ lref_t lhash2alist(lref_t hash);
 lref_t lhash2list(lref_t hash);
 lref_t lhash_clear(lref_t hash);
 lref_t lhash_copy(lref_t hash);
+lref_t lhash_fold(lref_t fn, lref_t initial, lref_t hash);
+lref_t lhash_for_each(lref_t fn, lref_t hash);
 lref_t lhash_hasp(lref_t table, lref_t key);
 lref_t lhash_key(lref_t obj);
+lref_t lhash_merge(lref_t target, lref_t source);
 lref_t lhash_ref(size_t argc, lref_t argv[]);
 lref_t lhash_refs(lref_t table, lref_t key);
 lref_t lhash_remove(lref_t table, lref_t key);
 lref_t lhash_set(lref_t table, lref_t key, lref_t value);
 lref_t lhash_set_multiple(lref_t hash, lref_t bindings);
+lref_t lhash_update(size_t argc, lref_t argv[]);
 lref_t lhashp(lref_t obj);
 lref_t lheap_cell_count_by_typecode();
 lref_t licontrol_field(lref_t control_field_id);
@@ -270,6 +285,7 @@ lref_t lihash_binding_vector(lref_t hash);
 lref_t liifasl_load(lref_t port);
 lref_t liimmediate_p(lref_t obj);
 lref_t liinternal_files();
+lref_t liopen_c_data_input_string(lref_t string);
 lref_t liload(lref_t fname);
 lref_t limacrocons(lref_t t);
 lref_t limag_part(lref_t cmplx);
@@ -304,11 +320,13 @@ lref_t lmacrop(lref_t obj);
 lref_t lmagnitude(lref_t cmplx);
 lref_t lmake_eof();
 lref_t lmake_fasl_reader(lref_t port);
-lref_t lmake_hash();
-lref_t lmake_identity_hash();
+lref_t lmake_hash(lref_t kind);
+lref_t lmake_identity_hash(lref_t kind);
 lref_t lmake_polar(lref_t r, lref_t theta);
 lref_t lmake_rectangular(lref_t re, lref_t im);
 lref_t lmake_vector(lref_t dim, lref_t initial);
+lref_t lmake_weak_key_hash();
+lref_t lmake_weak_value_hash();
 lref_t lmemref(lref_t addr);
 lref_t lmodulo(lref_t x, lref_t y);
 lref_t lmultiply(lref_t x, lref_t y);
@@ -347,6 +365,8 @@ lref_t lport_column(lref_t port);
 lref_t lport_row(lref_t port);
 lref_t lport_name(lref_t port);
 lref_t lport_openp(lref_t obj);
+lref_t lport_position(lref_t port);
+lref_t lport_set_position(lref_t port, lref_t position);
 lref_t lport_set_translate_mode(lref_t port, lref_t mode);
 lref_t lport_translate_mode(lref_t port);
 lref_t lprimitivep(lref_t obj);
@@ -383,6 +403,7 @@ lref_t lset_closure_env(lref_t exp, lref_t env);
 lref_t lset_debug_flags(lref_t c);
 lref_t lset_environment_variable(lref_t varname, lref_t value);
 lref_t lset_fasl_package_list(lref_t packages);
+lref_t lset_fasl_lazy_load(lref_t lazy);
 lref_t lset_handler_frames(lref_t new_frames);
 lref_t lset_interrupt_mask(lref_t new_mask);
 lref_t lset_package_name(lref_t p, lref_t new_name);
@@ -69,6 +69,13 @@ static void string_allocate_buffer(lref_t obj, size_t length)
 
      obj->as.string.data = (_TCHAR *)gc_malloc(space_needed);
      obj->as.string.dim = length;
+     obj->as.string.hash = 0;
+}
+
+/* Forget the cached hash of a string whose contents have changed. */
+static void string_contents_changed(lref_t str)
+{
+     str->as.string.hash = 0;
 }
 
 lref_t strcons()
@@ -112,13 +119,20 @@ lref_t strconsbufn(size_t length, const _TCHAR * buffer)
 {
      lref_t new_string = new_cell(TC_STRING);
 
-     string_allocate_buffer(new_string, length);
+     string_init_cell(new_string, length, buffer);
+
+     return new_string;
+}
+
+/* Give <str>, a string cell allocated by the caller, the <length>
+ * characters at <buffer>, or room for them if <buffer> is NULL. */
+void string_init_cell(lref_t str, size_t length, const _TCHAR * buffer)
+{
+     string_allocate_buffer(str, length);
 
      if (buffer) {
-          memcpy(new_string->as.string.data, buffer, length);
+          memcpy(str->as.string.data, buffer, length);
      }
-
-     return new_string;
 }
 
 lref_t lstringp(lref_t obj)
@@ -190,6 +204,8 @@ lref_t lstring_set(lref_t str, lref_t idx_, lref_t v)
           vmerror_wrong_type_n(3, v);
      }
 
+     string_contents_changed(str);
+
      return str;
 }
 
@@ -204,6 +220,8 @@ void string_appendd(lref_t str, const _TCHAR *buf, size_t len)
      str->as.string.dim += len;
 
      memcpy(&(str->as.string.data[size]), buf, len);
+
+     string_contents_changed(str);
 }
 
 lref_t lstring_append(size_t argc, lref_t argv[])
@@ -451,6 +469,8 @@ lref_t lstring_upcased(lref_t str)
           }
      }
 
+     string_contents_changed(str);
+
      return str;
 }
 
@@ -471,6 +491,8 @@ lref_t lstring_downcased(lref_t str)
           if (_istupper(str->as.string.data[loc]))
                str->as.string.data[loc] = (_TCHAR) _totlower(str->as.string.data[loc]);
 
+     string_contents_changed(str);
+
      return str;
 }
 
@@ -15,6 +15,8 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <time.h>
 #include <dirent.h>
 #include <memory.h>
@@ -23,6 +25,8 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "scan-sys.h"
 #include "scan-private.h"
@@ -448,5 +452,163 @@ void sys_sleep(uintptr_t duration_ms)
      usleep(duration_ms * MSEC_PER_USEC);
 }
 
+/****************************************************************
+ * Pages
+ */
+
+void *sys_allocate_pages(size_t size)
+{
+     void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+     return (base == MAP_FAILED) ? NULL : base;
+}
+
+void sys_release_pages(void *base, size_t size)
+{
+     munmap(base, size);
+}
+
+/****************************************************************
+ * Mapped files
+ */
+
+enum sys_retcode_t sys_map_file(const _TCHAR * path, void **base, size_t * size)
+{
+     int fd = open(path, O_RDONLY);
+
+     if (fd < 0)
+          return rc_to_sys_retcode_t(errno);
+
+     struct stat sbuf;
+
+     if (fstat(fd, &sbuf))
+     {
+          int rc = errno;
+
+          close(fd);
+
+          return rc_to_sys_retcode_t(rc);
+     }
+
+     if (!S_ISREG(sbuf.st_mode) || (sbuf.st_size == 0))
+     {
+          close(fd);
+
+          return S_ISDIR(sbuf.st_mode) ? SYS_E_IS_DIRECTORY : SYS_E_BAD_ARGUMENT;
+     }
+
+     void *addr = mmap(NULL, (size_t) sbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+     int rc = errno;
+
+     close(fd);
+
+     if (addr == MAP_FAILED)
+          return rc_to_sys_retcode_t(rc);
+
+     *base = addr;
+     *size = (size_t) sbuf.st_size;
+
+     return SYS_OK;
+}
+
+void sys_unmap_file(void *base, size_t size)
+{
+     munmap(base, size);
+}
+
+/****************************************************************
+ * Threads
+ */
+
+struct sys_thread_start_t
+{
+     sys_thread_proc_t proc;
+     void *arg;
+     size_t thread_index;
+};
+
+static void *sys_thread_main(void *start_arg)
+{
+     struct sys_thread_start_t *start = (struct sys_thread_start_t *) start_arg;
+
+     start->proc(start->thread_index, start->arg);
+
+     return NULL;
+}
+
+void sys_run_threads(size_t thread_count, sys_thread_proc_t proc, void *arg)
+{
+     struct sys_thread_start_t *starts =
+          (struct sys_thread_start_t *) malloc(sizeof(struct sys_thread_start_t) * thread_count);
+     pthread_t *threads = (pthread_t *) malloc(sizeof(pthread_t) * thread_count);
+     bool *started = (bool *) malloc(sizeof(bool) * thread_count);
+
+     if ((starts == NULL) || (threads == NULL) || (started == NULL))
+          panic("Failed to allocate thread table");
+
+     for (size_t ii = 1; ii < thread_count; ii++)
+     {
+          starts[ii].proc = proc;
+          starts[ii].arg = arg;
+          starts[ii].thread_index = ii;
+
+          started[ii] = (pthread_create(&threads[ii], NULL, sys_thread_main, &starts[ii]) == 0);
+     }
+
+     proc(0, arg);
+
+     /* Threads that couldn't be started are run here, in turn. */
+     for (size_t ii = 1; ii < thread_count; ii++)
+     {
+          if (started[ii])
+               pthread_join(threads[ii], NULL);
+          else
+               proc(ii, arg);
+     }
+
+     free(started);
+     free(threads);
+     free(starts);
+}
+
+void sys_yield_thread(void)
+{
+     sched_yield();
+}
+
+struct sys_mutex_t
+{
+     pthread_mutex_t mutex;
+};
+
+struct sys_mutex_t *sys_create_mutex(void)
+{
+     struct sys_mutex_t *mutex = (struct sys_mutex_t *) malloc(sizeof(struct sys_mutex_t));
+
+     if (mutex == NULL)
+          panic("Failed to allocate mutex");
+
+     pthread_mutex_init(&mutex->mutex, NULL);
+
+     return mutex;
+}
+
+void sys_destroy_mutex(struct sys_mutex_t *mutex)
+{
+     pthread_mutex_destroy(&mutex->mutex);
+
+     free(mutex);
+}
+
+void sys_lock_mutex(struct sys_mutex_t *mutex)
+{
+     pthread_mutex_lock(&mutex->mutex);
+}
+
+void sys_unlock_mutex(struct sys_mutex_t *mutex)
+{
+     pthread_mutex_unlock(&mutex->mutex);
+}
+
 
 
@@ -119,6 +119,7 @@ lref_t lvector_set(lref_t vec, lref_t i, lref_t v)
 
      if (index < vec->as.vector.dim)
      {
+          gc_write_barrier(vec, v);
           vec->as.vector.data[index] = v;
           return vec;
      }
@@ -178,6 +179,8 @@ lref_t lvector_fill(lref_t vec, lref_t v)
      if (!VECTORP(vec))
           vmerror_wrong_type_n(1, vec);
 
+     gc_write_barrier(vec, v);
+
      for (size_t ii = 0; ii < vec->as.vector.dim; ii++)
           vec->as.vector.data[ii] = v;
 
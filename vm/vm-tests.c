@@ -48,7 +48,7 @@ static bool test_assert(bool condition, _TCHAR *condition_name)
 #define TEST_ASSERT(condition) test_assert(condition, _T(#condition))
 
 static void test_encode_decode_int(void (* encode)(uint8_t *buf, fixnum_t num),
-                                   fixnum_t (* decode)(uint8_t *buf))
+                                   fixnum_t (* decode)(const uint8_t *buf))
 {
      fixnum_t ii;
      fixnum_t ii2;
@@ -64,7 +64,7 @@ static void test_encode_decode_int(void (* encode)(uint8_t *buf, fixnum_t num),
 }
 
 static void test_encode_decode_uint(void (* encode)(uint8_t *buf, unsigned_fixnum_t num),
-                                    unsigned_fixnum_t (* decode)(uint8_t *buf))
+                                    unsigned_fixnum_t (* decode)(const uint8_t *buf))
 {
      fixnum_t ii;
      fixnum_t ii2;
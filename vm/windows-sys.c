@@ -510,4 +510,151 @@ void sys_abnormally_terminate_vm(int rc)
     Sleep(duration_ms);
   }
 
+  void *sys_allocate_pages(size_t size)
+  {
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  }
+
+  void sys_release_pages(void *base, size_t size)
+  {
+    UNREFERENCED(size);
+
+    VirtualFree(base, 0, MEM_RELEASE);
+  }
+
+  sys_retcode_t sys_map_file(const _TCHAR *path, void **base, size_t *size)
+  {
+    HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (file == INVALID_HANDLE_VALUE)
+      return rc_to_sys_retcode_t(GetLastError());
+
+    LARGE_INTEGER file_size;
+
+    if (!GetFileSizeEx(file, &file_size) || (file_size.QuadPart == 0))
+      {
+        CloseHandle(file);
+
+        return SYS_E_BAD_ARGUMENT;
+      }
+
+    HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    CloseHandle(file);
+
+    if (mapping == NULL)
+      return rc_to_sys_retcode_t(GetLastError());
+
+    void *addr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+    CloseHandle(mapping);
+
+    if (addr == NULL)
+      return rc_to_sys_retcode_t(GetLastError());
+
+    *base = addr;
+    *size = (size_t)file_size.QuadPart;
+
+    return SYS_OK;
+  }
+
+  void sys_unmap_file(void *base, size_t size)
+  {
+    UNREFERENCED(size);
+
+    UnmapViewOfFile(base);
+  }
+
+  struct sys_thread_start_t
+  {
+    sys_thread_proc_t proc;
+    void *arg;
+    size_t thread_index;
+  };
+
+  static unsigned __stdcall sys_thread_main(void *start_arg)
+  {
+    struct sys_thread_start_t *start = (struct sys_thread_start_t *)start_arg;
+
+    start->proc(start->thread_index, start->arg);
+
+    return 0;
+  }
+
+  void sys_run_threads(size_t thread_count, sys_thread_proc_t proc, void *arg)
+  {
+    struct sys_thread_start_t *starts =
+      (struct sys_thread_start_t *)malloc(sizeof(struct sys_thread_start_t) * thread_count);
+    HANDLE *threads = (HANDLE *)malloc(sizeof(HANDLE) * thread_count);
+
+    if ((starts == NULL) || (threads == NULL))
+      panic("Failed to allocate thread table");
+
+    for (size_t ii = 1; ii < thread_count; ii++)
+    {
+      starts[ii].proc = proc;
+      starts[ii].arg = arg;
+      starts[ii].thread_index = ii;
+
+      threads[ii] = (HANDLE)_beginthreadex(NULL, 0, sys_thread_main, &starts[ii], 0, NULL);
+    }
+
+    proc(0, arg);
+
+    /* Threads that couldn't be started are run here, in turn. */
+    for (size_t ii = 1; ii < thread_count; ii++)
+    {
+      if (threads[ii] != 0)
+      {
+        WaitForSingleObject(threads[ii], INFINITE);
+        CloseHandle(threads[ii]);
+      }
+      else
+        proc(ii, arg);
+    }
+
+    free(threads);
+    free(starts);
+  }
+
+  void sys_yield_thread(void)
+  {
+    SwitchToThread();
+  }
+
+  struct sys_mutex_t
+  {
+    CRITICAL_SECTION critical_section;
+  };
+
+  struct sys_mutex_t *sys_create_mutex(void)
+  {
+    struct sys_mutex_t *mutex = (struct sys_mutex_t *)malloc(sizeof(struct sys_mutex_t));
+
+    if (mutex == NULL)
+      panic("Failed to allocate mutex");
+
+    InitializeCriticalSection(&mutex->critical_section);
+
+    return mutex;
+  }
+
+  void sys_destroy_mutex(struct sys_mutex_t *mutex)
+  {
+    DeleteCriticalSection(&mutex->critical_section);
+
+    free(mutex);
+  }
+
+  void sys_lock_mutex(struct sys_mutex_t *mutex)
+  {
+    EnterCriticalSection(&mutex->critical_section);
+  }
+
+  void sys_unlock_mutex(struct sys_mutex_t *mutex)
+  {
+    LeaveCriticalSection(&mutex->critical_section);
+  }
+
 